@@ -6,3 +6,5 @@ for k in 31 63 95 127
 do
   make MAXK=$k $@
 done
+
+make launch $@
@@ -1,6 +1,8 @@
 #include "global.h"
 #include "correct_alignment.h"
 
+#include "misc/city.h"
+
 // Global variables to specify if we should print output - used for debugging only
 // These are used in generate_paths.c
 bool gen_paths_print_contigs = false, gen_paths_print_paths = false;
@@ -71,6 +73,14 @@ void correct_alignment_init(CorrectAlnWorker *wrkr,
                           fq_cutoff1, fq_cutoff2, hp_cutoff,
                           wrkr->db_graph, params->ctxcol);
 
+  correct_alignment_init_aln(wrkr, params);
+}
+
+void correct_alignment_init_aln(CorrectAlnWorker *wrkr,
+                                const CorrectAlnParam *params)
+{
+  ctx_assert(params->ctxcol == params->ctpcol);
+
   const dBAlignment *aln = &wrkr->aln;
 
   // Copy parameters
@@ -283,9 +293,11 @@ static TraversalResult traverse_two_way2(dBNodeBuffer *contig0,
   return result;
 }
 
-static TraversalResult traverse_one_way(CorrectAlnWorker *wrkr,
-                                        size_t gap_idx, size_t end_idx,
-                                        size_t gap_min, size_t gap_max)
+// Returns number of traversals attempted, results written to `results`
+static size_t traverse_one_way(CorrectAlnWorker *wrkr,
+                               size_t gap_idx, size_t end_idx,
+                               size_t gap_min, size_t gap_max,
+                               TraversalResult results[2])
 {
   const CorrectAlnParam *params = &wrkr->params;
   const int aln_colour = wrkr->aln.colour; // -1 for all
@@ -309,9 +321,8 @@ static TraversalResult traverse_one_way(CorrectAlnWorker *wrkr,
                              &wrkr->wlk, &wrkr->rptwlk,
                              only_in_one_col, params->use_end_check);
 
-  correct_aln_stats_update(&wrkr->aln_stats, result);
-
-  if(result.traversed) return result;
+  results[0] = result;
+  if(result.traversed) return 1;
 
   // right to left
   graph_walker_prime(&wrkr->wlk, aln_nodes+gap_idx, block1len,
@@ -324,14 +335,15 @@ static TraversalResult traverse_one_way(CorrectAlnWorker *wrkr,
                              &wrkr->wlk, &wrkr->rptwlk,
                              only_in_one_col, params->use_end_check);
 
-  correct_aln_stats_update(&wrkr->aln_stats, result);
-
-  return result;
+  results[1] = result;
+  return 2;
 }
 
-static TraversalResult traverse_two_way(CorrectAlnWorker *wrkr,
-                                        size_t gap_idx, size_t end_idx,
-                                        size_t gap_min, size_t gap_max)
+// Returns number of traversals attempted, results written to `results`
+static size_t traverse_two_way(CorrectAlnWorker *wrkr,
+                               size_t gap_idx, size_t end_idx,
+                               size_t gap_min, size_t gap_max,
+                               TraversalResult results[1])
 {
   const CorrectAlnParam *params = &wrkr->params;
   const int aln_colour = wrkr->aln.colour; // -1 for all
@@ -353,7 +365,138 @@ static TraversalResult traverse_two_way(CorrectAlnWorker *wrkr,
                              &wrkr->wlk2, &wrkr->rptwlk2,
                              aln_colour != -1, params->use_end_check);
 
-  correct_aln_stats_update(&wrkr->aln_stats, result);
+  results[0] = result;
+  return 1;
+}
+
+// Number of nodes from one end of `block` that an end check can read
+// (graph_walker_agrees_contig) with at most `max_juncs` junctions left in its
+// paths. Counts nodes with in- or outdegree > 1 as junctions so it is an upper
+// bound in either direction.
+static size_t gap_check_len(const dBGraph *db_graph,
+                            const dBNode *block, size_t n, bool from_start,
+                            size_t max_juncs)
+{
+  size_t i, njuncs = 0;
+  dBNode node;
+  Edges edges;
+
+  for(i = 0; i < n && njuncs <= max_juncs; i++) {
+    node = from_start ? block[i] : block[n-1-i];
+    edges = db_node_get_edges_union(db_graph, node.key);
+    njuncs += (edges_get_outdegree(edges, FORWARD) > 1 ||
+               edges_get_outdegree(edges, REVERSE) > 1);
+  }
+
+  return i;
+}
+
+// Key for the gap between aln nodes [gap_idx-1] and [gap_idx]
+static void gap_memo_key(const CorrectAlnWorker *wrkr,
+                         size_t gap_idx, size_t end_idx,
+                         size_t gap_min, size_t gap_max,
+                         GapMemoKey *key)
+{
+  const CorrectAlnParam *params = &wrkr->params;
+  const dBGraph *db_graph = wrkr->db_graph;
+  const GPathStore *gpstore = &db_graph->gpstore;
+  const dBNode *block = wrkr->aln.nodes.b + gap_idx;
+  const dBNodeBuffer *contig = &wrkr->contig;
+
+  uint64_t settings[5] = {params->ctxcol, (uint64_t)(wrkr->aln.colour + 1),
+                          params->max_context,
+                          params->one_way_gap_traverse |
+                          (params->use_end_check << 1),
+                          ((uint64_t)gap_min << 32) | gap_max};
+
+  uint64_t hash = CityHash64((const char*)settings, sizeof(settings));
+
+  // When following links, the walk depends on the nodes we prime with (last
+  // max_context nodes of the contig, first max_context of the next block) and
+  // the nodes the end check reads. Without links only the end nodes matter.
+  if(gpath_store_use_traverse(gpstore) && gpstore->num_paths > 0)
+  {
+    size_t block_len = end_idx-gap_idx;
+    size_t lctx = MIN2(contig->len, params->max_context);
+    size_t rctx = MIN2(block_len, params->max_context);
+
+    if(params->use_end_check) {
+      size_t max_juncs = gpstore->max_path_juncs;
+      lctx = MAX2(lctx, gap_check_len(db_graph, contig->b, contig->len,
+                                      false, max_juncs));
+      rctx = MAX2(rctx, gap_check_len(db_graph, block, block_len,
+                                      true, max_juncs));
+    }
+
+    hash = CityHash64WithSeeds((const char*)(contig->b + contig->len - lctx),
+                               lctx * sizeof(dBNode), hash, lctx);
+    hash = CityHash64WithSeeds((const char*)block, rctx * sizeof(dBNode),
+                               hash, rctx);
+  }
+
+  key->left = contig->b[contig->len-1];
+  key->right = block[0];
+  key->hash = hash;
+}
+
+// Fill the gap between wrkr->contig and aln nodes [gap_idx..end_idx-1]
+// On success gap nodes are appended to wrkr->contig
+static TraversalResult traverse_gap(CorrectAlnWorker *wrkr,
+                                    size_t gap_idx, size_t end_idx,
+                                    size_t gap_min, size_t gap_max)
+{
+  dBNodeBuffer *contig = &wrkr->contig, *revcontig = &wrkr->revcontig;
+  TraversalResult results[GAP_MEMO_MAX_RESULTS];
+  size_t i, j, num_results;
+  GapMemoKey key;
+  memset(&key, 0, sizeof(key));
+
+  if(wrkr->gap_memo != NULL)
+  {
+    gap_memo_key(wrkr, gap_idx, end_idx, gap_min, gap_max, &key);
+    num_results = gap_memo_fetch(wrkr->gap_memo, &key, contig, results);
+
+    if(num_results > 0) {
+      wrkr->aln_stats.num_gap_memo_hits++;
+      for(i = 0; i < num_results; i++)
+        correct_aln_stats_update(&wrkr->aln_stats, results[i]);
+      return results[num_results-1];
+    }
+
+    wrkr->aln_stats.num_gap_memo_misses++;
+  }
+
+  db_node_buf_reset(revcontig);
+
+  if(wrkr->params.one_way_gap_traverse)
+    num_results = traverse_one_way(wrkr, gap_idx, end_idx, gap_min, gap_max, results);
+  else
+    num_results = traverse_two_way(wrkr, gap_idx, end_idx, gap_min, gap_max, results);
+
+  for(i = 0; i < num_results; i++)
+    correct_aln_stats_update(&wrkr->aln_stats, results[i]);
+
+  TraversalResult result = results[num_results-1];
+
+  if(result.traversed)
+  {
+    // reverse and copy from revcontig -> contig
+    db_node_buf_capacity(contig, contig->len + revcontig->len);
+
+    // reverse order and orientation of nodes
+    size_t new_contig_len = contig->len + revcontig->len;
+    for(i = contig->len, j = revcontig->len-1; i < new_contig_len; i++, j--)
+      contig->b[i] = db_node_reverse(revcontig->b[j]);
+
+    contig->len += revcontig->len;
+  }
+
+  if(wrkr->gap_memo != NULL) {
+    gap_memo_add(wrkr->gap_memo, &key,
+                 contig->b + contig->len - (result.traversed ? result.gap_len : 0),
+                 result.traversed ? result.gap_len : 0,
+                 results, num_results);
+  }
 
   return result;
 }
@@ -375,10 +518,10 @@ dBNodeBuffer* correct_alignment_nxt(CorrectAlnWorker *wrkr)
 
   // worker_generate_contigs ensures contig is at least aln_nodes->len long
   bool both_reads = (aln->used_r1 && aln->used_r2);
-  size_t i, j, block0len, block1len;
+  size_t block0len, block1len;
   size_t gap_est, gap_min, gap_max;
 
-  dBNodeBuffer *contig = &wrkr->contig, *revcontig = &wrkr->revcontig;
+  dBNodeBuffer *contig = &wrkr->contig;
   Int32Buffer *contig_rpos = &wrkr->rpos;
 
   block0len = wrkr->gap_idx - wrkr->start_idx;
@@ -438,18 +581,11 @@ dBNodeBuffer* correct_alignment_nxt(CorrectAlnWorker *wrkr)
     gap_min = (size_t)MAX2(0, gap_min_long);
     gap_max = (size_t)MAX2(0, gap_max_long);
 
-    db_node_buf_reset(revcontig);
-
     // Alternative traversing from both sides
     // gap len is the number of kmers filling the gap
-    TraversalResult result;
-
-    if(params.one_way_gap_traverse)
-      result = traverse_one_way(wrkr, wrkr->gap_idx, wrkr->end_idx,
-                                gap_min, gap_max);
-    else
-      result = traverse_two_way(wrkr, wrkr->gap_idx, wrkr->end_idx,
-                                gap_min, gap_max);
+    // gap nodes are appended to contig
+    TraversalResult result = traverse_gap(wrkr, wrkr->gap_idx, wrkr->end_idx,
+                                          gap_min, gap_max);
 
     // status("traversal: %s!\n", result.traversed ? "worked" : "failed");
 
@@ -458,16 +594,6 @@ dBNodeBuffer* correct_alignment_nxt(CorrectAlnWorker *wrkr)
     if(is_mp) wrkr->aln_stats.num_ins_traversed++;
     else      wrkr->aln_stats.num_mid_traversed++;
 
-    // reverse and copy from revcontig -> contig
-    db_node_buf_capacity(contig, contig->len + revcontig->len);
-
-    // reverse order and orientation of nodes
-    size_t new_contig_len = contig->len + revcontig->len;
-    for(i = contig->len, j = revcontig->len-1; i < new_contig_len; i++, j--)
-      contig->b[i] = db_node_reverse(revcontig->b[j]);
-
-    contig->len += revcontig->len;
-
     // Append -1 values to rpos for gap
     size_t len_and_gap = contig_rpos->len + result.gap_len;
     int32_buf_capacity(contig_rpos, len_and_gap);
@@ -9,6 +9,7 @@
 #include "graph_walker.h"
 #include "repeat_walker.h"
 #include "correct_aln_stats.h"
+#include "gap_memo.h"
 
 // Default min and max values for the length of a correct fragment
 #define DEFAULT_CRTALN_FRAGLEN_MIN 0
@@ -72,6 +73,9 @@ typedef struct
   dBNodeBuffer contig, revcontig;
   Int32Buffer rpos;
 
+  // Gaps filled by all threads, NULL if not used
+  GapMemo *gap_memo;
+
   // Statistics on gap traversal
   LoadingStats load_stats;
   CorrectAlnStats aln_stats;
@@ -105,6 +109,11 @@ void correct_alignment_init(CorrectAlnWorker *wrkr,
                             uint8_t fq_cutoff1, uint8_t fq_cutoff2,
                             int8_t hp_cutoff);
 
+// Same as correct_alignment_init() but wrkr->aln has already been filled in
+// with db_alignment_from_reads() (e.g. swapped in from a batch)
+void correct_alignment_init_aln(CorrectAlnWorker *wrkr,
+                                const CorrectAlnParam *params);
+
 // @return NULL if end of alignment, otherwise returns pointer to wrkr->contig
 dBNodeBuffer* correct_alignment_nxt(CorrectAlnWorker *wrkr);
 
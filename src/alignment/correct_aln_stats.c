@@ -54,6 +54,9 @@ void correct_aln_stats_merge(CorrectAlnStats *restrict dst,
   dst->num_gaps_too_short += src->num_gaps_too_short;
 
   dst->num_missing_edges += src->num_missing_edges;
+
+  dst->num_gap_memo_hits += src->num_gap_memo_hits;
+  dst->num_gap_memo_misses += src->num_gap_memo_misses;
 }
 
 // Sequencing error gap
@@ -176,6 +179,15 @@ void correct_aln_stats_print_summary(const CorrectAlnStats *stats,
          (size_t)stats->num_end_traversed, (size_t)stats->num_end_gaps,
          (100.0 * stats->num_end_traversed) / stats->num_end_gaps);
 
+  size_t num_memo_lookups = stats->num_gap_memo_hits + stats->num_gap_memo_misses;
+  if(num_memo_lookups > 0) {
+    char hits_str[50], lookups_str[50];
+    ulong_to_str(stats->num_gap_memo_hits, hits_str);
+    ulong_to_str(num_memo_lookups, lookups_str);
+    status("[CorrectAln] Gap memo hits: %s / %s (%.2f%%)", hits_str, lookups_str,
+           (100.0 * stats->num_gap_memo_hits) / num_memo_lookups);
+  }
+
   if(num_seq_gaps == 0)
   {
     status("[CorrectAln] Couldn't traverse any sequence gaps");
@@ -24,6 +24,7 @@ typedef struct
   uint64_t num_mid_gaps, num_mid_traversed; // gaps in the middle of reads
   uint64_t num_end_gaps, num_end_traversed; // gaps at the ends of reads
   uint64_t num_missing_edges; // gaps due to missing edges
+  uint64_t num_gap_memo_hits, num_gap_memo_misses; // gaps looked up in GapMemo
 } CorrectAlnStats;
 
 typedef struct {
@@ -24,28 +24,32 @@ void db_alignment_dealloc(dBAlignment *aln)
   memset(aln, 0, sizeof(dBAlignment));
 }
 
-// if colour is -1 aligns to all colours, otherwise aligns to given colour only
-// Returns number of kmers lost from the end
-static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
-                                     uint8_t qcutoff, uint8_t hp_cutoff,
-                                     const dBGraph *db_graph, int colour)
+// Add all kmers of read `r` with their positions in the read. Kmers are found
+// now or queued in `lookup` (if not NULL), their nodes are HASH_NOT_FOUND
+// until kmer_lookup_flush(). Kmers not in the graph are removed by
+// db_alignment_finish()
+static void db_alignment_add_read(dBAlignment *aln, const read_t *r,
+                                  uint8_t qcutoff, uint8_t hp_cutoff,
+                                  const dBGraph *db_graph, KmerLookup *lookup)
 {
   size_t contig_start, contig_end = 0, search_start = 0;
   const size_t kmer_size = db_graph->kmer_size;
 
-  BinaryKmer bkmer, tmp_key;
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
   Nucleotide nuc;
-  hkey_t node;
-  size_t i, offset, nxtbse;
+  size_t offset, nxtbse;
 
   dBNodeBuffer *nodes = &aln->nodes;
   Int32Buffer *rpos = &aln->rpos;
 
   ctx_assert(nodes->len == rpos->len);
-  size_t n = nodes->len, init_len = n;
+  size_t n = nodes->len;
 
-  db_node_buf_capacity(nodes, n + r->seq.end);
-  int32_buf_capacity(rpos, n + r->seq.end);
+  // Capacity is reserved for both reads by the caller, so queued node
+  // pointers stay valid
+  ctx_assert(n + r->seq.end <= nodes->size && n + r->seq.end <= rpos->size);
 
   while((contig_start = seq_contig_start(r, search_start, kmer_size,
                                          qcutoff, hp_cutoff)) < r->seq.end)
@@ -56,84 +60,140 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
     const char *contig = r->seq.b + contig_start;
     size_t contig_len = contig_end - contig_start;
 
-    bkmer = binary_kmer_from_str(contig, kmer_size);
-    bkmer = binary_kmer_right_shift_one_base(bkmer);
+    binary_kmer_iter_init(&kiter, contig, kmer_size);
 
     for(offset=contig_start, nxtbse=kmer_size-1; nxtbse < contig_len; nxtbse++,offset++)
     {
       nuc = dna_char_to_nuc(contig[nxtbse]);
-      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-      tmp_key = binary_kmer_get_key(bkmer, kmer_size);
-      node = hash_table_find(&db_graph->ht, tmp_key);
-
-      if(node != HASH_NOT_FOUND &&
-         (colour == -1 || db_node_has_col(db_graph, node, colour)))
-      {
-        nodes->b[n].key = node;
-        nodes->b[n].orient = bkmer_get_orientation(bkmer, tmp_key);
-        rpos->b[n] = offset;
-        n++;
+      binary_kmer_iter_add(&kiter, nuc);
+
+      if(lookup == NULL) {
+        nodes->b[n] = db_graph_find_iter(db_graph, &kiter);
+      } else {
+        bkey = binary_kmer_iter_key(&kiter, &orient);
+        nodes->b[n] = (dBNode){.key = HASH_NOT_FOUND, .orient = orient};
+        kmer_lookup_add(lookup, bkey, &nodes->b[n]);
       }
+
+      rpos->b[n] = offset;
+      n++;
     }
   }
 
-  // Return number of bases from the last kmer found until read end
-  size_t ret = (n == init_len ? r->seq.end /* No kmers found */
-                              : r->seq.end - (rpos->b[n-1] + kmer_size));
-
   nodes->len = rpos->len = n;
+}
+
+// Remove kmers not in the graph (or colour) from nodes[start..end), moving
+// kept kmers down to index *n.
+// Returns number of bases from the last kmer kept until read end
+static size_t db_alignment_compact(dBAlignment *aln, size_t start, size_t end,
+                                   size_t *n, size_t nbases,
+                                   const dBGraph *db_graph)
+{
+  dBNode *nodes = aln->nodes.b;
+  int32_t *rpos = aln->rpos.b;
+  size_t i, init_len = *n, j = *n;
+
+  for(i = start; i < end; i++) {
+    if(nodes[i].key != HASH_NOT_FOUND &&
+       (aln->colour == -1 || db_node_has_col(db_graph, nodes[i].key, aln->colour)))
+    {
+      nodes[j] = nodes[i];
+      rpos[j] = rpos[i];
+      j++;
+    }
+  }
 
   // Check for sequence gaps
-  for(i = init_len; i+1 < nodes->len; i++) {
-    if(rpos->b[i]+1 < rpos->b[i+1]) {
+  for(i = init_len; i+1 < j; i++) {
+    if(rpos[i]+1 < rpos[i+1]) {
       aln->seq_gaps = true;
       break;
     }
   }
 
-  return ret;
+  *n = j;
+  return (j == init_len ? nbases /* No kmers found */
+                        : nbases - (rpos[j-1] + db_graph->kmer_size));
 }
 
-
-// if colour is -1 aligns to all colours, otherwise aligns to given colour only
-// Assumes both reads are in FF orientation
-void db_alignment_from_reads(dBAlignment *alignment,
-                             const read_t *r1, const read_t *r2,
-                             uint8_t qcutoff1, uint8_t qcutoff2,
-                             uint8_t hp_cutoff,
-                             const dBGraph *db_graph, int colour)
+static void db_alignment_start(dBAlignment *alignment,
+                               const read_t *r1, const read_t *r2,
+                               uint8_t qcutoff1, uint8_t qcutoff2,
+                               uint8_t hp_cutoff,
+                               const dBGraph *db_graph, int colour,
+                               KmerLookup *lookup)
 {
   ctx_assert(colour == -1 || db_graph->node_in_cols != NULL);
 
   db_node_buf_reset(&alignment->nodes);
   int32_buf_reset(&alignment->rpos);
   alignment->seq_gaps = false;
-  alignment->r2enderr = 0;
+  alignment->r1enderr = alignment->r2enderr = 0;
   alignment->passed_r2 = (r2 != NULL);
   alignment->colour = colour;
   alignment->r1bases = r1->seq.end;
   alignment->r2bases = r2 ? r2->seq.end : 0;
 
-  alignment->r1enderr = db_alignment_from_read(alignment, r1,
-                                               qcutoff1, hp_cutoff,
-                                               db_graph, colour);
+  size_t nbases = alignment->r1bases + alignment->r2bases;
+  db_node_buf_capacity(&alignment->nodes, nbases);
+  int32_buf_capacity(&alignment->rpos, nbases);
 
+  db_alignment_add_read(alignment, r1, qcutoff1, hp_cutoff, db_graph, lookup);
   alignment->r2strtidx = alignment->nodes.len;
 
-  if(r2 != NULL) {
-    alignment->r2enderr = db_alignment_from_read(alignment, r2,
-                                                 qcutoff2, hp_cutoff,
-                                                 db_graph, colour);
+  if(r2 != NULL)
+    db_alignment_add_read(alignment, r2, qcutoff2, hp_cutoff, db_graph, lookup);
+}
+
+void db_alignment_finish(dBAlignment *alignment, const dBGraph *db_graph)
+{
+  size_t n = 0, r2start = alignment->r2strtidx, end = alignment->nodes.len;
+
+  alignment->r1enderr = db_alignment_compact(alignment, 0, r2start, &n,
+                                             alignment->r1bases, db_graph);
+  alignment->r2strtidx = n;
+
+  if(alignment->passed_r2) {
+    alignment->r2enderr = db_alignment_compact(alignment, r2start, end, &n,
+                                               alignment->r2bases, db_graph);
   }
 
-  alignment->used_r1 = (alignment->r1enderr < r1->seq.end);
-  alignment->used_r2 = (r2 != NULL && alignment->r2enderr < r2->seq.end);
+  alignment->nodes.len = alignment->rpos.len = n;
+
+  alignment->used_r1 = (alignment->r1enderr < alignment->r1bases);
+  alignment->used_r2 = (alignment->passed_r2 &&
+                        alignment->r2enderr < alignment->r2bases);
 
   #ifdef CTXVERBOSE
     db_alignment_print(alignment);
   #endif
 }
 
+// if colour is -1 aligns to all colours, otherwise aligns to given colour only
+// Assumes both reads are in FF orientation
+void db_alignment_from_reads(dBAlignment *alignment,
+                             const read_t *r1, const read_t *r2,
+                             uint8_t qcutoff1, uint8_t qcutoff2,
+                             uint8_t hp_cutoff,
+                             const dBGraph *db_graph, int colour)
+{
+  db_alignment_start(alignment, r1, r2, qcutoff1, qcutoff2, hp_cutoff,
+                     db_graph, colour, NULL);
+  db_alignment_finish(alignment, db_graph);
+}
+
+void db_alignment_queue_reads(dBAlignment *alignment,
+                              const read_t *r1, const read_t *r2,
+                              uint8_t qcutoff1, uint8_t qcutoff2,
+                              uint8_t hp_cutoff,
+                              const dBGraph *db_graph, int colour,
+                              KmerLookup *lookup)
+{
+  db_alignment_start(alignment, r1, r2, qcutoff1, qcutoff2, hp_cutoff,
+                     db_graph, colour, lookup);
+}
+
 /*
  * Get position after current segment. A segement is a stretch of kmers aligned
  * to the graph with no gaps.
@@ -3,6 +3,7 @@
 
 #include "db_graph.h"
 #include "db_node.h"
+#include "kmer_batch.h"
 #include "seq_file.h"
 #include "common_buffers.h" // Buffer of uint32_t
 
@@ -44,6 +45,20 @@ void db_alignment_from_reads(dBAlignment *alignment,
                              uint8_t hp_cutoff,
                              const dBGraph *db_graph, int colour);
 
+// As db_alignment_from_reads() but kmers are queued in `lookup` so that a
+// batch of reads can be looked up together in hash table order. Call
+// kmer_lookup_flush() then db_alignment_finish() before using the alignment.
+// The alignment must not be modified in between.
+void db_alignment_queue_reads(dBAlignment *alignment,
+                              const read_t *r1, const read_t *r2,
+                              uint8_t qcutoff1, uint8_t qcutoff2,
+                              uint8_t hp_cutoff,
+                              const dBGraph *db_graph, int colour,
+                              KmerLookup *lookup);
+
+// Remove kmers not found in the graph (or colour) once they have been looked up
+void db_alignment_finish(dBAlignment *alignment, const dBGraph *db_graph);
+
 /*
  * Get position after current segment. A segement is a stretch of kmers aligned
  * to the graph with no gaps.
@@ -0,0 +1,72 @@
+#include "global.h"
+#include "gap_memo.h"
+#include "util.h"
+
+// Stored as NodeCache entry data
+typedef struct
+{
+  TraversalResult results[GAP_MEMO_MAX_RESULTS]; // one per traversal attempt
+  uint8_t num_results;
+} GapMemoData;
+
+static inline NodeCacheKey gap_memo_key(const GapMemoKey *k)
+{
+  NodeCacheKey key = {.w = {node_cache_word(k->left),
+                            node_cache_word(k->right),
+                            k->hash}};
+  return key;
+}
+
+void gap_memo_alloc(GapMemo *gm, size_t mem_in_bytes)
+{
+  ctx_assert(sizeof(GapMemoData) <= NODE_CACHE_DATA_BYTES);
+
+  size_t cap_entries = node_cache_alloc(&gm->nc, mem_in_bytes,
+                                        GAP_MEMO_BUCKET_SIZE,
+                                        GAP_MEMO_BUCKET_NODES);
+
+  char cap_str[50], mem_str[50];
+  ulong_to_str(cap_entries, cap_str);
+  bytes_to_str(gap_memo_mem(gm->nc.num_of_buckets), 1, mem_str);
+  status("[GapMemo] Allocating memo of %s gaps, using %s", cap_str, mem_str);
+}
+
+void gap_memo_dealloc(GapMemo *gm)
+{
+  node_cache_dealloc(&gm->nc);
+}
+
+size_t gap_memo_fetch(GapMemo *gm, const GapMemoKey *key, dBNodeBuffer *nbuf,
+                      TraversalResult results[GAP_MEMO_MAX_RESULTS])
+{
+  NodeCacheKey nckey = gap_memo_key(key);
+  GapMemoData data;
+
+  if(!node_cache_fetch(&gm->nc, &nckey, nbuf, &data, sizeof(data))) return 0;
+
+  memcpy(results, data.results, data.num_results * sizeof(TraversalResult));
+  return data.num_results;
+}
+
+void gap_memo_add(GapMemo *gm, const GapMemoKey *key,
+                  const dBNode *nodes, size_t num_nodes,
+                  const TraversalResult *results, size_t num_results)
+{
+  ctx_assert(num_results > 0 && num_results <= GAP_MEMO_MAX_RESULTS);
+
+  NodeCacheKey nckey = gap_memo_key(key);
+  GapMemoData data;
+  memset(&data, 0, sizeof(data));
+  memcpy(data.results, results, num_results * sizeof(TraversalResult));
+  data.num_results = num_results;
+
+  node_cache_add(&gm->nc, &nckey, nodes, num_nodes, &data, sizeof(data));
+}
+
+void gap_memo_print_stats(const GapMemo *gm)
+{
+  char inserts_str[50], evicted_str[50];
+  ulong_to_str(gm->nc.num_inserts, inserts_str);
+  ulong_to_str(gm->nc.num_evicted, evicted_str);
+  status("[GapMemo] added: %s evicted: %s", inserts_str, evicted_str);
+}
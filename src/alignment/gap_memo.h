@@ -0,0 +1,64 @@
+#ifndef GAP_MEMO_H_
+#define GAP_MEMO_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "node_cache.h"
+#include "correct_aln_stats.h" // TraversalResult
+
+//
+// Bounded memo of filled read gaps shared between threads
+//
+// At high coverage the same gap between two kmer blocks is walked many times.
+// GapMemo remembers the result of each gap traversal (the nodes filling the
+// gap, or failure) keyed by the nodes either side of the gap, the colour, the
+// permitted gap length and a hash of anything else the walk depended on.
+// Storage and eviction are handled by NodeCache.
+//
+// Only valid whilst the graph and the links used for traversal are not
+// modified.
+//
+
+typedef struct
+{
+  dBNode left, right; // last node before gap, first node after
+  uint64_t hash; // colour, gap bounds, traversal settings, context
+} GapMemoKey;
+
+#define GAP_MEMO_MAX_RESULTS 2
+
+typedef struct
+{
+  NodeCache nc;
+} GapMemo;
+
+#define GAP_MEMO_BUCKET_SIZE 8
+#define GAP_MEMO_BUCKET_NODES 256
+
+// Default memory used by the memo
+#define GAP_MEMO_DEFAULT_MEM (16UL<<20)
+
+// Memory used for a given number of buckets
+#define gap_memo_mem(nbkts) \
+        node_cache_mem(nbkts, GAP_MEMO_BUCKET_SIZE, GAP_MEMO_BUCKET_NODES)
+
+void gap_memo_alloc(GapMemo *gm, size_t mem_in_bytes);
+void gap_memo_dealloc(GapMemo *gm);
+
+// Look up a gap. If found, appends gap nodes to `nbuf` and copies results
+// of each traversal attempt into `results`.
+// Thread safe.
+// Returns number of results (0 if not found)
+size_t gap_memo_fetch(GapMemo *gm, const GapMemoKey *key, dBNodeBuffer *nbuf,
+                      TraversalResult results[GAP_MEMO_MAX_RESULTS]);
+
+// Add a gap. May evict other gaps.
+// Gaps longer than GAP_MEMO_BUCKET_NODES are not stored.
+// Thread safe.
+void gap_memo_add(GapMemo *gm, const GapMemoKey *key,
+                  const dBNode *nodes, size_t num_nodes,
+                  const TraversalResult *results, size_t num_results);
+
+void gap_memo_print_stats(const GapMemo *gm);
+
+#endif /* GAP_MEMO_H_ */
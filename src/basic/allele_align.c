@@ -0,0 +1,299 @@
+#include "global.h"
+#include "allele_align.h"
+#include <ctype.h> // tolower()
+
+#define SCORE_MIN (INT_MIN/2)
+
+enum AlnState { STATE_M, STATE_X, STATE_Y };
+
+void allele_aligner_alloc(AlleleAligner *aa, const scoring_t *scoring)
+{
+  ctx_assert(!scoring->no_start_gap_penalty && !scoring->no_end_gap_penalty);
+  ctx_assert(!scoring->no_gaps_in_a && !scoring->no_gaps_in_b);
+  ctx_assert(!scoring->no_mismatches);
+  memset(aa, 0, sizeof(AlleleAligner));
+  aa->scoring = scoring;
+  aa->nw_aligner = needleman_wunsch_new();
+  aa->aln = alignment_create(1024);
+  aa->result_cap = 1024;
+  aa->result_a = ctx_malloc(aa->result_cap);
+  aa->result_b = ctx_malloc(aa->result_cap);
+}
+
+void allele_aligner_dealloc(AlleleAligner *aa)
+{
+  alignment_free(aa->aln);
+  needleman_wunsch_free(aa->nw_aligner);
+  ctx_free(aa->lc_a);
+  ctx_free(aa->lc_b);
+  ctx_free(aa->band_m);
+  ctx_free(aa->band_x);
+  ctx_free(aa->band_y);
+  ctx_free(aa->result_a);
+  ctx_free(aa->result_b);
+  memset(aa, 0, sizeof(AlleleAligner));
+}
+
+void allele_align_stats_merge(AlleleAlignStats *dst, const AlleleAlignStats *src)
+{
+  dst->num_exact += src->num_exact;
+  dst->num_hamming += src->num_hamming;
+  dst->num_banded += src->num_banded;
+  dst->num_full += src->num_full;
+  dst->num_band_retries += src->num_band_retries;
+}
+
+static void _result_capacity(AlleleAligner *aa, size_t len)
+{
+  if(len+1 > aa->result_cap) {
+    aa->result_cap = (len+1)*2;
+    aa->result_a = ctx_realloc(aa->result_a, aa->result_cap);
+    aa->result_b = ctx_realloc(aa->result_b, aa->result_cap);
+  }
+}
+
+static size_t _align_ungapped(AlleleAligner *aa, const char *a, const char *b,
+                              size_t len)
+{
+  _result_capacity(aa, len);
+  memcpy(aa->result_a, a, len);
+  memcpy(aa->result_b, b, len);
+  aa->result_a[len] = aa->result_b[len] = '\0';
+  return (aa->result_len = len);
+}
+
+// Copy `seq` into `buf` in lowercase
+static void _seq_to_lower(char *buf, const char *seq, size_t len)
+{
+  size_t i;
+  for(i = 0; i < len; i++) buf[i] = (char)tolower((unsigned char)seq[i]);
+}
+
+// Bases are compared with ==, so if scoring is not case sensitive (as
+// seq-align treats it) compare lowercase copies instead
+static void _normalise_case(AlleleAligner *aa,
+                            const char **a, size_t alen,
+                            const char **b, size_t blen)
+{
+  if(aa->scoring->case_sensitive) return;
+  size_t len = MAX2(alen, blen);
+  if(len > aa->lc_cap) {
+    aa->lc_cap = len*2;
+    aa->lc_a = ctx_realloc(aa->lc_a, aa->lc_cap);
+    aa->lc_b = ctx_realloc(aa->lc_b, aa->lc_cap);
+  }
+  _seq_to_lower(aa->lc_a, *a, alen);
+  _seq_to_lower(aa->lc_b, *b, blen);
+  *a = aa->lc_a;
+  *b = aa->lc_b;
+}
+
+static inline size_t _count_mismatches(const char *a, const char *b, size_t len)
+{
+  size_t i, n = 0;
+  for(i = 0; i < len; i++) n += (a[i] != b[i]);
+  return n;
+}
+
+// A gapped alignment of two sequences of length L has at least one insertion,
+// one deletion and one fewer aligned pair, so scores at most
+// (L-1)*match + 2*(gap_open+gap_extend). An ungapped alignment with k
+// mismatches scores L*match - k*(match-mismatch).
+static inline bool _hamming_is_optimal(const scoring_t *sc, size_t nmismatches)
+{
+  long diff = (long)sc->match - sc->mismatch;
+  long gapped = (long)sc->match - 2*((long)sc->gap_open + sc->gap_extend);
+  return diff > 0 && (long)nmismatches * diff < gapped;
+}
+
+static inline int _max3(int x, int y, int z)
+{
+  return MAX2(x, MAX2(y, z));
+}
+
+// Upper bound on the score of any alignment of a (length n) against b (length
+// m) that reaches diagonal d (diagonal = j-i). Reaching d > 0 needs at least
+// d gaps in a, and gaps in a minus gaps in b is always m-n. Mirror image for
+// d < 0.
+static long _max_score_off_band(const scoring_t *sc, long n, long m, long d)
+{
+  long gap_a, gap_b, npairs, nopens;
+  if(d >= 0) { gap_a = MAX2(d, m-n); gap_b = gap_a - (m-n); }
+  else       { gap_b = MAX2(-d, n-m); gap_a = gap_b - (n-m); }
+  npairs = n - gap_b;
+  nopens = (gap_a > 0) + (gap_b > 0);
+  return npairs * sc->match + (gap_a + gap_b) * sc->gap_extend +
+         nopens * sc->gap_open;
+}
+
+// Affine gap alignment restricted to diagonals dlo..dhi (diagonal = j-i)
+// around the length difference. Match and gap-in-b scores only depend on
+// the previous row so are computed in their own loops, which gcc -O3
+// vectorises; gap-in-a scores depend on the cell to the left. `ca`,`cb` are
+// `a`,`b` with case normalised, used for scoring; `a`,`b` are copied into the
+// result.
+// Returns false if an alignment leaving the band could score higher than the
+// best alignment inside the band, in which case a wider band is needed.
+static bool _align_banded(AlleleAligner *aa,
+                          const char *a, const char *ca, size_t alen,
+                          const char *b, const char *cb, size_t blen,
+                          size_t bandwidth)
+{
+  const scoring_t *sc = aa->scoring;
+  const int match = sc->match, mismatch = sc->mismatch;
+  const int gap_open = sc->gap_open + sc->gap_extend, gap_ext = sc->gap_extend;
+  const long n = alen, m = blen, w = bandwidth;
+  const long dlo = MAX2(MIN2(0, m-n) - w, -n);
+  const long dhi = MIN2(MAX2(0, m-n) + w, m);
+  const long width = dhi - dlo + 1;
+  const size_t ncells = (size_t)(n+1) * width;
+  long i, j, k, jlo, jhi;
+  size_t c, p;
+
+  if(ncells > aa->band_cap) {
+    aa->band_cap = ncells*2;
+    aa->band_m = ctx_realloc(aa->band_m, aa->band_cap * sizeof(int));
+    aa->band_x = ctx_realloc(aa->band_x, aa->band_cap * sizeof(int));
+    aa->band_y = ctx_realloc(aa->band_y, aa->band_cap * sizeof(int));
+  }
+
+  int *restrict M = aa->band_m, *restrict X = aa->band_x, *restrict Y = aa->band_y;
+
+  for(c = 0; c < ncells; c++) M[c] = X[c] = Y[c] = SCORE_MIN;
+
+  // cell (i,j) is stored at i*width + (j-i-dlo)
+  #define _cell(i,j) ((size_t)(i)*width + ((j)-(i)-dlo))
+
+  // First row: leading gap in a
+  M[_cell(0,0)] = 0;
+  for(j = 1; j <= dhi; j++) Y[_cell(0,j)] = gap_open + (j-1)*gap_ext;
+
+  for(i = 1; i <= n; i++)
+  {
+    jlo = MAX2(0, i+dlo);
+    jhi = MIN2(m, i+dhi);
+    const int *pM = M + (i-1)*width, *pX = X + (i-1)*width, *pY = Y + (i-1)*width;
+    int *rM = M + i*width, *rX = X + i*width, *rY = Y + i*width;
+    const char abase = ca[i-1];
+
+    // Match / mismatch and gap in b (move down from previous row)
+    // k is the same diagonal in the previous row, k+1 is the cell above
+    for(j = MAX2(jlo, 1); j <= jhi; j++) {
+      k = j-i-dlo;
+      rM[k] = (abase == cb[j-1] ? match : mismatch) + _max3(pM[k], pX[k], pY[k]);
+    }
+    for(j = jlo; j <= MIN2(jhi, i+dhi-1); j++) {
+      k = j-i-dlo;
+      rX[k] = _max3(pM[k+1] + gap_open, pX[k+1] + gap_ext, pY[k+1] + gap_open);
+    }
+
+    // Gap in a (move right along this row)
+    for(j = jlo+1; j <= jhi; j++) {
+      k = j-i-dlo;
+      rY[k] = _max3(rM[k-1] + gap_open, rY[k-1] + gap_ext, rX[k-1] + gap_open);
+    }
+  }
+
+  // Check no alignment outside of the band can beat the best in the band
+  enum AlnState state;
+  int score;
+
+  c = _cell(n,m);
+  if(M[c] >= X[c] && M[c] >= Y[c]) { state = STATE_M; score = M[c]; }
+  else if(X[c] >= Y[c]) { state = STATE_X; score = X[c]; }
+  else { state = STATE_Y; score = Y[c]; }
+
+  if((dhi < m && _max_score_off_band(sc, n, m, dhi+1) > score) ||
+     (dlo > -n && _max_score_off_band(sc, n, m, dlo-1) > score)) {
+    return false;
+  }
+
+  // Traceback
+  _result_capacity(aa, alen+blen);
+  char *ra = aa->result_a, *rb = aa->result_b;
+  size_t len = 0;
+
+  for(i = n, j = m; i > 0 || j > 0; len++)
+  {
+    c = _cell(i,j);
+
+    switch(state) {
+      case STATE_M:
+        ra[len] = a[i-1]; rb[len] = b[j-1];
+        score = M[c] - (ca[i-1] == cb[j-1] ? match : mismatch);
+        p = _cell(i-1,j-1);
+        state = (M[p] == score ? STATE_M : (X[p] == score ? STATE_X : STATE_Y));
+        i--; j--;
+        break;
+      case STATE_X:
+        ra[len] = a[i-1]; rb[len] = '-';
+        p = _cell(i-1,j);
+        if(M[p] + gap_open == X[c]) state = STATE_M;
+        else if(X[p] + gap_ext != X[c]) state = STATE_Y;
+        i--;
+        break;
+      case STATE_Y:
+        ra[len] = '-'; rb[len] = b[j-1];
+        p = _cell(i,j-1);
+        if(M[p] + gap_open == Y[c]) state = STATE_M;
+        else if(Y[p] + gap_ext != Y[c]) state = STATE_X;
+        j--;
+        break;
+    }
+  }
+
+  #undef _cell
+
+  // Reverse
+  size_t s, e;
+  for(s = 0, e = len-1; len > 0 && s < e; s++, e--) {
+    SWAP(ra[s], ra[e]);
+    SWAP(rb[s], rb[e]);
+  }
+
+  ra[len] = rb[len] = '\0';
+  aa->result_len = len;
+
+  return true;
+}
+
+size_t allele_align(AlleleAligner *aa, const char *a, size_t alen,
+                                       const char *b, size_t blen)
+{
+  size_t nmismatches, bandwidth;
+  const char *ca = a, *cb = b;
+  _normalise_case(aa, &ca, alen, &cb, blen);
+
+  if(alen == blen) {
+    nmismatches = _count_mismatches(ca, cb, alen);
+    if(nmismatches == 0) {
+      aa->stats.num_exact++;
+      return _align_ungapped(aa, a, b, alen);
+    }
+    if(_hamming_is_optimal(aa->scoring, nmismatches)) {
+      aa->stats.num_hamming++;
+      return _align_ungapped(aa, a, b, alen);
+    }
+  }
+
+  for(bandwidth = ALLELE_ALIGN_INIT_BAND;
+      bandwidth <= ALLELE_ALIGN_MAX_BAND;
+      bandwidth *= 2)
+  {
+    if(_align_banded(aa, a, ca, alen, b, cb, blen, bandwidth)) {
+      aa->stats.num_banded++;
+      return aa->result_len;
+    }
+    aa->stats.num_band_retries++;
+  }
+
+  // Fall back to full Needleman-Wunsch
+  needleman_wunsch_align2(a, b, alen, blen, aa->scoring, aa->nw_aligner, aa->aln);
+  aa->stats.num_full++;
+
+  size_t len = aa->aln->length;
+  _result_capacity(aa, len);
+  memcpy(aa->result_a, aa->aln->result_a, len+1);
+  memcpy(aa->result_b, aa->aln->result_b, len+1);
+  return (aa->result_len = len);
+}
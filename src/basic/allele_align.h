@@ -0,0 +1,63 @@
+#ifndef ALLELE_ALIGN_H_
+#define ALLELE_ALIGN_H_
+
+#include "seq-align/src/needleman_wunsch.h"
+
+//
+// Global alignment of a pair of alleles
+//
+// Most alleles differ by a SNP or short indel, so before running full
+// Needleman-Wunsch we try, in order:
+//   1. exact match
+//   2. hamming: same length, with few enough mismatches that no gapped
+//      alignment can score higher
+//   3. banded: affine gap alignment in a diagonal band around the length
+//      difference. Band is doubled whilst an alignment leaving the band could
+//      score higher than the best one inside it, up to ALLELE_ALIGN_MAX_BAND.
+//   4. full Needleman-Wunsch
+//
+// Scoring must be global (no free start/end gaps). Gap of length n scores
+// gap_open + n*gap_extend, as in seq-align.
+//
+
+#define ALLELE_ALIGN_INIT_BAND 8
+#define ALLELE_ALIGN_MAX_BAND 64
+
+typedef struct
+{
+  size_t num_exact, num_hamming, num_banded, num_full;
+  size_t num_band_retries; // number of times band was widened
+} AlleleAlignStats;
+
+typedef struct
+{
+  const scoring_t *scoring;
+  nw_aligner_t *nw_aligner;
+  alignment_t *aln;
+
+  // Lowercase copies of the input if scoring is not case sensitive
+  char *lc_a, *lc_b;
+  size_t lc_cap;
+
+  // Banded dynamic programming matrices (match, gap in b, gap in a)
+  int *band_m, *band_x, *band_y;
+  size_t band_cap;
+
+  // Alignment result, NUL terminated strings of equal length
+  char *result_a, *result_b;
+  size_t result_len, result_cap;
+
+  AlleleAlignStats stats;
+} AlleleAligner;
+
+void allele_aligner_alloc(AlleleAligner *aa, const scoring_t *scoring);
+void allele_aligner_dealloc(AlleleAligner *aa);
+
+// Align `a` against `b`, result is in aa->result_a, aa->result_b
+// Returns length of alignment
+size_t allele_align(AlleleAligner *aa, const char *a, size_t alen,
+                                       const char *b, size_t blen);
+
+void allele_align_stats_merge(AlleleAlignStats *dst, const AlleleAlignStats *src);
+
+#endif /* ALLELE_ALIGN_H_ */
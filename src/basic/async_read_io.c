@@ -10,8 +10,11 @@ struct AsyncIOWorker
 {
   pthread_t thread;
   MsgPool *const pool;
-  AsyncIOInput task;
+  const AsyncIOInput *const inputs;
+  const size_t num_inputs;
+  size_t *const next_input; // shared between io threads
   size_t *const num_running;
+  AsyncIOInput task; // input currently being read
 };
 
 
@@ -75,7 +78,7 @@ void asyncio_task_parse(AsyncIOInput *task, char shortopt, char *path_arg,
 
   AsyncIOInput tmp = {.file1 = sf1, .file2 = sf2,
                       .fq_offset = fq_offset, .interleaved = il,
-                      .ptr = NULL};
+                      .fields = SEQ_FIELDS_ALL, .ptr = NULL};
   memcpy(task, &tmp, sizeof(AsyncIOInput));
 }
 
@@ -86,6 +89,25 @@ void asyncio_task_close(AsyncIOInput *task)
   task->file1 = task->file2 = NULL;
 }
 
+static seq_file_t* asyncio_reopen_file(seq_file_t *sf)
+{
+  if(sf == NULL) return NULL;
+  if(strcmp(sf->path,"-") == 0) die("Cannot read STDIN twice");
+
+  char *path = strdup(sf->path);
+  seq_close(sf);
+  if((sf = seq_open(path)) == NULL) die("Cannot reopen file: %s", path);
+  free(path);
+
+  return sf;
+}
+
+void asyncio_task_reopen(AsyncIOInput *task)
+{
+  task->file1 = asyncio_reopen_file(task->file1);
+  task->file2 = asyncio_reopen_file(task->file2);
+}
+
 void asynciodata_alloc(AsyncIOData *iod)
 {
   if(seq_read_alloc(&iod->r1) == NULL ||
@@ -106,12 +128,13 @@ void asynciodata_pool_init(void *el, size_t idx, void *args)
 }
 
 // No memory allocated for io worker
-static void async_io_worker_init(AsyncIOWorker *wrkr,
-                                 const AsyncIOInput *task,
-                                 MsgPool *pool, size_t *num_running)
+static void async_io_worker_init(AsyncIOWorker *wrkr, MsgPool *pool,
+                                 const AsyncIOInput *inputs, size_t num_inputs,
+                                 size_t *next_input, size_t *num_running)
 {
   ctx_assert(pool->elsize == sizeof(AsyncIOData*));
-  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running};
+  AsyncIOWorker tmp = {.pool = pool, .inputs = inputs, .num_inputs = num_inputs,
+                       .next_input = next_input, .num_running = num_running};
   memcpy(wrkr, &tmp, sizeof(AsyncIOWorker));
 }
 
@@ -146,18 +169,26 @@ static void* async_io_reader(void *ptr)
 {
   AsyncIOWorker *wrkr = (AsyncIOWorker*)ptr;
   AsyncIOInput *task = &wrkr->task;
+  size_t i;
 
   read_t r1, r2;
   seq_read_alloc(&r1);
   seq_read_alloc(&r2);
 
-  if(task->interleaved)
+  // Take the next input not yet started, until all have been read
+  while((i = __sync_fetch_and_add((volatile size_t*)wrkr->next_input, 1))
+          < wrkr->num_inputs)
   {
-    seq_parse_interleaved_sf(task->file1, task->fq_offset,
-                             &r1, &r2, add_to_pool, wrkr);
-  } else {
-    seq_parse_pe_sf(task->file1, task->file2, task->fq_offset,
-                    &r1, &r2, add_to_pool, wrkr);
+    memcpy(task, &wrkr->inputs[i], sizeof(AsyncIOInput));
+
+    if(task->interleaved)
+    {
+      seq_parse_interleaved_sf(task->file1, task->fq_offset, task->fields,
+                               &r1, &r2, add_to_pool, wrkr);
+    } else {
+      seq_parse_pe_sf(task->file1, task->file2, task->fq_offset, task->fields,
+                      &r1, &r2, add_to_pool, wrkr);
+    }
   }
 
   seq_read_dealloc(&r1);
@@ -168,20 +199,23 @@ static void* async_io_reader(void *ptr)
 
   if(n == 0) {
     msgpool_close(wrkr->pool);
-    ctx_free(wrkr->num_running);
+    ctx_free(wrkr->num_running); // also frees next_input
   }
 
   pthread_exit(NULL);
 }
 
 // Start loading into a pool
-// returns an array of AsyncIOWorker of length len_files, each is a running
-// thread putting reading into the pool passed.
+// returns an array of AsyncIOWorker of length num_io_threads, each is a
+// running thread putting reads into the pool passed. Each thread reads inputs
+// one at a time, taking the next unread input when it finishes one.
 static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
                                          const AsyncIOInput *inputs,
-                                         size_t num_inputs)
+                                         size_t num_inputs,
+                                         size_t num_io_threads)
 {
   if(num_inputs == 0) return NULL;
+  ctx_assert(num_io_threads > 0 && num_io_threads <= num_inputs);
 
   size_t i;
   int rc;
@@ -190,22 +224,25 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
   ctx_assert(pool->elsize == sizeof(AsyncIOData*));
 
   // Create workers
-  AsyncIOWorker *workers = ctx_malloc(num_inputs * sizeof(AsyncIOWorker));
+  AsyncIOWorker *workers = ctx_malloc(num_io_threads * sizeof(AsyncIOWorker));
 
   // Keep a counter of how many threads are still running
   // last thread to finish closes the pool
-  size_t *num_running = ctx_malloc(sizeof(size_t));
-  *num_running = num_inputs;
+  // counters[0] is num_running, counters[1] is next input to read
+  size_t *counters = ctx_calloc(2, sizeof(size_t));
+  counters[0] = num_io_threads;
 
-  for(i = 0; i < num_inputs; i++)
-    async_io_worker_init(&workers[i], &inputs[i], pool, num_running);
+  for(i = 0; i < num_io_threads; i++) {
+    async_io_worker_init(&workers[i], pool, inputs, num_inputs,
+                         &counters[1], &counters[0]);
+  }
 
   // Start threads
   pthread_attr_t thread_attr;
   pthread_attr_init(&thread_attr);
   pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
 
-  for(i = 0; i < num_inputs; i++) {
+  for(i = 0; i < num_io_threads; i++) {
     rc = pthread_create(&workers[i].thread, &thread_attr,
                         async_io_reader, (void*)&workers[i]);
     if(rc != 0) die("Creating thread failed: %s", strerror(rc));
@@ -245,16 +282,20 @@ void asyncio_run_threads(MsgPool *pool,
   if(!num_inputs) return;
   ctx_assert(num_readers > 0);
 
-  status("[asyncio] Inputs: %zu; Threads: %zu", num_inputs, num_readers);
+  size_t num_io_threads = MIN2(num_inputs, MAX_IO_THREADS);
+
+  status("[asyncio] Inputs: %zu; IO threads: %zu; Threads: %zu",
+         num_inputs, num_io_threads, num_readers);
 
   // Start async io reading
   AsyncIOWorker *asyncio_workers;
-  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs);
+  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs,
+                                       num_io_threads);
 
   util_run_threads(args, num_readers, elsize, num_readers, job);
 
   // Finish with the async io (waits until queue is empty)
-  asyncio_read_finish(asyncio_workers, num_inputs);
+  asyncio_read_finish(asyncio_workers, num_io_threads);
 }
 
 typedef struct {
@@ -278,7 +319,7 @@ static void grab_reads_from_pool(void *arg)
   }
 }
 
-// `num_inputs` number of threads pushing reads into the pool
+// `num_inputs` inputs read by up to MAX_IO_THREADS threads into the pool
 // `num_readers` number of threads pulling reads from the pool
 void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
                       void (*job)(AsyncIOData *_data, void *_arg),
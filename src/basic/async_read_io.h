@@ -5,6 +5,7 @@
 #include "msg-pool/msgpool.h"
 
 #include "loading_stats.h"
+#include "seq_reader.h"
 
 // Rename async_read_io.h -> async_read.h
 // AsyncIOInput->AsyncReadFiles AsyncIOData->AsyncReadData
@@ -15,6 +16,7 @@ typedef struct
   void *ptr; // general porpoise pointer for this file is passed into AsyncIOData
   const uint8_t fq_offset;
   const bool interleaved; // if file1 is an interleaved PE file
+  uint8_t fields; // SEQ_FIELD_* values of reads used [default: all]
 } AsyncIOInput;
 
 typedef struct
@@ -40,6 +42,9 @@ void asyncio_task_parse(AsyncIOInput *task, char shortopt, char *path_arg,
 
 void asyncio_task_close(AsyncIOInput *task);
 
+// Close and reopen input files so they can be read again. Dies on STDIN.
+void asyncio_task_reopen(AsyncIOInput *task);
+
 void asynciodata_alloc(AsyncIOData *iod);
 void asynciodata_dealloc(AsyncIOData *iod);
 
@@ -48,12 +53,15 @@ typedef struct AsyncIOWorker AsyncIOWorker;
 void asynciodata_pool_init(void *el, size_t idx, void *args);
 void asynciodata_pool_destroy(void *el, size_t idx, void *args);
 
+// Up to MAX_IO_THREADS threads push reads from `asyncio_tasks` into the pool.
+// Each io thread reads one input at a time, moving on to the next unread
+// input when done, so any number of inputs can be passed at once.
 void asyncio_run_threads(MsgPool *pool,
                          AsyncIOInput *asyncio_tasks, size_t num_inputs,
                          void (*job)(void*),
                          void *args, size_t num_readers, size_t elsize);
 
-// `num_inputs` number of threads pushing reads into the pool
+// `num_inputs` inputs read by up to MAX_IO_THREADS threads into the pool
 // `num_readers` number of threads pulling reads from the pool
 void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
                       void (*job)(AsyncIOData *_data, void *_arg),
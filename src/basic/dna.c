@@ -2,6 +2,10 @@
 #include "dna.h"
 #include <ctype.h> // tolower()
 
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
 const char dna_nuc_to_char_arr[4] = "ACGT";
 
 // 0:Adenine, 1:Cytosine, 2:Guanine, 3:Thymine, 4:N 8:other
@@ -131,3 +135,56 @@ size_t dna_bases_list_to_str(const bool bases[4], char *out)
   *str = '\0';
   return str-out;
 }
+
+// Length of the run of ACGT bases (either case) at the start of seq[0..len)
+size_t dna_scan_acgt(const char *seq, size_t len)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // Clearing bit 5 converts lowercase to uppercase, only 'A' and 'a' map to 'A'
+  const __m128i casemask = _mm_set1_epi8((char)0xDF);
+  const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C');
+  const __m128i g = _mm_set1_epi8('G'), t = _mm_set1_epi8('T');
+  __m128i v, m;
+  unsigned int bad;
+
+  for(; i+16 <= len; i += 16) {
+    v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(seq+i)), casemask);
+    m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v,a), _mm_cmpeq_epi8(v,c)),
+                     _mm_or_si128(_mm_cmpeq_epi8(v,g), _mm_cmpeq_epi8(v,t)));
+    bad = ~(unsigned int)_mm_movemask_epi8(m) & 0xffff;
+    if(bad) return i + __builtin_ctz(bad);
+  }
+#endif
+
+  while(i < len && char_is_acgt(seq[i])) i++;
+  return i;
+}
+
+// Length of the run of quality scores >= min_qual at the start of qual[0..len)
+size_t dna_scan_qual(const char *qual, size_t len, size_t min_qual)
+{
+  if(min_qual == 0) return len;
+  if(min_qual > UINT8_MAX) return 0;
+
+  const uint8_t *q = (const uint8_t*)qual;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // max(v,min_qual) == v iff v >= min_qual (unsigned)
+  const __m128i minq = _mm_set1_epi8((char)min_qual);
+  __m128i v, m;
+  unsigned int bad;
+
+  for(; i+16 <= len; i += 16) {
+    v = _mm_loadu_si128((const __m128i*)(q+i));
+    m = _mm_cmpeq_epi8(_mm_max_epu8(v, minq), v);
+    bad = ~(unsigned int)_mm_movemask_epi8(m) & 0xffff;
+    if(bad) return i + __builtin_ctz(bad);
+  }
+#endif
+
+  while(i < len && q[i] >= min_qual) i++;
+  return i;
+}
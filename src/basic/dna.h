@@ -44,4 +44,10 @@ int dna_revncasecmp(const char *a, const char *b, size_t len);
 // out must be at least 11 bytes long: "A, C, G, T"
 size_t dna_bases_list_to_str(const bool bases[4], char *out);
 
+// Scanning for contig ends in reads. Uses SSE2 where available.
+// Length of the run of ACGT bases (either case) at the start of seq[0..len)
+size_t dna_scan_acgt(const char *seq, size_t len);
+// Length of the run of quality scores >= min_qual at the start of qual[0..len)
+size_t dna_scan_qual(const char *qual, size_t len, size_t min_qual);
+
 #endif /* DNA_H_ */
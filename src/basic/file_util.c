@@ -282,6 +282,31 @@ FILE** futil_create_tmp_files(size_t num_tmp_files)
   return tmp_files;
 }
 
+// Creates <base>.tmp.<rand>, which is unlinked immediately
+// @param path is set to the path of the temporary file
+FILE* futil_create_tmp_file(StrBuf *path, const char *base)
+{
+  size_t i;
+  const size_t attempt_limit = 100;
+  FILE *fh;
+
+  for(i = 0; i < attempt_limit; i++) {
+    size_t r = rand() % 9999;
+    strbuf_reset(path);
+    strbuf_sprintf(path, "%s.tmp.%04zu", base, r);
+    if(!futil_file_exists(path->b)) break;
+  }
+  if(i == attempt_limit)
+    die("Temporary files already exist (%zu tries): %s", attempt_limit, path->b);
+
+  if((fh = futil_fopen_create(path->b, "r+")) == NULL) {
+    die("Cannot write temporary file: %s [%s]", path->b, strerror(errno));
+  }
+
+  unlink(path->b); // Immediately unlink to hide temp file
+  return fh;
+}
+
 // Merge temporary files, closes tmp files
 void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout)
 {
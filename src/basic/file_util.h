@@ -78,6 +78,10 @@ bool futil_path_has_extension(const char *path, const char *ext);
 //   ctx_free(tmp_files);
 FILE** futil_create_tmp_files(size_t num_tmp_files);
 
+// Creates <base>.tmp.<rand>, which is unlinked immediately
+// @param path is set to the path of the temporary file
+FILE* futil_create_tmp_file(StrBuf *path, const char *base);
+
 // Merge temporary files, closes tmp files
 void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout);
 
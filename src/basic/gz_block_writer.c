@@ -0,0 +1,218 @@
+#include "global.h"
+#include "gz_block_writer.h"
+#include "file_util.h"
+
+static void gz_block_alloc(GzBlock *blk, int level)
+{
+  memset(blk, 0, sizeof(GzBlock));
+  strbuf_alloc(&blk->txt, 1<<16);
+  blk->gzcap = 1<<16;
+  blk->gz = ctx_malloc(blk->gzcap);
+
+  // windowBits of 15+16 => write gzip header and trailer
+  int ret = deflateInit2(&blk->strm, level, Z_DEFLATED, 15+16, 8,
+                         Z_DEFAULT_STRATEGY);
+  if(ret != Z_OK) die("Cannot initialise zlib [%i]", ret);
+}
+
+static void gz_block_dealloc(GzBlock *blk)
+{
+  deflateEnd(&blk->strm);
+  strbuf_dealloc(&blk->txt);
+  ctx_free(blk->gz);
+}
+
+// Compress blk->txt into a complete gzip member in blk->gz
+static void gz_block_compress(GzBlock *blk)
+{
+  blk->gzlen = 0;
+  if(blk->txt.end == 0) return;
+  ctx_assert(blk->txt.end < UINT_MAX);
+
+  size_t bound = deflateBound(&blk->strm, blk->txt.end);
+  if(bound > blk->gzcap) {
+    blk->gzcap = bound;
+    blk->gz = ctx_realloc(blk->gz, blk->gzcap);
+  }
+
+  blk->strm.next_in = (Bytef*)blk->txt.b;
+  blk->strm.avail_in = blk->txt.end;
+  blk->strm.next_out = blk->gz;
+  blk->strm.avail_out = blk->gzcap;
+
+  int ret = deflate(&blk->strm, Z_FINISH);
+  if(ret != Z_STREAM_END) die("gzip compression failed [%i]", ret);
+
+  blk->gzlen = blk->gzcap - blk->strm.avail_out;
+  deflateReset(&blk->strm);
+}
+
+// Remove and return the next block to be written, or NULL if we must wait
+// Must hold the lock
+static GzBlock* gz_block_writer_pop_full(GzBlockWriter *wrtr)
+{
+  size_t i;
+  GzBlock *blk;
+
+  if(wrtr->nfull == 0) return NULL;
+
+  // Unordered: write blocks in the order they were finished
+  if(!wrtr->ordered) {
+    blk = wrtr->full_blocks[0];
+    wrtr->nfull--;
+    memmove(wrtr->full_blocks, wrtr->full_blocks+1,
+            wrtr->nfull * sizeof(GzBlock*));
+    return blk;
+  }
+
+  for(i = 0; i < wrtr->nfull; i++) {
+    if(wrtr->full_blocks[i]->id == wrtr->next_id) {
+      blk = wrtr->full_blocks[i];
+      wrtr->full_blocks[i] = wrtr->full_blocks[--wrtr->nfull];
+      return blk;
+    }
+  }
+
+  return NULL;
+}
+
+static void* gz_block_writer_thread(void *ptr)
+{
+  GzBlockWriter *wrtr = (GzBlockWriter*)ptr;
+  GzBlock *blk;
+
+  pthread_mutex_lock(&wrtr->lock);
+
+  while(1)
+  {
+    if((blk = gz_block_writer_pop_full(wrtr)) == NULL)
+    {
+      if(wrtr->closed) {
+        if(wrtr->nfull > 0) die("Missing output block %zu", wrtr->next_id);
+        break;
+      }
+      pthread_cond_wait(&wrtr->full_cond, &wrtr->lock);
+      continue;
+    }
+
+    // Don't hold the lock whilst writing
+    pthread_mutex_unlock(&wrtr->lock);
+
+    if(blk->gzlen > 0 && fwrite(blk->gz, 1, blk->gzlen, wrtr->fout) != blk->gzlen)
+      die("Cannot write to file: %s", futil_outpath_str(wrtr->path));
+
+    pthread_mutex_lock(&wrtr->lock);
+    wrtr->nbytes_txt += blk->txt.end;
+    wrtr->nbytes_gz += blk->gzlen;
+    wrtr->next_id++;
+    wrtr->free_blocks[wrtr->nfree++] = blk;
+    pthread_cond_signal(&wrtr->free_cond);
+  }
+
+  pthread_mutex_unlock(&wrtr->lock);
+  return NULL;
+}
+
+void gz_block_writer_alloc(GzBlockWriter *wrtr, FILE *fout, const char *path,
+                           size_t nblocks, int level, bool ordered)
+{
+  ctx_assert(nblocks > 0);
+  size_t i;
+  int rc;
+
+  GzBlockWriter tmp = {.fout = fout, .path = path,
+                       .ordered = ordered, .level = level,
+                       .nblocks = nblocks, .nfree = nblocks, .nfull = 0,
+                       .next_id = 0, .closed = false,
+                       .nbytes_txt = 0, .nbytes_gz = 0};
+
+  memcpy(wrtr, &tmp, sizeof(GzBlockWriter));
+
+  wrtr->blocks = ctx_calloc(nblocks, sizeof(GzBlock));
+  wrtr->free_blocks = ctx_calloc(nblocks, sizeof(GzBlock*));
+  wrtr->full_blocks = ctx_calloc(nblocks, sizeof(GzBlock*));
+
+  for(i = 0; i < nblocks; i++) {
+    gz_block_alloc(&wrtr->blocks[i], level);
+    wrtr->free_blocks[i] = &wrtr->blocks[i];
+  }
+
+  if(pthread_mutex_init(&wrtr->lock, NULL) != 0) die("mutex init failed");
+  if(pthread_cond_init(&wrtr->free_cond, NULL) != 0) die("cond init failed");
+  if(pthread_cond_init(&wrtr->full_cond, NULL) != 0) die("cond init failed");
+
+  rc = pthread_create(&wrtr->thread, NULL, gz_block_writer_thread, wrtr);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+}
+
+void gz_block_writer_dealloc(GzBlockWriter *wrtr)
+{
+  size_t i;
+  int rc;
+
+  pthread_mutex_lock(&wrtr->lock);
+  wrtr->closed = true;
+  pthread_cond_signal(&wrtr->full_cond);
+  pthread_mutex_unlock(&wrtr->lock);
+
+  rc = pthread_join(wrtr->thread, NULL);
+  if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+
+  ctx_assert2(wrtr->nfree == wrtr->nblocks, "Blocks not returned to writer");
+
+  for(i = 0; i < wrtr->nblocks; i++) gz_block_dealloc(&wrtr->blocks[i]);
+
+  pthread_cond_destroy(&wrtr->free_cond);
+  pthread_cond_destroy(&wrtr->full_cond);
+  pthread_mutex_destroy(&wrtr->lock);
+
+  ctx_free(wrtr->blocks);
+  ctx_free(wrtr->free_blocks);
+  ctx_free(wrtr->full_blocks);
+}
+
+GzBlock* gz_block_writer_claim(GzBlockWriter *wrtr)
+{
+  GzBlock *blk;
+
+  pthread_mutex_lock(&wrtr->lock);
+  while(wrtr->nfree == 0) pthread_cond_wait(&wrtr->free_cond, &wrtr->lock);
+  blk = wrtr->free_blocks[--wrtr->nfree];
+  pthread_mutex_unlock(&wrtr->lock);
+
+  blk->id = 0;
+  strbuf_reset(&blk->txt);
+  return blk;
+}
+
+void gz_block_writer_release(GzBlockWriter *wrtr, GzBlock *blk)
+{
+  pthread_mutex_lock(&wrtr->lock);
+  wrtr->free_blocks[wrtr->nfree++] = blk;
+  pthread_cond_signal(&wrtr->free_cond);
+  pthread_mutex_unlock(&wrtr->lock);
+}
+
+void gz_block_writer_write(GzBlockWriter *wrtr, GzBlock *blk)
+{
+  gz_block_compress(blk);
+
+  pthread_mutex_lock(&wrtr->lock);
+  wrtr->full_blocks[wrtr->nfull++] = blk;
+  pthread_cond_signal(&wrtr->full_cond);
+  pthread_mutex_unlock(&wrtr->lock);
+}
+
+void gz_block_write_str(FILE *fout, const char *path, int level,
+                        const char *str, size_t len)
+{
+  GzBlock blk;
+  gz_block_alloc(&blk, level);
+  strbuf_append_strn(&blk.txt, str, len);
+  gz_block_compress(&blk);
+
+  if(blk.gzlen > 0 && fwrite(blk.gz, 1, blk.gzlen, fout) != blk.gzlen)
+    die("Cannot write to file: %s", futil_outpath_str(path));
+
+  gz_block_dealloc(&blk);
+}
@@ -0,0 +1,84 @@
+#ifndef GZ_BLOCK_WRITER_H_
+#define GZ_BLOCK_WRITER_H_
+
+#include <pthread.h>
+#include <zlib.h>
+#include "string_buffer/string_buffer.h"
+
+//
+// Multithreaded gzip output
+//
+// Worker threads claim a block, fill its text buffer, then compress it
+// themselves into a complete gzip member. A single writer thread concatenates
+// compressed blocks into the output file (in the same manner as BGZF), so the
+// output is a valid multi-member gzip file that zcat / gzip -d can read.
+//
+// If the writer is `ordered`, each block must be given an id (0,1,2,...) and
+// blocks are written in order of id. Otherwise blocks are written in the order
+// they are finished and ids are ignored.
+//
+// Anything that must come first (e.g. a file header) should be written with
+// gz_block_write_str() before the writer is started.
+//
+
+typedef struct
+{
+  size_t id; // position in the output if writer is ordered
+  StrBuf txt; // uncompressed text, filled by caller
+  z_stream strm;
+  uint8_t *gz; // compressed gzip member
+  size_t gzlen, gzcap;
+} GzBlock;
+
+typedef struct
+{
+  FILE *fout;
+  const char *path;
+  const bool ordered;
+  const int level; // compression level
+
+  GzBlock *blocks;
+  size_t nblocks;
+  GzBlock **free_blocks; // stack of blocks
+  GzBlock **full_blocks; // queue of blocks, oldest first
+  size_t nfree, nfull;
+
+  size_t next_id; // id of next block to write (ordered only)
+  bool closed;
+
+  // Statistics
+  size_t nbytes_txt, nbytes_gz;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t free_cond, full_cond;
+} GzBlockWriter;
+
+// Start the writer thread
+// @param nblocks max number of blocks held in memory, should be at least
+//                twice the number of worker threads
+// @param level zlib compression level e.g. Z_DEFAULT_COMPRESSION
+void gz_block_writer_alloc(GzBlockWriter *wrtr, FILE *fout, const char *path,
+                           size_t nblocks, int level, bool ordered);
+
+// Wait for all blocks to be written, stop writer thread and free memory.
+// Does not close `fout`
+void gz_block_writer_dealloc(GzBlockWriter *wrtr);
+
+// Get an empty block to fill. Waits if all blocks are in use.
+// Sets blk->id to zero and empties blk->txt
+GzBlock* gz_block_writer_claim(GzBlockWriter *wrtr);
+
+// Return a block without writing it (e.g. no work left)
+void gz_block_writer_release(GzBlockWriter *wrtr, GzBlock *blk);
+
+// Compress blk->txt in the calling thread then pass to the writer thread.
+// Empty blocks are not written but still count towards ordering.
+void gz_block_writer_write(GzBlockWriter *wrtr, GzBlock *blk);
+
+// Compress a string into a gzip member and write it to `fout` now, from the
+// calling thread (e.g. file header before starting a GzBlockWriter)
+void gz_block_write_str(FILE *fout, const char *path, int level,
+                        const char *str, size_t len);
+
+#endif /* GZ_BLOCK_WRITER_H_ */
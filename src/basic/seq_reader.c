@@ -60,27 +60,39 @@ int64_t seq_est_seq_bases(seq_file_t **files, size_t nfiles)
 size_t seq_contig_start(const read_t *r, size_t offset, size_t kmer_size,
                         uint8_t qual_cutoff, uint8_t hp_cutoff)
 {
-  size_t next_kmer, pos = offset;
+  size_t i, next_kmer, qual_lim, pos = offset;
+  // seq[pos..acgt_end) are ACGT, qual[pos..qual_end) are above qual_cutoff
+  // so only need to scan the bases newly added to the kmer
+  size_t acgt_end = offset, qual_end = offset;
+
   while((next_kmer = pos+kmer_size) <= r->seq.end)
   {
     // Check for invalid bases
-    size_t i = next_kmer;
-    while(i > pos && char_is_acgt(r->seq.b[i-1])) i--;
+    if(acgt_end < next_kmer)
+    {
+      acgt_end = MAX2(acgt_end, pos);
+      acgt_end += dna_scan_acgt(r->seq.b+acgt_end, next_kmer-acgt_end);
 
-    if(i > pos) {
-      pos = i;
-      continue;
+      if(acgt_end < next_kmer) {
+        pos = acgt_end+1;
+        continue;
+      }
     }
 
     // Check for low qual values
     if(qual_cutoff > 0 && r->qual.end > 0)
     {
-      i = MIN2(next_kmer, r->qual.end);
-      while(i > pos && r->qual.b[i-1] > qual_cutoff) i--;
+      qual_lim = MIN2(next_kmer, r->qual.end);
+      if(pos < qual_lim && qual_end < qual_lim)
+      {
+        qual_end = MAX2(qual_end, pos);
+        qual_end += dna_scan_qual(r->qual.b+qual_end, qual_lim-qual_end,
+                                  (size_t)qual_cutoff+1);
 
-      if(i > pos) {
-        pos = i;
-        continue;
+        if(qual_end < qual_lim) {
+          pos = qual_end+1;
+          continue;
+        }
       }
     }
 
@@ -116,7 +128,18 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
                       uint8_t qual_cutoff, uint8_t hp_cutoff,
                       size_t *search_start)
 {
-  size_t contig_end = contig_start+kmer_size;
+  size_t contig_end = contig_start+kmer_size, valid_end, qual_lim, qual_end;
+
+  // Find the first invalid base or low quality score
+  valid_end = contig_end + dna_scan_acgt(r->seq.b+contig_end,
+                                         r->seq.end-contig_end);
+
+  qual_lim = MIN2(valid_end, r->qual.end);
+  if(qual_cutoff > 0 && contig_end < qual_lim) {
+    qual_end = contig_end + dna_scan_qual(r->qual.b+contig_end,
+                                          qual_lim-contig_end, qual_cutoff);
+    if(qual_end < qual_lim) valid_end = qual_end;
+  }
 
   size_t hp_run = 1;
   if(hp_cutoff > 0)
@@ -124,18 +147,9 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
     // Get the length of the hp run at the end of the current kmer
     // kmer won't contain a run longer than hp_run-1
     while(r->seq.b[contig_end-1-hp_run] == r->seq.b[contig_end-1]) hp_run++;
-  }
-
-  for(; contig_end < r->seq.end; contig_end++)
-  {
-    if(!char_is_acgt(r->seq.b[contig_end]) ||
-       (contig_end < r->qual.end && r->qual.b[contig_end] < qual_cutoff))
-    {
-      break;
-    }
 
     // Check hp
-    if(hp_cutoff > 0)
+    for(; contig_end < valid_end; contig_end++)
     {
       if(r->seq.b[contig_end] == r->seq.b[contig_end-1])
       {
@@ -145,6 +159,7 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
       else hp_run = 1;
     }
   }
+  else contig_end = valid_end;
 
   if(hp_cutoff > 0 && hp_run == (size_t)hp_cutoff)
     *search_start = contig_end - (size_t)hp_cutoff + 1;
@@ -163,9 +178,13 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
 
 // Takes, updates and returns warnings that were printed
 // Warnings are only printed once per file
-static uint8_t process_new_read(const read_t *r, uint8_t qmin, uint8_t qmax,
-                                const char *path, uint8_t warn_flags)
+static uint8_t process_new_read(read_t *r, uint8_t qmin, uint8_t qmax,
+                                const char *path, uint8_t warn_flags,
+                                uint8_t fields)
 {
+  // Drop unused qualities, which also skips checking them
+  if(!(fields & SEQ_FIELD_QUAL)) strbuf_reset(&r->qual);
+
   // Test if we've already warned about issue (e.g. bad base) before checking
   if(!(warn_flags & WFLAG_INVALID_BASE))
   {
@@ -259,8 +278,16 @@ static inline int guess_fastq_format(seq_file_t *sf)
   return fmt;
 }
 
+// Drop unused names once reads have been paired
+// Names of empty reads are kept so that a mate without sequence is not taken
+// for a missing mate (empty name and sequence)
+static inline void seq_read_drop_name(read_t *r, uint8_t fields)
+{
+  if(!(fields & SEQ_FIELD_NAME) && r->seq.end > 0) strbuf_reset(&r->name);
+}
+
 void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
-                              read_t *r1, read_t *r2,
+                              uint8_t fields, read_t *r1, read_t *r2,
                               void (*read_func)(read_t *_r1, read_t *_r2,
                                                 uint8_t _qoffset1,
                                                 uint8_t _qoffset2,
@@ -288,16 +315,20 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   while((s = seq_read(sf, r[ridx])) > 0)
   {
-    warn_flags = process_new_read(r[ridx], qmin, qmax, sf->path, warn_flags);
+    warn_flags = process_new_read(r[ridx], qmin, qmax, sf->path, warn_flags,
+                                  fields);
 
     if(ridx)
     {
       // ridx == 1
       if(seq_read_names_cmp(r[0]->name.b, r[1]->name.b) == 0) {
+        seq_read_drop_name(r[0], fields);
+        seq_read_drop_name(r[1], fields);
         read_func(r[0], r[1], qoffset, qoffset, reader_ptr);
         num_pe_pairs++;
         ridx = 0;
       } else {
+        seq_read_drop_name(r[0], fields);
         read_func(r[0], NULL, qoffset, 0, reader_ptr);
         num_se_reads++;
         SWAP(r[0], r[1]);
@@ -309,6 +340,7 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   // Process last read
   if(ridx == 1) {
+    seq_read_drop_name(r[0], fields);
     read_func(r[0], NULL, qoffset, 0, reader_ptr);
     num_se_reads++;
   }
@@ -323,14 +355,14 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 }
 
 void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
-                     read_t *r1, read_t *r2,
+                     uint8_t fields, read_t *r1, read_t *r2,
                      void (*read_func)(read_t *_r1, read_t *_r2,
                                        uint8_t _qoffset1, uint8_t _qoffset2,
                                        void *_ptr),
                      void *reader_ptr)
 {
   if(sf2 == NULL) {
-    seq_parse_se_sf(sf1, ascii_fq_offset, r1, read_func, reader_ptr);
+    seq_parse_se_sf(sf1, ascii_fq_offset, fields, r1, read_func, reader_ptr);
     return;
   }
 
@@ -377,8 +409,12 @@ void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
 
     // PE
     // We don't care about read orientation at this point
-    warn_flags = process_new_read(r1, qmin1, qmax1, sf1->path, warn_flags);
-    warn_flags = process_new_read(r2, qmin2, qmax2, sf2->path, warn_flags);
+    warn_flags = process_new_read(r1, qmin1, qmax1, sf1->path, warn_flags,
+                                  fields);
+    warn_flags = process_new_read(r2, qmin2, qmax2, sf2->path, warn_flags,
+                                  fields);
+    seq_read_drop_name(r1, fields);
+    seq_read_drop_name(r2, fields);
     read_func(r1, r2, qoffset1, qoffset2, reader_ptr);
     num_pe_pairs++;
   }
@@ -390,7 +426,7 @@ void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
 }
 
 void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
-                     read_t *r1,
+                     uint8_t fields, read_t *r1,
                      void (*read_func)(read_t *r1, read_t *r2,
                                        uint8_t qoffset1, uint8_t qoffset2,
                                        void *ptr),
@@ -418,7 +454,9 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   while((s = seq_read(sf, r1)) > 0)
   {
-    warn_flags = process_new_read(r1, qmin, qmax, sf->path, warn_flags);
+    warn_flags = process_new_read(r1, qmin, qmax, sf->path, warn_flags,
+                                  fields);
+    seq_read_drop_name(r1, fields);
     read_func(r1, NULL, qoffset, 0, reader_ptr);
     num_se_reads++;
   }
@@ -442,7 +480,8 @@ void seq_parse_pe(const char *path1, const char *path2, uint8_t ascii_fq_offset,
   seq_file_t *sf1, *sf2;
   if((sf1 = seq_open(path1)) == NULL) die("Cannot open: %s", path1);
   if((sf2 = seq_open(path2)) == NULL) die("Cannot open: %s", path2);
-  seq_parse_pe_sf(sf1, sf2, ascii_fq_offset, r1, r2, read_func, reader_ptr);
+  seq_parse_pe_sf(sf1, sf2, ascii_fq_offset, SEQ_FIELDS_ALL, r1, r2,
+                  read_func, reader_ptr);
   seq_close(sf1);
   seq_close(sf2);
 }
@@ -456,7 +495,8 @@ void seq_parse_se(const char *path, uint8_t ascii_fq_offset,
 {
   seq_file_t *sf;
   if((sf = seq_open(path)) == NULL) die("Cannot open: %s", path);
-  seq_parse_se_sf(sf, ascii_fq_offset, r1, read_func, reader_ptr);
+  seq_parse_se_sf(sf, ascii_fq_offset, SEQ_FIELDS_ALL, r1,
+                  read_func, reader_ptr);
   seq_close(sf);
 }
 
@@ -28,22 +28,29 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
                       uint8_t qual_cutoff, uint8_t hp_cutoff,
                       size_t *search_start);
 
+// Read fields to keep when parsing, sequence is always kept.
+// Dropped fields are left empty. Qualities are not checked if dropped.
+#define SEQ_FIELD_NAME 1
+#define SEQ_FIELD_QUAL 2
+#define SEQ_FIELDS_ALL (SEQ_FIELD_NAME | SEQ_FIELD_QUAL)
+
+// `fields` are the SEQ_FIELD_* values to keep
 void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
-                     read_t *r1, read_t *r2,
+                     uint8_t fields, read_t *r1, read_t *r2,
                      void (*read_func)(read_t *_r1, read_t *_r2,
                                        uint8_t _qoffset1, uint8_t _qoffset2,
                                        void *_ptr),
                      void *reader_ptr);
 
 void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
-                     read_t *r1,
+                     uint8_t fields, read_t *r1,
                      void (*read_func)(read_t *_r1, read_t *_r2,
                                        uint8_t _qoffset1, uint8_t _qoffset2,
                                        void *_ptr),
                      void *reader_ptr);
 
 void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
-                              read_t *r1, read_t *r2,
+                              uint8_t fields, read_t *r1, read_t *r2,
                               void (*read_func)(read_t *_r1, read_t *_r2,
                                                 uint8_t _qoffset1,
                                                 uint8_t _qoffset2,
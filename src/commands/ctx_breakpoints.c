@@ -7,6 +7,8 @@
 #include "graph_format.h"
 #include "breakpoint_caller.h"
 #include "kmer_occur.h"
+#include "kmer_batch.h"
+#include "snode_cache.h"
 #include "seq_reader.h"
 #include "gpath_reader.h"
 #include "gpath_checks.h"
@@ -26,8 +28,11 @@ const char breakpoints_usage[] =
 "  -p, --paths <in.ctp>    Load path file (can specify multiple times)\n"
 "  -o, --out <out.txt.gz>  Save calls (gzipped output) [default: STDOUT]\n"
 "  -s, --seq <in>          Trusted input (can specify multiple times)\n"
+"  -I, --index <in.koi>    Load reference saved with --save-index instead of --seq\n"
+"  -S, --save-index <out>  Save reference kmer index built from --seq\n"
 "  -r, --minref <N>        Require <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MIN_REF_NKMERS)"]\n"
 "  -R, --maxref <N>        Limit to <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MAX_REF_NKMERS)"]\n"
+"  -O, --ordered           Output in the same order with any number of threads\n"
 "\n";
 
 static struct option longopts[] =
@@ -45,6 +50,9 @@ static struct option longopts[] =
   {"seq",          required_argument, NULL, 's'},
   {"minref",       required_argument, NULL, 'r'},
   {"maxref",       required_argument, NULL, 'R'},
+  {"index",        required_argument, NULL, 'I'},
+  {"save-index",   required_argument, NULL, 'S'},
+  {"ordered",      no_argument,       NULL, 'O'},
   {NULL, 0, NULL, 0}
 };
 
@@ -55,6 +63,8 @@ int ctx_breakpoints(int argc, char **argv)
   const char *output_file = NULL;
   size_t min_ref_flank = DEFAULT_MIN_REF_NKMERS;
   size_t max_ref_flank = DEFAULT_MAX_REF_NKMERS;
+  bool ordered = false;
+  const char *index_path = NULL, *save_index_path = NULL;
 
   GPathReader tmp_gpfile;
   GPathFileBuffer gpfiles;
@@ -90,6 +100,9 @@ int ctx_breakpoints(int argc, char **argv)
       case 'r': min_ref_flank = cmd_uint32_nonzero(cmd, optarg); set_min_flank++; break;
       case 'R': max_ref_flank = cmd_uint32_nonzero(cmd, optarg); set_max_flank++; break;
       case 'o': cmd_check(!output_file, cmd); output_file = optarg; break;
+      case 'O': cmd_check(!ordered, cmd); ordered = true; break;
+      case 'I': cmd_check(!index_path, cmd); index_path = optarg; break;
+      case 'S': cmd_check(!save_index_path, cmd); save_index_path = optarg; break;
       case '1':
       case 's':
         if((tmp_sfile = seq_open(optarg)) == NULL)
@@ -116,7 +129,12 @@ int ctx_breakpoints(int argc, char **argv)
     max_ref_flank = min_ref_flank;
   }
 
-  if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
+  if(index_path != NULL) {
+    if(sfilebuf.len > 0) cmd_print_usage("Cannot use --seq with --index");
+    if(save_index_path) cmd_print_usage("Cannot use --save-index with --index");
+  }
+  else if(sfilebuf.len == 0)
+    cmd_print_usage("Require at least one --seq file or --index");
   if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
 
   //
@@ -134,13 +152,26 @@ int ctx_breakpoints(int argc, char **argv)
   graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles.b, gpfiles.len, -1);
 
   //
-  // Get file sizes of sequence files
+  // Get file sizes of sequence files, or number of kmers in the index
   //
-  // set to -1 if we cannot calc
-  int64_t est_num_bases = seq_est_seq_bases(sfilebuf.b, sfilebuf.len);
-  if(est_num_bases < 0) {
-    warn("Cannot get file sizes, using pipes");
-    est_num_bases = memargs.num_kmers;
+  int64_t est_num_bases;
+  KOIndexHeader kohdr;
+
+  if(index_path != NULL) {
+    kograph_index_read_header(index_path, &kohdr, true);
+    if(kohdr.kmer_size != gfiles[0].hdr.kmer_size) {
+      die("Reference index kmer size does not match graph (%u vs %u) [%s]",
+          kohdr.kmer_size, gfiles[0].hdr.kmer_size, index_path);
+    }
+    est_num_bases = kohdr.nkmers;
+  }
+  else {
+    // set to -1 if we cannot calc
+    est_num_bases = seq_est_seq_bases(sfilebuf.b, sfilebuf.len);
+    if(est_num_bases < 0) {
+      warn("Cannot get file sizes, using pipes");
+      est_num_bases = memargs.num_kmers;
+    }
   }
 
   //
@@ -155,7 +186,7 @@ int ctx_breakpoints(int argc, char **argv)
 
   // kmer memory = Edges + paths + 1 bit per colour for in-colour
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
-                  (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) +
+                  (gpfiles.len > 0 ? (sizeof(GPath*)+sizeof(uint64_t))*8 : 0) +
                   ncols +
                   sizeof(KONodeList) + sizeof(KOccur) + // see kmer_occur.h
                   8; // 1 byte per kmer for each base to load sequence files
@@ -176,7 +207,7 @@ int ctx_breakpoints(int argc, char **argv)
                                         false, &graph_mem);
 
   // Paths memory
-  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem);
+  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem+SNODE_CACHE_DEFAULT_MEM);
   path_mem = gpath_reader_mem_req(gpfiles.b, gpfiles.len, ncols, rem_mem, false);
 
   // Shift path store memory from graphs->paths
@@ -184,13 +215,26 @@ int ctx_breakpoints(int argc, char **argv)
   path_mem  += sizeof(GPath*)*kmers_in_hash;
   cmd_print_mem(path_mem, "paths");
 
-  size_t total_mem = graph_mem + path_mem;
+  // Offsets used whilst flattening the path store
+  size_t flat_mem = gpfiles.len > 0 ? gpath_store_flatten_mem(kmers_in_hash) : 0;
+  graph_mem -= MIN2(graph_mem, flat_mem);
+  if(flat_mem) cmd_print_mem(flat_mem, "path offsets");
+  cmd_print_mem(SNODE_CACHE_DEFAULT_MEM, "supernode cache");
+
+  // Each thread sorts a batch of kmers before inserting them, unless loading
+  // an index
+  size_t batch_mem = index_path ? 0 : nthreads * kmer_batch_mem(KMER_BATCH_SIZE);
+  if(batch_mem) cmd_print_mem(batch_mem, "kmer batches");
+
+  size_t total_mem = graph_mem + path_mem + flat_mem + batch_mem +
+                     SNODE_CACHE_DEFAULT_MEM;
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   //
   // Open output file
+  // Output is written as gzip blocks compressed by the calling threads
   //
-  gzFile gzout = futil_gzopen_create(output_file != NULL ? output_file : "-", "w");
+  FILE *fout = futil_fopen_create(output_file != NULL ? output_file : "-", "w");
 
   //
   // Set up memory
@@ -229,26 +273,46 @@ int ctx_breakpoints(int argc, char **argv)
   for(i = 0; i < gpfiles.len; i++)
     gpath_reader_load(&gpfiles.b[i], true, &db_graph);
 
-  // Get array of sequence file paths
-  size_t num_seq_paths = sfilebuf.len;
+  // Links are read-only from here on
+  if(gpfiles.len > 0) gpath_store_flatten(&db_graph.gpstore);
+
+  // Get array of sequence file paths (or index path) to list in the header
+  size_t num_seq_paths = index_path ? 1 : sfilebuf.len;
   char **seq_paths = ctx_calloc(num_seq_paths, sizeof(char*));
   for(i = 0; i < num_seq_paths; i++)
-    seq_paths[i] = strdup(sfilebuf.b[i]->path);
+    seq_paths[i] = strdup(index_path ? index_path : sfilebuf.b[i]->path);
 
   //
-  // Load reference sequence into a read buffer
+  // Add reference kmers to the graph
   //
-  ReadBuffer rbuf;
-  read_buf_alloc(&rbuf, 1024);
-  seq_load_all_reads(sfilebuf.b, sfilebuf.len, &rbuf);
-
-  // Remove commas and colons from read names so we can print:
-  //   chr1:start1-end1,chr2:start2-end2...
-  for(i = 0; i < rbuf.len; i++) {
-    read_t *r = &rbuf.b[i];
-    seq_read_truncate_name(r); // strip fast[aq] comments (after whitespace)
-    string_char_replace(r->name.b, ',', '.'); // change , -> . in read name
-    string_char_replace(r->name.b, ':', ';'); // change : -> ; in read name
+  KOGraph kograph;
+
+  if(index_path != NULL) {
+    kograph = kograph_load(index_path, true, nthreads, &db_graph);
+  }
+  else
+  {
+    // Load reference sequence into a read buffer
+    ReadBuffer rbuf;
+    read_buf_alloc(&rbuf, 1024);
+    seq_load_all_reads(sfilebuf.b, sfilebuf.len, &rbuf);
+
+    // Remove commas and colons from read names so we can print:
+    //   chr1:start1-end1,chr2:start2-end2...
+    for(i = 0; i < rbuf.len; i++) {
+      read_t *r = &rbuf.b[i];
+      seq_read_truncate_name(r); // strip fast[aq] comments (after whitespace)
+      string_char_replace(r->name.b, ',', '.'); // change , -> . in read name
+      string_char_replace(r->name.b, ':', ';'); // change : -> ; in read name
+    }
+
+    kograph = kograph_create(rbuf.b, rbuf.len, true, nthreads, &db_graph);
+
+    if(save_index_path != NULL)
+      kograph_save(kograph, rbuf.b, rbuf.len, save_index_path, &db_graph);
+
+    for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
+    read_buf_dealloc(&rbuf);
   }
 
   // Create array of cJSON** from input files
@@ -257,15 +321,16 @@ int ctx_breakpoints(int argc, char **argv)
 
   // Call breakpoints
   breakpoints_call(nthreads,
-                   gzout, output_file,
-                   rbuf.b, rbuf.len,
+                   fout, output_file, ordered,
+                   kograph,
                    seq_paths, num_seq_paths,
                    min_ref_flank, max_ref_flank,
                    hdrs, gpfiles.len,
                    &db_graph);
 
   // Finished: do clean up
-  gzclose(gzout);
+  if(fout != stdout) fclose(fout);
+  kograph_free(kograph);
   ctx_free(hdrs);
 
   // Close input files
@@ -273,9 +338,6 @@ int ctx_breakpoints(int argc, char **argv)
     gpath_reader_close(&gpfiles.b[i]);
   gpfile_buf_dealloc(&gpfiles);
 
-  for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.b[i]);
-  read_buf_dealloc(&rbuf);
-
   seq_file_ptr_buf_dealloc(&sfilebuf);
 
   for(i = 0; i < num_seq_paths; i++) free(seq_paths[i]);
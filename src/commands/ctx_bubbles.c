@@ -30,6 +30,7 @@ const char bubbles_usage[] =
 "  -H, --haploid <col>     Colour is haploid, can use repeatedly [e.g. ref colour]\n"
 "  -A, --max-allele <len>  Max bubble branch length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_ALLELE)"]\n"
 "  -F, --max-flank <len>   Max flank length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_FLANK)"]\n"
+"  -O, --ordered           Output in the same order with any number of threads\n"
 "\n"
 "  When loading path files with -p, use offset (e.g. 2:in.ctp) to specify\n"
 "  which colour to load the data into.\n"
@@ -49,6 +50,7 @@ static struct option longopts[] =
   {"haploid",      required_argument, NULL, 'H'},
   {"max-allele",   required_argument, NULL, 'A'},
   {"max-flank",    required_argument, NULL, 'F'},
+  {"ordered",      no_argument,       NULL, 'O'},
   {NULL, 0, NULL, 0}
 };
 
@@ -58,6 +60,7 @@ int ctx_bubbles(int argc, char **argv)
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_path = NULL;
   size_t max_allele_len = 0, max_flank_len = 0;
+  bool ordered = false;
 
   SizeBuffer haploidbuf;
   size_buf_alloc(&haploidbuf, 8);
@@ -96,6 +99,7 @@ int ctx_bubbles(int argc, char **argv)
       case 'H': tmp_col = cmd_uint32(cmd, optarg); size_buf_add(&haploidbuf, tmp_col); break;
       case 'A': cmd_check(!max_allele_len, cmd); max_allele_len = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(!max_flank_len, cmd); max_flank_len = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'O': cmd_check(!ordered, cmd); ordered = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -148,7 +152,7 @@ int ctx_bubbles(int argc, char **argv)
   // visitedfw/rv(2bits/thread)
 
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 +
-                  (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) +
+                  (gpfiles.len > 0 ? (sizeof(GPath*)+sizeof(uint64_t))*8 : 0) +
                   ncols + 2*nthreads;
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -166,7 +170,7 @@ int ctx_bubbles(int argc, char **argv)
           nthreads, thread_mem, thread_mem_str);
 
   // Paths memory
-  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem+thread_mem);
+  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem+thread_mem+SNODE_CACHE_DEFAULT_MEM);
   path_mem = gpath_reader_mem_req(gpfiles.b, gpfiles.len, ncols, rem_mem, false);
 
   // Shift path store memory from graphs->paths
@@ -174,13 +178,21 @@ int ctx_bubbles(int argc, char **argv)
   path_mem  += sizeof(GPath*)*kmers_in_hash;
   cmd_print_mem(path_mem, "paths");
 
-  size_t total_mem = graph_mem + thread_mem + path_mem;
+  // Offsets used whilst flattening the path store
+  size_t flat_mem = gpfiles.len > 0 ? gpath_store_flatten_mem(kmers_in_hash) : 0;
+  graph_mem -= MIN2(graph_mem, flat_mem);
+  if(flat_mem) cmd_print_mem(flat_mem, "path offsets");
+  cmd_print_mem(SNODE_CACHE_DEFAULT_MEM, "supernode cache");
+
+  size_t total_mem = graph_mem + thread_mem + path_mem + flat_mem +
+                     SNODE_CACHE_DEFAULT_MEM;
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   //
   // Open output file
+  // Output is written as gzip blocks compressed by the calling threads
   //
-  gzFile gzout = futil_gzopen_create(out_path, "w");
+  FILE *fout = futil_fopen_create(out_path, "w");
 
   // Allocate memory
   dBGraph db_graph;
@@ -214,6 +226,9 @@ int ctx_bubbles(int argc, char **argv)
   for(i = 0; i < gpfiles.len; i++)
     gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
 
+  // Links are read-only from here on
+  if(gpfiles.len > 0) gpath_store_flatten(&db_graph.gpstore);
+
   // Create array of cJSON** from input files
   cJSON **hdrs = ctx_malloc(gpfiles.len * sizeof(cJSON*));
   for(i = 0; i < gpfiles.len; i++) hdrs[i] = gpfiles.b[i].json;
@@ -225,12 +240,12 @@ int ctx_bubbles(int argc, char **argv)
                                    .num_haploid = haploidbuf.len};
 
   invoke_bubble_caller(nthreads, call_prefs,
-                       gzout, out_path,
+                       fout, out_path, ordered,
                        hdrs, gpfiles.len,
                        &db_graph);
 
   status("  saved to: %s\n", out_path);
-  gzclose(gzout);
+  if(fout != stdout) fclose(fout);
   ctx_free(hdrs);
 
   // Close input path files
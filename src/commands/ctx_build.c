@@ -7,6 +7,10 @@
 #include "graph_format.h"
 #include "loading_stats.h"
 #include "build_graph.h"
+#include "count_filter.h"
+#include "dup_filter.h"
+#include "prune_nodes.h"
+#include "graph_partition.h"
 
 #include "seq_file.h"
 
@@ -32,18 +36,32 @@ const char build_usage[] =
 "  -H, --cut_hp <bp>        Breaks reads at homopolymers >= <bp> [default: off]\n"
 "  -p, --remove-pcr         Remove (or keep) PCR duplicate reads [default: keep]\n"
 "  -P, --keep-pcr           Don't do PCR duplicate removal\n"
+"  -D, --dup-mem <mem>      Memory used to find PCR duplicates\n"
+"                           [default: estimated from input size]\n"
 "  -M, --matepair <orient>  Mate pair orientation: FF,FR,RF,RR [default: FR]\n"
 "                           (for --keep_pcr only)\n"
 "  -g, --graph <in.ctx>     Load samples from a graph file (.ctx)\n"
+"  -c, --min-count <N>      Only load kmers seen >= N times in all samples\n"
+"                           [2-"QUOTE_VALUE(COUNT_FILTER_MAX_COUNT)"]\n"
+"  -C, --count-mem <mem>    Memory used to count kmers for --min-count\n"
+"                           [default: 1/4 of --memory]\n"
+"  -B, --partitions <N>     Build graph in N parts on disk, using less memory\n"
 "\n"
 "  Note: Argument must come before input file\n"
-"  PCR duplicate removal works by ignoring read (pairs) if (both) reads\n"
-"  start at the same k-mer as any previous read. Carried out per sample, not \n"
-"  per file. --sample <name> is required before sequence input can be loaded.\n"
+"  PCR duplicate removal works by ignoring read pairs if both reads start at\n"
+"  the same k-mers as a previous pair (or a single read if it starts at the\n"
+"  same k-mer as a previous read). Carried out per sample, not per file.\n"
+"  --sample <name> is required before sequence input can be loaded.\n"
 "  Consecutive sequence options are loaded into the same colour.\n"
 "  --graph argument can have colours specifed e.g. in.ctx:0,6-8 will load\n"
 "  samples 0,6,7,8.  Graphs are loaded into new colours.\n"
 "  See `"CMD" join` to combine .ctx files\n"
+"  --min-count reads sequence files twice: first kmers are counted, then only\n"
+"  kmers seen at least N times are loaded (so cannot read from STDIN). Kmers\n"
+"  from --graph files are always kept.\n"
+"  --partitions splits kmers into N temporary files (<out.ctx>.part*) by\n"
+"  minimizer then builds one at a time, so the hash table only needs to hold\n"
+"  ~1/N of the kmers. Cannot be used with --graph, --remove-pcr or --min-count.\n"
 "\n";
 
 static struct option longopts[] =
@@ -66,7 +84,11 @@ static struct option longopts[] =
   {"cut-hp",       required_argument, NULL, 'H'},
   {"remove-pcr",   no_argument,       NULL, 'p'},
   {"keep-pcr",     no_argument,       NULL, 'P'},
+  {"dup-mem",      required_argument, NULL, 'D'},
   {"graph",        required_argument, NULL, 'g'},
+  {"min-count",    required_argument, NULL, 'c'},
+  {"count-mem",    required_argument, NULL, 'C'},
+  {"partitions",   required_argument, NULL, 'B'},
   {NULL, 0, NULL, 0}
 };
 
@@ -88,12 +110,24 @@ static struct MemArgs memargs = MEM_ARGS_INIT;
 static char *out_path = NULL;
 static size_t output_colours = 0, kmer_size = 0;
 
+// Only load kmers seen at least min_count times (0 => off)
+static size_t min_count = 0, count_mem = 0;
+
+// Memory for PCR duplicate filter (0 => estimate)
+static size_t dup_mem = 0;
+
+// Build graph one partition at a time (0 => off)
+static size_t num_parts = 0;
+
 static void add_task(BuildGraphTask *task)
 {
   uint8_t fq_offset = task->files.fq_offset, fq_cutoff = task->fq_cutoff;
   if(fq_offset >= 128) die("fq-offset too big: %i", (int)fq_offset);
   if(fq_offset+fq_cutoff >= 128) die("fq-cutoff too big: %i", fq_offset+fq_cutoff);
 
+  // Read names are never used, qualities only for --fq-cutoff
+  task->files.fields = fq_cutoff ? SEQ_FIELD_QUAL : 0;
+
   if(task->remove_pcr_dups || task->files.file2 == NULL) {
     // Submit paired end reads together
     build_graph_task_buf_push(&gtaskbuf, task, 1);
@@ -161,6 +195,7 @@ static void parse_args(int argc, char **argv)
       case 'H': task.hp_cutoff = cmd_uint8(cmd, optarg); pref_unused = true; break;
       case 'p': task.remove_pcr_dups = true; pref_unused = true; break;
       case 'P': task.remove_pcr_dups = false; pref_unused = true; break;
+      case 'D': cmd_check(!dup_mem,cmd); dup_mem = cmd_parse_arg_mem(cmd, optarg); break;
       case 'g':
         if(intocolour == -1) intocolour = 0;
         graph_file_reset(&tmp_gfile);
@@ -169,6 +204,9 @@ static void parse_args(int argc, char **argv)
         gfile_buf_push(&gfilebuf, &tmp_gfile, 1);
         sample_named = false;
         break;
+      case 'c': cmd_check(!min_count,cmd); min_count = cmd_uint32(cmd, optarg); break;
+      case 'C': cmd_check(!count_mem,cmd); count_mem = cmd_parse_arg_mem(cmd, optarg); break;
+      case 'B': cmd_check(!num_parts,cmd); num_parts = cmd_uint32_nonzero(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -195,6 +233,19 @@ static void parse_args(int argc, char **argv)
 
   if(!kmer_size) die("kmer size not set with -k <K>");
 
+  if(min_count == 1) min_count = 0;
+  if(min_count > COUNT_FILTER_MAX_COUNT) {
+    cmd_print_usage("--min-count must be <= %i", COUNT_FILTER_MAX_COUNT);
+  }
+  if(count_mem && !min_count)
+    cmd_print_usage("--count-mem only used with --min-count");
+
+  if(num_parts == 1) num_parts = 0;
+  if(num_parts && min_count)
+    cmd_print_usage("Cannot use --partitions with --min-count");
+  if(num_parts && gfilebuf.len)
+    cmd_print_usage("Cannot use --partitions with --graph");
+
   // Check kmer size in graphs to load
   size_t i;
   for(i = 0; i < gfilebuf.len; i++) {
@@ -208,6 +259,48 @@ static void parse_args(int argc, char **argv)
   output_colours = intocolour + (sample_named ? 1 : 0);
 }
 
+static inline void mark_node(hkey_t hkey, uint8_t *keep)
+{
+  bitset_set(keep, hkey);
+}
+
+static inline void mark_min_count(hkey_t hkey, uint8_t *keep,
+                                  const dBGraph *db_graph)
+{
+  if(db_node_sum_covg(db_graph, hkey) >= min_count) bitset_set(keep, hkey);
+}
+
+// Split reads into partitions on disk, then build and save one at a time
+static void build_partitioned(dBGraph *db_graph, BuildGraphTask *tasks,
+                              size_t ntasks)
+{
+  GraphPartitions gp;
+  size_t i;
+
+  graph_partitions_alloc(&gp, out_path, num_parts, db_graph->kmer_size);
+  graph_partitions_write(&gp, tasks, ntasks, nthreads);
+
+  for(i = 0; i < ntasks; i++)
+    graph_info_update_stats(&db_graph->ginfo[tasks[i].colour], &tasks[i].stats);
+
+  GraphFileHeader header = {.version = CTX_GRAPH_FILEFORMAT,
+                            .kmer_size = (uint32_t)db_graph->kmer_size,
+                            .num_of_bitfields = NUM_BKMER_WORDS,
+                            .num_of_cols = (uint32_t)output_colours,
+                            .capacity = 0,
+                            .ginfo = db_graph->ginfo};
+
+  status("Dumping graph...\n");
+  FILE *fout = futil_fopen(out_path, "w");
+  graph_write_header(fout, &header);
+  size_t nkmers = graph_partitions_build(&gp, db_graph, fout, nthreads);
+  fclose(fout);
+
+  graph_writer_print_status(nkmers, output_colours, futil_outpath_str(out_path),
+                            CTX_GRAPH_FILEFORMAT);
+
+  graph_partitions_dealloc(&gp);
+}
 
 int ctx_build(int argc, char **argv)
 {
@@ -226,17 +319,22 @@ int ctx_build(int argc, char **argv)
   for(i = 0; i < ntasks && !tasks[i].remove_pcr_dups; i++) {}
   bool remove_pcr_used = (i < ntasks);
 
+  if(num_parts && remove_pcr_used)
+    cmd_print_usage("Cannot use --partitions with --remove-pcr");
+
   //
   // Print inputs
   //
-  size_t max_kmers = 0;
+  size_t max_kmers = 0, graph_kmers = 0;
 
   // Print graphs to be loaded
   for(i = 0; i < gfilebuf.len; i++) {
     file_filter_status(&gfilebuf.b[i].fltr);
-    max_kmers += gfilebuf.b[i].num_of_kmers;
+    graph_kmers += gfilebuf.b[i].num_of_kmers;
   }
 
+  max_kmers = graph_kmers;
+
   // Print tasks and sample names
   for(s = t = 0; s < ncolours || t < ntasks; ) {
     if(t == ntasks || (s < ncolours && samples[s].colour <= tasks[t].colour)) {
@@ -248,42 +346,99 @@ int ctx_build(int argc, char **argv)
     }
   }
 
+  // Duplicate filter is wiped between samples, size it for the largest one
+  size_t sample_kmers = 0, max_sample_kmers = 0;
+
   for(t = 0; t < ntasks; t++) {
     size_t nkmers = asyncio_input_nkmers(&tasks[t].files);
-    if(nkmers == SIZE_MAX) { max_kmers = nkmers; break; }
+    if(nkmers == SIZE_MAX) { max_kmers = max_sample_kmers = nkmers; break; }
     max_kmers += nkmers;
+    if(t > 0 && tasks[t].colour != tasks[t-1].colour) sample_kmers = 0;
+    sample_kmers += nkmers;
+    max_sample_kmers = MAX2(max_sample_kmers, sample_kmers);
   }
 
+  //
+  // Check output path
+  //
+  futil_create_output(out_path);
+
+  //
+  // Count kmers, to only load those seen at least min_count times
+  //
+  CountFilter cfilter;
+
+  if(min_count > 0)
+  {
+    if(!count_mem) count_mem = memargs.mem_to_use / 4;
+    cmd_check_mem_limit(memargs.mem_to_use, count_mem);
+    count_filter_alloc(&cfilter, count_mem);
+    count_mem = count_filter_mem(cfilter.num_counters);
+
+    size_t num_passed = build_graph_count_kmers(&cfilter, min_count, kmer_size,
+                                                tasks, ntasks, nthreads);
+
+    for(t = 0; t < ntasks; t++) asyncio_task_reopen(&tasks[t].files);
+
+    char num_passed_str[50];
+    ulong_to_str(num_passed, num_passed_str);
+    status("[CountFilter] ~%s kmers seen at least %zu times",
+           num_passed_str, min_count);
+
+    // Estimate can be low, since collisions can push kmers past min_count
+    max_kmers = graph_kmers + num_passed + num_passed / 8;
+  }
+
+  // Only one partition is held in memory at a time, allow for uneven sizes
+  if(num_parts > 0 && max_kmers != SIZE_MAX)
+    max_kmers = 2 * (max_kmers / num_parts) + 1;
+
   //
   // Decide on memory
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
+  DupFilter dfilter;
+
+  if(remove_pcr_used)
+  {
+    // One key per read (pair), assume reads of at least 100bp
+    if(!dup_mem && max_sample_kmers != SIZE_MAX)
+      dup_mem = MIN2(dup_filter_mem(max_sample_kmers / 100 * 8 / 7),
+                     memargs.mem_to_use / 4);
+    if(!dup_mem) dup_mem = memargs.mem_to_use / 8;
+    cmd_check_mem_limit(memargs.mem_to_use, count_mem + dup_mem);
+    dup_filter_alloc(&dfilter, dup_mem);
+    dup_mem = dup_filter_mem(dfilter.capacity);
+  }
+  else if(dup_mem)
+    warn("--dup-mem ignored without --remove-pcr");
+
+  // Partition write buffers and read chunks are held with the graph
+  size_t part_mem = 0;
+  if(num_parts > 0) {
+    part_mem = graph_partitions_mem(num_parts, kmer_size, nthreads);
+    cmd_check_mem_limit(memargs.mem_to_use, count_mem + dup_mem + part_mem);
+  }
 
-  // remove_pcr_dups requires a fw and rv bit per kmer
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + sizeof(Edges)) * 8 * output_colours +
-                  remove_pcr_used*2;
+                  (sizeof(Covg) + sizeof(Edges)) * 8 * output_colours;
 
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use - count_mem -
+                                        dup_mem - part_mem,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
                                         memargs.num_kmers_set,
                                         bits_per_kmer, 0, max_kmers,
                                         true, &graph_mem);
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
-
-  //
-  // Check output path
-  //
-  futil_create_output(out_path);
+  cmd_check_mem_limit(memargs.mem_to_use,
+                      graph_mem + count_mem + dup_mem + part_mem);
 
   status("Writing %zu colour graph to %s\n", output_colours, futil_outpath_str(out_path));
 
   // Create db_graph
   dBGraph db_graph;
-  int alloc_flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS |
-                    (remove_pcr_used ? DBG_ALLOC_READSTRT : 0);
+  int alloc_flags = DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS;
 
   db_graph_alloc(&db_graph, kmer_size, output_colours, output_colours,
                  kmers_in_hash, alloc_flags);
@@ -303,38 +458,55 @@ int ctx_build(int argc, char **argv)
     }
   }
 
+  // Kmers loaded from graphs are kept whatever their count
+  uint8_t *keep = NULL;
+
+  if(min_count > 0) {
+    keep = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
+    HASH_ITERATE(&db_graph.ht, mark_node, keep);
+  }
+
   // Set sample names using seq_colours array
   for(i = 0; i < ncolours; i++) {
     strbuf_set(&db_graph.ginfo[samples[i].colour].sample_name, samples[i].name);
   }
 
-  size_t start, end, num_load, colour, prev_colour = 0;
-
-  // If we are using PCR duplicate removal,
-  // it's best to load one colour at a time
-  for(start = 0; start < ntasks; start = end, prev_colour = colour)
+  // Load all samples at once: io threads move on to the next file as they
+  // finish one, and build threads take reads from any sample
+  if(num_parts > 0)
+    build_partitioned(&db_graph, tasks, ntasks);
+  else if(!remove_pcr_used) {
+    build_graph_filtered(&db_graph, tasks, ntasks, nthreads,
+                         min_count ? &cfilter : NULL, min_count, NULL);
+  }
+  else
   {
-    // Wipe read start bitfield
-    colour = tasks[start].colour;
-    if(remove_pcr_used)
-    {
-      if(colour != prev_colour)
-        memset(db_graph.readstrt, 0, roundup_bits2bytes(db_graph.ht.capacity)*2);
-
-      end = start+1;
-      while(end < ntasks && end-start < MAX_IO_THREADS &&
-            tasks[end].colour == colour) end++;
-    }
-    else {
-      end = MIN2(start+MAX_IO_THREADS, ntasks);
+    // PCR duplicates are removed per sample, so load one sample at a time
+    // (its inputs still share threads) and wipe the filter in between
+    size_t start, end, colour;
+    for(start = 0; start < ntasks; start = end) {
+      colour = tasks[start].colour;
+      for(end = start+1; end < ntasks && tasks[end].colour == colour; end++) {}
+      build_graph_filtered(&db_graph, tasks+start, end-start, nthreads,
+                           min_count ? &cfilter : NULL, min_count, &dfilter);
+      dup_filter_reset(&dfilter);
     }
+  }
 
-    num_load = end-start;
-    build_graph(&db_graph, tasks+start, num_load, nthreads);
+  if(remove_pcr_used) dup_filter_dealloc(&dfilter);
+
+  // Remove kmers that passed the filter but were seen fewer than min_count
+  // times (hash collisions, PCR duplicates)
+  if(min_count > 0)
+  {
+    count_filter_dealloc(&cfilter);
+    HASH_ITERATE(&db_graph.ht, mark_min_count, keep, &db_graph);
+    prune_nodes_lacking_flag(nthreads, keep, &db_graph);
+    ctx_free(keep);
   }
 
   // Print stats for hash table
-  hash_table_print_stats(&db_graph.ht);
+  if(!num_parts) hash_table_print_stats(&db_graph.ht);
 
   // Print stats per input file
   for(i = 0; i < ntasks; i++) {
@@ -342,9 +514,11 @@ int ctx_build(int argc, char **argv)
     build_graph_task_destroy(&tasks[i]);
   }
 
-  status("Dumping graph...\n");
-  graph_file_save_mkhdr(out_path, &db_graph, CTX_GRAPH_FILEFORMAT, NULL,
-                        0, output_colours);
+  if(!num_parts) {
+    status("Dumping graph...\n");
+    graph_file_save_mkhdr(out_path, &db_graph, CTX_GRAPH_FILEFORMAT, NULL,
+                          0, output_colours);
+  }
 
   build_graph_task_buf_dealloc(&gtaskbuf);
   gfile_buf_dealloc(&gfilebuf);
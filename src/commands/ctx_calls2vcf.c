@@ -7,6 +7,7 @@
 #include "call_file_reader.h"
 #include "json_hdr.h"
 #include "chrom_pos_list.h" // Parse chromosome position lists
+#include "allele_align.h"
 
 #include "htslib/sam.h" // cigar
 #include "seq-align/src/needleman_wunsch.h"
@@ -16,6 +17,9 @@
 #define DEFAULT_MAX_ALLELE 500 /* max allele length */
 #define DEFAULT_MAX_PDIFF 500 /* max allele length */
 
+// Number of entries read per thread before aligning
+#define CALLS2VCF_ENTRIES_PER_THREAD 256
+
 const char calls2vcf_usage[] =
 "usage: "CMD" calls2vcf [options] <in.txt.gz> <ref.fa> [ref2.fa ...]\n"
 "\n"
@@ -26,6 +30,7 @@ const char calls2vcf_usage[] =
 "  -q, --quiet            Silence status output normally printed to STDERR\n"
 "  -f, --force            Overwrite output files\n"
 "  -o, --out <out.txt>    Save output graph file [default: STDOUT]\n"
+"  -t, --threads <T>      Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n"
 "  -F, --flanks <in.bam>  Mapped flanks in SAM or BAM file\n"
 "  -Q, --min-mapq <Q>     Flank must map with MAPQ >= <Q> [default: "QUOTE_VALUE(DEFAULT_MIN_MAPQ)"]\n"
@@ -46,6 +51,7 @@ static struct option longopts[] =
   {"help",         no_argument,       NULL, 'h'},
   {"out",          required_argument, NULL, 'o'},
   {"force",        no_argument,       NULL, 'f'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"flanks",       required_argument, NULL, 'F'},
   {"min-mapq",     required_argument, NULL, 'Q'},
@@ -65,6 +71,7 @@ static struct option longopts[] =
 //
 static const char *input_path = NULL;
 static const char *out_path = NULL, default_out_path[] = "-";
+static size_t nthreads = 0;
 // Filtering parameters
 static size_t min_mapq = SIZE_MAX;
 static size_t max_align_len = SIZE_MAX;
@@ -96,35 +103,91 @@ static ReadBuffer chroms;
 // Flank mapping
 static samFile *samfh;
 static bam_hdr_t *bam_header;
-static bam1_t *bamentry;
 
 // nw alignment
-static nw_aligner_t *nw_aligner;
-static alignment_t *aln;
 static scoring_t nw_scoring_flank, nw_scoring_allele;
 
 //
 // Statistics
 //
 // Var reading stats
-static size_t num_entries_read = 0, num_entries_well_mapped = 0, num_vars_printed = 0;
+static size_t num_entries_read = 0, num_vars_printed = 0;
+
+typedef struct
+{
+  size_t num_entries_well_mapped;
 
-// Bubble statistics
-static size_t num_flank5p_unmapped = 0, num_flank5p_lowqual = 0;
-static size_t num_flank3p_exact_match = 0, num_flank3p_approx_match = 0;
-static size_t num_flank3p_multihits = 0, num_flank3p_not_found = 0;
+  // Bubble statistics
+  size_t num_flank5p_unmapped, num_flank5p_lowqual;
+  size_t num_flank3p_exact_match, num_flank3p_approx_match;
+  size_t num_flank3p_multihits, num_flank3p_not_found;
 
-// Breakpoint statistics
-static size_t num_flanks_not_uniquely_mapped = 0;
-static size_t num_flanks_diff_chroms = 0;
-static size_t num_flanks_diff_strands = 0;
+  // Breakpoint statistics
+  size_t num_flanks_not_uniquely_mapped;
+  size_t num_flanks_diff_chroms;
+  size_t num_flanks_diff_strands;
 
-// Both
-static size_t num_flanks_overlap_too_large = 0;
-static size_t num_flanks_too_far_apart = 0;
+  // Both
+  size_t num_flanks_overlap_too_large;
+  size_t num_flanks_too_far_apart;
 
-// Processing
-static size_t num_nw_allele = 0, num_nw_flank = 0;
+  // Processing
+  AlleleAlignStats allele_aln;
+  size_t num_nw_flank;
+} Calls2VcfStats;
+
+static void calls2vcf_stats_merge(Calls2VcfStats *dst, const Calls2VcfStats *src)
+{
+  dst->num_entries_well_mapped += src->num_entries_well_mapped;
+  dst->num_flank5p_unmapped += src->num_flank5p_unmapped;
+  dst->num_flank5p_lowqual += src->num_flank5p_lowqual;
+  dst->num_flank3p_exact_match += src->num_flank3p_exact_match;
+  dst->num_flank3p_approx_match += src->num_flank3p_approx_match;
+  dst->num_flank3p_multihits += src->num_flank3p_multihits;
+  dst->num_flank3p_not_found += src->num_flank3p_not_found;
+  dst->num_flanks_not_uniquely_mapped += src->num_flanks_not_uniquely_mapped;
+  dst->num_flanks_diff_chroms += src->num_flanks_diff_chroms;
+  dst->num_flanks_diff_strands += src->num_flanks_diff_strands;
+  dst->num_flanks_overlap_too_large += src->num_flanks_overlap_too_large;
+  dst->num_flanks_too_far_apart += src->num_flanks_too_far_apart;
+  allele_align_stats_merge(&dst->allele_aln, &src->allele_aln);
+  dst->num_nw_flank += src->num_nw_flank;
+}
+
+//
+// Multithreading
+//
+// The main thread reads a batch of entries (and their mapped flanks), worker
+// threads then map and align entries and print VCF lines into a buffer per
+// entry. The main thread prints the buffers in input order, filling in
+// variant ids as it goes.
+//
+
+typedef struct
+{
+  CallFileEntry centry;
+  bam1_t *bamentry; // mapped 5p flank, only used with bubble input
+  StrBuf vcf_lines; // output without variant ids
+  SizeBuffer varid_pos; // where variant ids go in vcf_lines
+} Calls2VcfJob;
+
+typedef struct
+{
+  Calls2VcfJob *jobs;
+  size_t num_jobs, next_job;
+} Calls2VcfBatch;
+
+typedef struct
+{
+  Calls2VcfBatch *batch;
+  nw_aligner_t *nw_aligner;
+  alignment_t *aln;
+  AlleleAligner allele_aligner;
+  ChromPosBuffer chrposbuf;
+  StrBuf tmpbuf, flank3pbuf;
+  const char **genotypes; // only used with breakpoint input
+  Calls2VcfStats stats;
+} Calls2VcfWorker;
 
 static void print_stat(size_t nom, size_t denom, const char *descr)
 {
@@ -152,6 +215,7 @@ static void parse_cmdline_args(int argc, char **argv)
       case 'h': cmd_print_usage(NULL); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(!sam_path,cmd); sam_path = optarg; break;
       case 'Q': cmd_check(min_mapq == SIZE_MAX,cmd); min_mapq = cmd_uint32(cmd, optarg); break;
       case 'A': cmd_check(max_align_len  == SIZE_MAX,cmd);  max_align_len  = cmd_uint32(cmd, optarg); break;
@@ -170,6 +234,7 @@ static void parse_cmdline_args(int argc, char **argv)
 
   // Defaults for unset values
   if(out_path == NULL) out_path = default_out_path;
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
   if(min_mapq == SIZE_MAX) min_mapq = DEFAULT_MIN_MAPQ;
   if(max_align_len  == SIZE_MAX) max_align_len  = DEFAULT_MAX_ALIGN;
   if(max_allele_len == SIZE_MAX) max_allele_len = DEFAULT_MAX_ALLELE;
@@ -183,22 +248,54 @@ static void parse_cmdline_args(int argc, char **argv)
   num_ref_paths = argc - optind;
 }
 
-// Setup pairwise aligner
-static void nw_aligner_setup()
+// Setup pairwise alignment scoring
+static void nw_scoring_setup()
 {
-  nw_aligner = needleman_wunsch_new();
-  aln = alignment_create(1024);
   scoring_init(&nw_scoring_flank, nwmatch, nwmismatch, nwgapopen, nwgapextend,
                true, true, 0, 0, 0, 0);
   scoring_init(&nw_scoring_allele, nwmatch, nwmismatch, nwgapopen, nwgapextend,
                false, false, 0, 0, 0, 0);
 }
 
-// Clean up pairwise aligner
-static void nw_aligner_destroy()
+static void calls2vcf_worker_alloc(Calls2VcfWorker *wrkr, Calls2VcfBatch *batch)
+{
+  memset(wrkr, 0, sizeof(Calls2VcfWorker));
+  wrkr->batch = batch;
+  wrkr->nw_aligner = needleman_wunsch_new();
+  wrkr->aln = alignment_create(1024);
+  allele_aligner_alloc(&wrkr->allele_aligner, &nw_scoring_allele);
+  chrompos_buf_alloc(&wrkr->chrposbuf, 32);
+  strbuf_alloc(&wrkr->tmpbuf, 1024);
+  strbuf_alloc(&wrkr->flank3pbuf, 1024);
+  if(!input_bubble_format)
+    wrkr->genotypes = ctx_calloc(num_samples, sizeof(char*));
+}
+
+static void calls2vcf_worker_dealloc(Calls2VcfWorker *wrkr)
+{
+  alignment_free(wrkr->aln);
+  needleman_wunsch_free(wrkr->nw_aligner);
+  allele_aligner_dealloc(&wrkr->allele_aligner);
+  chrompos_buf_dealloc(&wrkr->chrposbuf);
+  strbuf_dealloc(&wrkr->tmpbuf);
+  strbuf_dealloc(&wrkr->flank3pbuf);
+  ctx_free(wrkr->genotypes);
+}
+
+static void calls2vcf_job_alloc(Calls2VcfJob *job)
 {
-  alignment_free(aln);
-  needleman_wunsch_free(nw_aligner);
+  call_file_entry_alloc(&job->centry);
+  job->bamentry = input_bubble_format ? bam_init1() : NULL;
+  strbuf_alloc(&job->vcf_lines, 1024);
+  size_buf_alloc(&job->varid_pos, 16);
+}
+
+static void calls2vcf_job_dealloc(Calls2VcfJob *job)
+{
+  call_file_entry_dealloc(&job->centry);
+  if(job->bamentry) bam_destroy1(job->bamentry);
+  strbuf_dealloc(&job->vcf_lines);
+  size_buf_dealloc(&job->varid_pos);
 }
 
 static size_t call_file_max_allele_len(const CallFileEntry *centry)
@@ -255,7 +352,18 @@ static inline uint32_t bam_get_end_padding(int n_cigar, const uint32_t *cigar)
   return l;
 }
 
-static bool sam_fetch_coords(const CallFileEntry *centry,
+// Read the next primary alignment
+static void sam_read_primary(bam1_t *bamentry)
+{
+  do {
+    if(sam_read1(samfh, bam_header, bamentry) < 0)
+      die("We've run out of SAM entries!");
+  } while(bamentry->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY));
+}
+
+static bool sam_fetch_coords(Calls2VcfWorker *wrkr,
+                             const CallFileEntry *centry,
+                             const bam1_t *bamentry,
                              const char *flank5p, size_t flank5p_len,
                              const char *flank3p, size_t flank3p_len,
                              size_t *cpy_flnk_5p, size_t *cpy_flnk_3p,
@@ -263,14 +371,10 @@ static bool sam_fetch_coords(const CallFileEntry *centry,
                              size_t *start, size_t *end,
                              bool *fw_strand_ptr)
 {
-  // Get the next primary alignment
-  do {
-    if(sam_read1(samfh, bam_header, bamentry) < 0)
-      die("We've run out of SAM entries!");
-  } while(bamentry->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY));
+  Calls2VcfStats *stats = &wrkr->stats;
 
-  if(bamentry->core.flag & BAM_FUNMAP) { num_flank5p_unmapped++; return false; }
-  if(bamentry->core.qual < min_mapq)   { num_flank5p_lowqual++;  return false; }
+  if(bamentry->core.flag & BAM_FUNMAP) { stats->num_flank5p_unmapped++; return false; }
+  if(bamentry->core.qual < min_mapq)   { stats->num_flank5p_lowqual++;  return false; }
 
   bool fw_strand = !bam_is_rev(bamentry);
   *fw_strand_ptr = fw_strand;
@@ -288,7 +392,7 @@ static bool sam_fetch_coords(const CallFileEntry *centry,
   *cpy_flnk_3p = 0; // set this later
 
   // Get bam query name
-  char *bname = bam_get_qname(bamentry);
+  const char *bname = bam_get_qname(bamentry);
 
   // Check entry/flank names match
   const char *hdrline = call_file_get_line(centry, 0);
@@ -338,7 +442,7 @@ static bool sam_fetch_coords(const CallFileEntry *centry,
     // Check for multiple hits
     size_t rem_search_len = search_region+search_len-kmer_match;
     if(ctx_strnstr(kmer_match+1, endkmer, rem_search_len-1) != NULL) {
-      num_flank3p_multihits++;
+      stats->num_flank3p_multihits++;
       return false;
     }
 
@@ -349,15 +453,16 @@ static bool sam_fetch_coords(const CallFileEntry *centry,
       *start = kmer_match + kmer_size - chrom->seq.b;
       *end   = bamentry->core.pos;
     }
-    num_flank3p_exact_match++;
+    stats->num_flank3p_exact_match++;
     return true;
   }
   else
   {
     // Look for approximate match
+    alignment_t *aln = wrkr->aln;
     needleman_wunsch_align2(search_region, endkmer, search_len, kmer_size,
-                            &nw_scoring_flank, nw_aligner, aln);
-    num_nw_flank++;
+                            &nw_scoring_flank, wrkr->nw_aligner, aln);
+    stats->num_nw_flank++;
     const char *ref = aln->result_a, *alt = aln->result_b;
     // --aa--dd-cge
     // bb--ccd-ecge
@@ -382,11 +487,11 @@ static bool sam_fetch_coords(const CallFileEntry *centry,
     if(matches < (int)kmer_size / 2)
     {
       // flank doesn't map well
-      num_flank3p_not_found++;
+      stats->num_flank3p_not_found++;
       return false;
     }
 
-    num_flank3p_approx_match++;
+    stats->num_flank3p_approx_match++;
 
     *cpy_flnk_3p += fw_strand ? alt_offset_left : alt_offset_rght;
 
@@ -446,12 +551,14 @@ static int brkpnt_fetch_largest_match(const char *line, ChromPosBuffer *buf,
   return chrom_pos_list_get_largest(buf, flank);
 }
 
-static bool brkpnt_fetch_coords(const CallFileEntry *centry,
-                                ChromPosBuffer *chrposbuf,
+static bool brkpnt_fetch_coords(Calls2VcfWorker *wrkr,
+                                const CallFileEntry *centry,
                                 const read_t **chrom,
                                 size_t *start, size_t *end, bool *fw_strand,
                                 size_t *cpy_flnk_5p, size_t *cpy_flnk_3p)
 {
+  ChromPosBuffer *chrposbuf = &wrkr->chrposbuf;
+  Calls2VcfStats *stats = &wrkr->stats;
   ChromPosOffset flank5p, flank3p;
   size_t n;
 
@@ -464,9 +571,9 @@ static bool brkpnt_fetch_coords(const CallFileEntry *centry,
                   brkpnt_fetch_largest_match(line2, chrposbuf, &flank3p));
 
   // Didn't map uniquely, with mismatching chromosomes or strands
-  if(!success) { num_flanks_not_uniquely_mapped++; return false; }
-  else if(strcmp(flank5p.chrom,flank3p.chrom) != 0) { num_flanks_diff_chroms++; return false; }
-  else if(flank5p.fw_strand != flank3p.fw_strand) { num_flanks_diff_strands++; return false; }
+  if(!success) { stats->num_flanks_not_uniquely_mapped++; return false; }
+  else if(strcmp(flank5p.chrom,flank3p.chrom) != 0) { stats->num_flanks_diff_chroms++; return false; }
+  else if(flank5p.fw_strand != flank3p.fw_strand) { stats->num_flanks_diff_strands++; return false; }
   else {
     // Copy required bases so flank5p, flank3p go right up to the breakpoints
     // offset is 1-based
@@ -523,15 +630,18 @@ static size_t align_get_len(const char *allele, size_t len)
 // Print allele with previous base and no deletions
 // 'A--CG-T' with prev_base 'C' => print 'CACGT'
 static void print_vcf_allele(int prev_base, const char *allele, size_t len,
-                             FILE *fout)
+                             StrBuf *sbuf)
 {
   size_t i;
-  if(prev_base > 0) fputc((char)prev_base, fout);
+  strbuf_ensure_capacity(sbuf, sbuf->end + len + 1);
+  if(prev_base > 0) sbuf->b[sbuf->end++] = (char)prev_base;
   for(i = 0; i < len; i++)
     if(allele[i] != '-')
-      fputc(allele[i], fout);
+      sbuf->b[sbuf->end++] = allele[i];
+  sbuf->b[sbuf->end] = '\0';
 }
 
+// Variant id is filled in when the job is printed
 // @param vcf_pos is 1-based
 // @param prev_base is -1 if SNP otherwise previous base
 static void print_vcf_entry(const char *chrom_name, size_t vcf_pos, int prev_base,
@@ -539,33 +649,52 @@ static void print_vcf_entry(const char *chrom_name, size_t vcf_pos, int prev_bas
                             size_t aligned_len,
                             const char *info,
                             const char **genotypes,
-                            FILE *fout)
+                            Calls2VcfJob *job)
 {
+  StrBuf *sbuf = &job->vcf_lines;
+
   // Check actual allele length
   size_t i, alt_bases = 0;
   for(i = 0; i < aligned_len; i++) alt_bases += (alt[i] != '-');
   if(alt_bases > max_allele_len) return;
 
   // CHROM POS ID REF ALT QUAL FILTER INFO
-  fprintf(fout, "%s\t%zu\tvar%zu\t", chrom_name, vcf_pos, num_vars_printed);
-  print_vcf_allele(prev_base, ref, aligned_len, fout);
-  fputc('\t', fout);
-  print_vcf_allele(prev_base, alt, aligned_len, fout);
-  fputs("\t.\tPASS\t", fout);
-  if(info) fputs(info, fout);
-  else fputc('.', fout);
-  fputs("\tGT", fout);
+  strbuf_sprintf(sbuf, "%s\t%zu\tvar", chrom_name, vcf_pos);
+  size_buf_add(&job->varid_pos, sbuf->end);
+  strbuf_append_char(sbuf, '\t');
+  print_vcf_allele(prev_base, ref, aligned_len, sbuf);
+  strbuf_append_char(sbuf, '\t');
+  print_vcf_allele(prev_base, alt, aligned_len, sbuf);
+  strbuf_append_str(sbuf, "\t.\tPASS\t");
+  if(info) strbuf_append_str(sbuf, info);
+  else strbuf_append_char(sbuf, '.');
+  strbuf_append_str(sbuf, "\tGT");
 
   // Print genotypes
   if(genotypes) {
     for(i = 0; i < num_samples; i++) {
-      fputc('\t', fout);
-      fputs(genotypes[i], fout);
+      strbuf_append_char(sbuf, '\t');
+      strbuf_append_str(sbuf, genotypes[i]);
     }
   }
 
-  fputc('\n', fout);
-  num_vars_printed++;
+  strbuf_append_char(sbuf, '\n');
+}
+
+// Print VCF lines from a job, numbering variants
+static void print_vcf_job(const Calls2VcfJob *job, FILE *fout)
+{
+  const StrBuf *sbuf = &job->vcf_lines;
+  size_t i, start = 0, end;
+
+  for(i = 0; i < job->varid_pos.len; i++) {
+    end = job->varid_pos.b[i];
+    fwrite(sbuf->b+start, 1, end-start, fout);
+    fprintf(fout, "%zu", num_vars_printed++);
+    start = end;
+  }
+
+  fwrite(sbuf->b+start, 1, sbuf->end-start, fout);
 }
 
 /**
@@ -577,7 +706,7 @@ static void print_vcf_entry(const char *chrom_name, size_t vcf_pos, int prev_bas
 static void align_biallelic(const char *ref, const char *alt,
                             const read_t *chr, size_t ref_pos,
                             const char *info, const char **genotypes,
-                            FILE *fout)
+                            Calls2VcfJob *job)
 {
   int start, len;
   size_t ref_allele_len, alt_allele_len;
@@ -610,7 +739,7 @@ static void align_biallelic(const char *ref, const char *alt,
 
     print_vcf_entry(chr->name.b, vcf_pos, prev_base,
                     ref, alt, len,
-                    info, genotypes, fout);
+                    info, genotypes, job);
 
     ref_pos += ref_allele_len;
     ref += len;
@@ -643,17 +772,18 @@ static int get_callid_str(const char *hdrline, bool bubble_format,
  * @param cpy_flnk_5p how many characters to copy from end of 5' flank to start of allele
  * @param cpy_flnk_3p how many characters to copy from end of 3' flank to end of allele
  */
-static void align_entry_allele(const char *line, size_t linelen,
+static void align_entry_allele(Calls2VcfWorker *wrkr, Calls2VcfJob *job,
+                               const char *line, size_t linelen,
                                const char *flank5p, size_t flank5p_len,
                                const char *flank3p, size_t flank3p_len,
                                size_t cpy_flnk_5p, size_t cpy_flnk_3p,
                                const read_t *chr,
                                size_t ref_start, size_t ref_end,
                                bool fw_strand,
-                               const char *info, const char **genotypes,
-                               StrBuf *tmpbuf, FILE *fout)
+                               const char *info, const char **genotypes)
 {
   (void)flank3p_len;
+  StrBuf *tmpbuf = &wrkr->tmpbuf;
   ctx_assert(ref_start <= ref_end);
 
   // Ref allele
@@ -686,14 +816,13 @@ static void align_entry_allele(const char *line, size_t linelen,
   //                          (int)alt_len, seq);
 
   // Align chrom and seq
-  needleman_wunsch_align2(ref_allele, alt_allele, ref_len, alt_len,
-                          &nw_scoring_allele, nw_aligner, aln);
-  num_nw_allele++;
+  AlleleAligner *aa = &wrkr->allele_aligner;
+  allele_align(aa, ref_allele, ref_len, alt_allele, alt_len);
 
   // Break into variants and print VCF
-  align_biallelic(aln->result_a, aln->result_b,
+  align_biallelic(aa->result_a, aa->result_b,
                   chr, ref_start,
-                  info, genotypes, fout);
+                  info, genotypes, job);
 }
 
 #define GENO_REF    0
@@ -729,16 +858,18 @@ static void brkpnt_parse_genotype_colours(const char *hdrline,
   }
 }
 
-static void align_entry(const CallFileEntry *centry, const char *callid,
+static void align_entry(Calls2VcfWorker *wrkr, Calls2VcfJob *job,
+                        const char *callid,
                         const char *flank5p, size_t flank5p_len,
                         const char *flank3p, size_t flank3p_len,
                         size_t cpy_flnk_5p, size_t cpy_flnk_3p,
                         const read_t *chr,
                         size_t ref_start, size_t ref_end,
-                        bool fw_strand,
-                        StrBuf *tmpbuf, const char **genotypes,
-                        FILE *fout)
+                        bool fw_strand)
 {
+  const CallFileEntry *centry = &job->centry;
+  const char **genotypes = wrkr->genotypes;
+  Calls2VcfStats *stats = &wrkr->stats;
   size_t i;
 
   // If variant starts after it ends, we need to copy some sequence to fix this
@@ -765,7 +896,7 @@ static void align_entry(const CallFileEntry *centry, const char *callid,
       else          ref_end += ncpy;
     }
     else {
-      num_flanks_overlap_too_large++;
+      stats->num_flanks_overlap_too_large++;
       return; // can't align
     }
   }
@@ -773,14 +904,14 @@ static void align_entry(const CallFileEntry *centry, const char *callid,
   ctx_assert(ref_start <= ref_end);
 
   if(ref_end-ref_start > max_align_len) {
-    num_flanks_too_far_apart++;
+    stats->num_flanks_too_far_apart++;
     return; // can't align
   }
 
   if(ref_end > chr->seq.end) die("Out of range: %zu > %zu", ref_end, chr->seq.end);
 
   // We now have mapped to a valid site in the reference genome
-  num_entries_well_mapped++;
+  stats->num_entries_well_mapped++;
 
   // Deal with alleles one at a time vs ref
   // First allele stored in line 5:
@@ -806,27 +937,19 @@ static void align_entry(const CallFileEntry *centry, const char *callid,
       brkpnt_parse_genotype_colours(hdrline, genotypes, num_samples);
     }
 
-    align_entry_allele(line, linelen,
+    align_entry_allele(wrkr, job, line, linelen,
                        flank5p, flank5p_len, flank3p, flank3p_len,
                        cpy_flnk_5p, cpy_flnk_3p,
                        chr, ref_start, ref_end,
                        fw_strand,
-                       info, genotypes,
-                       tmpbuf, fout);
+                       info, genotypes);
   }
 }
 
-static void parse_entries(gzFile gzin, FILE *fout)
+// Map and align a single entry, VCF lines are printed to job->vcf_lines
+static void process_entry(Calls2VcfWorker *wrkr, Calls2VcfJob *job)
 {
-  CallFileEntry centry;
-  call_file_entry_alloc(&centry);
-
-  ChromPosBuffer chrposbuf;
-  chrompos_buf_alloc(&chrposbuf, 32);
-
-  StrBuf tmpbuf, flank3pbuf;
-  strbuf_alloc(&tmpbuf, 1024);
-  strbuf_alloc(&flank3pbuf, 1024);
+  CallFileEntry *centry = &job->centry;
 
   const char *flank5p, *flank3p;
   size_t flank5p_len, flank3p_len;
@@ -836,63 +959,103 @@ static void parse_entries(gzFile gzin, FILE *fout)
   size_t ref_start = 0, ref_end = 0;
   bool mapped = false, fw_strand = false;
 
-  const char **genotypes = NULL;
+  strbuf_reset(&job->vcf_lines);
+  size_buf_reset(&job->varid_pos);
 
-  if(!input_bubble_format)
-    genotypes = ctx_calloc(num_samples, sizeof(char*));
+  size_t nlines = call_file_num_lines(centry);
+  ctx_assert2(!(nlines&1) && nlines >= 6, "Too few lines: %zu", nlines);
+
+  flank5p = call_file_get_line(centry,1);
+  flank5p_len = call_file_line_len(centry,1);
+  cpy_flnk_5p = cpy_flnk_3p = 0;
 
-  for(; call_file_read(gzin, input_path, &centry); num_entries_read++)
+  // Use the corresponding SAM entry
+  if(input_bubble_format)
   {
-    size_t nlines = call_file_num_lines(&centry);
-    ctx_assert2(!(nlines&1) && nlines >= 6, "Too few lines: %zu", nlines);
+    // Trim down alleles, add to 3p flank
+    bubble_trim_alleles(centry, &wrkr->flank3pbuf);
+    flank3p = wrkr->flank3pbuf.b;
+    flank3p_len = wrkr->flank3pbuf.end;
+
+    mapped = sam_fetch_coords(wrkr, centry, job->bamentry,
+                              flank5p, flank5p_len, flank3p, flank3p_len,
+                              &cpy_flnk_5p, &cpy_flnk_3p,
+                              &chrom, &ref_start, &ref_end, &fw_strand);
+  }
+  else {
+    flank3p = call_file_get_line(centry, 3);
+    flank3p_len = call_file_line_len(centry, 3);
 
-    flank5p = call_file_get_line(&centry,1);
-    flank5p_len = call_file_line_len(&centry,1);
-    cpy_flnk_5p = cpy_flnk_3p = 0;
+    mapped = brkpnt_fetch_coords(wrkr, centry,
+                                 &chrom, &ref_start, &ref_end, &fw_strand,
+                                 &cpy_flnk_5p, &cpy_flnk_3p);
+  }
 
-    // Read a corresponding SAM entry
-    if(input_bubble_format)
-    {
-      // Trim down alleles, add to 3p flank
-      bubble_trim_alleles(&centry, &flank3pbuf);
-      flank3p = flank3pbuf.b;
-      flank3p_len = flank3pbuf.end;
-
-      mapped = sam_fetch_coords(&centry, flank5p, flank5p_len, flank3p, flank3p_len,
-                                &cpy_flnk_5p, &cpy_flnk_3p,
-                                &chrom, &ref_start, &ref_end, &fw_strand);
-    }
-    else {
-      flank3p = call_file_get_line(&centry, 3);
-      flank3p_len = call_file_line_len(&centry, 3);
+  if(mapped)
+  {
+    // Get call id
+    const char *hdrline = call_file_get_line(centry, 0);
+    char callid[100];
+    int r = get_callid_str(hdrline, input_bubble_format, callid, sizeof(callid));
+    if(r == -1) die("Poorly formatted: %s", hdrline);
+    if(r == -2) die("Call id string is too long: %s", hdrline);
+
+    align_entry(wrkr, job, callid, flank5p, flank5p_len, flank3p, flank3p_len,
+                cpy_flnk_5p, cpy_flnk_3p,
+                chrom, ref_start, ref_end, fw_strand);
+  }
+}
 
-      mapped = brkpnt_fetch_coords(&centry, &chrposbuf,
-                                   &chrom, &ref_start, &ref_end, &fw_strand,
-                                   &cpy_flnk_5p, &cpy_flnk_3p);
-    }
+static void calls2vcf_worker(void *ptr)
+{
+  Calls2VcfWorker *wrkr = (Calls2VcfWorker*)ptr;
+  Calls2VcfBatch *batch = wrkr->batch;
+  size_t i;
 
-    if(mapped)
-    {
-      // Get call id
-      const char *hdrline = call_file_get_line(&centry, 0);
-      char callid[100];
-      int r = get_callid_str(hdrline, input_bubble_format, callid, sizeof(callid));
-      if(r == -1) die("Poorly formatted: %s", hdrline);
-      if(r == -2) die("Call id string is too long: %s", hdrline);
-
-      align_entry(&centry, callid, flank5p, flank5p_len, flank3p, flank3p_len,
-                  cpy_flnk_5p, cpy_flnk_3p,
-                  chrom, ref_start, ref_end, fw_strand,
-                  &tmpbuf, genotypes,
-                  fout);
+  while((i = __sync_fetch_and_add((volatile size_t*)&batch->next_job, 1)) < batch->num_jobs)
+    process_entry(wrkr, &batch->jobs[i]);
+}
+
+static void parse_entries(gzFile gzin, FILE *fout, Calls2VcfStats *stats)
+{
+  size_t i, max_jobs = nthreads * CALLS2VCF_ENTRIES_PER_THREAD;
+
+  Calls2VcfBatch batch = {.jobs = ctx_calloc(max_jobs, sizeof(Calls2VcfJob)),
+                          .num_jobs = 0, .next_job = 0};
+
+  for(i = 0; i < max_jobs; i++) calls2vcf_job_alloc(&batch.jobs[i]);
+
+  Calls2VcfWorker *workers = ctx_calloc(nthreads, sizeof(Calls2VcfWorker));
+  for(i = 0; i < nthreads; i++) calls2vcf_worker_alloc(&workers[i], &batch);
+
+  do
+  {
+    // Read a batch of entries with their mapped flanks
+    for(batch.num_jobs = 0; batch.num_jobs < max_jobs; batch.num_jobs++) {
+      Calls2VcfJob *job = &batch.jobs[batch.num_jobs];
+      if(!call_file_read(gzin, input_path, &job->centry)) break;
+      if(input_bubble_format) sam_read_primary(job->bamentry);
+      num_entries_read++;
     }
+
+    batch.next_job = 0;
+    util_run_threads(workers, nthreads, sizeof(workers[0]),
+                     nthreads, calls2vcf_worker);
+
+    // Print in input order
+    for(i = 0; i < batch.num_jobs; i++)
+      print_vcf_job(&batch.jobs[i], fout);
   }
+  while(batch.num_jobs == max_jobs);
 
-  ctx_free(genotypes);
-  call_file_entry_dealloc(&centry);
-  chrompos_buf_dealloc(&chrposbuf);
-  strbuf_dealloc(&tmpbuf);
-  strbuf_dealloc(&flank3pbuf);
+  for(i = 0; i < nthreads; i++) {
+    calls2vcf_stats_merge(stats, &workers[i].stats);
+    calls2vcf_worker_dealloc(&workers[i]);
+  }
+  ctx_free(workers);
+
+  for(i = 0; i < max_jobs; i++) calls2vcf_job_dealloc(&batch.jobs[i]);
+  ctx_free(batch.jobs);
 }
 
 static void flanks_sam_open()
@@ -910,14 +1073,12 @@ static void flanks_sam_open()
 
   // Load BAM header
   bam_header = sam_hdr_read(samfh);
-  bamentry = bam_init1();
 }
 
 static void flanks_sam_close()
 {
   sam_close(samfh);
   free(bam_header);
-  free(bamentry);
 }
 
 static cJSON* read_input_header(gzFile gzin)
@@ -1094,7 +1255,7 @@ int ctx_calls2vcf(int argc, char **argv)
   // These functions call die() on error
   gzFile gzin = futil_gzopen(input_path, "r");
 
-  nw_aligner_setup();
+  nw_scoring_setup();
 
   // Read file header
   cJSON *json = read_input_header(gzin);
@@ -1133,7 +1294,12 @@ int ctx_calls2vcf(int argc, char **argv)
   num_samples = print_vcf_header(json, !input_bubble_format, fout);
   status("Reading %s call file with %zu samples",
          input_bubble_format ? "Bubble" : "Breakpoint", num_samples);
-  parse_entries(gzin, fout);
+
+  Calls2VcfStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  status("Aligning with %zu thread%s", nthreads, util_plural_str(nthreads));
+  parse_entries(gzin, fout, &stats);
 
   // Print stats
   char num_entries_read_str[50];
@@ -1147,24 +1313,34 @@ int ctx_calls2vcf(int argc, char **argv)
   if(input_bubble_format) {
     char msg[200];
     // Bubble caller specific
-    print_stat(num_flank5p_unmapped,    num_entries_read, "flank 5p unmapped");
+    print_stat(stats.num_flank5p_unmapped,    num_entries_read, "flank 5p unmapped");
     sprintf(msg, "flank 5p low mapq (<%zu)", min_mapq);
-    print_stat(num_flank5p_lowqual,     num_entries_read, msg);
-    print_stat(num_flank3p_not_found,   num_entries_read, "flank 3p not found");
-    print_stat(num_flank3p_multihits,   num_entries_read, "flank 3p multiple hits");
-    print_stat(num_flank3p_approx_match,num_entries_read, "flank 3p approx match used");
-    print_stat(num_flank3p_exact_match, num_entries_read, "flank 3p exact match");
+    print_stat(stats.num_flank5p_lowqual,     num_entries_read, msg);
+    print_stat(stats.num_flank3p_not_found,   num_entries_read, "flank 3p not found");
+    print_stat(stats.num_flank3p_multihits,   num_entries_read, "flank 3p multiple hits");
+    print_stat(stats.num_flank3p_approx_match,num_entries_read, "flank 3p approx match used");
+    print_stat(stats.num_flank3p_exact_match, num_entries_read, "flank 3p exact match");
   } else {
     // Breakpoint caller specific
-    print_stat(num_flanks_not_uniquely_mapped, num_entries_read, "flank pairs contain one flank not mapped uniquely");
-    print_stat(num_flanks_diff_chroms,         num_entries_read, "flank pairs map to diff chroms");
-    print_stat(num_flanks_diff_strands,        num_entries_read, "flank pairs map to diff strands");
+    print_stat(stats.num_flanks_not_uniquely_mapped, num_entries_read, "flank pairs contain one flank not mapped uniquely");
+    print_stat(stats.num_flanks_diff_chroms,         num_entries_read, "flank pairs map to diff chroms");
+    print_stat(stats.num_flanks_diff_strands,        num_entries_read, "flank pairs map to diff strands");
   }
-  print_stat(num_flanks_too_far_apart,       num_entries_read, "flank pairs too far apart");
-  print_stat(num_flanks_overlap_too_large,   num_entries_read, "flank pairs overlap too much");
-  print_stat(num_entries_well_mapped,        num_entries_read, "flank pairs map well");
-
-  status("Aligned %zu allele pairs and %zu flanks", num_nw_allele, num_nw_flank);
+  print_stat(stats.num_flanks_too_far_apart,       num_entries_read, "flank pairs too far apart");
+  print_stat(stats.num_flanks_overlap_too_large,   num_entries_read, "flank pairs overlap too much");
+  print_stat(stats.num_entries_well_mapped,        num_entries_read, "flank pairs map well");
+
+  const AlleleAlignStats *aastats = &stats.allele_aln;
+  size_t num_allele_alns = aastats->num_exact + aastats->num_hamming +
+                           aastats->num_banded + aastats->num_full;
+
+  status("Aligned %zu allele pairs and %zu flanks",
+         num_allele_alns, stats.num_nw_flank);
+  print_stat(aastats->num_exact,   num_allele_alns, "allele pairs identical");
+  print_stat(aastats->num_hamming, num_allele_alns, "allele pairs aligned without gaps");
+  print_stat(aastats->num_banded,  num_allele_alns, "allele pairs aligned in a band");
+  print_stat(aastats->num_full,    num_allele_alns, "allele pairs aligned with full NW");
+  status("   band widened %zu times", aastats->num_band_retries);
 
   // Finished - clean up
   cJSON_Delete(json);
@@ -1174,7 +1350,6 @@ int ctx_calls2vcf(int argc, char **argv)
   for(i = 0; i < chroms.len; i++) seq_read_dealloc(&chroms.b[i]);
   read_buf_dealloc(&chroms);
   kh_destroy_ChromHash(genome);
-  nw_aligner_destroy();
 
   if(sam_path) flanks_sam_close();
 
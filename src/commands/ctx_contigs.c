@@ -205,7 +205,9 @@ int ctx_contigs(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem, total_mem;
 
   // 1 bit needed per kmer if we need to keep track of kmer usage
+  // 8 bytes per kmer for offsets when flattening the path store
   bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 + sizeof(GPath*)*8 +
+                  (gpfiles.len > 0 ? sizeof(uint64_t)*8 : 0) +
                   ncols + !sample_with_replacement;
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -225,8 +227,13 @@ int ctx_contigs(int argc, char **argv)
   path_mem  += sizeof(GPath*)*kmers_in_hash;
   cmd_print_mem(path_mem, "paths");
 
+  // Offsets used whilst flattening the path store
+  size_t flat_mem = gpfiles.len > 0 ? gpath_store_flatten_mem(kmers_in_hash) : 0;
+  graph_mem -= MIN2(graph_mem, flat_mem);
+  if(flat_mem) cmd_print_mem(flat_mem, "path offsets");
+
   // Total memory
-  total_mem = graph_mem + path_mem;
+  total_mem = graph_mem + path_mem + flat_mem;
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   // Load contig hist distribution from ctp files
@@ -293,6 +300,10 @@ int ctx_contigs(int argc, char **argv)
     gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
     gpath_reader_close(&gpfiles.b[i]);
   }
+
+  // Links are read-only from here on
+  if(gpfiles.len > 0) gpath_store_flatten(&db_graph.gpstore);
+
   gpfile_buf_dealloc(&gpfiles);
 
   AssembleContigStats assem_stats;
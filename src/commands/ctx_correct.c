@@ -7,6 +7,7 @@
 #include "gpath_reader.h"
 #include "gpath_checks.h"
 #include "correct_reads.h"
+#include "gap_memo.h"
 #include "read_thread_cmd.h"
 
 const char correct_usage[] =
@@ -150,8 +151,10 @@ int ctx_correct(int argc, char **argv)
   graph_mem -= sizeof(GPath*)*kmers_in_hash;
   path_mem  += sizeof(GPath*)*kmers_in_hash;
 
+  cmd_print_mem(GAP_MEMO_DEFAULT_MEM, "gap memo");
+
   // Total memory
-  total_mem = graph_mem + path_mem;
+  total_mem = graph_mem + path_mem + GAP_MEMO_DEFAULT_MEM;
   cmd_check_mem_limit(args.memargs.mem_to_use, total_mem);
 
   //
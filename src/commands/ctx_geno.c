@@ -6,10 +6,10 @@
 #include "graph_format.h"
 #include "seq_reader.h"
 #include "gpath_checks.h"
-#include "seq_reader.h"
 #include "genotyping.h"
 
 #include "htslib/vcf.h"
+#include "htslib/synced_bcf_reader.h"
 
 // DEV: specify sample/chrom ploidy
 
@@ -18,12 +18,19 @@ const char geno_usage[] =
 "\n"
 "  Genotype a VCF using cortex graphs. VCF must be sorted by position. \n"
 "  VCF must be a file, not piped in. It is recommended to use uncleaned graphs.\n"
+"  Output is a VCF with the number of kmers unique to each allele and their\n"
+"  coverage, in each colour.\n"
 "\n"
 "  -h, --help              This help message\n"
 "  -q, --quiet             Silence status output normally printed to STDERR\n"
 "  -f, --force             Overwrite output files\n"
-"  -o, --out <bub.txt.gz>  Output file [default: STDOUT]\n"
+"  -m, --memory <mem>      Memory to use\n"
+"  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -o, --out <out.vcf>     Output file [default: STDOUT]\n"
 "  -r, --ref <ref.fa>      Reference file\n"
+"  -R, --regions <regs>    Only genotype sites in regions e.g. chr1:1-5000,chr2\n"
+"                          VCF must be bgzipped and indexed\n"
 "\n";
 
 static struct option longopts[] =
@@ -34,37 +41,87 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+// command specific
   {"ref",          required_argument, NULL, 'r'},
+  {"regions",      required_argument, NULL, 'R'},
   {NULL, 0, NULL, 0}
 };
 
-typedef struct {
-  // _kmers is the number of kmers unique to the allele
-  // _sumcovg is the sum of coverages on those kmers
-  // _medcovg is the median coverage of those kmers
-  size_t refkmers, refsumcovg;// refmedcovg;
-  size_t altkmers, altsumcovg;// altmedcovg;
-} GenoCovg;
-
-/**
- * Get coverage of ref and alt alleles from the de Bruijn graph in the given
- * colour.
- */
-void bkey_get_covg(BinaryKmer bkey, uint64_t altref_bits,
-                   GenoVar *gts, size_t ntgts,
-                   int colour, const dBGraph *db_graph)
+#define GENO_CLUSTERS_PER_THREAD 64
+
+// Max number of neighbouring variants used when genotyping a variant
+// Genotyping considers all combinations of neighbouring variants
+#define GENO_MAX_NEIGHBOURS 8
+
+// Coverage fields per variant per colour
+#define GENO_NFIELDS 4
+enum { GENO_REFK, GENO_REFC, GENO_ALTK, GENO_ALTC };
+
+//
+// Multithreading
+//
+// VCF records are split into clusters: records on the same chromosome with
+// fewer than kmer_size bases between them. Clusters are independent, so the
+// main thread reads a batch of clusters, worker threads genotype them and the
+// main thread writes them out in input order.
+//
+// Only kmers needed for genotyping are loaded from the graphs. On the first
+// pass over the VCF workers add those kmers to the graph, on the second pass
+// they fetch coverage.
+//
+
+typedef struct
 {
-  size_t i;
-  dBNode node = db_graph_find(db_graph, bkey);
+  bcf1_t **recs;
+  size_t nrecs, recs_cap;
+  GenoVarBuffer vars;
+  SizeBuffer covgs; // [var][colour][GENO_NFIELDS]
+} GenoCluster;
 
-  if(node.key != HASH_NOT_FOUND) {
-    Covg covg = colour >= 0 ? db_node_get_covg(db_graph, node.key, colour)
-                            : db_node_sum_covg(db_graph, node.key);
+typedef struct
+{
+  GenoCluster *clusters;
+  size_t num_clusters, next_cluster;
+  // Shared between workers
+  bool add_kmers; // first pass: add kmers to the graph
+  const bcf_hdr_t *vcfhdr;
+  khash_t(ChromHash) *genome;
+  dBGraph *db_graph;
+} GenoBatch;
+
+typedef struct
+{
+  GenoBatch *batch;
+  Genotyper gtyper;
+  size_t num_vars, num_kmers;
+} GenoWorker;
 
-    for(i = 0; i < ntgts; i++, altref_bits >>= 2) {
-      if((altref_bits & 3) == 1) { gts[i].refkmers++; gts[i].refsumcovg += covg; }
-      if((altref_bits & 3) == 2) { gts[i].altkmers++; gts[i].altsumcovg += covg; }
-    }
+static void geno_cluster_alloc(GenoCluster *cl)
+{
+  memset(cl, 0, sizeof(GenoCluster));
+  genovar_buf_alloc(&cl->vars, 16);
+  size_buf_alloc(&cl->covgs, 64);
+}
+
+static void geno_cluster_dealloc(GenoCluster *cl)
+{
+  size_t i;
+  for(i = 0; i < cl->recs_cap; i++) bcf_destroy(cl->recs[i]);
+  ctx_free(cl->recs);
+  genovar_buf_dealloc(&cl->vars);
+  size_buf_dealloc(&cl->covgs);
+  memset(cl, 0, sizeof(GenoCluster));
+}
+
+// Make sure there is a free record at the end of the cluster
+static void geno_cluster_capacity(GenoCluster *cl)
+{
+  if(cl->nrecs == cl->recs_cap) {
+    size_t i, newcap = cl->recs_cap ? cl->recs_cap*2 : 8;
+    cl->recs = ctx_realloc(cl->recs, newcap * sizeof(bcf1_t*));
+    for(i = cl->recs_cap; i < newcap; i++) cl->recs[i] = bcf_init1();
+    cl->recs_cap = newcap;
   }
 }
 
@@ -85,36 +142,323 @@ static inline bool init_new_var(GenoVar *var, int32_t pos,
   return var->reflen || var->altlen;
 }
 
-/**
- * @return 1 on success, 0 otherwise
- */
-static inline int read_vars(GenoVarList *vlist, htsFile *vcf_file,
-                            bcf_hdr_t *vcfhdr, bcf1_t *v)
+// Split records into variants, sorted for genotyping_get_covg()
+static void geno_cluster_load_vars(GenoCluster *cl, const read_t *chrom)
+{
+  GenoVar var;
+  bcf1_t *rec;
+  size_t r, a;
+
+  genovar_buf_reset(&cl->vars);
+
+  for(r = 0; r < cl->nrecs; r++)
+  {
+    rec = cl->recs[r];
+    bcf_unpack(rec, BCF_UN_STR);
+
+    for(a = 1; a < rec->n_allele; a++)
+    {
+      // Skip symbolic alleles e.g. <DEL> and *
+      const char *alt = rec->d.allele[a];
+      if(alt[0] == '<' || alt[0] == '*') continue;
+
+      memset(&var, 0, sizeof(var));
+      if(init_new_var(&var, rec->pos, rec->d.allele[0], alt) &&
+         var.pos + var.reflen <= chrom->seq.end)
+      {
+        var.vcfrec = r;
+        var.altidx = a-1;
+        genovar_buf_add(&cl->vars, var);
+      }
+    }
+  }
+
+  genovars_sort(cl->vars.b, cl->vars.len);
+}
+
+// Sum coverage on kmers unique to ref / alt in each colour
+static void geno_kmer_covgs(const GenoKmer *kmers, size_t nkmers,
+                            size_t *covgs, const dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  size_t i, col, *c;
+  hkey_t hkey;
+  Covg covg;
+  bool isalt;
+
+  for(i = 0; i < nkmers; i++) {
+    hkey = hash_table_find(&db_graph->ht, kmers[i].bkey);
+    if(hkey != HASH_NOT_FOUND) {
+      isalt = ((kmers[i].arbits & 3) == 2);
+      for(col = 0, c = covgs; col < ncols; col++, c += GENO_NFIELDS) {
+        covg = db_node_get_covg(db_graph, hkey, col);
+        c[isalt ? GENO_ALTK : GENO_REFK]++;
+        c[isalt ? GENO_ALTC : GENO_REFC] += covg;
+      }
+    }
+  }
+}
+
+static void geno_cluster_process(GenoWorker *wrkr, GenoCluster *cl)
 {
+  const GenoBatch *batch = wrkr->batch;
+  dBGraph *db_graph = batch->db_graph;
+  const size_t kmer_size = db_graph->kmer_size;
+  const size_t ncovgs = db_graph->num_of_cols * GENO_NFIELDS;
+  size_t t, i, start, end;
+  bool found;
+
+  const char *chrom_name = bcf_seqname(batch->vcfhdr, cl->recs[0]);
+  const read_t *chrom = seq_fetch_chrom(batch->genome, chrom_name);
+
+  geno_cluster_load_vars(cl, chrom);
+
+  const GenoVar *vars = cl->vars.b;
+  const size_t nvars = cl->vars.len;
+
+  if(!batch->add_kmers) {
+    size_buf_capacity(&cl->covgs, nvars * ncovgs);
+    memset(cl->covgs.b, 0, nvars * ncovgs * sizeof(size_t));
+    cl->covgs.len = nvars * ncovgs;
+  }
+
+  for(t = 0; t < nvars; t++)
+  {
+    // Neighbouring variants that overlap kmers of the target
+    for(start = t; start > 0 && t-start < GENO_MAX_NEIGHBOURS/2 &&
+        vars[start-1].pos + vars[start-1].reflen + kmer_size > vars[t].pos;
+        start--) {}
+
+    for(end = t+1; end < nvars && end-t <= GENO_MAX_NEIGHBOURS/2 &&
+        vars[end].pos < vars[t].pos + vars[t].reflen + kmer_size;
+        end++) {}
+
+    genotyping_get_covg(&wrkr->gtyper, vars+start, end-start, t-start, 1,
+                        chrom->seq.b, chrom->seq.end, kmer_size);
+
+    const GenoKmer *kmers = wrkr->gtyper.kmer_buf.b;
+    const size_t nkmers = wrkr->gtyper.kmer_buf.len;
+
+    if(batch->add_kmers) {
+      for(i = 0; i < nkmers; i++) {
+        hash_table_find_or_insert_mt(&db_graph->ht, kmers[i].bkey,
+                                     &found, db_graph->bktlocks);
+      }
+    }
+    else {
+      geno_kmer_covgs(kmers, nkmers, cl->covgs.b + t*ncovgs, db_graph);
+    }
+
+    wrkr->num_kmers += nkmers;
+  }
+
+  wrkr->num_vars += nvars;
+}
+
+static void geno_worker(void *ptr)
+{
+  GenoWorker *wrkr = (GenoWorker*)ptr;
+  GenoBatch *batch = wrkr->batch;
   size_t i;
-  int s;
-  GenoVar tmpvar;
 
-  if((s = bcf_read(vcf_file, vcfhdr, v)) != 0) {
-    if(s < 0) warn("Bad entry");
-    return 0;
+  while((i = __sync_fetch_and_add((volatile size_t*)&batch->next_cluster, 1)) < batch->num_clusters)
+    geno_cluster_process(wrkr, &batch->clusters[i]);
+}
+
+//
+// Output
+//
+
+// Add coverage of each ALT allele in each colour to records, then write them
+static void geno_cluster_write(const GenoCluster *cl, Int32Buffer *fields,
+                               const bcf_hdr_t *vcfhdr,
+                               htsFile *vcfout, bcf_hdr_t *outhdr)
+{
+  const size_t ncols = bcf_hdr_nsamples(outhdr);
+  const char *keys[GENO_NFIELDS] = {"RK", "RC", "AK", "AC"};
+  size_t r, v, i, f, col, nalts, nvals;
+  const size_t *covgs;
+  bcf1_t *rec;
+
+  for(r = 0, v = 0; r < cl->nrecs; r++)
+  {
+    rec = cl->recs[r];
+    nalts = rec->n_allele - 1;
+    nvals = ncols * nalts;
+
+    int32_buf_capacity(fields, GENO_NFIELDS * nvals);
+    for(i = 0; i < GENO_NFIELDS * nvals; i++) fields->b[i] = bcf_int32_missing;
+
+    // Variants are sorted by position, so may not be in record order
+    for(v = 0; v < cl->vars.len; v++) {
+      if(cl->vars.b[v].vcfrec != r) continue;
+      covgs = cl->covgs.b + v * ncols * GENO_NFIELDS;
+      for(col = 0; col < ncols; col++, covgs += GENO_NFIELDS) {
+        for(f = 0; f < GENO_NFIELDS; f++) {
+          fields->b[f*nvals + col*nalts + cl->vars.b[v].altidx]
+            = (int32_t)MIN2(covgs[f], INT32_MAX);
+        }
+      }
+    }
+
+    // Drop input samples, add a sample for each colour
+    bcf_subset(vcfhdr, rec, 0, NULL);
+
+    for(f = 0; f < GENO_NFIELDS; f++) {
+      if(bcf_update_format_int32(outhdr, rec, keys[f],
+                                 fields->b + f*nvals, nvals) < 0)
+        die("Cannot set FORMAT/%s on VCF record", keys[f]);
+    }
+
+    if(bcf_write(vcfout, outhdr, rec) != 0) die("Cannot write VCF record");
   }
+}
 
-  bcf_unpack(v, BCF_UN_ALL);
-  if(v->n_allele < 2) die("Bad line");
+//
+// VCF input
+//
 
-  for(i = 1; i < v->n_allele; i++) {
-    if(init_new_var(&tmpvar, v->pos, v->d.allele[0], v->d.allele[i]))
-      genovar_list_push(vlist, &tmpvar, 1);
+static bcf_srs_t* geno_vcf_open(const char *vcf_path, const char *regions)
+{
+  bcf_srs_t *sr = bcf_sr_init();
+
+  if(regions != NULL && bcf_sr_set_regions(sr, regions, 0) < 0)
+    die("Cannot parse regions: %s", regions);
+
+  if(!bcf_sr_add_reader(sr, vcf_path)) {
+    die("Cannot open VCF %s [%s]%s", vcf_path, bcf_sr_strerror(sr->errnum),
+        regions ? " (regions require a bgzipped and indexed VCF)" : "");
+  }
+
+  return sr;
+}
+
+static bool geno_vcf_read(bcf_srs_t *sr, const char *vcf_path, bcf1_t *rec)
+{
+  if(!bcf_sr_next_line(sr)) {
+    if(sr->errnum)
+      die("Cannot read VCF %s [%s]", vcf_path, bcf_sr_strerror(sr->errnum));
+    return false;
+  }
+  bcf_copy(rec, bcf_sr_get_line(sr, 0));
+  return true;
+}
+
+// Read next cluster of VCF records into `cl`
+// `next` is the first record of the next cluster, if `*have_next` is true
+// Returns false if there are no more records
+static bool geno_read_cluster(bcf_srs_t *sr, const char *vcf_path,
+                              bcf1_t **next, bool *have_next,
+                              GenoCluster *cl, size_t kmer_size)
+{
+  bcf1_t *rec;
+  int64_t end = 0;
+
+  cl->nrecs = 0;
+  if(!*have_next) return false;
+
+  do
+  {
+    geno_cluster_capacity(cl);
+    SWAP(cl->recs[cl->nrecs], *next);
+    rec = cl->recs[cl->nrecs++];
+    end = MAX2(end, (int64_t)rec->pos + rec->rlen);
+
+    *have_next = geno_vcf_read(sr, vcf_path, *next);
+
+    if(*have_next && (*next)->rid == rec->rid && (*next)->pos < rec->pos)
+      die("VCF is not sorted: %s", vcf_path);
   }
+  while(*have_next && (*next)->rid == rec->rid &&
+        (*next)->pos < end + (int64_t)kmer_size);
+
+  return true;
+}
+
+// Pass over the VCF, genotyping clusters in batches
+// Returns number of records read
+static size_t geno_vcf_pass(const char *vcf_path, const char *regions,
+                            GenoBatch *batch, GenoWorker *workers,
+                            size_t nthreads, size_t max_clusters,
+                            htsFile *vcfout, bcf_hdr_t *outhdr)
+{
+  const size_t kmer_size = batch->db_graph->kmer_size;
+  bcf_srs_t *sr = geno_vcf_open(vcf_path, regions);
+  bcf1_t *next = bcf_init1();
+  bool have_next;
+  size_t i, num_recs = 0;
+
+  Int32Buffer fields;
+  int32_buf_alloc(&fields, 256);
+
+  batch->vcfhdr = bcf_sr_get_header(sr, 0);
+  have_next = geno_vcf_read(sr, vcf_path, next);
+
+  do
+  {
+    // Read a batch of clusters
+    for(batch->num_clusters = 0;
+        batch->num_clusters < max_clusters &&
+        geno_read_cluster(sr, vcf_path, &next, &have_next,
+                          &batch->clusters[batch->num_clusters], kmer_size);
+        batch->num_clusters++)
+    {
+      num_recs += batch->clusters[batch->num_clusters].nrecs;
+    }
+
+    batch->next_cluster = 0;
+    util_run_threads(workers, nthreads, sizeof(workers[0]),
+                     nthreads, geno_worker);
+
+    // Print in input order
+    if(vcfout != NULL) {
+      for(i = 0; i < batch->num_clusters; i++) {
+        geno_cluster_write(&batch->clusters[i], &fields,
+                           batch->vcfhdr, vcfout, outhdr);
+      }
+    }
+  }
+  while(batch->num_clusters == max_clusters);
+
+  int32_buf_dealloc(&fields);
+  bcf_destroy(next);
+  bcf_sr_destroy(sr);
+  batch->vcfhdr = NULL;
+
+  return num_recs;
+}
+
+// Output header has no input samples and a sample for each colour
+static bcf_hdr_t* geno_make_header(const char *vcf_path, const char *regions,
+                                   const dBGraph *db_graph)
+{
+  size_t i;
+  bcf_srs_t *sr = geno_vcf_open(vcf_path, regions);
+  bcf_hdr_t *outhdr = bcf_hdr_subset(bcf_sr_get_header(sr, 0), 0, NULL, NULL);
+  bcf_sr_destroy(sr);
+
+  bcf_hdr_append(outhdr, "##FORMAT=<ID=RK,Number=A,Type=Integer,"
+                         "Description=\"Kmers unique to the ref allele\">");
+  bcf_hdr_append(outhdr, "##FORMAT=<ID=RC,Number=A,Type=Integer,"
+                         "Description=\"Summed coverage on kmers unique to the ref allele\">");
+  bcf_hdr_append(outhdr, "##FORMAT=<ID=AK,Number=A,Type=Integer,"
+                         "Description=\"Kmers unique to the alt allele\">");
+  bcf_hdr_append(outhdr, "##FORMAT=<ID=AC,Number=A,Type=Integer,"
+                         "Description=\"Summed coverage on kmers unique to the alt allele\">");
+
+  for(i = 0; i < db_graph->num_of_cols; i++)
+    bcf_hdr_add_sample(outhdr, db_graph->ginfo[i].sample_name.b);
+
+  if(bcf_hdr_sync(outhdr) < 0) die("Cannot create VCF header");
 
-  return 1;
+  return outhdr;
 }
 
 int ctx_geno(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
+  size_t nthreads = 0;
+  const char *out_path = NULL, *regions = NULL;
 
   seq_file_t *tmp_seq_file;
   SeqFilePtrBuffer ref_buf;
@@ -139,30 +483,29 @@ int ctx_geno(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r':
         if((tmp_seq_file = seq_open(optarg)) == NULL)
           die("Cannot read --seq file %s", optarg);
         seq_file_ptr_buf_add(&ref_buf, tmp_seq_file);
         break;
+      case 'R': cmd_check(!regions, cmd); regions = optarg; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
-        die("`"CMD" bubbles -h` for help. Bad option: %s", argv[optind-1]);
+        die("`"CMD" geno -h` for help. Bad option: %s", argv[optind-1]);
       default: abort();
     }
   }
 
   // Defaults for unset values
   if(out_path == NULL) out_path = "-";
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
 
   if(optind+2 > argc) cmd_print_usage("Require VCF, ref and graph files");
+  if(ref_buf.len == 0) cmd_print_usage("Require at least one --ref file");
 
-  // Open VCF file
   const char *vcf_path = argv[optind++];
-  htsFile *vcf_file = hts_open(vcf_path, "r");
-
-  bcf_hdr_t *vcfhdr = bcf_hdr_read(vcf_file);
-  bcf1_t *v = bcf_init1();
 
   //
   // Open graph files
@@ -185,7 +528,7 @@ int ctx_geno(int argc, char **argv)
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
-  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Covg) * ncols;
+  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Covg)*8 * ncols;
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
@@ -199,12 +542,14 @@ int ctx_geno(int argc, char **argv)
   //
   // Open output file
   //
-  FILE *fout = futil_fopen_create(out_path, "w");
+  futil_create_output(out_path);
+  htsFile *vcfout = hts_open(out_path, "w");
+  if(vcfout == NULL) die("Cannot open output: %s", out_path);
 
   // Allocate memory
   dBGraph db_graph;
   db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, 1, kmers_in_hash,
-                 DBG_ALLOC_COVGS);
+                 DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
 
   // Load reference genome
   ReadBuffer chromsbuf;
@@ -212,11 +557,37 @@ int ctx_geno(int argc, char **argv)
   khash_t(ChromHash) *genome = kh_init(ChromHash);
   seq_reader_load_ref_genome2(ref_buf.b, ref_buf.len, &chromsbuf, genome);
 
-  // Add samples to vcf header
-  for(i = 0; i < db_graph.num_of_cols; i++)
-    bcf_hdr_add_sample(vcfhdr, db_graph.ginfo[i].sample_name.b);
+  //
+  // Set up workers
+  //
+  size_t max_clusters = nthreads * GENO_CLUSTERS_PER_THREAD;
+
+  GenoBatch batch = {.clusters = ctx_calloc(max_clusters, sizeof(GenoCluster)),
+                     .num_clusters = 0, .next_cluster = 0,
+                     .add_kmers = true, .vcfhdr = NULL,
+                     .genome = genome, .db_graph = &db_graph};
 
-  // TODO: Load kmers from VCF + ref
+  for(i = 0; i < max_clusters; i++) geno_cluster_alloc(&batch.clusters[i]);
+
+  GenoWorker *workers = ctx_calloc(nthreads, sizeof(GenoWorker));
+  for(i = 0; i < nthreads; i++) {
+    workers[i].batch = &batch;
+    genotyper_alloc(&workers[i].gtyper);
+  }
+
+  //
+  // Pass 1: add kmers from VCF + ref to the graph
+  //
+  status("Adding kmers from %s with %zu thread%s%s%s", vcf_path,
+         nthreads, util_plural_str(nthreads),
+         regions ? " in regions: " : "", regions ? regions : "");
+
+  size_t num_recs = geno_vcf_pass(vcf_path, regions, &batch, workers,
+                                  nthreads, max_clusters, NULL, NULL);
+
+  if(num_recs == 0) warn("Empty VCF");
+
+  hash_table_print_stats(&db_graph.ht);
 
   //
   // Load graphs
@@ -238,88 +609,44 @@ int ctx_geno(int argc, char **argv)
 
   hash_table_print_stats(&db_graph.ht);
 
-  // Seek to the start of VCF file
-  hts_close(vcf_file);
-  vcf_file = hts_open(vcf_path, "r");
-
-  // Genotype calls
-  read_t *chrom;
-  const char *chrom_name;
-  GenoVarList vlist;
-  genovar_list_alloc(&vlist, 256);
-
-  Genotyper gtyper;
-  genotyper_alloc(&gtyper);
-
-  const size_t kmer_size = db_graph.kmer_size;
-  size_t tgtidx, ntgts;
-  GenoVar *last;
-  size_t end;
-
-  if(!read_vars(&vlist, vcf_file, vcfhdr, v)) warn("Empty VCF");
-  else {
-    tgtidx = 0;
-    ntgts = 1;
-    while(1)
-    {
-      last = genovar_list_getptr(&vlist, tgtidx);
-      end = last->pos + last->reflen;
-      while(last->pos <= end+kmer_size) {
-        read_vars(&vlist, vcf_file, vcfhdr, v);
-        last = genovar_list_getptr(&vlist, genovar_list_len(&vlist)-1);
-        end = last->pos + last->reflen;
-      }
-
-      // Genotype and print
-      chrom_name = vcfhdr->id[BCF_DT_CTG][v->rid].key;
-      chrom = seq_fetch_chrom(genome, chrom_name);
-
-      genotyping_get_covg(&gtyper,
-                          genovar_list_getptr(&vlist, 0),
-                          genovar_list_len(&vlist),
-                          tgtidx, ntgts,
-                          chrom->seq.b, chrom->seq.end, kmer_size);
+  //
+  // Pass 2: genotype
+  //
+  bcf_hdr_t *outhdr = geno_make_header(vcf_path, regions, &db_graph);
+  if(bcf_hdr_write(vcfout, outhdr) != 0) die("Cannot write VCF header");
 
-      GenoKmer *kmers = gtyper.kmer_buf.b;
-      size_t nkmers = gtyper.kmer_buf.len;
-      int colour = -1;
+  batch.add_kmers = false;
+  for(i = 0; i < nthreads; i++) workers[i].num_vars = workers[i].num_kmers = 0;
 
-      for(i = 0; i < nkmers; i++) {
-        bkey_get_covg(kmers[i].bkey, kmers[i].arbits,
-                      genovar_list_getptr(&vlist, tgtidx), ntgts,
-                      colour, &db_graph);
-      }
+  geno_vcf_pass(vcf_path, regions, &batch, workers,
+                nthreads, max_clusters, vcfout, outhdr);
 
-      // Set new tgt
-      tgtidx += ntgts;
-      ntgts = 1;
-      if(tgtidx >= genovar_list_len(&vlist)) break; // done
-
-      // DEV: shift off unwanted
-    }
+  size_t num_vars = 0, num_kmers = 0;
+  for(i = 0; i < nthreads; i++) {
+    num_vars += workers[i].num_vars;
+    num_kmers += workers[i].num_kmers;
+    genotyper_dealloc(&workers[i].gtyper);
   }
+  ctx_free(workers);
 
-  genotyper_dealloc(&gtyper);
-
-    // fprintf(stderr, "%s %i %u", chrom_name, v->pos+1, v->rlen);
-    // fprintf(stderr, " %s", v->d.allele[0]);
-    // fprintf(stderr, " %s", v->d.allele[1]);
-    // for(i=2; i < v->n_allele; i++)
-    //   fprintf(stderr, ",%s", v->d.allele[i]);
-    // fprintf(stderr, "\n");
+  for(i = 0; i < max_clusters; i++) geno_cluster_dealloc(&batch.clusters[i]);
+  ctx_free(batch.clusters);
 
-  status("  saved to: %s\n", out_path);
-  
-  bcf_destroy(v);
-  bcf_hdr_destroy(vcfhdr);
+  char num_recs_str[50], num_vars_str[50], num_kmers_str[50];
+  ulong_to_str(num_recs, num_recs_str);
+  ulong_to_str(num_vars, num_vars_str);
+  ulong_to_str(num_kmers, num_kmers_str);
+  status("Genotyped %s VCF records (%s alleles) using %s kmers",
+         num_recs_str, num_vars_str, num_kmers_str);
+  status("  saved to: %s\n", futil_outpath_str(out_path));
 
-  // gzclose(vcf_file);
-  hts_close(vcf_file);
-  fclose(fout);
+  bcf_hdr_destroy(outhdr);
+  hts_close(vcfout);
 
   for(i = 0; i < chromsbuf.len; i++) seq_read_dealloc(&chromsbuf.b[i]);
   read_buf_dealloc(&chromsbuf);
   kh_destroy_ChromHash(genome);
+  seq_file_ptr_buf_dealloc(&ref_buf);
   db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
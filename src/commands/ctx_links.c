@@ -2,7 +2,7 @@
 #include "commands.h"
 #include "util.h"
 #include "file_util.h"
-#include "link_tree.h"
+#include "link_block.h"
 #include "gpath_reader.h"
 #include "json_hdr.h"
 #include "gpath_save.h"
@@ -18,6 +18,7 @@ const char links_usage[] =
 "  -q, --quiet            Silence status output normally printed to STDERR\n"
 "  -f, --force            Overwrite output files\n"
 "  -o, --out <out.ctp.gz> Save output link file [default: STDOUT]\n"
+"  -t, --threads <T>      Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n"
 "  -L,--limit <N>         Only use links from first N kmers\n"
 "\n"
@@ -35,6 +36,7 @@ static struct option longopts[] =
   {"help",         no_argument,       NULL, 'h'},
   {"out",          required_argument, NULL, 'o'},
   {"force",        no_argument,       NULL, 'f'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"list",         required_argument, NULL, 'l'},
   {"clean",        required_argument, NULL, 'c'},
@@ -45,30 +47,6 @@ static struct option longopts[] =
   {NULL, 0, NULL, 0}
 };
 
-// Creates <base>.tmp.<rand>
-static FILE* create_tmp_file(StrBuf *path, const char *base)
-{
-  size_t i;
-  const size_t attempt_limit = 100;
-  FILE *fh;
-
-  for(i = 0; i < attempt_limit; i++) {
-    size_t r = rand() % 9999;
-    strbuf_reset(path);
-    strbuf_sprintf(path, "%s.tmp.%04zu", base, r);
-    if(!futil_file_exists(path->b)) break;
-  }
-  if(i == attempt_limit)
-    die("Temporary files already exist (%zu tries): %s", attempt_limit, path->b);
-
-  if((fh = futil_fopen_create(path->b, "r+")) == NULL) {
-    die("Cannot write temporary file: %s [%s]", path->b, strerror(errno));
-  }
-
-  unlink(path->b); // Immediately unlink to hide temp file
-  return fh;
-}
-
 /**
  * Prints cutoff values for different link lengths and returns the median
  */
@@ -115,7 +93,7 @@ static void print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
 
 int ctx_links(int argc, char **argv)
 {
-  size_t limit = 0;
+  size_t nthreads = 0, limit = 0;
   const char *link_out_path = NULL, *csv_out_path = NULL, *plot_out_path = NULL;
   double link_fdr = -1;
 
@@ -135,6 +113,7 @@ int ctx_links(int argc, char **argv)
       case 'h': cmd_print_usage(NULL); break;
       case 'o': cmd_check(!link_out_path, cmd); link_out_path = optarg; break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'l': cmd_check(!csv_out_path, cmd); csv_out_path = optarg; break;
       case 'c': cmd_check(!cutoff, cmd); cutoff = cmd_size(cmd, optarg); clean = true; break;
       case 'L': cmd_check(!limit, cmd); limit = cmd_size(cmd, optarg); break;
@@ -148,6 +127,8 @@ int ctx_links(int argc, char **argv)
     }
   }
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
   if(optind + 1 != argc) cmd_print_usage("Wrong number of arguments");
   const char *ctp_path = argv[optind];
 
@@ -211,7 +192,7 @@ int ctx_links(int argc, char **argv)
       die("Cannot find required header entries");
 
     // Create a random temporary file
-    link_tmp_fh = create_tmp_file(&link_tmp_path, link_out_path);
+    link_tmp_fh = futil_create_tmp_file(&link_tmp_path, link_out_path);
 
     status("Saving output to: %s", link_out_path);
     status("Temporary output: %s", link_tmp_path.b);
@@ -242,85 +223,58 @@ int ctx_links(int argc, char **argv)
       die("Cannot open output .dot file %s", plot_out_path);
   }
 
-  SizeBuffer countbuf, jposbuf;
-  size_buf_alloc(&countbuf, 16);
-  size_buf_alloc(&jposbuf, 1024);
+  LinkBlock block = {.ctpin = &ctpin,
+                     .clean = clean, .list = list, .save = save,
+                     .hist_covg = hist_covg,
+                     .cutoff = cutoff,
+                     .plot_knum = plot ? plot_kmer_idx : SIZE_MAX,
+                     .hist_distsize = hist_distsize,
+                     .hist_covgsize = hist_covgsize};
 
-  StrBuf kmerbuf, juncsbuf, seqbuf, outbuf;
-  strbuf_alloc(&kmerbuf, 1024);
-  strbuf_alloc(&juncsbuf, 1024);
-  strbuf_alloc(&seqbuf, 1024);
-  strbuf_alloc(&outbuf, 1024);
+  const size_t max_kmers = nthreads * LINKS_KMERS_PER_THREAD;
+  link_block_alloc(&block, max_kmers);
+  LinkWorker *workers = link_workers_alloc(nthreads, &block, kmer_size);
+  size_t i, knum = 0;
 
-  bool link_fw;
-  size_t njuncs;
-  size_t knum, nlinks, num_links_exp = 0;
+  status("Using %zu threads", nthreads);
 
-  LinkTree ltree;
-  ltree_alloc(&ltree, kmer_size);
-
-  LinkTreeStats tree_stats;
-  memset(&tree_stats, 0, sizeof(tree_stats));
-  size_t init_num_links = 0, num_links = 0;
-
-  for(knum = 0; !limit || knum < limit; knum++)
+  do
   {
-    ltree_reset(&ltree);
-    if(!gpath_reader_read_kmer(&ctpin, &kmerbuf, &num_links_exp)) break;
-    ctx_assert2(kmerbuf.end == kmer_size, "Kmer incorrect length %zu != %zu",
-                kmerbuf.end, kmer_size);
-    // status("kmer: %s", kmerbuf.b);
-
-    for(nlinks = 0;
-        gpath_reader_read_link(&ctpin, &link_fw, &njuncs,
-                               &countbuf, &juncsbuf,
-                               &seqbuf, &jposbuf);
-        nlinks++)
+    // Read a block of kmers
+    for(block.num_kmers = 0;
+        block.num_kmers < max_kmers && (!limit || knum < limit) &&
+        link_kmer_read(&ctpin, &block.kmers[block.num_kmers], kmer_size);
+        block.num_kmers++, knum++)
     {
-      ltree_add(&ltree, link_fw, countbuf.b[0], jposbuf.b,
-                juncsbuf.b, seqbuf.b);
+      block.kmers[block.num_kmers].knum = knum;
     }
 
-    if(nlinks != num_links_exp)
-      warn("Links count mismatch %zu != %zu", nlinks, num_links_exp);
+    link_block_run(&block, workers, nthreads);
 
-    if(hist_covg)
+    // Write in input order
+    for(i = 0; i < block.num_kmers; i++)
     {
-      ltree_update_covg_hists(&ltree, (uint64_t*)hists, hist_distsize, hist_covgsize);
-    }
-    if(clean)
-    {
-      ltree_clean(&ltree, cutoff);
-    }
-
-    // Accumulate statistics
-    ltree_get_stats(&ltree, &tree_stats);
-    num_links = tree_stats.num_links - init_num_links;
-    init_num_links = tree_stats.num_links;
-
-    if(list)
-    {
-      ltree_write_list(&ltree, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, csv_fh) != outbuf.end)
+      LinkKmer *lk = &block.kmers[i];
+      if(list && fwrite(lk->list.b, 1, lk->list.end, csv_fh) != lk->list.end)
         die("Cannot write CSV file to: %s", csv_out_path);
-      strbuf_reset(&outbuf);
-    }
-    if(save && num_links)
-    {
-      ltree_write_ctp(&ltree, kmerbuf.b, num_links, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, link_tmp_fh) != outbuf.end)
+      if(save && fwrite(lk->ctp.b, 1, lk->ctp.end, link_tmp_fh) != lk->ctp.end)
         die("Cannot write ctp file to: %s", link_tmp_path.b);
-      strbuf_reset(&outbuf);
-    }
-    if(plot && knum == plot_kmer_idx)
-    {
-      status("Plotting tree...");
-      ltree_write_dot(&ltree, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, plot_fh) != outbuf.end)
-        die("Cannot write plot DOT file to: %s", plot_out_path);
-      strbuf_reset(&outbuf);
+      if(lk->knum == block.plot_knum) {
+        status("Plotting tree...");
+        if(fwrite(lk->dot.b, 1, lk->dot.end, plot_fh) != lk->dot.end)
+          die("Cannot write plot DOT file to: %s", plot_out_path);
+      }
     }
   }
+  while(block.num_kmers == max_kmers);
+
+  // Merge results from workers
+  LinkTreeStats tree_stats;
+  memset(&tree_stats, 0, sizeof(tree_stats));
+  link_workers_merge(workers, nthreads, &tree_stats, (uint64_t*)hists);
+
+  link_workers_dealloc(workers, nthreads);
+  link_block_dealloc(&block);
 
   gpath_reader_close(&ctpin);
 
@@ -381,13 +335,6 @@ int ctx_links(int argc, char **argv)
 
   cJSON_Delete(newhdr);
   strbuf_dealloc(&link_tmp_path);
-  ltree_dealloc(&ltree);
-  size_buf_dealloc(&countbuf);
-  size_buf_dealloc(&jposbuf);
-  strbuf_dealloc(&kmerbuf);
-  strbuf_dealloc(&juncsbuf);
-  strbuf_dealloc(&seqbuf);
-  strbuf_dealloc(&outbuf);
 
   return EXIT_SUCCESS;
 }
@@ -7,6 +7,10 @@
 #include "gpath_reader.h"
 #include "gpath_checks.h"
 #include "gpath_save.h"
+#include "binary_seq.h"
+#include "json_hdr.h"
+
+#include "sort_r/sort_r.h"
 
 const char pjoin_usage[] =
 "usage: "CMD" pjoin [options] <in1.ctp> [[offset:]in2.ctp[:0,2-4] ...]\n"
@@ -24,9 +28,12 @@ const char pjoin_usage[] =
 "  -g, --graph <in.ctx>   Get number of hash table entries from graph file\n"
 "  -c, --outcols <C>      How many 'colours' should the output file have\n"
 "  -r, --noredundant      Remove redundant paths\n"
+"  -s, --stream           Merge files sorted by kmer without loading them,\n"
+"                         does not need --memory. Not with -r or -g\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctp:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctp\n"
+"  Link files written by this version are sorted by kmer.\n"
 "\n";
 
 static struct option longopts[] =
@@ -42,14 +49,269 @@ static struct option longopts[] =
   {"graph",        required_argument, NULL, 'g'},
   {"outcols",      required_argument, NULL, 'c'},
   {"noredundant",  required_argument, NULL, 'r'},
+  {"stream",       no_argument,       NULL, 's'},
   {NULL, 0, NULL, 0}
 };
 
+//
+// Streaming merge
+//
+// Link files written by gpath_save() are sorted by kmer, so we can merge them
+// with a k-way merge, holding only the links of one kmer in memory. Files are
+// kept in a heap ordered by their current kmer. Links from all files for the
+// smallest kmer are collected, sorted, duplicates merged (summing counts),
+// then written. Output is written to a temporary file, since the header needs
+// the number of links.
+//
+
+typedef struct
+{
+  uint8_t orient;
+  uint32_t num_juncs;
+  size_t seq, covgs; // offsets into seqbuf and covgbuf
+} PJoinLink;
+
+madcrow_buffer(pjoin_link_buf, PJoinLinkBuffer, PJoinLink);
+
+typedef struct
+{
+  GPathReader *files;
+  StrBuf *kmers; // current kmer of each file
+  size_t *num_links; // expected number of links for current kmer
+  size_t *heap, heap_len; // file indices, smallest kmer first
+} PJoinStream;
+
+#define _pjoin_kmer_lt(ps,i,j) (strcmp((ps)->kmers[i].b,(ps)->kmers[j].b) < 0)
+
+static void pjoin_heap_sift_down(PJoinStream *ps, size_t i)
+{
+  size_t l, r, m;
+  while(1) {
+    l = 2*i+1; r = l+1; m = i;
+    if(l < ps->heap_len && _pjoin_kmer_lt(ps, ps->heap[l], ps->heap[m])) m = l;
+    if(r < ps->heap_len && _pjoin_kmer_lt(ps, ps->heap[r], ps->heap[m])) m = r;
+    if(m == i) break;
+    SWAP(ps->heap[i], ps->heap[m]);
+    i = m;
+  }
+}
+
+// Read next kmer of file i, returns false at end of file
+static bool pjoin_read_kmer(PJoinStream *ps, size_t i, StrBuf *prev)
+{
+  GPathReader *file = &ps->files[i];
+  if(!gpath_reader_read_kmer(file, &ps->kmers[i], &ps->num_links[i]))
+    return false;
+
+  if(prev && strcmp(prev->b, ps->kmers[i].b) >= 0) {
+    die("Link file is not sorted by kmer [%s]: %s then %s\n"
+        "  Links saved by older versions need to be re-saved with `"CMD" pjoin`",
+        file_filter_path(&file->fltr), prev->b, ps->kmers[i].b);
+  }
+  return true;
+}
+
+static int pjoin_link_cmp(const void *aa, const void *bb, void *arg)
+{
+  const PJoinLink *a = (const PJoinLink*)aa, *b = (const PJoinLink*)bb;
+  const uint8_t *seqs = (const uint8_t*)arg;
+  int ret;
+  if((ret = (int)a->orient - (int)b->orient) != 0) return ret;
+  return binary_seqs_cmp(seqs + a->seq, a->num_juncs, seqs + b->seq, b->num_juncs);
+}
+
+static void pjoin_stream(GPathReader *pfiles, size_t num_pfiles,
+                         size_t output_ncols, const char *out_ctp_path,
+                         const ZeroSizeBuffer *contig_histgrms)
+{
+  size_t i, j, col, kmer_size = gpath_reader_get_kmer_size(&pfiles[0]);
+  size_t num_kmers = 0, num_links = 0, link_bytes = 0;
+
+  status("Streaming merge of %zu link files", num_pfiles);
+
+  // Only used for sample names and the header
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, kmer_size, output_ncols, 0, 1024, 0);
+
+  for(i = 0; i < num_pfiles; i++)
+    gpath_reader_load_sample_names(&pfiles[i], &db_graph);
+
+  gzFile gzout = futil_gzopen_create(out_ctp_path, "w");
+  StrBuf tmp_path;
+  strbuf_alloc(&tmp_path, 1024);
+  FILE *tmp_fh = futil_create_tmp_file(&tmp_path, out_ctp_path);
+
+  PJoinStream ps = {.files = pfiles,
+                    .kmers = ctx_calloc(num_pfiles, sizeof(StrBuf)),
+                    .num_links = ctx_calloc(num_pfiles, sizeof(size_t)),
+                    .heap = ctx_calloc(num_pfiles, sizeof(size_t)),
+                    .heap_len = 0};
+
+  for(i = 0; i < num_pfiles; i++) {
+    strbuf_alloc(&ps.kmers[i], 64);
+    if(pjoin_read_kmer(&ps, i, NULL)) ps.heap[ps.heap_len++] = i;
+  }
+  for(i = ps.heap_len/2; i-- > 0; ) pjoin_heap_sift_down(&ps, i);
+
+  PJoinLinkBuffer links;
+  ByteBuffer seqbuf, covgbuf;
+  SizeBuffer countbuf;
+  StrBuf kmer, juncs, sbuf;
+  pjoin_link_buf_alloc(&links, 256);
+  byte_buf_alloc(&seqbuf, 1024);
+  byte_buf_alloc(&covgbuf, 1024);
+  size_buf_alloc(&countbuf, 64);
+  strbuf_alloc(&kmer, 64);
+  strbuf_alloc(&juncs, 256);
+  strbuf_alloc(&sbuf, 2 * DEFAULT_IO_BUFSIZE);
+
+  bool fw;
+  size_t f, nlinks, njuncs;
+  uint8_t *covgs;
+
+  while(ps.heap_len > 0)
+  {
+    strbuf_set(&kmer, ps.kmers[ps.heap[0]].b);
+    pjoin_link_buf_reset(&links);
+    byte_buf_reset(&seqbuf);
+    byte_buf_reset(&covgbuf);
+
+    // Collect links for this kmer from all files
+    while(ps.heap_len > 0 && strcmp(ps.kmers[f = ps.heap[0]].b, kmer.b) == 0)
+    {
+      for(nlinks = 0;
+          gpath_reader_read_link(&pfiles[f], &fw, &njuncs,
+                                 &countbuf, &juncs, NULL, NULL);
+          nlinks++)
+      {
+        PJoinLink link = {.orient = fw ? FORWARD : REVERSE,
+                          .num_juncs = njuncs,
+                          .seq = seqbuf.len, .covgs = covgbuf.len};
+        pjoin_link_buf_add(&links, link);
+        byte_buf_push_zero(&seqbuf, binary_seq_mem(njuncs));
+        binary_seq_from_str(juncs.b, njuncs, seqbuf.b + link.seq);
+        byte_buf_push_zero(&covgbuf, output_ncols);
+        for(col = 0; col < countbuf.len; col++)
+          covgbuf.b[link.covgs+col] = MIN2(countbuf.b[col], UINT8_MAX);
+      }
+
+      if(nlinks != ps.num_links[f])
+        warn("Links count mismatch %zu != %zu", nlinks, ps.num_links[f]);
+
+      if(!pjoin_read_kmer(&ps, f, &kmer)) ps.heap[0] = ps.heap[--ps.heap_len];
+      pjoin_heap_sift_down(&ps, 0);
+    }
+
+    // Sort, then merge duplicate links
+    sort_r(links.b, links.len, sizeof(PJoinLink), pjoin_link_cmp, seqbuf.b);
+
+    for(i = 0, j = 1; j < links.len; j++) {
+      if(pjoin_link_cmp(&links.b[i], &links.b[j], seqbuf.b) == 0) {
+        covgs = covgbuf.b + links.b[i].covgs;
+        for(col = 0; col < output_ncols; col++)
+          safe_add_uint8(&covgs[col], covgbuf.b[links.b[j].covgs+col]);
+      }
+      else links.b[++i] = links.b[j];
+    }
+    if(links.len == 0) continue;
+    links.len = i+1;
+
+    // Write "<kmer> <nlinks>" then links as gpath_save_sbuf() does
+    strbuf_append_strn(&sbuf, kmer.b, kmer.end);
+    strbuf_append_char(&sbuf, ' ');
+    strbuf_append_ulong(&sbuf, links.len);
+    strbuf_append_char(&sbuf, '\n');
+
+    for(i = 0; i < links.len; i++) {
+      const PJoinLink *link = &links.b[i];
+      covgs = covgbuf.b + link->covgs;
+      strbuf_append_char(&sbuf, link->orient == FORWARD ? 'F' : 'R');
+      strbuf_append_char(&sbuf, ' ');
+      strbuf_append_ulong(&sbuf, link->num_juncs);
+      strbuf_append_char(&sbuf, ' ');
+      strbuf_append_ulong(&sbuf, covgs[0]);
+      for(col = 1; col < output_ncols; col++) {
+        strbuf_append_char(&sbuf, ',');
+        strbuf_append_ulong(&sbuf, covgs[col]);
+      }
+      strbuf_append_char(&sbuf, ' ');
+      strbuf_ensure_capacity(&sbuf, sbuf.end + link->num_juncs + 2);
+      binary_seq_to_str(seqbuf.b + link->seq, link->num_juncs, sbuf.b+sbuf.end);
+      sbuf.end += link->num_juncs;
+      strbuf_append_char(&sbuf, '\n');
+      link_bytes += binary_seq_mem(link->num_juncs);
+    }
+
+    num_kmers++;
+    num_links += links.len;
+
+    if(sbuf.end > DEFAULT_IO_BUFSIZE) {
+      if(fwrite(sbuf.b, 1, sbuf.end, tmp_fh) != sbuf.end)
+        die("Cannot write temporary file: %s", tmp_path.b);
+      strbuf_reset(&sbuf);
+    }
+  }
+
+  if(fwrite(sbuf.b, 1, sbuf.end, tmp_fh) != sbuf.end)
+    die("Cannot write temporary file: %s", tmp_path.b);
+
+  // Write header now that we have link counts
+  cJSON **hdrs = ctx_calloc(num_pfiles, sizeof(cJSON*));
+  for(i = 0; i < num_pfiles; i++) hdrs[i] = pfiles[i].json;
+
+  cJSON *json = gpath_save_mkhdr2(out_ctp_path, NULL, NULL, hdrs, num_pfiles,
+                                  contig_histgrms, output_ncols,
+                                  num_kmers, num_links, link_bytes,
+                                  &db_graph);
+
+  // Kmers are not loaded into the graph
+  cJSON *graph_json = json_hdr_get(json, "graph", cJSON_Object, out_ctp_path);
+  cJSON *nkmers_json = json_hdr_get(graph_json, "num_kmers_in_graph", cJSON_Number, out_ctp_path);
+  nkmers_json->valuedouble = nkmers_json->valueint = num_kmers;
+
+  json_hdr_gzprint(json, gzout);
+  cJSON_Delete(json);
+  gzputs(gzout, ctp_explanation_comment);
+
+  // Copy links from temporary file
+  fseek(tmp_fh, 0, SEEK_SET);
+  size_t n;
+  while((n = fread(sbuf.b, 1, sbuf.size, tmp_fh)) > 0) {
+    if(gzwrite(gzout, sbuf.b, n) != (int)n)
+      die("Cannot write to output: %s", out_ctp_path);
+  }
+
+  fclose(tmp_fh);
+  gzclose(gzout);
+
+  char nkmers_str[50], nlinks_str[50], nbytes_str[50];
+  ulong_to_str(num_kmers, nkmers_str);
+  ulong_to_str(num_links, nlinks_str);
+  bytes_to_str(link_bytes, 1, nbytes_str);
+  status("Paths written to: %s\n", out_ctp_path);
+  status("  %s paths, %s path-bytes, %s kmers", nlinks_str, nbytes_str, nkmers_str);
+
+  for(i = 0; i < num_pfiles; i++) strbuf_dealloc(&ps.kmers[i]);
+  ctx_free(ps.kmers);
+  ctx_free(ps.num_links);
+  ctx_free(ps.heap);
+  ctx_free(hdrs);
+  pjoin_link_buf_dealloc(&links);
+  byte_buf_dealloc(&seqbuf);
+  byte_buf_dealloc(&covgbuf);
+  size_buf_dealloc(&countbuf);
+  strbuf_dealloc(&kmer);
+  strbuf_dealloc(&juncs);
+  strbuf_dealloc(&sbuf);
+  strbuf_dealloc(&tmp_path);
+  db_graph_dealloc(&db_graph);
+}
+
 int ctx_pjoin(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool noredundant = false;
+  bool noredundant = false, stream = false;
   size_t output_ncols = 0;
   char *graph_file = NULL;
   const char *out_ctp_path = NULL;
@@ -76,6 +338,7 @@ int ctx_pjoin(int argc, char **argv)
       case 'g': cmd_check(!graph_file,cmd); graph_file = optarg; break;
       case 'c': cmd_check(!output_ncols, cmd); output_ncols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r': cmd_check(!noredundant,cmd); noredundant = true; break;
+      case 's': cmd_check(!stream,cmd); stream = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -88,6 +351,8 @@ int ctx_pjoin(int argc, char **argv)
   if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
 
   if(out_ctp_path == NULL) cmd_print_usage("--out <out.ctp> required");
+  if(stream && noredundant) cmd_print_usage("Cannot use --stream with --noredundant");
+  if(stream && graph_file) cmd_print_usage("Cannot use --stream with --graph");
   if(optind >= argc) cmd_print_usage("Please specify at least one input file");
 
   // argi .. argend-1 are graphs to load
@@ -142,6 +407,33 @@ int ctx_pjoin(int argc, char **argv)
   if(graph_file != NULL)
     graph_file_close(&gfile);
 
+  // Load contig hist distribution
+  ZeroSizeBuffer *contig_histgrms = ctx_calloc(output_ncols, sizeof(ZeroSizeBuffer));
+
+  for(i = 0; i < output_ncols; i++)
+    zsize_buf_alloc(&contig_histgrms[i], 512);
+
+  size_t fromcol, intocol;
+  for(i = 0; i < num_pfiles; i++) {
+    for(j = 0; j < file_filter_num(&pfiles[i].fltr); j++) {
+      fromcol = file_filter_fromcol(&pfiles[i].fltr, j);
+      intocol = file_filter_intocol(&pfiles[i].fltr, j);
+      gpath_reader_load_contig_hist(pfiles[i].json, pfiles[i].fltr.path.b,
+                                    fromcol, &contig_histgrms[intocol]);
+    }
+  }
+
+  if(stream)
+  {
+    pjoin_stream(pfiles, num_pfiles, output_ncols, out_ctp_path, contig_histgrms);
+
+    for(i = 0; i < output_ncols; i++) zsize_buf_dealloc(&contig_histgrms[i]);
+    ctx_free(contig_histgrms);
+    for(i = 0; i < num_pfiles; i++) gpath_reader_close(&pfiles[i]);
+    ctx_free(pfiles);
+    return EXIT_SUCCESS;
+  }
+
   if(memargs.num_kmers_set && memargs.num_kmers > ctp_sum_kmers) {
     char num_kmers_str[100], args_num_kmers_str[100];
     ulong_to_str(ctp_sum_kmers, num_kmers_str);
@@ -170,16 +462,20 @@ int ctx_pjoin(int argc, char **argv)
                                         ctp_max_kmers, ctp_sum_kmers,
                                         false, &graph_mem);
 
+  // Sorting kmers with paths to save them
+  size_t save_mem = gpath_save_mem(kmers_in_hash);
+
   // Paths memory
-  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem);
+  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem+save_mem);
   path_mem = gpath_reader_mem_req(pfiles, num_pfiles, output_ncols, rem_mem, true);
 
   // Shift path store memory from graphs->paths
   graph_mem -= sizeof(GPath*)*kmers_in_hash;
   path_mem  += sizeof(GPath*)*kmers_in_hash;
   cmd_print_mem(path_mem, "paths");
+  cmd_print_mem(save_mem, "sorting kmers");
 
-  total_mem = graph_mem + path_mem;
+  total_mem = graph_mem + path_mem + save_mem;
 
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
@@ -198,22 +494,6 @@ int ctx_pjoin(int argc, char **argv)
   for(i = 0; i < num_pfiles; i++)
     gpath_reader_load_sample_names(&pfiles[i], &db_graph);
 
-  // Load contig hist distribution
-  ZeroSizeBuffer *contig_histgrms = ctx_calloc(output_ncols, sizeof(ZeroSizeBuffer));
-
-  for(i = 0; i < output_ncols; i++)
-    zsize_buf_alloc(&contig_histgrms[i], 512);
-
-  size_t fromcol, intocol;
-  for(i = 0; i < num_pfiles; i++) {
-    for(j = 0; j < file_filter_num(&pfiles[i].fltr); j++) {
-      fromcol = file_filter_fromcol(&pfiles[i].fltr, j);
-      intocol = file_filter_intocol(&pfiles[i].fltr, j);
-      gpath_reader_load_contig_hist(pfiles[i].json, pfiles[i].fltr.path.b,
-                                    fromcol, &contig_histgrms[intocol]);
-    }
-  }
-
   // Load path files
   for(i = 0; i < num_pfiles; i++)
     gpath_reader_load(&pfiles[i], GPATH_ADD_MISSING_KMERS, &db_graph);
@@ -63,7 +63,6 @@ typedef struct
   // Global settings
   dBGraph *db_graph;
   volatile size_t *rcounter;
-  LoadingStats *stats;
   bool invert;
   seq_format fmt; // output format
 
@@ -173,7 +172,7 @@ static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
                                LoadingStats *stats)
 {
   bool found = false;
-  BinaryKmer bkmer; Nucleotide nuc; dBNode node;
+  BinaryKmerIter kiter; Nucleotide nuc; dBNode node;
   const size_t kmer_size = db_graph->kmer_size;
   size_t i, num_contigs = 0, num_kmers_loaded = 0;
   size_t search_pos = 0, start, end = 0, contig_len;
@@ -185,43 +184,44 @@ static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
     {
       end = seq_contig_end(r, start, kmer_size, 0, 0, &search_pos);
       contig_len = end - start;
-      __sync_fetch_and_add((volatile size_t*)&stats->total_bases_loaded, contig_len);
+      stats->total_bases_loaded += contig_len;
 
       num_contigs++;
 
-      bkmer = binary_kmer_from_str(r->seq.b + start, kmer_size);
+      binary_kmer_iter_init(&kiter, r->seq.b + start, kmer_size);
+      binary_kmer_iter_add(&kiter, dna_char_to_nuc(r->seq.b[start+kmer_size-1]));
       num_kmers_loaded++;
-      node = db_graph_find(db_graph, bkmer);
+      node = db_graph_find_iter(db_graph, &kiter);
       if(node.key != HASH_NOT_FOUND) { found = true; break; }
 
       for(i = start+kmer_size; i < end; i++)
       {
         nuc = dna_char_to_nuc(r->seq.b[i]);
-        bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+        binary_kmer_iter_add(&kiter, nuc);
         num_kmers_loaded++;
-        node = db_graph_find(db_graph, bkmer);
+        node = db_graph_find_iter(db_graph, &kiter);
         if(node.key != HASH_NOT_FOUND) { found = true; break; }
       }
     }
   }
 
   // Update stats
-  __sync_fetch_and_add((volatile size_t*)&stats->total_bases_read, r->seq.end);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_loaded, num_kmers_loaded);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_novel, num_kmers_loaded - found);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_good_reads, num_contigs > 0);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_bad_reads, num_contigs == 0);
+  stats->total_bases_read += r->seq.end;
+  stats->num_kmers_loaded += num_kmers_loaded;
+  stats->num_kmers_novel += num_kmers_loaded - found;
+  stats->num_good_reads += num_contigs > 0;
+  stats->num_bad_reads += num_contigs == 0;
 
   return found;
 }
 
+// `arg` is the LoadingStats of this thread
 void filter_reads(AsyncIOData *data, void *arg)
 {
-  (void)arg;
   read_t *r1 = (read_t*)&data->r1, *r2 = data->r2.seq.end ? (read_t*)&data->r2 : NULL;
   AlignReadsData *input = (AlignReadsData*)data->ptr;
   const dBGraph *db_graph = input->db_graph;
-  LoadingStats *stats = input->stats;
+  LoadingStats *stats = (LoadingStats*)arg;
 
   ctx_assert2(r2 == NULL || input->seqout.is_pe,
               "Were not expecting r2: %p %i", r2, (int)input->seqout.is_pe);
@@ -235,8 +235,8 @@ void filter_reads(AsyncIOData *data, void *arg)
     input->num_of_reads_printed += 1 + (r2 != NULL);
   }
 
-  if(r2 == NULL) __sync_add_and_fetch((volatile size_t*)&stats->num_se_reads, 1);
-  else           __sync_add_and_fetch((volatile size_t*)&stats->num_pe_reads, 2);
+  if(r2 == NULL) stats->num_se_reads++;
+  else           stats->num_pe_reads += 2;
 
   size_t n = __sync_add_and_fetch(&read_counter, 1);
   ctx_update("FilterReads", n);
@@ -303,10 +303,12 @@ int ctx_reads(int argc, char **argv)
   //
   LoadingStats seq_stats = LOAD_STATS_INIT_MACRO;
 
-  for(i = 0; i < inputs.len; i++) {
-    inputs.b[i].stats = &seq_stats;
+  // Each thread keeps its own stats, merged once all reads are filtered
+  LoadingStats *thread_stats = ctx_malloc(nthreads * sizeof(LoadingStats));
+  for(i = 0; i < nthreads; i++) loading_stats_init(&thread_stats[i]);
+
+  for(i = 0; i < inputs.len; i++)
     inputs.b[i].db_graph = &db_graph;
-  }
 
   // Deal with a set of files at once
   size_t start, end;
@@ -314,9 +316,14 @@ int ctx_reads(int argc, char **argv)
   {
     // Can have different numbers of inputs vs threads
     end = MIN2(inputs.len, start+MAX_IO_THREADS);
-    asyncio_run_pool(files.b+start, end-start, filter_reads, NULL, nthreads, 0);
+    asyncio_run_pool(files.b+start, end-start, filter_reads,
+                     thread_stats, nthreads, sizeof(LoadingStats));
   }
 
+  for(i = 0; i < nthreads; i++)
+    loading_stats_merge(&seq_stats, &thread_stats[i]);
+  ctx_free(thread_stats);
+
   size_t total_reads_printed = 0;
   size_t total_reads = seq_stats.num_se_reads + seq_stats.num_pe_reads;
 
@@ -4,6 +4,7 @@
 #include "file_util.h"
 #include "seq_reader.h"
 #include "kmer_occur.h"
+#include "kmer_batch.h"
 #include "seqout.h"
 
 const char rmsubstr_usage[] =
@@ -192,7 +193,11 @@ int ctx_rmsubstr(int argc, char **argv)
                                         est_num_bases, est_num_bases,
                                         false, &graph_mem);
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  // Each thread sorts a batch of kmers before inserting them
+  size_t batch_mem = nthreads * kmer_batch_mem(KMER_BATCH_SIZE);
+  cmd_print_mem(batch_mem, "kmer batches");
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + batch_mem);
 
   //
   // Open output file
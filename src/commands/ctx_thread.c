@@ -133,17 +133,22 @@ int ctx_thread(int argc, char **argv)
                                         gfile->num_of_kmers,
                                         false, &graph_mem);
 
+  // Filled gaps can only be reused if the links we follow don't change
+  size_t gap_memo_mem = args.use_new_paths ? 0 : GAP_MEMO_DEFAULT_MEM;
+  if(gap_memo_mem) cmd_print_mem(gap_memo_mem, "gap memo");
+
   // Paths memory
   size_t min_path_mem = 0;
   gpath_reader_sum_mem(gpfiles->b, gpfiles->len, 1, true, true, &min_path_mem);
 
-  if(graph_mem + min_path_mem > args.memargs.mem_to_use) {
+  if(graph_mem + gap_memo_mem + min_path_mem > args.memargs.mem_to_use) {
     char buf[50];
-    die("Require at least %s memory", bytes_to_str(graph_mem+min_path_mem, 1, buf));
+    die("Require at least %s memory",
+        bytes_to_str(graph_mem+gap_memo_mem+min_path_mem, 1, buf));
   }
 
-  path_mem = args.memargs.mem_to_use - graph_mem;
-  size_t pentry_hash_mem = sizeof(GPEntry)/0.7;
+  path_mem = args.memargs.mem_to_use - graph_mem - gap_memo_mem;
+  size_t pentry_hash_mem = GPATH_HASH_ENTRY_MEM/0.7;
   size_t pentry_store_mem = sizeof(GPath) + 8 + // struct + sequence
                             1 + // in colour
                             sizeof(uint8_t) + // counts
@@ -155,7 +160,11 @@ int ctx_thread(int argc, char **argv)
   cmd_print_mem(path_hash_mem, "paths hash");
   cmd_print_mem(path_store_mem, "paths store");
 
-  total_mem = graph_mem + path_mem;
+  // Sorting kmers with paths to save them, at most one kmer per path. The
+  // path hash and gap memo are freed before saving.
+  size_t save_mem = gpath_save_mem(MIN2(kmers_in_hash, max_paths));
+
+  total_mem = graph_mem + MAX2(path_mem + gap_memo_mem, path_store_mem + save_mem);
   cmd_check_mem_limit(args.memargs.mem_to_use, total_mem);
 
   //
@@ -195,6 +204,12 @@ int ctx_thread(int argc, char **argv)
   GenPathWorker *workers;
   workers = gen_paths_workers_alloc(args.nthreads, &db_graph);
 
+  GapMemo gap_memo;
+  if(gap_memo_mem) {
+    gap_memo_alloc(&gap_memo, gap_memo_mem);
+    gen_paths_workers_set_gap_memo(workers, args.nthreads, &gap_memo);
+  }
+
   // Setup for loading graphs graph
   LoadingStats gstats;
   loading_stats_init(&gstats);
@@ -238,6 +253,14 @@ int ctx_thread(int argc, char **argv)
     generate_paths(inputs->b+start, end-start, workers, args.nthreads);
   }
 
+  gen_paths_print_stage_times(workers, args.nthreads);
+
+  if(gap_memo_mem) {
+    gap_memo_print_stats(&gap_memo);
+    gap_memo_dealloc(&gap_memo);
+    gen_paths_workers_set_gap_memo(workers, args.nthreads, NULL);
+  }
+
   // Print memory statistics
   gpath_hash_print_stats(&db_graph.gphash);
   gpath_store_print_stats(&db_graph.gpstore);
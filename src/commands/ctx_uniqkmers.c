@@ -6,6 +6,7 @@
 #include "graph_format.h"
 #include "gpath_checks.h"
 #include "build_graph.h"
+#include "kmer_batch.h"
 #include "seqout.h"
 #include "seq_reader.h"
 
@@ -263,10 +264,17 @@ int ctx_uniqkmers(int argc, char **argv)
   //
   // Decide on memory
   //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+  size_t bits_per_kmer, kmers_in_hash, graph_mem, batch_mem = 0;
+
+  // Each build thread sorts a batch of kmers before inserting them
+  if(sfilebuf.len > 0 || flankbuf.len > 0)
+    batch_mem = nthreads * kmer_batch_mem(KMER_BATCH_SIZE);
+
+  // Hash table uses the remaining memory
+  size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, batch_mem);
 
   bits_per_kmer = sizeof(BinaryKmer)*8;
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+  kmers_in_hash = cmd_get_kmers_in_hash(rem_mem,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
                                         memargs.num_kmers_set,
@@ -274,7 +282,8 @@ int ctx_uniqkmers(int argc, char **argv)
                                         ctx_max_kmers, ctx_sum_kmers,
                                         true, &graph_mem);
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  if(batch_mem) cmd_print_mem(batch_mem, "kmer batches");
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + batch_mem);
 
   //
   // Open output file
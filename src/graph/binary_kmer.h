@@ -3,6 +3,7 @@
 
 #include "bit_array/bit_macros.h"
 #include "dna.h"
+#include "cortex_types.h"
 
 // coding is: [1]=xx665544 [0]=33221100
 
@@ -152,4 +153,53 @@ BinaryKmer binary_kmer_from_str(const char *seq, size_t kmer_size);
 
 void binary_kmer_to_hex(const BinaryKmer bkmer, size_t kmer_size, char *seq);
 
+//
+// Rolling kmer iterator
+// Keeps a kmer and its reverse complement up to date as bases are added, so
+// getting the key (lower of the two) does not need a reverse complement
+//
+
+typedef struct
+{
+  BinaryKmer fw, rv;
+  size_t kmer_size;
+} BinaryKmerIter;
+
+// Start from an existing kmer
+static inline void binary_kmer_iter_init_bkmer(BinaryKmerIter *it,
+                                               BinaryKmer bkmer,
+                                               size_t kmer_size)
+{
+  it->fw = bkmer;
+  it->rv = binary_kmer_reverse_complement(bkmer, kmer_size);
+  it->kmer_size = kmer_size;
+}
+
+// Start with the first kmer_size-1 bases of `seq`,
+// binary_kmer_iter_add() then gives the first kmer
+static inline void binary_kmer_iter_init(BinaryKmerIter *it, const char *seq,
+                                         size_t kmer_size)
+{
+  binary_kmer_iter_init_bkmer(it, binary_kmer_from_str(seq, kmer_size-1),
+                              kmer_size);
+}
+
+// Add a base to the end of the kmer
+static inline void binary_kmer_iter_add(BinaryKmerIter *it, Nucleotide nuc)
+{
+  it->fw = binary_kmer_left_shift_add(it->fw, it->kmer_size, nuc);
+  it->rv = binary_kmer_right_shift_add(it->rv, it->kmer_size,
+                                       dna_nuc_complement(nuc));
+}
+
+// Get the key of the current kmer and its orientation relative to the key
+// Same result as binary_kmer_get_key() and bkmer_get_orientation()
+static inline BinaryKmer binary_kmer_iter_key(const BinaryKmerIter *it,
+                                              Orientation *orient)
+{
+  bool fw = !binary_kmer_less_than(it->rv, it->fw);
+  *orient = fw ? FORWARD : REVERSE;
+  return fw ? it->fw : it->rv;
+}
+
 #endif /* BINARY_KMER_H_ */
@@ -0,0 +1,93 @@
+#include "global.h"
+#include "count_filter.h"
+#include "util.h"
+
+void count_filter_alloc(CountFilter *cf, size_t mem_in_bytes)
+{
+  // Number of counters must be a power of two, at least one word
+  size_t num_counters = 16;
+  while(count_filter_mem(num_counters*2) <= mem_in_bytes) num_counters *= 2;
+
+  char cap_str[50], mem_str[50];
+  ulong_to_str(num_counters, cap_str);
+  bytes_to_str(count_filter_mem(num_counters), 1, mem_str);
+  status("[CountFilter] Allocating filter of %s counters, using %s",
+         cap_str, mem_str);
+
+  CountFilter tmp = {.counters = ctx_calloc(num_counters/16, sizeof(uint64_t)),
+                     .num_counters = num_counters,
+                     .mask = num_counters - 1};
+
+  memcpy(cf, &tmp, sizeof(CountFilter));
+}
+
+void count_filter_dealloc(CountFilter *cf)
+{
+  ctx_free(cf->counters);
+  memset(cf, 0, sizeof(CountFilter));
+}
+
+// Fill `idx` with the counter indices of a kmer
+static inline void count_filter_idxs(const CountFilter *cf, BinaryKmer bkey,
+                                     size_t idx[COUNT_FILTER_NHASH])
+{
+  // Double hashing: idx_i = h1 + i*h2
+  uint32_t a = binary_kmer_hash(bkey, 0), b = binary_kmer_hash(bkey, a);
+  uint64_t h1 = ((uint64_t)a << 32) | b, h2 = (((uint64_t)b << 32) | a) | 1;
+  size_t i;
+  for(i = 0; i < COUNT_FILTER_NHASH; i++) idx[i] = (h1 + i*h2) & cf->mask;
+}
+
+#define count_filter_word(cf,i) ((cf)->counters[(i)/16])
+#define count_filter_shift(i) (((i)%16)*4)
+#define count_filter_counter(word,i) (((word) >> count_filter_shift(i)) & 0xf)
+
+// Increment a counter unless it is saturated, returns value before increment
+static inline uint8_t count_filter_incr_mt(CountFilter *cf, size_t i)
+{
+  volatile uint64_t *word = &count_filter_word(cf, i);
+  uint64_t oldw, neww;
+  uint8_t c;
+
+  do {
+    oldw = *word;
+    c = count_filter_counter(oldw, i);
+    if(c == COUNT_FILTER_MAX_COUNT) break;
+    neww = oldw + (1UL << count_filter_shift(i));
+  }
+  while(!__sync_bool_compare_and_swap(word, oldw, neww));
+
+  return c;
+}
+
+void count_filter_add_mt(CountFilter *cf, BinaryKmer bkey,
+                         uint8_t *before, uint8_t *after)
+{
+  size_t i, idx[COUNT_FILTER_NHASH];
+  uint8_t c, min = COUNT_FILTER_MAX_COUNT;
+
+  count_filter_idxs(cf, bkey, idx);
+
+  for(i = 0; i < COUNT_FILTER_NHASH; i++) {
+    c = count_filter_incr_mt(cf, idx[i]);
+    min = MIN2(min, c);
+  }
+
+  *before = min;
+  *after = MIN2(min+1, COUNT_FILTER_MAX_COUNT);
+}
+
+uint8_t count_filter_get(const CountFilter *cf, BinaryKmer bkey)
+{
+  size_t i, idx[COUNT_FILTER_NHASH];
+  uint8_t c, min = COUNT_FILTER_MAX_COUNT;
+
+  count_filter_idxs(cf, bkey, idx);
+
+  for(i = 0; i < COUNT_FILTER_NHASH; i++) {
+    c = count_filter_counter(count_filter_word(cf, idx[i]), idx[i]);
+    min = MIN2(min, c);
+  }
+
+  return min;
+}
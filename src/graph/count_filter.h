@@ -0,0 +1,40 @@
+#ifndef COUNT_FILTER_H_
+#define COUNT_FILTER_H_
+
+#include "binary_kmer.h"
+
+//
+// Counting Bloom filter of kmers shared between threads
+//
+// Used to count kmers in a first pass over the reads, so that kmers seen only
+// a few times (mostly sequencing errors) are never added to the hash table.
+// Each kmer is hashed to COUNT_FILTER_NHASH 4 bit saturating counters, the
+// count of a kmer is the minimum of its counters. Counts may be too high
+// (hash collisions) but are never too low.
+//
+
+#define COUNT_FILTER_NHASH 3
+#define COUNT_FILTER_MAX_COUNT 15
+
+typedef struct
+{
+  uint64_t *const counters; // 16 counters per word
+  const size_t num_counters, mask; // num_counters is a power of two
+} CountFilter;
+
+// Memory used for a given number of counters
+#define count_filter_mem(ncounters) ((ncounters) / 2)
+
+void count_filter_alloc(CountFilter *cf, size_t mem_in_bytes);
+void count_filter_dealloc(CountFilter *cf);
+
+// Add one to the count of a kmer
+// Thread safe.
+// Returns counts of the kmer before and after adding
+void count_filter_add_mt(CountFilter *cf, BinaryKmer bkey,
+                         uint8_t *before, uint8_t *after);
+
+// Get count of a kmer. Not thread safe with count_filter_add_mt()
+uint8_t count_filter_get(const CountFilter *cf, BinaryKmer bkey);
+
+#endif /* COUNT_FILTER_H_ */
@@ -17,7 +17,6 @@ static void db_graph_status(const dBGraph *db_graph)
 const int DBG_ALLOC_EDGES       =  1;
 const int DBG_ALLOC_COVGS       =  2;
 const int DBG_ALLOC_BKTLOCKS    =  4;
-const int DBG_ALLOC_READSTRT    =  8;
 const int DBG_ALLOC_NODE_IN_COL = 16;
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
@@ -34,8 +33,7 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                  .ginfo = NULL,
                  .col_edges = NULL,
                  .col_covgs = NULL,
-                 .node_in_cols = NULL,
-                 .readstrt = NULL};
+                 .node_in_cols = NULL};
 
   ctx_assert(num_of_cols > 0);
   ctx_assert(num_edge_cols == 0 || num_edge_cols == 1 || num_edge_cols == num_of_cols);
@@ -59,10 +57,6 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
   if(alloc_flags & DBG_ALLOC_BKTLOCKS)
     tmp.bktlocks = ctx_calloc(roundup_bits2bytes(tmp.ht.num_of_buckets), 1);
 
-  // 1 bit for forward, 1 bit for reverse per kmer
-  if(alloc_flags & DBG_ALLOC_READSTRT)
-    tmp.readstrt = ctx_calloc(roundup_bits2bytes(tmp.ht.capacity)*2, 1);
-
   if(alloc_flags & DBG_ALLOC_NODE_IN_COL) {
     size_t bytes_per_col = roundup_bits2bytes(tmp.ht.capacity);
     tmp.node_in_cols = ctx_calloc(bytes_per_col*num_of_cols, 1);
@@ -87,7 +81,6 @@ void db_graph_dealloc(dBGraph *db_graph)
   ctx_free(db_graph->col_covgs); // num_of_cols * capacity
   ctx_free(db_graph->col_edges); // num_col_edges * capacity
   ctx_free(db_graph->node_in_cols);
-  ctx_free(db_graph->readstrt);
 
   gpath_hash_dealloc(&db_graph->gphash);
   gpath_store_dealloc(&db_graph->gpstore);
@@ -127,6 +120,25 @@ dBNode db_graph_find_or_add_node_mt(dBGraph *db_graph, BinaryKmer bkmer,
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
+// Thread safe
+dBNode db_graph_find_or_add_iter_mt(dBGraph *db_graph, const BinaryKmerIter *it,
+                                    bool *foundptr)
+{
+  Orientation orient;
+  BinaryKmer bkey = binary_kmer_iter_key(it, &orient);
+  hkey_t hkey = hash_table_find_or_insert_mt(&db_graph->ht, bkey, foundptr,
+                                             db_graph->bktlocks);
+
+  return (dBNode){.key = hkey, .orient = orient};
+}
+
+dBNode db_graph_find_iter(const dBGraph *db_graph, const BinaryKmerIter *it)
+{
+  Orientation orient;
+  BinaryKmer bkey = binary_kmer_iter_key(it, &orient);
+  return (dBNode){.key = hash_table_find(&db_graph->ht, bkey), .orient = orient};
+}
+
 dBNode db_graph_find_str(const dBGraph *db_graph, const char *str)
 {
   BinaryKmer bkmer;
@@ -465,8 +477,6 @@ void db_graph_reset(dBGraph *db_graph)
     memset(db_graph->col_covgs, 0, ncols * sizeof(Covg) * capacity);
   if(db_graph->node_in_cols != NULL)
     memset(db_graph->node_in_cols, 0, roundup_bits2bytes(capacity) * ncols);
-  if(db_graph->readstrt != NULL)
-    memset(db_graph->readstrt, 0, 2 * roundup_bits2bytes(capacity) * ncols);
 
   gpath_store_reset(&db_graph->gpstore);
 }
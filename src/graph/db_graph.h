@@ -14,7 +14,6 @@
 extern const int DBG_ALLOC_EDGES;
 extern const int DBG_ALLOC_COVGS;
 extern const int DBG_ALLOC_BKTLOCKS;
-extern const int DBG_ALLOC_READSTRT;
 extern const int DBG_ALLOC_NODE_IN_COL;
 
 //
@@ -50,9 +49,6 @@ typedef struct
   // New path data
   GPathStore gpstore;
   GPathHash gphash; // adding new paths quickly
-
-  // Loading reads, 2 bits per kmers
-  uint8_t *readstrt;
 } dBGraph;
 
 #define db_graph_has_path_hash(graph) ((graph)->gphash.table != NULL)
@@ -89,6 +85,11 @@ dBNode db_graph_find_or_add_node_mt(dBGraph *db_graph, BinaryKmer bkmer,
 dBNode db_graph_find(const dBGraph *db_graph, BinaryKmer bkmer);
 dBNode db_graph_find_str(const dBGraph *db_graph, const char *str);
 
+// As above, but take the current kmer of a BinaryKmerIter
+dBNode db_graph_find_or_add_iter_mt(dBGraph *db_graph, const BinaryKmerIter *it,
+                                    bool *found);
+dBNode db_graph_find_iter(const dBGraph *db_graph, const BinaryKmerIter *it);
+
 // In the case of self-loops in palindromes the two edges collapse into one
 void db_graph_add_edge(dBGraph *db_graph, Colour colour,
                        hkey_t src_node, hkey_t tgt_node,
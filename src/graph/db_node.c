@@ -307,6 +307,28 @@ void db_nodes_gzprint_cont(const dBNode *nodes, size_t num,
   }
 }
 
+void db_nodes_sprint(const dBNode *nodes, size_t num,
+                     const dBGraph *db_graph, StrBuf *sbuf)
+{
+  if(num == 0) return;
+  strbuf_ensure_capacity(sbuf, sbuf->end + db_graph->kmer_size + num);
+  sbuf->end += db_nodes_to_str(nodes, num, db_graph, sbuf->b+sbuf->end);
+}
+
+// Do not print first k-1 bases => 3 nodes gives 3bp instead of 3+k-1
+void db_nodes_sprint_cont(const dBNode *nodes, size_t num,
+                          const dBGraph *db_graph, StrBuf *sbuf)
+{
+  size_t i;
+  Nucleotide nuc;
+  strbuf_ensure_capacity(sbuf, sbuf->end + num);
+  for(i = 0; i < num; i++) {
+    nuc = db_node_get_last_nuc(nodes[i], db_graph);
+    sbuf->b[sbuf->end++] = dna_nuc_to_char(nuc);
+  }
+  sbuf->b[sbuf->end] = '\0';
+}
+
 // Print:
 // 0: AAACCCAAATGCAAACCCAAATGCAAACCCA:1 TGGGTTTGCATTTGGGTTTGCATTTGGGTTT
 // 1: CAAACCCAAATGCAAACCCAAATGCAAACCC:1 GGGTTTGCATTTGGGTTTGCATTTGGGTTTG
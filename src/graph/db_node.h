@@ -291,6 +291,14 @@ void db_nodes_gzprint(const dBNode *nodes, size_t num,
 void db_nodes_gzprint_cont(const dBNode *nodes, size_t num,
                            const dBGraph *db_graph, gzFile out);
 
+// Append to a string buffer
+void db_nodes_sprint(const dBNode *nodes, size_t num,
+                     const dBGraph *db_graph, StrBuf *sbuf);
+
+// Do not print first k-1 bases => 3 nodes gives 3bp instead of 3+k-1
+void db_nodes_sprint_cont(const dBNode *nodes, size_t num,
+                          const dBGraph *db_graph, StrBuf *sbuf);
+
 // Print:
 // 0: AAACCCAAATGCAAACCCAAATGCAAACCCA:1 TGGGTTTGCATTTGGGTTTGCATTTGGGTTT
 // 1: CAAACCCAAATGCAAACCCAAATGCAAACCC:1 GGGTTTGCATTTGGGTTTGCATTTGGGTTTG
@@ -0,0 +1,60 @@
+#include "global.h"
+#include "dup_filter.h"
+#include "util.h"
+
+void dup_filter_alloc(DupFilter *df, size_t mem_in_bytes)
+{
+  // Capacity must be a power of two
+  size_t capacity = 64;
+  while(dup_filter_mem(capacity*2) <= mem_in_bytes) capacity *= 2;
+
+  char cap_str[50], mem_str[50];
+  ulong_to_str(capacity, cap_str);
+  bytes_to_str(dup_filter_mem(capacity), 1, mem_str);
+  status("[DupFilter] Allocating duplicate filter of %s reads, using %s",
+         cap_str, mem_str);
+
+  DupFilter tmp = {.keys = ctx_calloc(capacity, sizeof(uint64_t)),
+                   .capacity = capacity, .mask = capacity - 1,
+                   .max_keys = capacity - capacity / 8,
+                   .num_keys = 0};
+
+  memcpy(df, &tmp, sizeof(DupFilter));
+}
+
+void dup_filter_dealloc(DupFilter *df)
+{
+  ctx_free(df->keys);
+  memset(df, 0, sizeof(DupFilter));
+}
+
+void dup_filter_reset(DupFilter *df)
+{
+  memset(df->keys, 0, dup_filter_mem(df->capacity));
+  df->num_keys = 0;
+}
+
+bool dup_filter_add_mt(DupFilter *df, uint64_t key)
+{
+  if(key == 0) key = 1; // zero marks empty
+  volatile uint64_t *keys = df->keys;
+  size_t i = (key ^ (key >> 29)) & df->mask;
+  uint64_t curr;
+
+  while(1)
+  {
+    curr = keys[i];
+    if(curr == key) return true;
+    if(curr == 0)
+    {
+      // Full, treat as novel rather than fill the table
+      if(df->num_keys >= df->max_keys) return false;
+      if(__sync_bool_compare_and_swap(&keys[i], 0, key)) {
+        __sync_fetch_and_add(&df->num_keys, 1);
+        return false;
+      }
+      continue; // another thread took this slot, check it again
+    }
+    i = (i + 1) & df->mask;
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef DUP_FILTER_H_
+#define DUP_FILTER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+//
+// Set of read (pair) keys for PCR duplicate removal, shared between threads
+//
+// Keys are 64 bit hashes of the first kmer of each mate and its orientation.
+// Stored in an open addressing table sized by the number of reads rather than
+// the number of kmers in the graph. Keys are added with a compare-and-swap so
+// no locking is needed. Once the table is full, new keys are not stored and
+// reported as novel.
+//
+
+typedef struct
+{
+  uint64_t *const keys; // zero means empty, cast to volatile to read/write
+  const size_t capacity, mask, max_keys; // capacity is a power of two
+  volatile size_t num_keys;
+} DupFilter;
+
+// Memory used for a given number of keys
+#define dup_filter_mem(nkeys) ((nkeys) * sizeof(uint64_t))
+
+void dup_filter_alloc(DupFilter *df, size_t mem_in_bytes);
+void dup_filter_dealloc(DupFilter *df);
+
+// Remove all keys
+void dup_filter_reset(DupFilter *df);
+
+// Add a key. Thread safe.
+// Returns true if the key was already in the set (i.e. a duplicate)
+bool dup_filter_add_mt(DupFilter *df, uint64_t key);
+
+#endif /* DUP_FILTER_H_ */
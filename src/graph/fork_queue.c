@@ -0,0 +1,128 @@
+#include "global.h"
+#include "fork_queue.h"
+
+void fork_queue_alloc(ForkQueue *q, size_t batch_size, bool ordered,
+                      const dBGraph *db_graph)
+{
+  ctx_assert(batch_size > 0);
+
+  ForkQueue tmp = {.db_graph = db_graph,
+                   .batch_size = batch_size,
+                   .ordered = ordered,
+                   .next_hkey = 0, .num_batches = 0,
+                   .num_batches_numbered = 0, .num_calls = 0};
+
+  memcpy(q, &tmp, sizeof(ForkQueue));
+
+  if(pthread_mutex_init(&q->lock, NULL) != 0) die("mutex init failed");
+  if(pthread_cond_init(&q->numbered_cond, NULL) != 0) die("cond init failed");
+}
+
+void fork_queue_dealloc(ForkQueue *q)
+{
+  ctx_assert(q->num_batches_numbered == q->num_batches);
+  pthread_cond_destroy(&q->numbered_cond);
+  pthread_mutex_destroy(&q->lock);
+}
+
+void fork_batch_alloc(ForkBatch *batch, size_t batch_size)
+{
+  batch->id = 0;
+  db_node_buf_alloc(&batch->nodes, batch_size+1);
+}
+
+void fork_batch_dealloc(ForkBatch *batch)
+{
+  db_node_buf_dealloc(&batch->nodes);
+}
+
+// Fill `batch` with the next set of fork nodes
+// Returns false if there are no fork nodes left
+bool fork_queue_next(ForkQueue *q, ForkBatch *batch)
+{
+  const dBGraph *db_graph = q->db_graph;
+  const size_t capacity = db_graph->ht.capacity;
+  hkey_t hkey;
+  Edges edges;
+  dBNode node;
+
+  db_node_buf_reset(&batch->nodes);
+
+  pthread_mutex_lock(&q->lock);
+
+  if(q->next_hkey >= capacity) {
+    pthread_mutex_unlock(&q->lock);
+    return false;
+  }
+
+  batch->id = q->num_batches++;
+
+  // Scanning is cheap compared to calling, so we do it holding the lock
+  for(hkey = q->next_hkey;
+      hkey < capacity && batch->nodes.len < q->batch_size;
+      hkey++)
+  {
+    if(db_graph_node_assigned(db_graph, hkey))
+    {
+      edges = db_node_get_edges(db_graph, hkey, 0);
+      node.key = hkey;
+      if(edges_get_outdegree(edges, FORWARD) > 1) {
+        node.orient = FORWARD;
+        db_node_buf_add(&batch->nodes, node);
+      }
+      if(edges_get_outdegree(edges, REVERSE) > 1) {
+        node.orient = REVERSE;
+        db_node_buf_add(&batch->nodes, node);
+      }
+    }
+  }
+
+  q->next_hkey = hkey;
+
+  pthread_mutex_unlock(&q->lock);
+  return true;
+}
+
+// Reserve `ncalls` call ids for a finished batch. Each batch must be numbered
+// exactly once, even if it produced no calls.
+// Returns id of the first call in the batch
+size_t fork_queue_number(ForkQueue *q, const ForkBatch *batch, size_t ncalls)
+{
+  size_t first_callid;
+
+  pthread_mutex_lock(&q->lock);
+
+  if(q->ordered) {
+    // Wait for all previous batches to be numbered
+    while(q->num_batches_numbered != batch->id)
+      pthread_cond_wait(&q->numbered_cond, &q->lock);
+  }
+
+  first_callid = q->num_calls;
+  q->num_calls += ncalls;
+  q->num_batches_numbered++;
+
+  if(q->ordered) pthread_cond_broadcast(&q->numbered_cond);
+
+  pthread_mutex_unlock(&q->lock);
+
+  return first_callid;
+}
+
+// Append `txt` to `out`, inserting call ids at the positions stored in `idpos`
+void fork_batch_print_callids(const StrBuf *txt, const SizeBuffer *idpos,
+                              size_t first_callid, StrBuf *out)
+{
+  size_t i, start = 0, end;
+  ctx_assert(idpos->len % 2 == 0);
+
+  for(i = 0; i < idpos->len; i += 2) {
+    end = idpos->b[i];
+    ctx_assert(start <= end && end <= txt->end);
+    strbuf_append_strn(out, txt->b+start, end-start);
+    strbuf_append_ulong(out, first_callid + idpos->b[i+1]);
+    start = end;
+  }
+
+  strbuf_append_strn(out, txt->b+start, txt->end-start);
+}
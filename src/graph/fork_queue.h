@@ -0,0 +1,81 @@
+#ifndef FORK_QUEUE_H_
+#define FORK_QUEUE_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "common_buffers.h"
+
+//
+// Work queue of fork nodes (outdegree > 1 in colour 0 edges)
+//
+// Threads take batches of fork nodes from the queue rather than iterating over
+// a fixed slice of the hash table, so that repeat-dense regions do not leave
+// one thread with most of the work. Batches always contain the same nodes,
+// regardless of the number of threads, so output can be made deterministic by
+// writing batches in order of id.
+//
+// Calls (e.g. bubbles) are given ids once a batch is finished:
+//   ordered   => ids are assigned in order of batch id (waits on earlier batches)
+//   unordered => ids are assigned as batches finish
+//
+
+typedef struct
+{
+  size_t id; // batch number: 0,1,2,...
+  dBNodeBuffer nodes;
+} ForkBatch;
+
+typedef struct
+{
+  const dBGraph *db_graph;
+  const size_t batch_size;
+  const bool ordered;
+  size_t next_hkey, num_batches;
+  size_t num_batches_numbered, num_calls; // numbering calls
+  pthread_mutex_t lock;
+  pthread_cond_t numbered_cond;
+} ForkQueue;
+
+// Number of fork nodes per batch
+#define FORK_QUEUE_BATCH_SIZE 128
+
+void fork_queue_alloc(ForkQueue *q, size_t batch_size, bool ordered,
+                      const dBGraph *db_graph);
+void fork_queue_dealloc(ForkQueue *q);
+
+void fork_batch_alloc(ForkBatch *batch, size_t batch_size);
+void fork_batch_dealloc(ForkBatch *batch);
+
+// Fill `batch` with the next set of fork nodes
+// Returns false if there are no fork nodes left
+bool fork_queue_next(ForkQueue *q, ForkBatch *batch);
+
+// Reserve `ncalls` call ids for a finished batch. Each batch must be numbered
+// exactly once, even if it produced no calls.
+// Returns id of the first call in the batch
+size_t fork_queue_number(ForkQueue *q, const ForkBatch *batch, size_t ncalls);
+
+// Total number of calls numbered so far
+static inline size_t fork_queue_num_calls(const ForkQueue *q) {
+  return q->num_calls;
+}
+
+//
+// Call ids are not known whilst a batch is being processed, so we record where
+// they go in the output text and fill them in later.
+//
+
+// Record that the id of call number `callidx` (within the batch) goes at the
+// end of `txt`. `idpos` holds pairs of (offset, callidx)
+static inline void fork_batch_add_callid(const StrBuf *txt, SizeBuffer *idpos,
+                                         size_t callidx)
+{
+  size_buf_add(idpos, txt->end);
+  size_buf_add(idpos, callidx);
+}
+
+// Append `txt` to `out`, inserting call ids at the positions stored in `idpos`
+void fork_batch_print_callids(const StrBuf *txt, const SizeBuffer *idpos,
+                              size_t first_callid, StrBuf *out);
+
+#endif /* FORK_QUEUE_H_ */
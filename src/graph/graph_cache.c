@@ -21,6 +21,8 @@ void graph_cache_alloc(GraphCache *cache, const dBGraph *db_graph)
   cache_path_buf_alloc(&cache->path_buf, 1024);
   cache->snode_hash = kh_init(SnodeIdHash);
   cache->db_graph = db_graph;
+  cache->snode_cache = NULL;
+  cache->snode_lookups = cache->snode_hits = 0;
 }
 
 void graph_cache_dealloc(GraphCache *cache)
@@ -52,13 +54,34 @@ static inline void _create_supernode(GraphCache *cache, dBNode node,
   const dBGraph *db_graph = cache->db_graph;
   ctx_assert(db_graph->num_edge_cols == 1);
 
-  size_t first_node_id = cache->node_buf.len;
-  db_node_buf_add(&cache->node_buf, node);
-  supernode_extend(&cache->node_buf, 0, db_graph);
-  size_t num_nodes = cache->node_buf.len - first_node_id;
+  size_t num_nodes, first_node_id = cache->node_buf.len;
+  dBNode *nodes;
 
-  dBNode *nodes = graph_cache_node(cache, first_node_id);
-  supernode_normalise(nodes, num_nodes, db_graph);
+  // Try the shared cache before walking the graph
+  bool found = false;
+  if(cache->snode_cache != NULL) {
+    found = snode_cache_fetch(cache->snode_cache, node, &cache->node_buf);
+    cache->snode_lookups++;
+    cache->snode_hits += found;
+  }
+
+  if(found)
+  {
+    num_nodes = cache->node_buf.len - first_node_id;
+    nodes = graph_cache_node(cache, first_node_id);
+  }
+  else
+  {
+    db_node_buf_add(&cache->node_buf, node);
+    supernode_extend(&cache->node_buf, 0, db_graph);
+    num_nodes = cache->node_buf.len - first_node_id;
+
+    nodes = graph_cache_node(cache, first_node_id);
+    supernode_normalise(nodes, num_nodes, db_graph);
+
+    if(cache->snode_cache != NULL)
+      snode_cache_add(cache->snode_cache, node, nodes, num_nodes);
+  }
 
   // printf("Loaded supernode:\n  ");
   // db_nodes_print(nodes, num_nodes, db_graph, stdout);
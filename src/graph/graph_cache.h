@@ -3,6 +3,7 @@
 
 #include "htslib/khash.h"
 #include "db_node.h"
+#include "snode_cache.h"
 
 // Build and store paths through the graph
 // Must build one path at a time
@@ -55,6 +56,11 @@ typedef struct
   // hash hkey_t->uint32_t (supernode_id)
   khash_t(SnodeIdHash) *snode_hash;
 
+  // Supernodes shared between threads, may be NULL
+  SnodeCache *snode_cache;
+  // Lookups in snode_cache, not cleared by graph_cache_reset()
+  size_t snode_lookups, snode_hits;
+
   const dBGraph *db_graph;
 } GraphCache;
 
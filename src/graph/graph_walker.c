@@ -56,7 +56,35 @@ void graph_walker_print_state(const GraphWalker *wlk, FILE *fout)
 
 size_t graph_walker_est_mem()
 {
-  return sizeof(GPathFollow)*1024;
+  return sizeof(GPathFollow)*1024 +
+         sizeof(GraphWalkerMemo)*GRAPH_WALKER_MEMO_SIZE;
+}
+
+void graph_walker_stats_merge(GraphWalkerStats *dst, const GraphWalkerStats *src)
+{
+  dst->num_forks          += src->num_forks;
+  dst->num_links_followed += src->num_links_followed;
+  dst->num_junc_lookups   += src->num_junc_lookups;
+  dst->num_memo_lookups   += src->num_memo_lookups;
+  dst->num_memo_hits      += src->num_memo_hits;
+}
+
+void graph_walker_stats_print(const GraphWalkerStats *stats)
+{
+  char forks_str[50], links_str[50], juncs_str[50];
+  char lookups_str[50], hits_str[50];
+  ulong_to_str(stats->num_forks, forks_str);
+  ulong_to_str(stats->num_links_followed, links_str);
+  ulong_to_str(stats->num_junc_lookups, juncs_str);
+  ulong_to_str(stats->num_memo_lookups, lookups_str);
+  ulong_to_str(stats->num_memo_hits, hits_str);
+
+  status("[GraphWalker] forks: %s; links followed: %s; link bases read: %s",
+         forks_str, links_str, juncs_str);
+  status("[GraphWalker] link memo hits: %s / %s lookups [%.2f%%]",
+         hits_str, lookups_str,
+         stats->num_memo_lookups ? (100.0 * stats->num_memo_hits) /
+                                   stats->num_memo_lookups : 0.0);
 }
 
 // Allocate memory, default to colour 0 and using missing info check
@@ -66,6 +94,7 @@ void graph_walker_alloc(GraphWalker *wlk, const dBGraph *graph)
   gpath_follow_buf_alloc(&wlk->paths, 256);
   gpath_follow_buf_alloc(&wlk->cntr_paths, 512);
   gseg_list_alloc(&wlk->gsegs, 128);
+  wlk->memo = ctx_calloc(GRAPH_WALKER_MEMO_SIZE, sizeof(GraphWalkerMemo));
   graph_walker_setup(wlk, true, 0, 0, graph);
 }
 
@@ -75,6 +104,7 @@ void graph_walker_dealloc(GraphWalker *wlk)
   gpath_follow_buf_dealloc(&wlk->paths);
   gpath_follow_buf_dealloc(&wlk->cntr_paths);
   gseg_list_dealloc(&wlk->gsegs);
+  ctx_free(wlk->memo);
   memset(wlk, 0, sizeof(GraphWalker));
 }
 
@@ -86,6 +116,10 @@ void graph_walker_setup(GraphWalker *wlk, bool missing_path_check,
   ctx_assert(graph->num_edge_cols == 1);
   ctx_assert(graph->num_of_cols == 1 || graph->node_in_cols != NULL);
 
+  // Memo is keyed on GPath pointers, which belong to the graph
+  if(wlk->db_graph != graph && wlk->db_graph != NULL)
+    memset(wlk->memo, 0, GRAPH_WALKER_MEMO_SIZE * sizeof(GraphWalkerMemo));
+
   wlk->db_graph = graph;
   wlk->gpstore = &graph->gpstore;
   wlk->ctxcol = ctxcol;
@@ -93,6 +127,37 @@ void graph_walker_setup(GraphWalker *wlk, bool missing_path_check,
   wlk->missing_path_check = missing_path_check;
 }
 
+// Get a link base, fetching the block it is in from the memo if we can.
+// Leaves path->cache as gpath_follow_get_base() would, since it is hashed.
+static inline Nucleotide _gw_get_base(GraphWalker *wlk, GPathFollow *path,
+                                      size_t pos)
+{
+  uint16_t first_cached = gpath_follow_cache_start(pos);
+  wlk->stats.num_junc_lookups++;
+
+  if(first_cached != path->first_cached)
+  {
+    uint64_t h = twang_mix64((uint64_t)(size_t)path->gpath ^
+                             ((uint64_t)first_cached << 48));
+    GraphWalkerMemo *memo = &wlk->memo[h & (GRAPH_WALKER_MEMO_SIZE-1)];
+    wlk->stats.num_memo_lookups++;
+
+    if(memo->gpath == path->gpath && memo->first_cached == first_cached) {
+      path->first_cached = first_cached;
+      memcpy(path->cache, memo->cache, sizeof(path->cache));
+      wlk->stats.num_memo_hits++;
+    }
+    else {
+      gpath_follow_cache_update(path, pos);
+      memo->gpath = path->gpath;
+      memo->first_cached = first_cached;
+      memcpy(memo->cache, path->cache, sizeof(memo->cache));
+    }
+  }
+
+  return binary_seq_get(path->cache, pos - path->first_cached);
+}
+
 static inline void _gw_gseg_init(GraphWalker *wlk)
 {
   ctx_assert(gseg_list_len(&wlk->gsegs) == 0);
@@ -167,6 +232,12 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
 
   GPath *gpath = gpath_store_fetch_traverse(gpstore, node.key);
 
+  // Flattened paths are contiguous so we know how many there are
+  if(gpath != NULL && gpath_store_is_flat(gpstore)) {
+    gpath_follow_buf_capacity(pbuf, num_paths +
+                              gpath_store_flat_num_paths(gpstore, node.key));
+  }
+
   for(; gpath != NULL; gpath = gpath->next)
   {
     if(node.orient == gpath->orient && gpath_has_colour(gpath, ncols, wlk->ctpcol))
@@ -174,7 +245,7 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
       GPathFollow fpath = gpath_follow_create(gpath);
 
       if(!cntr_filter_nuc0) gpath_follow_buf_add(pbuf, fpath);
-      else if(gpath_follow_get_base(&fpath, 0) == next_nuc) {
+      else if(_gw_get_base(wlk, &fpath, 0) == next_nuc) {
         // Loading a counter path at a fork
         fpath.pos++; // already took a base
         gpath_follow_buf_add(pbuf, fpath);
@@ -199,6 +270,8 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
   //           pbuf->len - num_paths, (size_t)node.key, counter ? " [cntr]" : "");
   // }
 
+  wlk->stats.num_links_followed += pbuf->len - num_paths;
+
   return pbuf->len - num_paths;
 }
 
@@ -295,16 +368,25 @@ uint64_t graph_walker_hash64(GraphWalker *wlk)
 // Junction decision
 //
 
-static inline void update_path_forks(GPathFollowBuffer *pbuf, bool taken[4])
+static inline void update_path_forks(GraphWalker *wlk, GPathFollowBuffer *pbuf,
+                                     bool taken[4])
 {
   size_t i;
   GPathFollow *path;
   for(i = 0; i < pbuf->len; i++) {
     path = &pbuf->b[i];
-    taken[gpath_follow_get_base(path, path->pos)] = true;
+    taken[_gw_get_base(wlk, path, path->pos)] = true;
   }
 }
 
+// Next base of a path whose cache already covers path->pos
+// (i.e. after update_path_forks())
+static inline Nucleotide _gw_cached_next_base(const GPathFollow *path)
+{
+  ctx_assert(path->first_cached == gpath_follow_cache_start(path->pos));
+  return binary_seq_get(path->cache, path->pos - path->first_cached);
+}
+
 static inline void _corrupt_paths(GraphWalker *wlk, size_t num_next,
                                   const dBNode nodes[4],
                                   const Nucleotide bases[4])
@@ -338,8 +420,8 @@ static inline void _corrupt_paths(GraphWalker *wlk, size_t num_next,
   for(i = 0; i < num_next; i++) forks[bases[i]] = true;
 
   // Check for path corruption
-  update_path_forks(&wlk->paths,      taken_curr);
-  update_path_forks(&wlk->cntr_paths, taken_cntr);
+  update_path_forks(wlk, &wlk->paths,      taken_curr);
+  update_path_forks(wlk, &wlk->cntr_paths, taken_cntr);
 
   char bases_fork[20], bases_curr[20], bases_newp[20], bases_cntr[20];
   dna_bases_list_to_str(forks,      bases_fork);
@@ -425,6 +507,8 @@ GraphStep graph_walker_choose(GraphWalker *wlk, size_t num_next,
   }
 
   // We have hit a fork
+  wlk->stats.num_forks++;
+
   // abandon if no path info
   if(wlk->paths.len == 0) _gw_choose_return(-1, GRPHWLK_NOPATHS, 0);
 
@@ -435,8 +519,8 @@ GraphStep graph_walker_choose(GraphWalker *wlk, size_t num_next,
   for(i = 0; i < num_next; i++) forks[bases[i]] = true;
 
   // Check for path corruption
-  update_path_forks(&wlk->paths,      taken);
-  update_path_forks(&wlk->cntr_paths, taken);
+  update_path_forks(wlk, &wlk->paths,      taken);
+  update_path_forks(wlk, &wlk->cntr_paths, taken);
 
   if((taken[0] && !forks[0]) || (taken[1] && !forks[1]) ||
      (taken[2] && !forks[2]) || (taken[3] && !forks[3]))
@@ -450,7 +534,7 @@ GraphStep graph_walker_choose(GraphWalker *wlk, size_t num_next,
   Nucleotide greatest_nuc;
 
   greatest_age = oldest_path->age;
-  greatest_nuc = gpath_follow_get_base(oldest_path, oldest_path->pos);
+  greatest_nuc = _gw_cached_next_base(oldest_path);
 
   ctx_assert(oldest_path->pos < oldest_path->len);
 
@@ -460,7 +544,7 @@ GraphStep graph_walker_choose(GraphWalker *wlk, size_t num_next,
   // OR wlk->paths.length if all paths agree
   for(i = 1; i < wlk->paths.len; i++) {
     path = &wlk->paths.b[i];
-    if(gpath_follow_get_base(path, path->pos) != greatest_nuc) break;
+    if(_gw_cached_next_base(path) != greatest_nuc) break;
   }
 
   // If a path of the same age disagrees, cannot proceed
@@ -559,7 +643,7 @@ static void _graph_walker_force_jump(GraphWalker *wlk,
     for(i = 0, j = 0; i < npaths; i++)
     {
       path = &wlk->paths.b[i];
-      pnuc = gpath_follow_get_base(path, path->pos);
+      pnuc = _gw_get_base(wlk, path, path->pos);
       if(base == pnuc) {
         path->pos++;
         if(path->pos < path->len) {
@@ -582,7 +666,7 @@ static void _graph_walker_force_jump(GraphWalker *wlk,
     for(i = 0, j = 0; i < wlk->cntr_paths.len; i++)
     {
       path = &wlk->cntr_paths.b[i];
-      pnuc = gpath_follow_get_base(path, path->pos);
+      pnuc = _gw_get_base(wlk, path, path->pos);
       if(base == pnuc && path->pos+1 < path->len) {
         path->pos++;
         wlk->cntr_paths.b[j++] = *path;
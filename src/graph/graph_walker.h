@@ -16,6 +16,27 @@ typedef struct
 
 madcrow_list(gseg_list,GSegList,GraphSegment);
 
+// Memo of decoded link blocks, keyed by (GPath, first base in block)
+// Hot repeat kmers keep picking up the same links, so we save re-reading them
+// from the path store at every fork
+#define GRAPH_WALKER_MEMO_BITS 10
+#define GRAPH_WALKER_MEMO_SIZE (1UL<<GRAPH_WALKER_MEMO_BITS)
+
+typedef struct
+{
+  const GPath *gpath;
+  uint16_t first_cached;
+  uint8_t cache[sizeof(((GPathFollow*)0)->cache)];
+} GraphWalkerMemo;
+
+typedef struct
+{
+  uint64_t num_forks; // junctions where we had to use links to choose
+  uint64_t num_links_followed; // links picked up
+  uint64_t num_junc_lookups; // link bases decoded
+  uint64_t num_memo_lookups, num_memo_hits; // link blocks fetched
+} GraphWalkerStats;
+
 typedef struct
 {
   const dBGraph *db_graph;
@@ -32,13 +53,20 @@ typedef struct
   GPathFollowBuffer paths, cntr_paths;
   GSegList gsegs;
 
+  // Decoded link blocks [GRAPH_WALKER_MEMO_SIZE]
+  GraphWalkerMemo *memo;
+
   // Statistics
   size_t fork_count; // how many forks we have traversed
   GraphStep last_step;
+  GraphWalkerStats stats; // accumulate across walks
 } GraphWalker;
 
 void graph_walker_print_state(const GraphWalker *wlk, FILE *fout);
 
+void graph_walker_stats_merge(GraphWalkerStats *dst, const GraphWalkerStats *src);
+void graph_walker_stats_print(const GraphWalkerStats *stats);
+
 // Get initial memory requirement
 size_t graph_walker_est_mem();
 
@@ -288,6 +288,14 @@ void json_hdr_fprint(cJSON *json, FILE *fout)
   free(jstr);
 }
 
+void json_hdr_sprint(cJSON *json, StrBuf *sbuf)
+{
+  char *jstr = cJSON_Print(json);
+  strbuf_append_str(sbuf, jstr);
+  strbuf_append_str(sbuf, "\n\n");
+  free(jstr);
+}
+
 cJSON* json_hdr_try(cJSON *json, const char *field, int type, const char *path)
 {
   cJSON *obj = cJSON_GetObjectItem(json, field);
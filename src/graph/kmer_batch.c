@@ -0,0 +1,164 @@
+#include "global.h"
+#include "kmer_batch.h"
+#include "hash_table.h"
+#include "util.h"
+
+void kmer_batch_alloc(KmerBatch *kb, size_t capacity, size_t edge_col,
+                      void (*func)(hkey_t hkey, void *arg), void *arg,
+                      dBGraph *db_graph)
+{
+  ctx_assert(capacity > 0);
+  ctx_assert(db_graph->bktlocks != NULL);
+  ctx_assert(db_graph->col_edges == NULL || edge_col < db_graph->num_edge_cols);
+
+  KmerBatch tmp = {.db_graph = db_graph,
+                   .kmers = ctx_malloc(capacity * sizeof(KmerBatchEntry)),
+                   .tmp = ctx_malloc(capacity * sizeof(KmerBatchEntry)),
+                   .capacity = capacity, .edge_col = edge_col,
+                   .len = 0, .num_novel = 0,
+                   .func = func, .arg = arg};
+
+  memcpy(kb, &tmp, sizeof(KmerBatch));
+}
+
+void kmer_batch_dealloc(KmerBatch *kb)
+{
+  ctx_assert2(kb->len == 0, "KmerBatch not flushed");
+  ctx_free(kb->kmers);
+  ctx_free(kb->tmp);
+  memset(kb, 0, sizeof(KmerBatch));
+}
+
+// Least significant digit radix sort on the lowest `nbits` of bkt, 8 bits a
+// pass. Sort is stable. Returns whichever of `kmers` or `tmp` holds the result
+#define _KMER_RADIX_SORT(name,type)                                            \
+static type* name(type *kmers, type *tmp, size_t len, size_t nbits)            \
+{                                                                              \
+  size_t i, shift, counts[256], sum, c;                                        \
+                                                                               \
+  for(shift = 0; shift < nbits; shift += 8)                                    \
+  {                                                                            \
+    memset(counts, 0, sizeof(counts));                                         \
+    for(i = 0; i < len; i++) counts[(kmers[i].bkt >> shift) & 0xff]++;         \
+                                                                               \
+    for(i = sum = 0; i < 256; i++) { c = counts[i]; counts[i] = sum; sum += c; }\
+                                                                               \
+    for(i = 0; i < len; i++)                                                   \
+      tmp[counts[(kmers[i].bkt >> shift) & 0xff]++] = kmers[i];                \
+                                                                               \
+    SWAP(kmers, tmp);                                                          \
+  }                                                                            \
+                                                                               \
+  return kmers;                                                                \
+}
+
+_KMER_RADIX_SORT(kmer_batch_radix_sort, KmerBatchEntry)
+_KMER_RADIX_SORT(kmer_lookup_radix_sort, KmerLookupEntry)
+
+void kmer_batch_flush(KmerBatch *kb)
+{
+  if(kb->len == 0) return;
+
+  dBGraph *db_graph = kb->db_graph;
+  HashTable *ht = &db_graph->ht;
+  Edges *col_edges = db_graph->col_edges;
+  size_t i, nbits = __builtin_popcountll((uint64_t)ht->hash_mask);
+  size_t num_novel = 0;
+  hkey_t hkey;
+  bool found;
+
+  const KmerBatchEntry *kmers;
+  kmers = kmer_batch_radix_sort(kb->kmers, kb->tmp, kb->len, nbits);
+
+  for(i = 0; i < kb->len; i++)
+  {
+    hkey = hash_table_find_or_insert_mt(ht, kmers[i].bkey, &found,
+                                        db_graph->bktlocks);
+    num_novel += !found;
+
+    if(col_edges != NULL && kmers[i].edges)
+      __sync_or_and_fetch(&db_node_edges(db_graph, hkey, kb->edge_col),
+                          kmers[i].edges);
+
+    if(kb->func != NULL) kb->func(hkey, kb->arg);
+  }
+
+  kb->num_novel += num_novel;
+  kb->len = 0;
+}
+
+// Edges to the kmers either side of a kmer, `prev` and `next` are the bases
+// before and after it in the sequence or -1
+static inline Edges kmer_batch_edges(int prev, int next, Orientation orient)
+{
+  Edges edges = 0;
+  if(prev >= 0) edges |= nuc_orient_to_edge(dna_nuc_complement(prev), !orient);
+  if(next >= 0) edges |= nuc_orient_to_edge(next, orient);
+  return edges;
+}
+
+void kmer_batch_add_str(KmerBatch *kb, const char *seq, size_t len)
+{
+  const size_t kmer_size = kb->db_graph->kmer_size;
+  const HashTable *ht = &kb->db_graph->ht;
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
+  int prev, next;
+  size_t i;
+
+  ctx_assert(len >= kmer_size);
+
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+
+  for(i = kmer_size-1; i < len; i++)
+  {
+    if(kb->len == kb->capacity) kmer_batch_flush(kb);
+
+    binary_kmer_iter_add(&kiter, dna_char_to_nuc(seq[i]));
+    bkey = binary_kmer_iter_key(&kiter, &orient);
+
+    prev = i >= kmer_size ? dna_char_to_nuc(seq[i-kmer_size]) : -1;
+    next = i+1 < len ? dna_char_to_nuc(seq[i+1]) : -1;
+
+    kb->kmers[kb->len++] = (KmerBatchEntry){
+      .bkey = bkey,
+      .bkt = binary_kmer_hash(bkey, ht->seed) & ht->hash_mask,
+      .edges = kmer_batch_edges(prev, next, orient)};
+  }
+}
+
+//
+// Batched lookup
+//
+
+void kmer_lookup_alloc(KmerLookup *kl, size_t capacity, const dBGraph *db_graph)
+{
+  ctx_assert(capacity > 0);
+  KmerLookup tmp = {.db_graph = db_graph,
+                    .kmers = ctx_malloc(capacity * sizeof(KmerLookupEntry)),
+                    .tmp = ctx_malloc(capacity * sizeof(KmerLookupEntry)),
+                    .len = 0, .capacity = capacity};
+  memcpy(kl, &tmp, sizeof(KmerLookup));
+}
+
+void kmer_lookup_dealloc(KmerLookup *kl)
+{
+  ctx_free(kl->kmers);
+  ctx_free(kl->tmp);
+  memset(kl, 0, sizeof(KmerLookup));
+}
+
+void kmer_lookup_flush(KmerLookup *kl)
+{
+  const HashTable *ht = &kl->db_graph->ht;
+  size_t i, nbits = __builtin_popcountll((uint64_t)ht->hash_mask);
+  const KmerLookupEntry *kmers;
+
+  kmers = kmer_lookup_radix_sort(kl->kmers, kl->tmp, kl->len, nbits);
+
+  for(i = 0; i < kl->len; i++)
+    kmers[i].node->key = hash_table_find(ht, kmers[i].bkey);
+
+  kl->len = 0;
+}
@@ -0,0 +1,100 @@
+#ifndef KMER_BATCH_H_
+#define KMER_BATCH_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+
+//
+// Batched insertion of reference kmers into the graph
+//
+// Inserting the kmers of a long sequence in order sends each insert to a
+// random hash table bucket and nearly every insert misses in cache. Instead
+// kmers (and the edges to the kmers either side of them) are buffered, radix
+// sorted by their first choice bucket and inserted in bucket order. Each
+// thread uses its own KmerBatch.
+//
+// KmerLookup does the same for finding kmers in a graph that is not being
+// modified, e.g. all the kmers of a batch of reads.
+//
+
+// Number of kmers buffered per batch by default
+#define KMER_BATCH_SIZE (1UL<<18)
+
+typedef struct
+{
+  BinaryKmer bkey;
+  uint32_t bkt; // first bucket the kmer hashes to
+  Edges edges; // edges to the kmers either side in the sequence
+} KmerBatchEntry;
+
+typedef struct
+{
+  dBGraph *const db_graph;
+  KmerBatchEntry *const kmers, *const tmp;
+  const size_t capacity, edge_col;
+  size_t len;
+  size_t num_novel; // number of kmers that were not already in the graph
+  // Called on every kmer after it is inserted, may be NULL
+  void (*const func)(hkey_t hkey, void *arg);
+  void *const arg;
+} KmerBatch;
+
+// Memory used by a batch of `capacity` kmers
+#define kmer_batch_mem(capacity) (2 * (capacity) * sizeof(KmerBatchEntry))
+
+// Edges are added to colour `edge_col`
+void kmer_batch_alloc(KmerBatch *kb, size_t capacity, size_t edge_col,
+                      void (*func)(hkey_t hkey, void *arg), void *arg,
+                      dBGraph *db_graph);
+
+// Batch must be empty, call kmer_batch_flush() first
+void kmer_batch_dealloc(KmerBatch *kb);
+
+// Add the kmers of `seq`, inserting the batch whenever it fills up
+// Sequence must be entirely ACGT and len >= kmer_size
+// Thread safe with other batches on the same graph
+void kmer_batch_add_str(KmerBatch *kb, const char *seq, size_t len);
+
+// Insert buffered kmers into the graph, in bucket order
+void kmer_batch_flush(KmerBatch *kb);
+
+//
+// Batched lookup
+//
+
+typedef struct
+{
+  BinaryKmer bkey;
+  uint32_t bkt; // first bucket the kmer hashes to
+  dBNode *node; // node->key is set to the kmer's hkey or HASH_NOT_FOUND
+} KmerLookupEntry;
+
+typedef struct
+{
+  const dBGraph *const db_graph;
+  KmerLookupEntry *kmers, *tmp;
+  size_t len, capacity; // grows as needed
+} KmerLookup;
+
+void kmer_lookup_alloc(KmerLookup *kl, size_t capacity, const dBGraph *db_graph);
+void kmer_lookup_dealloc(KmerLookup *kl);
+
+// Queue a kmer, `node` must stay valid until kmer_lookup_flush()
+static inline void kmer_lookup_add(KmerLookup *kl, BinaryKmer bkey, dBNode *node)
+{
+  const HashTable *ht = &kl->db_graph->ht;
+  if(kl->len == kl->capacity) {
+    kl->capacity *= 2;
+    kl->kmers = ctx_reallocarray(kl->kmers, kl->capacity, sizeof(KmerLookupEntry));
+    kl->tmp = ctx_reallocarray(kl->tmp, kl->capacity, sizeof(KmerLookupEntry));
+  }
+  kl->kmers[kl->len++] = (KmerLookupEntry){
+    .bkey = bkey,
+    .bkt = binary_kmer_hash(bkey, ht->seed) & ht->hash_mask,
+    .node = node};
+}
+
+// Find queued kmers in bucket order, setting the key of their nodes
+void kmer_lookup_flush(KmerLookup *kl);
+
+#endif /* KMER_BATCH_H_ */
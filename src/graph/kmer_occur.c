@@ -3,6 +3,13 @@
 #include "seq_reader.h"
 #include "util.h"
 #include "db_node.h"
+#include "kmer_batch.h"
+#include "file_util.h"
+
+#include "sort_r/sort_r.h"
+
+// Memory mapped index files
+#include <sys/mman.h>
 
 //
 // This file provides a datastore for loading sequences and recording where
@@ -41,9 +48,9 @@ void koruns_print(KOccurRun *runs, size_t n, size_t kmer_size, FILE *fout)
   }
 }
 
-void korun_gzprint(gzFile gzout, size_t kmer_size,
-                   KOGraph kograph, KOccurRun korun,
-                   size_t first_kmer_idx, size_t kmer_offset)
+void korun_sprint(StrBuf *sbuf, size_t kmer_size,
+                  KOGraph kograph, KOccurRun korun,
+                  size_t first_kmer_idx, size_t kmer_offset)
 {
   const char strand[] = {'+','-'};
   const char *chrom = kograph_chrom(kograph,korun).name;
@@ -60,20 +67,20 @@ void korun_gzprint(gzFile gzout, size_t kmer_size,
   }
   qoffset = korun.qoffset - first_kmer_idx;
   // +1 to coords to convert to 1-based
-  gzprintf(gzout, "%s:%zu-%zu:%c:%u",
-           chrom, start+1, end+1, strand[korun.strand], qoffset+1);
+  strbuf_sprintf(sbuf, "%s:%zu-%zu:%c:%zu",
+                 chrom, start+1, end+1, strand[korun.strand], qoffset+1);
 }
 
-void koruns_gzprint(gzFile gzout, size_t kmer_size, KOGraph kograph,
-                    const KOccurRun *koruns, size_t n,
-                    size_t first_kmer_idx, size_t kmer_offset)
+void koruns_sprint(StrBuf *sbuf, size_t kmer_size, KOGraph kograph,
+                   const KOccurRun *koruns, size_t n,
+                   size_t first_kmer_idx, size_t kmer_offset)
 {
   size_t i;
   if(n == 0) return;
-  korun_gzprint(gzout, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
+  korun_sprint(sbuf, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
   for(i = 1; i < n; i++) {
-    gzputc(gzout, ',');
-    korun_gzprint(gzout, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
+    strbuf_append_char(sbuf, ',');
+    korun_sprint(sbuf, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
   }
 }
 
@@ -124,69 +131,56 @@ static void generate_chrom_list(KOGraph *kograph,
   }
 }
 
-// Add missing kmers and edges to the graph whilst keeping track of the count
-// of how many times each kmer in the graph is seen in sequence (with klists)
-// Returns number of kmers added to the graph
-// Threadsafe
-static inline size_t add_ref_seq_to_graph_mt(const char *seq, size_t len,
-                                             KONodeList *klists,
-                                             dBGraph *db_graph)
+// Count how many times each kmer in the graph is seen in sequence (with klists)
+static void ref_kmer_update_count(hkey_t hkey, void *arg)
 {
-  const size_t kmer_size = db_graph->kmer_size;
-  size_t i, num_novel_kmers = 0;
-  BinaryKmer bkmer;
-  Nucleotide nuc;
-  dBNode prev, curr;
-  bool found;
-
-  ctx_assert(len >= kmer_size);
-
-  bkmer = binary_kmer_from_str(seq, kmer_size);
-  prev = db_graph_find_or_add_node_mt(db_graph, bkmer, &found);
-  __sync_fetch_and_add((volatile uint32_t*)&klists[prev.key].kcount, 1); // kcount++
-  num_novel_kmers += !found;
-
-  for(i = kmer_size; i < len; i++, prev = curr)
-  {
-    nuc = dna_char_to_nuc(seq[i]);
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    curr = db_graph_find_or_add_node_mt(db_graph, bkmer, &found);
-    __sync_fetch_and_add((volatile uint32_t*)&klists[curr.key].kcount, 1); // kcount++
-    db_graph_add_edge_mt(db_graph, 0, prev, curr);
-    num_novel_kmers += !found;
-  }
-
-  return num_novel_kmers;
+  KONodeList *klists = (KONodeList*)arg;
+  __sync_fetch_and_add((volatile uint32_t*)&klists[hkey].kcount, 1); // kcount++
 }
 
+struct RefBatchLoader {
+  const read_t *reads;
+  size_t num_reads, idx, num_threads;
+  KONodeList *klists;
+  dBGraph *db_graph;
+};
+
 // Add missing kmers and edges to the graph whilst keeping track of the count
 // of how many times each kmer in the graph is seen in sequence (with klists)
-// Returns number of kmers added to the graph
-// Threadsafe
-static inline size_t add_ref_read_to_graph_mt(const read_t *r,
-                                              KONodeList *klists,
-                                              dBGraph *db_graph)
+// Kmers are inserted in batches sorted by hash bucket, see kmer_batch.h
+// Multithreaded: each thread takes every num_threads-th read
+static void load_ref_reads_batched(void *arg)
 {
+  const struct RefBatchLoader *ldr = (const struct RefBatchLoader*)arg;
+  dBGraph *db_graph = ldr->db_graph;
   const size_t kmer_size = db_graph->kmer_size;
-  size_t contig_start, contig_end, contig_len;
-  size_t search_start = 0, num_novel_kmers = 0;
+  size_t i, contig_start, contig_end, search_start;
+  const read_t *r;
+  KmerBatch kbatch;
 
-  if(r->seq.end < kmer_size) return 0;
+  kmer_batch_alloc(&kbatch, KMER_BATCH_SIZE, 0,
+                   ref_kmer_update_count, ldr->klists, db_graph);
 
-  while((contig_start = seq_contig_start(r, search_start, kmer_size,
-                                         0, 0)) < r->seq.end)
+  for(i = ldr->idx; i < ldr->num_reads; i += ldr->num_threads)
   {
-    contig_end = seq_contig_end(r, contig_start, kmer_size, 0, 0, &search_start);
+    r = &ldr->reads[i];
+    search_start = 0;
 
-    contig_len = contig_end - contig_start;
-    num_novel_kmers += add_ref_seq_to_graph_mt(r->seq.b+contig_start, contig_len,
-                                               klists, db_graph);
+    while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                           0, 0)) < r->seq.end)
+    {
+      contig_end = seq_contig_end(r, contig_start, kmer_size, 0, 0,
+                                  &search_start);
+      kmer_batch_add_str(&kbatch, r->seq.b+contig_start,
+                         contig_end - contig_start);
+    }
   }
 
-  return num_novel_kmers;
+  kmer_batch_flush(&kbatch);
+  kmer_batch_dealloc(&kbatch);
 }
 
-// Same as above but don't add missing kmers
+// Count occurances of kmers already in the graph
 // Threadsafe
 static inline void bkmer_update_counts_find_mt(BinaryKmer bkmer,
                                                KONodeList *klists,
@@ -200,25 +194,16 @@ static inline void bkmer_update_counts_find_mt(BinaryKmer bkmer,
 struct ReadUpdateCounts {
   const read_t *r;
   KONodeList *klists;
-  bool add_missing_kmers;
   dBGraph *db_graph;
 };
 
 // Multithreaded core function to store kmer occurances
-// Also adds read to the graph if `add_missing_kmers` is true
 static void read_update_counts(void *arg)
 {
   struct ReadUpdateCounts data = *(struct ReadUpdateCounts*)arg;
-  const read_t *r = data.r;
-
-  if(data.add_missing_kmers) {
-    add_ref_read_to_graph_mt(r, data.klists, data.db_graph);
-  }
-  else {
-    LoadingStats stats = LOAD_STATS_INIT_MACRO;
-    READ_TO_BKMERS(r, data.db_graph->kmer_size, 0, 0, &stats,
-                   bkmer_update_counts_find_mt, data.klists, data.db_graph);
-  }
+  LoadingStats stats = LOAD_STATS_INIT_MACRO;
+  READ_TO_BKMERS(data.r, data.db_graph->kmer_size, 0, 0, &stats,
+                 bkmer_update_counts_find_mt, data.klists, data.db_graph);
 }
 
 static void bkmer_store_kmer_pos(BinaryKmer bkmer, KONodeList *klists,
@@ -257,16 +242,37 @@ static void load_reads_count_kmers(const read_t *reads, size_t num_reads,
 {
   if(!num_reads) return;
 
-  // 1. Loop through reads, add to graph and record kmer counts
-  struct ReadUpdateCounts *updates;
   size_t i;
 
+  // 1. Loop through reads, add to graph and record kmer counts
+  if(add_missing_kmers) {
+    num_threads = MIN2(num_threads, num_reads);
+    struct RefBatchLoader *loaders;
+    loaders = ctx_malloc(num_threads * sizeof(struct RefBatchLoader));
+
+    for(i = 0; i < num_threads; i++) {
+      loaders[i] = (struct RefBatchLoader){.reads = reads,
+                                           .num_reads = num_reads,
+                                           .idx = i,
+                                           .num_threads = num_threads,
+                                           .klists = klists,
+                                           .db_graph = db_graph};
+    }
+
+    util_run_threads(loaders, num_threads, sizeof(struct RefBatchLoader),
+                     num_threads, load_ref_reads_batched);
+
+    ctx_free(loaders);
+    return;
+  }
+
+  // 1. Loop through reads, record counts of kmers already in the graph
+  struct ReadUpdateCounts *updates;
   updates = ctx_malloc(num_reads * sizeof(struct ReadUpdateCounts));
 
   for(i = 0; i < num_reads; i++) {
     updates[i] = (struct ReadUpdateCounts){.r = &reads[i],
                                            .klists = klists,
-                                           .add_missing_kmers = add_missing_kmers,
                                            .db_graph = db_graph};
   }
 
@@ -366,7 +372,351 @@ void kograph_free(KOGraph kograph)
   ctx_free(kograph.chrom_name_buf);
   ctx_free(kograph.chroms);
   ctx_free(kograph.klists);
-  ctx_free(kograph.koccurs);
+
+  if(kograph.mmap_ptr != NULL) {
+    if(munmap(kograph.mmap_ptr, kograph.mmap_len) == -1)
+      die("Cannot release mmap index file [%s]", strerror(errno));
+  }
+  else ctx_free(kograph.koccurs);
+}
+
+//
+// Reference index file
+//
+
+#define koidx_pad8(x) (((x)+7) & ~(size_t)7)
+
+// Bytes in index file, excluding the header
+static size_t kograph_index_size(const KOIndexHeader *hdr)
+{
+  return hdr->nchroms * sizeof(uint64_t) +
+         koidx_pad8(hdr->names_len) +
+         hdr->nkmers * (sizeof(BinaryKmer) + sizeof(uint64_t)) +
+         koidx_pad8(hdr->nkmers * sizeof(Edges)) +
+         hdr->nkoccurs * sizeof(KOccur);
+}
+
+// Edges between consecutive kmers of a contig, stored by hash entry
+static void ref_seq_edges(const char *seq, size_t len, Edges *edges,
+                          const dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmerIter kiter;
+  Nucleotide lhs_nuc, rhs_nuc;
+  dBNode prev, curr;
+  size_t i;
+
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+  binary_kmer_iter_add(&kiter, dna_char_to_nuc(seq[kmer_size-1]));
+  prev = db_graph_find_iter(db_graph, &kiter);
+
+  for(i = kmer_size; i < len; i++, prev = curr)
+  {
+    binary_kmer_iter_add(&kiter, dna_char_to_nuc(seq[i]));
+    curr = db_graph_find_iter(db_graph, &kiter);
+
+    // Same as db_graph_add_edge_mt()
+    if(prev.key != HASH_NOT_FOUND && curr.key != HASH_NOT_FOUND) {
+      lhs_nuc = db_node_get_first_nuc(prev, db_graph);
+      rhs_nuc = db_node_get_last_nuc(curr, db_graph);
+      edges[prev.key] = edges_set_edge(edges[prev.key], rhs_nuc, prev.orient);
+      edges[curr.key] = edges_set_edge(edges[curr.key],
+                                       dna_nuc_complement(lhs_nuc), !curr.orient);
+    }
+  }
+}
+
+static void ref_read_edges(const read_t *r, Edges *edges, const dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  size_t contig_start, contig_end, search_start = 0;
+
+  if(r->seq.end < kmer_size) return;
+
+  while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                         0, 0)) < r->seq.end)
+  {
+    contig_end = seq_contig_end(r, contig_start, kmer_size, 0, 0, &search_start);
+    ref_seq_edges(r->seq.b+contig_start, contig_end-contig_start,
+                  edges, db_graph);
+  }
+}
+
+static int hkeys_bkmer_cmp(const void *aa, const void *bb, void *arg)
+{
+  const hkey_t *a = (const hkey_t*)aa, *b = (const hkey_t*)bb;
+  const BinaryKmer *table = (const BinaryKmer*)arg;
+  return binary_kmers_cmp(table[*a], table[*b]);
+}
+
+static void koidx_fwrite(FILE *fout, const void *ptr, size_t size,
+                        const char *path)
+{
+  if(size && fwrite(ptr, 1, size, fout) != size)
+    die("Cannot write to index file: %s [%s]", path, strerror(errno));
+}
+
+static void koidx_write_padding(FILE *fout, size_t len, const char *path)
+{
+  const char zeros[8] = {0};
+  koidx_fwrite(fout, zeros, koidx_pad8(len) - len, path);
+}
+
+// Save a KOGraph built with kograph_create() with `reads`
+void kograph_save(KOGraph kograph, const read_t *reads, size_t num_reads,
+                  const char *path, const dBGraph *db_graph)
+{
+  ctx_assert(kograph.nchroms == num_reads);
+
+  size_t i, n, nkmers = 0, nkoccurs = 0, names_len = 0;
+  const KOccur *ko;
+  hkey_t hkey;
+
+  status("[KOGraph] Saving reference index to: %s", path);
+
+  // Get reference kmers sorted by kmer
+  for(i = 0; i < db_graph->ht.capacity; i++)
+    nkmers += (kograph.klists[i].first != NULL);
+
+  hkey_t *hkeys = ctx_malloc(nkmers * sizeof(hkey_t));
+  for(i = n = 0; i < db_graph->ht.capacity; i++)
+    if(kograph.klists[i].first != NULL)
+      hkeys[n++] = i;
+
+  sort_r(hkeys, nkmers, sizeof(hkey_t), hkeys_bkmer_cmp, db_graph->ht.table);
+
+  // Reference edges
+  Edges *edges = ctx_calloc(db_graph->ht.capacity, sizeof(Edges));
+  for(i = 0; i < num_reads; i++)
+    ref_read_edges(&reads[i], edges, db_graph);
+
+  for(i = 0; i < kograph.nchroms; i++)
+    names_len += strlen(kograph.chroms[i].name) + 1;
+
+  // Index of first KOccur of each kmer
+  uint64_t *kofirst = ctx_malloc(nkmers * sizeof(uint64_t));
+  for(i = 0; i < nkmers; i++) {
+    kofirst[i] = nkoccurs;
+    for(ko = kograph.klists[hkeys[i]].first; ko->next; ko++) {}
+    nkoccurs += ko - kograph.klists[hkeys[i]].first + 1;
+  }
+
+  KOIndexHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, KOGRAPH_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = KOGRAPH_INDEX_VERSION;
+  hdr.kmer_size = db_graph->kmer_size;
+  hdr.num_of_bitfields = NUM_BKMER_WORDS;
+  hdr.nchroms = kograph.nchroms;
+  hdr.nkmers = nkmers;
+  hdr.nkoccurs = nkoccurs;
+  hdr.names_len = names_len;
+
+  FILE *fout = futil_fopen_create(path, "w");
+
+  koidx_fwrite(fout, &hdr, sizeof(hdr), path);
+
+  for(i = 0; i < kograph.nchroms; i++) {
+    uint64_t len = kograph.chroms[i].length;
+    koidx_fwrite(fout, &len, sizeof(len), path);
+  }
+
+  for(i = 0; i < kograph.nchroms; i++) {
+    const char *name = kograph.chroms[i].name;
+    koidx_fwrite(fout, name, strlen(name)+1, path);
+  }
+  koidx_write_padding(fout, names_len, path);
+
+  for(i = 0; i < nkmers; i++)
+    koidx_fwrite(fout, &db_graph->ht.table[hkeys[i]], sizeof(BinaryKmer), path);
+
+  koidx_fwrite(fout, kofirst, nkmers * sizeof(uint64_t), path);
+
+  for(i = 0; i < nkmers; i++)
+    koidx_fwrite(fout, &edges[hkeys[i]], sizeof(Edges), path);
+  koidx_write_padding(fout, nkmers * sizeof(Edges), path);
+
+  for(i = 0; i < nkmers; i++) {
+    hkey = hkeys[i];
+    n = (i+1 < nkmers ? kofirst[i+1] : nkoccurs) - kofirst[i];
+    koidx_fwrite(fout, kograph.klists[hkey].first, n * sizeof(KOccur), path);
+  }
+
+  if(fout != stdout) fclose(fout);
+
+  char nkmers_str[50], nkoccurs_str[50];
+  ulong_to_str(nkmers, nkmers_str);
+  ulong_to_str(nkoccurs, nkoccurs_str);
+  status("[KOGraph]   %s kmers, %s occurrences, %zu chromosomes",
+         nkmers_str, nkoccurs_str, kograph.nchroms);
+
+  ctx_free(kofirst);
+  ctx_free(edges);
+  ctx_free(hkeys);
+}
+
+// die() if fatal, otherwise warn() and return false
+#define koidx_error(fatal,fmt,...) do {                                        \
+  if(fatal) die(fmt, ##__VA_ARGS__);                                           \
+  warn(fmt, ##__VA_ARGS__);                                                    \
+  return false;                                                                \
+} while(0)
+
+// Read and check the header of an index file and the file size
+bool kograph_index_read_header(const char *path, KOIndexHeader *hdr,
+                               bool fatal)
+{
+  FILE *fh = futil_fopen(path, "r");
+  size_t nread = fread(hdr, 1, sizeof(KOIndexHeader), fh);
+  fclose(fh);
+
+  if(nread != sizeof(KOIndexHeader))
+    koidx_error(fatal, "Reference index file is truncated: %s", path);
+  if(memcmp(hdr->magic, KOGRAPH_INDEX_MAGIC, sizeof(hdr->magic)) != 0)
+    koidx_error(fatal, "Not a reference index file: %s", path);
+  if(hdr->version != KOGRAPH_INDEX_VERSION) {
+    koidx_error(fatal, "Reference index version %u not supported [%s]",
+                hdr->version, path);
+  }
+  if(hdr->num_of_bitfields != NUM_BKMER_WORDS) {
+    koidx_error(fatal, "Reference index built with maxk=%u, this is maxk=%i "
+                "[%s]", hdr->num_of_bitfields*32-1, MAX_KMER_SIZE, path);
+  }
+  if(hdr->nchroms > KMER_OCCUR_MAX_CHROMS)
+    koidx_error(fatal, "Reference index has too many chromosomes [%s]", path);
+
+  off_t file_len = futil_get_file_size(path);
+  if(file_len < 0 ||
+     (size_t)file_len != sizeof(KOIndexHeader) + kograph_index_size(hdr))
+    koidx_error(fatal, "Reference index file is corrupt or truncated: %s", path);
+
+  return true;
+}
+
+typedef struct
+{
+  const BinaryKmer *bkmers;
+  const uint64_t *kofirst;
+  const Edges *edges;
+  KOccur *koccurs;
+  size_t start, end;
+  bool add_missing_kmers;
+  KONodeList *klists;
+  dBGraph *db_graph;
+} KOIndexAttach;
+
+// Look up a block of index kmers in the graph
+static void kograph_attach_kmers(void *arg)
+{
+  const KOIndexAttach *job = (const KOIndexAttach*)arg;
+  dBGraph *db_graph = job->db_graph;
+  bool add_edges = job->add_missing_kmers && db_graph->col_edges != NULL;
+  hkey_t hkey;
+  bool found;
+  size_t i;
+
+  for(i = job->start; i < job->end; i++)
+  {
+    if(job->add_missing_kmers)
+      hkey = hash_table_find_or_insert_mt(&db_graph->ht, job->bkmers[i],
+                                          &found, db_graph->bktlocks);
+    else
+      hkey = hash_table_find(&db_graph->ht, job->bkmers[i]);
+
+    if(hkey != HASH_NOT_FOUND) {
+      job->klists[hkey].first = job->koccurs + job->kofirst[i];
+      if(add_edges)
+        __sync_or_and_fetch(&db_node_edges(db_graph, hkey, 0), job->edges[i]);
+    }
+  }
+}
+
+// Memory map an index file and attach it to the graph
+KOGraph kograph_load(const char *path, bool add_missing_kmers,
+                     size_t num_threads, dBGraph *db_graph)
+{
+  KOIndexHeader hdr;
+  size_t i;
+
+  ctx_assert(!add_missing_kmers || db_graph->num_edge_cols <= 1);
+  ctx_assert(!add_missing_kmers || db_graph->bktlocks != NULL);
+
+  kograph_index_read_header(path, &hdr, true);
+
+  if(hdr.kmer_size != db_graph->kmer_size) {
+    die("Reference index kmer size does not match graph (%u vs %zu) [%s]",
+        hdr.kmer_size, db_graph->kmer_size, path);
+  }
+
+  status("[KOGraph] Loading reference index from: %s", path);
+
+  const size_t file_len = sizeof(KOIndexHeader) + kograph_index_size(&hdr);
+
+  FILE *fh = futil_fopen(path, "r");
+  void *mmap_ptr = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE, fileno(fh), 0);
+  if(mmap_ptr == MAP_FAILED)
+    die("Cannot memory map file: %s [%s]", path, strerror(errno));
+  fclose(fh);
+
+  // Find each section
+  char *ptr = (char*)mmap_ptr + sizeof(KOIndexHeader);
+  const uint64_t *chrom_lens = (const uint64_t*)ptr;
+  ptr += hdr.nchroms * sizeof(uint64_t);
+  const char *names = ptr;
+  ptr += koidx_pad8(hdr.names_len);
+  const BinaryKmer *bkmers = (const BinaryKmer*)ptr;
+  ptr += hdr.nkmers * sizeof(BinaryKmer);
+  const uint64_t *kofirst = (const uint64_t*)ptr;
+  ptr += hdr.nkmers * sizeof(uint64_t);
+  const Edges *edges = (const Edges*)ptr;
+  ptr += koidx_pad8(hdr.nkmers * sizeof(Edges));
+  KOccur *koccurs = (KOccur*)ptr;
+
+  if(hdr.names_len > 0 && names[hdr.names_len-1] != '\0')
+    die("Reference index file is corrupt: %s", path);
+
+  KOGraph kograph;
+  memset(&kograph, 0, sizeof(KOGraph));
+
+  kograph.mmap_ptr = mmap_ptr;
+  kograph.mmap_len = file_len;
+  kograph.nchroms = hdr.nchroms;
+  kograph.koccurs = koccurs;
+  kograph.chroms = ctx_malloc(hdr.nchroms * sizeof(KOChrom));
+
+  for(i = 0; i < hdr.nchroms; i++) {
+    kograph.chroms[i] = (KOChrom){.id = i,
+                                  .length = chrom_lens[i],
+                                  .name = names};
+    names += strlen(names) + 1;
+  }
+
+  kograph.klists = ctx_calloc(db_graph->ht.capacity, sizeof(KONodeList));
+
+  // Attach kmers to the graph in a single pass over the index
+  KOIndexAttach *jobs = ctx_calloc(num_threads, sizeof(KOIndexAttach));
+  for(i = 0; i < num_threads; i++) {
+    jobs[i] = (KOIndexAttach){.bkmers = bkmers, .kofirst = kofirst,
+                              .edges = edges, .koccurs = koccurs,
+                              .start = (hdr.nkmers * i) / num_threads,
+                              .end = (hdr.nkmers * (i+1)) / num_threads,
+                              .add_missing_kmers = add_missing_kmers,
+                              .klists = kograph.klists,
+                              .db_graph = db_graph};
+  }
+
+  util_run_threads(jobs, num_threads, sizeof(KOIndexAttach),
+                   num_threads, kograph_attach_kmers);
+
+  ctx_free(jobs);
+
+  char nkmers_str[50], nkoccurs_str[50];
+  ulong_to_str(hdr.nkmers, nkmers_str);
+  ulong_to_str(hdr.nkoccurs, nkoccurs_str);
+  status("[KOGraph]   %s kmers, %s occurrences, %zu chromosomes",
+         nkmers_str, nkoccurs_str, (size_t)hdr.nchroms);
+
+  return kograph;
 }
 
 
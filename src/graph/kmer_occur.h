@@ -38,8 +38,35 @@ typedef struct
   KONodeList *klists; // one entry per hash entry
   size_t nchroms;
   char *chrom_name_buf;
+  // Only set if loaded from an index file, then koccurs and chrom names
+  // point into the memory mapped file
+  void *mmap_ptr;
+  size_t mmap_len;
 } KOGraph;
 
+//
+// Reference index file
+//
+// A KOGraph can be saved to disk and memory mapped back in so that the
+// reference does not need to be parsed again. Layout (8 byte aligned):
+//   KOIndexHeader
+//   uint64_t  chrom_lens[nchroms]
+//   char      chrom_names[names_len] (NUL terminated names), padded to 8 bytes
+//   BinaryKmer bkmers[nkmers]        (sorted kmer keys)
+//   uint64_t  kofirst[nkmers]        (index of first KOccur of each kmer)
+//   Edges     edges[nkmers]          (edges in the reference), padded
+//   KOccur    koccurs[nkoccurs]
+//
+#define KOGRAPH_INDEX_MAGIC "CTXKOIDX"
+#define KOGRAPH_INDEX_VERSION 1
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version, kmer_size, num_of_bitfields, padding;
+  uint64_t nchroms, nkmers, nkoccurs, names_len;
+} KOIndexHeader;
+
 typedef struct {
   uint64_t first, last; // 0-bases chromosome coordinates
   uint32_t qoffset, chrom; // qoffset some query offset
@@ -52,13 +79,30 @@ typedef struct {
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(kmer_run_buf, KOccurRunBuffer, KOccurRun);
 
-// We add the reads to the graph if `add_missing_kmers` is true
+// We add the reads to the graph if `add_missing_kmers` is true, using an extra
+// kmer_batch_mem(KMER_BATCH_SIZE) bytes per thread
 KOGraph kograph_create(const read_t *reads, size_t num_reads,
                        bool add_missing_kmers, size_t num_threads,
                        dBGraph *db_graph);
 
 void kograph_free(KOGraph kograph);
 
+// Save a KOGraph built with kograph_create() with `reads`. Also stores edges
+// between reference kmers, so the reference can be added to another graph.
+void kograph_save(KOGraph kograph, const read_t *reads, size_t num_reads,
+                  const char *path, const dBGraph *db_graph);
+
+// Read and check the header of an index file and the file size. If not valid,
+// dies if `fatal`, otherwise prints a warning and returns false.
+bool kograph_index_read_header(const char *path, KOIndexHeader *hdr,
+                               bool fatal);
+
+// Memory map an index file and attach it to the graph. Reference kmers and
+// edges are added to the graph (edges in colour 0) if `add_missing_kmers`.
+// Graph must have the same kmer size and MAXK as when the index was saved.
+KOGraph kograph_load(const char *path, bool add_missing_kmers,
+                     size_t num_threads, dBGraph *db_graph);
+
 // Get KOccur* to first occurance of a kmer in sequence
 #define kograph_get(kograph,hkey) ((kograph).klists[hkey].first)
 
@@ -92,13 +136,15 @@ void korun_print(KOccurRun run, size_t kmer_size, FILE *fout);
 // Mostly used for debugging
 void koruns_print(KOccurRun *run, size_t n, size_t kmer_size, FILE *fout);
 
-void korun_gzprint(gzFile gzout, size_t kmer_size,
-                   KOGraph kograph, KOccurRun korun,
-                   size_t first_kmer_idx, size_t kmer_offset);
+// Append comma separated runs to a string buffer
+//   e.g. "chromid:1:17-5:-:1,chromid:1:37-47:+:1"
+void korun_sprint(StrBuf *sbuf, size_t kmer_size,
+                  KOGraph kograph, KOccurRun korun,
+                  size_t first_kmer_idx, size_t kmer_offset);
 
-void koruns_gzprint(gzFile gzout, size_t kmer_size, KOGraph kograph,
-                    const KOccurRun *koruns, size_t n,
-                    size_t first_kmer_idx, size_t kmer_offset);
+void koruns_sprint(StrBuf *sbuf, size_t kmer_size, KOGraph kograph,
+                   const KOccurRun *koruns, size_t n,
+                   size_t first_kmer_idx, size_t kmer_offset);
 
 // src, dst can point to the same place
 // returns number of elements added
@@ -0,0 +1,167 @@
+#include "global.h"
+#include "node_cache.h"
+#include "util.h"
+
+#include "htslib/khash.h"
+
+static inline size_t node_cache_hash(const NodeCache *nc, const NodeCacheKey *key)
+{
+  uint64_t h = key->w[0] ^ (key->w[1] << 7) ^ (key->w[2] << 13);
+  return kh_int64_hash_func(h) & nc->mask;
+}
+
+#define node_cache_keys_equal(a,b) \
+        (memcmp((a)->w, (b)->w, sizeof(NodeCacheKey)) == 0)
+
+size_t node_cache_alloc(NodeCache *nc, size_t mem_in_bytes,
+                        size_t bucket_size, size_t bucket_nodes)
+{
+  ctx_assert(bucket_size > 0 && bucket_size <= UINT8_MAX);
+
+  // Number of buckets must be a power of two
+  size_t num_bkts = 1;
+  while(node_cache_mem(num_bkts*2, bucket_size, bucket_nodes) <= mem_in_bytes)
+    num_bkts *= 2;
+
+  const size_t cap_entries = num_bkts * bucket_size;
+
+  NodeCache tmp = {.entries = ctx_calloc(cap_entries, sizeof(NodeCacheEntry)),
+                   .nodes = ctx_malloc(num_bkts * bucket_nodes * sizeof(dBNode)),
+                   .bkt_nnodes = ctx_calloc(num_bkts, sizeof(uint32_t)),
+                   .bkt_hand = ctx_calloc(num_bkts, sizeof(uint8_t)),
+                   .bktlocks = ctx_calloc(roundup_bits2bytes(num_bkts), 1),
+                   .num_of_buckets = num_bkts,
+                   .mask = num_bkts - 1,
+                   .bucket_size = bucket_size,
+                   .bucket_nodes = bucket_nodes,
+                   .num_inserts = 0, .num_evicted = 0};
+
+  memcpy(nc, &tmp, sizeof(NodeCache));
+  return cap_entries;
+}
+
+void node_cache_dealloc(NodeCache *nc)
+{
+  ctx_free(nc->entries);
+  ctx_free(nc->nodes);
+  ctx_free(nc->bkt_nnodes);
+  ctx_free(nc->bkt_hand);
+  ctx_free(nc->bktlocks);
+  memset(nc, 0, sizeof(NodeCache));
+}
+
+bool node_cache_fetch(NodeCache *nc, const NodeCacheKey *key,
+                      dBNodeBuffer *nbuf, void *data, size_t datalen)
+{
+  ctx_assert(datalen <= NODE_CACHE_DATA_BYTES);
+
+  const size_t hash = node_cache_hash(nc, key);
+  NodeCacheEntry *entry = nc->entries + hash * nc->bucket_size;
+  NodeCacheEntry *end = entry + nc->bucket_size;
+  const dBNode *bkt_nodes = nc->nodes + hash * nc->bucket_nodes;
+  bool found = false;
+
+  bitlock_yield_acquire(nc->bktlocks, hash);
+
+  for(; entry < end; entry++) {
+    if(entry->used && node_cache_keys_equal(&entry->key, key)) {
+      db_node_buf_push(nbuf, bkt_nodes + entry->offset, entry->num_nodes);
+      if(datalen) memcpy(data, entry->data, datalen);
+      entry->recent = 1;
+      found = true;
+      break;
+    }
+  }
+
+  bitlock_release(nc->bktlocks, hash);
+
+  return found;
+}
+
+// Remove an entry, shifting nodes of later entries down to fill the gap
+// Must hold the bucket lock
+static void _node_cache_evict(NodeCache *nc, size_t hash, NodeCacheEntry *victim)
+{
+  NodeCacheEntry *entry = nc->entries + hash * nc->bucket_size;
+  NodeCacheEntry *end = entry + nc->bucket_size;
+  dBNode *bkt_nodes = nc->nodes + hash * nc->bucket_nodes;
+  uint32_t offset = victim->offset, len = victim->num_nodes;
+  uint32_t nnodes = nc->bkt_nnodes[hash];
+
+  memmove(bkt_nodes + offset, bkt_nodes + offset + len,
+          (nnodes - offset - len) * sizeof(dBNode));
+
+  for(; entry < end; entry++)
+    if(entry->used && entry->offset > offset)
+      entry->offset -= len;
+
+  nc->bkt_nnodes[hash] -= len;
+  memset(victim, 0, sizeof(NodeCacheEntry));
+  __sync_fetch_and_add((volatile size_t*)&nc->num_evicted, 1);
+}
+
+// Advance the CLOCK hand to the next entry without its reference bit set
+// Must hold the bucket lock
+static NodeCacheEntry* _node_cache_victim(NodeCache *nc, size_t hash)
+{
+  NodeCacheEntry *entries = nc->entries + hash * nc->bucket_size;
+  NodeCacheEntry *entry;
+
+  while(1) {
+    entry = &entries[nc->bkt_hand[hash]];
+    nc->bkt_hand[hash] = (nc->bkt_hand[hash] + 1) % nc->bucket_size;
+    if(entry->used) {
+      if(!entry->recent) return entry;
+      entry->recent = 0;
+    }
+  }
+}
+
+void node_cache_add(NodeCache *nc, const NodeCacheKey *key,
+                    const dBNode *nodes, size_t num_nodes,
+                    const void *data, size_t datalen)
+{
+  ctx_assert(datalen <= NODE_CACHE_DATA_BYTES);
+  if(num_nodes > nc->bucket_nodes) return;
+
+  const size_t hash = node_cache_hash(nc, key);
+  NodeCacheEntry *entries = nc->entries + hash * nc->bucket_size;
+  dBNode *bkt_nodes = nc->nodes + hash * nc->bucket_nodes;
+  NodeCacheEntry *entry = NULL;
+  size_t i;
+
+  bitlock_yield_acquire(nc->bktlocks, hash);
+
+  for(i = 0; i < nc->bucket_size; i++) {
+    if(!entries[i].used) entry = &entries[i];
+    else if(node_cache_keys_equal(&entries[i].key, key)) break; // already added
+  }
+
+  if(i == nc->bucket_size)
+  {
+    // Evict until we have a free entry and room for the nodes
+    while(entry == NULL ||
+          nc->bkt_nnodes[hash] + num_nodes > nc->bucket_nodes)
+    {
+      NodeCacheEntry *victim = _node_cache_victim(nc, hash);
+      _node_cache_evict(nc, hash, victim);
+      if(entry == NULL) entry = victim;
+    }
+
+    NodeCacheEntry tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.key = *key;
+    if(datalen) memcpy(tmp.data, data, datalen);
+    tmp.offset = nc->bkt_nnodes[hash];
+    tmp.num_nodes = num_nodes;
+    tmp.used = 1;
+
+    memcpy(bkt_nodes + tmp.offset, nodes, num_nodes * sizeof(dBNode));
+    nc->bkt_nnodes[hash] += num_nodes;
+    *entry = tmp;
+
+    __sync_fetch_and_add((volatile size_t*)&nc->num_inserts, 1);
+  }
+
+  bitlock_release(nc->bktlocks, hash);
+}
@@ -0,0 +1,79 @@
+#ifndef NODE_CACHE_H_
+#define NODE_CACHE_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+
+//
+// Bounded cache of node lists shared between threads
+//
+// Used by SnodeCache (supernodes) and GapMemo (filled read gaps). Each entry
+// has a fixed size key, a list of nodes and a few bytes of data for the
+// caller.
+//
+// The table is split into buckets, each protected by a bit lock. Each bucket
+// has a fixed number of entries and a fixed number of nodes, so memory use is
+// bounded. When a bucket is full, entries are evicted with the CLOCK algorithm
+// (second chance: entries hit since the hand last passed are skipped once).
+//
+
+#define NODE_CACHE_KEY_WORDS 3
+#define NODE_CACHE_DATA_BYTES 20
+
+typedef struct
+{
+  uint64_t w[NODE_CACHE_KEY_WORDS];
+} NodeCacheKey;
+
+typedef struct
+{
+  NodeCacheKey key;
+  uint8_t data[NODE_CACHE_DATA_BYTES]; // stored for the caller
+  uint32_t offset, num_nodes;
+  uint8_t used, recent; // recent is the CLOCK reference bit
+} NodeCacheEntry;
+
+typedef struct
+{
+  NodeCacheEntry *const entries;
+  dBNode *const nodes;
+  uint32_t *const bkt_nnodes; // nodes used in each bucket
+  uint8_t *const bkt_hand; // CLOCK hand in each bucket
+  uint8_t *const bktlocks;
+  const size_t num_of_buckets, mask;
+  const size_t bucket_size, bucket_nodes; // entries, nodes per bucket
+  // Statistics
+  size_t num_inserts, num_evicted;
+} NodeCache;
+
+// Memory used for a given number of buckets
+#define node_cache_mem(nbkts,bktsize,bktnodes) \
+        ((nbkts) * ((bktsize)*sizeof(NodeCacheEntry) + \
+                    (bktnodes)*sizeof(dBNode) + \
+                    sizeof(uint32_t) + sizeof(uint8_t)) + \
+         roundup_bits2bytes(nbkts))
+
+// Returns number of entries
+size_t node_cache_alloc(NodeCache *nc, size_t mem_in_bytes,
+                        size_t bucket_size, size_t bucket_nodes);
+
+void node_cache_dealloc(NodeCache *nc);
+
+// Pack a node into a key word
+#define node_cache_word(node) (((uint64_t)(node).key << 1) | (node).orient)
+
+// Look up `key`. If found, appends nodes to `nbuf` and copies `datalen` bytes
+// of data into `data`.
+// Thread safe.
+// Returns true if found
+bool node_cache_fetch(NodeCache *nc, const NodeCacheKey *key,
+                      dBNodeBuffer *nbuf, void *data, size_t datalen);
+
+// Add an entry. May evict other entries.
+// Entries with more than bucket_nodes nodes are not stored.
+// Thread safe.
+void node_cache_add(NodeCache *nc, const NodeCacheKey *key,
+                    const dBNode *nodes, size_t num_nodes,
+                    const void *data, size_t datalen);
+
+#endif /* NODE_CACHE_H_ */
@@ -0,0 +1,65 @@
+#include "global.h"
+#include "snode_cache.h"
+#include "util.h"
+
+static inline NodeCacheKey snode_cache_key(dBNode node)
+{
+  NodeCacheKey key = {.w = {node_cache_word(node), 0, 0}};
+  return key;
+}
+
+void snode_cache_alloc(SnodeCache *snc, size_t mem_in_bytes)
+{
+  memset(snc, 0, sizeof(SnodeCache));
+  size_t cap_entries = node_cache_alloc(&snc->nc, mem_in_bytes,
+                                        SNODE_CACHE_BUCKET_SIZE,
+                                        SNODE_CACHE_BUCKET_NODES);
+  size_t num_bkts = snc->nc.num_of_buckets;
+
+  char cap_str[50], nodes_str[50], mem_str[50];
+  ulong_to_str(cap_entries, cap_str);
+  ulong_to_str(num_bkts * SNODE_CACHE_BUCKET_NODES, nodes_str);
+  bytes_to_str(snode_cache_mem(num_bkts), 1, mem_str);
+  status("[SnodeCache] Allocating cache of %s supernodes / %s kmers, using %s",
+         cap_str, nodes_str, mem_str);
+}
+
+void snode_cache_dealloc(SnodeCache *snc)
+{
+  node_cache_dealloc(&snc->nc);
+  memset(snc, 0, sizeof(SnodeCache));
+}
+
+bool snode_cache_fetch(SnodeCache *snc, dBNode node, dBNodeBuffer *nbuf)
+{
+  NodeCacheKey key = snode_cache_key(node);
+  return node_cache_fetch(&snc->nc, &key, nbuf, NULL, 0);
+}
+
+void snode_cache_add(SnodeCache *snc, dBNode node,
+                     const dBNode *nodes, size_t num_nodes)
+{
+  if(num_nodes == 0) return;
+  NodeCacheKey key = snode_cache_key(node);
+  node_cache_add(&snc->nc, &key, nodes, num_nodes, NULL, 0);
+}
+
+void snode_cache_add_stats(SnodeCache *snc, size_t num_lookups, size_t num_hits)
+{
+  snc->num_lookups += num_lookups;
+  snc->num_hits += num_hits;
+}
+
+void snode_cache_print_stats(const SnodeCache *snc)
+{
+  char lookups_str[50], hits_str[50], inserts_str[50], evicted_str[50];
+  ulong_to_str(snc->num_lookups, lookups_str);
+  ulong_to_str(snc->num_hits, hits_str);
+  ulong_to_str(snc->nc.num_inserts, inserts_str);
+  ulong_to_str(snc->nc.num_evicted, evicted_str);
+
+  status("[SnodeCache] hits: %s / %s lookups [%.2f%%]; added: %s evicted: %s",
+         hits_str, lookups_str,
+         snc->num_lookups ? (100.0 * snc->num_hits) / snc->num_lookups : 0.0,
+         inserts_str, evicted_str);
+}
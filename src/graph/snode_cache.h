@@ -0,0 +1,58 @@
+#ifndef SNODE_CACHE_H_
+#define SNODE_CACHE_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "node_cache.h"
+
+//
+// Bounded supernode cache shared between threads
+//
+// GraphCache is private to a thread and reset after each fork node, so in
+// repeat-dense regions the same supernodes are rebuilt many times. SnodeCache
+// remembers supernodes (normalised, as built by GraphCache) keyed by the node
+// they were fetched from, and is shared by all threads. Storage and eviction
+// are handled by NodeCache.
+//
+// Only valid whilst the graph is not modified.
+//
+
+typedef struct
+{
+  NodeCache nc;
+  // Statistics, counted by each thread and added with snode_cache_add_stats()
+  size_t num_lookups, num_hits;
+} SnodeCache;
+
+#define SNODE_CACHE_BUCKET_SIZE 8
+#define SNODE_CACHE_BUCKET_NODES 512
+
+// Default memory used by the cache
+#define SNODE_CACHE_DEFAULT_MEM (16UL<<20)
+
+// Memory used for a given number of buckets
+#define snode_cache_mem(nbkts) \
+        node_cache_mem(nbkts, SNODE_CACHE_BUCKET_SIZE, SNODE_CACHE_BUCKET_NODES)
+
+void snode_cache_alloc(SnodeCache *snc, size_t mem_in_bytes);
+void snode_cache_dealloc(SnodeCache *snc);
+
+// Look up supernode fetched from `node`. If found, appends nodes to `nbuf`.
+// Does not count lookups, callers keep their own counts to avoid contention.
+// Thread safe.
+// Returns true if found
+bool snode_cache_fetch(SnodeCache *snc, dBNode node, dBNodeBuffer *nbuf);
+
+// Add supernode fetched from `node`. May evict other supernodes.
+// Supernodes longer than SNODE_CACHE_BUCKET_NODES are not stored.
+// Thread safe.
+void snode_cache_add(SnodeCache *snc, dBNode node,
+                     const dBNode *nodes, size_t num_nodes);
+
+// Add lookups/hits counted by a thread. Not thread safe.
+void snode_cache_add_stats(SnodeCache *snc, size_t num_lookups, size_t num_hits);
+
+// Print hit rate
+void snode_cache_print_stats(const SnodeCache *snc);
+
+#endif /* SNODE_CACHE_H_ */
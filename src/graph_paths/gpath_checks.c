@@ -360,7 +360,7 @@ static int _kmer_check_paths(hkey_t hkey, const dBGraph *db_graph,
   size_t num_gpaths = 0;
   GPath *gpath;
 
-  for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = gpath->next)
+  for(gpath = gpath_store_fetch(gpstore, hkey); gpath != NULL; gpath = gpath->next)
   {
     ctx_assert_ret(gpath_checks_path(hkey, gpath, db_graph));
     num_gpaths++;
@@ -416,7 +416,7 @@ bool gpath_checks_all_paths(const dBGraph *db_graph, size_t nthreads)
   }
   ctx_free(checkers);
 
-  size_t act_num_gpaths = db_graph->gpstore.gpset.entries.len;
+  size_t act_num_gpaths = db_graph->gpstore.gpset.num_paths;
   size_t act_num_kmers = db_graph->gpstore.num_kmers_with_paths;
 
   ctx_assert_ret2(num_gpaths == act_num_gpaths, "%zu vs %zu", num_gpaths, act_num_gpaths);
@@ -457,6 +457,6 @@ void gpath_checks_counts(const dBGraph *db_graph)
               nvisited, (size_t)db_graph->ht.num_kmers);
   ctx_assert2(nkmers == gpstore->num_kmers_with_paths, "%zu vs %zu",
               nkmers, (size_t)gpstore->num_kmers_with_paths);
-  ctx_assert2(npaths == gpstore->gpset.entries.len, "%zu vs %zu",
-              npaths, (size_t)gpstore->gpset.entries.len);
+  ctx_assert2(npaths == gpstore->gpset.num_paths, "%zu vs %zu",
+              npaths, (size_t)gpstore->gpset.num_paths);
 }
@@ -335,7 +335,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
     intocol = file_filter_intocol(fltr, i);
     counts->b[offset+intocol] += counts->b[fromcol];
   }
-  memcpy(counts->b, counts->b+offset, num_into);
+  memmove(counts->b, counts->b+offset, num_into * sizeof(counts->b[0]));
   counts->len = num_into;
 
   // 4:[juncs:ACAGA]
@@ -394,19 +394,12 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
 }
 
 /**
- * Reads line [FR] <num_links>
- * Calls die() on error
- * @param seq return seq=... optional entry (ignored if NULL)
- * @param seq return juncpos=... optional entry (ignored if NULL)
+ * Reads a link line without parsing it, parse with link_line_parse()
  * @return true unless end of link entries
  */
-bool gpath_reader_read_link(GPathReader *file,
-                            bool *fw, size_t *njuncs,
-                            SizeBuffer *countbuf, StrBuf *juncs,
-                            StrBuf *seq, SizeBuffer *juncpos)
+bool gpath_reader_read_link_line(GPathReader *file, StrBuf *line)
 {
   int c;
-  StrBuf *line = &file->line;
   strbuf_reset(line);
 
   while((c = gzgetc_buf(file->gz, &file->strmbuf)) != -1)
@@ -421,9 +414,6 @@ bool gpath_reader_read_link(GPathReader *file,
       strbuf_append_char(line, c);
       strbuf_gzreadline_buf(line, file->gz, &file->strmbuf);
       strbuf_chomp(line);
-      link_line_parse(line, file->version, &file->fltr,
-                      fw, njuncs, countbuf, juncs,
-                      seq, juncpos);
       return true;
     }
   }
@@ -431,6 +421,26 @@ bool gpath_reader_read_link(GPathReader *file,
   return false;
 }
 
+/**
+ * Reads line [FR] <num_links>
+ * Calls die() on error
+ * @param seq return seq=... optional entry (ignored if NULL)
+ * @param seq return juncpos=... optional entry (ignored if NULL)
+ * @return true unless end of link entries
+ */
+bool gpath_reader_read_link(GPathReader *file,
+                            bool *fw, size_t *njuncs,
+                            SizeBuffer *countbuf, StrBuf *juncs,
+                            StrBuf *seq, SizeBuffer *juncpos)
+{
+  if(!gpath_reader_read_link_line(file, &file->line)) return false;
+
+  link_line_parse(&file->line, file->version, &file->fltr,
+                  fw, njuncs, countbuf, juncs,
+                  seq, juncpos);
+  return true;
+}
+
 static hkey_t find_link_kmer(BinaryKmer bkey, int flags,
                              const char *path, dBGraph *db_graph)
 {
@@ -489,7 +499,8 @@ static size_t _load_paths_from_set(dBGraph *db_graph, GPathSet *gpset,
   if(db_graph_has_path_hash(db_graph)) {
     for(i = 0; i < subset1->list.len; i++) {
       newgp = gpath_set_get(gpset, subset1->list.b[i]);
-      gpath_hash_find_or_insert_mt(gphash, hkey, newgp, &found);
+      // Paths are loaded by a single thread
+      gpath_hash_find_or_insert_mt(gphash, hkey, newgp, &found, &gphash->stats);
     }
   } else {
     for(i = 0; i < subset1->list.len; i++) {
@@ -519,7 +530,8 @@ void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
 
   // Load paths into this temporary set for each kmer
   GPathSet gpset;
-  gpath_set_alloc(&gpset, db_graph->num_of_cols, ONE_MEGABYTE, true, true);
+  gpath_set_alloc(&gpset, db_graph->num_of_cols, ONE_MEGABYTE,
+                  GPATH_SET_NO_MEM_LIMIT, true);
 
   GPathSubset subset0, subset1;
   gpath_subset_alloc(&subset0);
@@ -591,9 +603,9 @@ void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
     }
 
     num_links_seen += nlink;
-    num_kmers_loaded += (gpset.entries.len > 0);
+    num_kmers_loaded += (gpset.num_paths > 0);
 
-    if(gpset.entries.len > 0) {
+    if(gpset.num_paths > 0) {
       BinaryKmer bkey = binary_kmer_from_str(kmerstr.b, db_graph->kmer_size);
       hkey_t hkey = find_link_kmer(bkey, kmer_flags, path, db_graph);
 
@@ -669,7 +681,7 @@ void gpath_reader_max_mem_req(GPathReader *files, size_t nfiles,
   size_t max_npaths = 0, sum_npaths = 0, max_pbytes = 0, sum_pbytes = 0;
 
   path_bytes = sizeof(GPath) + (store_nseen ? sizeof(uint8_t)*ncols : 0);
-  hash_bytes = (use_hash ? sizeof(GPEntry)/IDEAL_OCCUPANCY : 0);
+  hash_bytes = (use_hash ? GPATH_HASH_ENTRY_MEM/IDEAL_OCCUPANCY : 0);
 
   for(i = 0; i < nfiles; i++) {
     size_t npaths = gpath_reader_get_num_paths(&files[i]);
@@ -705,7 +717,7 @@ size_t gpath_reader_sum_mem(GPathReader *files, size_t nfiles,
                path_bytes + // Sequence
                npaths * (ncols+7)/8 + // Colset
                npaths * (count_nseen ? ncols*sizeof(uint8_t) + sizeof(uint32_t) : 0) +
-               (npaths/IDEAL_OCCUPANCY) * (use_gphash ? sizeof(GPEntry) : 0);
+               (npaths/IDEAL_OCCUPANCY) * (use_gphash ? GPATH_HASH_ENTRY_MEM : 0);
 
     path_sum_mem += file_mem;
     max_file_mem = MAX2(max_file_mem, file_mem);
@@ -96,6 +96,10 @@ bool gpath_reader_read_link(GPathReader *file,
                             SizeBuffer *countbuf, StrBuf *juncs,
                             StrBuf *seq, SizeBuffer *juncpos);
 
+// Reads a link line without parsing it, parse with link_line_parse()
+// Returns true unless end of link entries
+bool gpath_reader_read_link_line(GPathReader *file, StrBuf *line);
+
 
 //
 // Fetch information from header
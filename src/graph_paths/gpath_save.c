@@ -7,6 +7,8 @@
 #include "util.h"
 #include "json_hdr.h"
 
+#include "sort_r/sort_r.h"
+
 const char ctp_explanation_comment[] =
 "# This file was generated with McCortex\n"
 "#   written by Isaac Turner <turner.isaac@gmail.com>\n"
@@ -66,13 +68,30 @@ cJSON* gpath_save_mkhdr(const char *path,
                         const ZeroSizeBuffer *contig_hists, size_t ncols,
                         const dBGraph *db_graph)
 {
-  ctx_assert(!cmdstr == !cmdhdr);
-
   const GPathStore *gpstore = &db_graph->gpstore;
-  const GPathSet *gpset = &gpstore->gpset;
 
   // using json_hdr_make_std() assumes the following
-  ctx_assert(gpset->ncols == db_graph->num_of_cols);
+  ctx_assert(gpstore->gpset.ncols == db_graph->num_of_cols);
+
+  return gpath_save_mkhdr2(path, cmdstr, cmdhdr, hdrs, nhdrs,
+                           contig_hists, ncols,
+                           gpstore->num_kmers_with_paths, gpstore->num_paths,
+                           gpstore->path_bytes, db_graph);
+}
+
+/**
+ * As gpath_save_mkhdr() but link counts are passed rather than taken from
+ * db_graph->gpstore, for when links are written without being loaded
+ */
+cJSON* gpath_save_mkhdr2(const char *path,
+                         const char *cmdstr, cJSON *cmdhdr,
+                         cJSON **hdrs, size_t nhdrs,
+                         const ZeroSizeBuffer *contig_hists, size_t ncols,
+                         size_t num_kmers_with_paths, size_t num_paths,
+                         size_t path_bytes,
+                         const dBGraph *db_graph)
+{
+  ctx_assert(!cmdstr == !cmdhdr);
 
   // Construct cJSON
   cJSON *json = cJSON_CreateObject();
@@ -94,9 +113,9 @@ cJSON* gpath_save_mkhdr(const char *path,
   cJSON_AddItemToObject(json, "paths", paths);
 
   // Add command specific header fields
-  cJSON_AddNumberToObject(paths, "num_kmers_with_paths", gpstore->num_kmers_with_paths);
-  cJSON_AddNumberToObject(paths, "num_paths", gpstore->num_paths);
-  cJSON_AddNumberToObject(paths, "path_bytes", gpstore->path_bytes);
+  cJSON_AddNumberToObject(paths, "num_kmers_with_paths", num_kmers_with_paths);
+  cJSON_AddNumberToObject(paths, "num_paths", num_paths);
+  cJSON_AddNumberToObject(paths, "path_bytes", path_bytes);
 
   // Add size distribution
   cJSON *json_hists = cJSON_CreateArray();
@@ -110,15 +129,6 @@ cJSON* gpath_save_mkhdr(const char *path,
 }
 
 
-static inline void _gpath_save_flush(gzFile gzout, StrBuf *sbuf,
-                                     pthread_mutex_t *outlock)
-{
-  pthread_mutex_lock(outlock);
-  gzwrite(gzout, sbuf->b, sbuf->end);
-  pthread_mutex_unlock(outlock);
-  strbuf_reset(sbuf);
-}
-
 /**
  * Print paths to a string buffer. Paths are sorted before being written.
  *
@@ -222,65 +232,82 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
   }
 }
 
-// @subset is a temp variable that is reused each time
-// @sbuf   is a temp variable that is reused each time
-static inline int _gpath_gzsave_node(hkey_t hkey,
-                                     StrBuf *sbuf, GPathSubset *subset,
-                                     dBNodeBuffer *nbuf, SizeBuffer *jposbuf,
-                                     gzFile gzout, pthread_mutex_t *outlock,
-                                     const dBGraph *db_graph)
-{
-  gpath_save_sbuf(hkey, sbuf, subset, nbuf, jposbuf, db_graph);
-
-  if(sbuf->end > DEFAULT_IO_BUFSIZE)
-    _gpath_save_flush(gzout, sbuf, outlock);
+// Kmers with links are written in sorted order, so that link files can be
+// merged by streaming through them (`ctx pjoin --stream`).
+// Kmers are written in batches; each thread prints a contiguous run of kmers
+// from the batch into its own buffer, then buffers are written in order.
 
-  return 0; // => keep iterating
-}
+// Kmers per thread per batch
+#define GPATH_SAVE_BATCH 16384
 
 typedef struct
 {
-  size_t threadid, nthreads;
+  const hkey_t *hkeys;
+  size_t start, end; // range of hkeys to print
   bool save_seq; // write seq=... juncpos=...
-  gzFile gzout;
-  pthread_mutex_t *outlock;
-  dBGraph *db_graph;
+  StrBuf sbuf;
+  GPathSubset subset;
+  dBNodeBuffer nbuf;
+  SizeBuffer jposbuf;
+  const dBGraph *db_graph;
 } GPathSaver;
 
 static void gpath_save_thread(void *arg)
 {
   GPathSaver *wrkr = (GPathSaver*)arg;
-  const dBGraph *db_graph = wrkr->db_graph;
+  size_t i;
 
-  GPathSubset subset;
-  StrBuf sbuf;
+  strbuf_reset(&wrkr->sbuf);
 
-  gpath_subset_alloc(&subset);
-  gpath_subset_init(&subset, &wrkr->db_graph->gpstore.gpset);
-  strbuf_alloc(&sbuf, 2 * DEFAULT_IO_BUFSIZE);
+  for(i = wrkr->start; i < wrkr->end; i++) {
+    gpath_save_sbuf(wrkr->hkeys[i], &wrkr->sbuf, &wrkr->subset,
+                    wrkr->save_seq ? &wrkr->nbuf : NULL,
+                    wrkr->save_seq ? &wrkr->jposbuf : NULL,
+                    wrkr->db_graph);
+  }
+}
 
-  dBNodeBuffer nbuf;
-  SizeBuffer jposbuf;
-  db_node_buf_alloc(&nbuf, 1024);
-  size_buf_alloc(&jposbuf, 256);
-
-  HASH_ITERATE_PART(&db_graph->ht, wrkr->threadid, wrkr->nthreads,
-                    _gpath_gzsave_node,
-                    &sbuf, &subset,
-                    wrkr->save_seq ? &nbuf : NULL, wrkr->save_seq ? &jposbuf : NULL,
-                    wrkr->gzout, wrkr->outlock,
-                    db_graph);
-
-  _gpath_save_flush(wrkr->gzout, &sbuf, wrkr->outlock);
-
-  db_node_buf_dealloc(&nbuf);
-  size_buf_dealloc(&jposbuf);
-  gpath_subset_dealloc(&subset);
-  strbuf_dealloc(&sbuf);
+static int hkeys_bkmer_cmp(const void *aa, const void *bb, void *arg)
+{
+  const hkey_t *a = (const hkey_t*)aa, *b = (const hkey_t*)bb;
+  const BinaryKmer *table = (const BinaryKmer*)arg;
+  return binary_kmers_cmp(table[*a], table[*b]);
+}
+
+// Get kmers that have links, sorted by kmer
+// Returns number of kmers
+static size_t gpath_save_sorted_hkeys(const dBGraph *db_graph, hkey_t **hkeys_ptr)
+{
+  const GPathStore *gpstore = &db_graph->gpstore;
+  const HashTable *ht = &db_graph->ht;
+  size_t n = 0;
+  hkey_t hkey, *hkeys;
+
+  size_t mem = gpath_save_mem(gpstore->num_kmers_with_paths);
+  char kmers_str[50], mem_str[50];
+  ulong_to_str(gpstore->num_kmers_with_paths, kmers_str);
+  bytes_to_str(mem, 1, mem_str);
+  status("[GPathSave] Sorting %s kmers with paths using %s", kmers_str, mem_str);
+
+  hkeys = ctx_malloc(mem);
+
+  for(hkey = 0; hkey < ht->capacity; hkey++) {
+    if(HASH_ENTRY_ASSIGNED(ht->table[hkey]) &&
+       gpath_store_fetch(gpstore, hkey) != NULL)
+    {
+      ctx_assert(n < gpstore->num_kmers_with_paths);
+      hkeys[n++] = hkey;
+    }
+  }
+
+  sort_r(hkeys, n, sizeof(hkey_t), hkeys_bkmer_cmp, ht->table);
+
+  *hkeys_ptr = hkeys;
+  return n;
 }
 
 /**
- * Save paths to a file.
+ * Save paths to a file. Kmers are written in sorted order.
  * @param gzout         gzFile to write to
  * @param path          path of output file
  * @param save_path_seq if true, save seq= and juncpos= for links, requires
@@ -314,27 +341,51 @@ void gpath_save(gzFile gzout, const char *path,
   // Print comments about the format
   gzputs(gzout, ctp_explanation_comment);
 
+  // Sort kmers
+  hkey_t *hkeys = NULL;
+  size_t nkmers = gpath_save_sorted_hkeys(db_graph, &hkeys);
+
   // Multithreaded
   GPathSaver *wrkrs = ctx_calloc(nthreads, sizeof(GPathSaver));
-  pthread_mutex_t outlock;
-  size_t i;
-
-  if(pthread_mutex_init(&outlock, NULL) != 0) die("Mutex init failed");
+  size_t i, start, batch_end;
 
   for(i = 0; i < nthreads; i++) {
-    wrkrs[i] = (GPathSaver){.threadid = i,
-                            .nthreads = nthreads,
-                            .save_seq = save_path_seq,
-                            .gzout = gzout,
-                            .outlock = &outlock,
-                            .db_graph = db_graph};
+    wrkrs[i].hkeys = hkeys;
+    wrkrs[i].save_seq = save_path_seq;
+    wrkrs[i].db_graph = db_graph;
+    strbuf_alloc(&wrkrs[i].sbuf, 2 * DEFAULT_IO_BUFSIZE);
+    gpath_subset_alloc(&wrkrs[i].subset);
+    gpath_subset_init(&wrkrs[i].subset, &db_graph->gpstore.gpset);
+    db_node_buf_alloc(&wrkrs[i].nbuf, 1024);
+    size_buf_alloc(&wrkrs[i].jposbuf, 256);
   }
 
   // Iterate over kmers writing paths
-  util_run_threads(wrkrs, nthreads, sizeof(*wrkrs), nthreads, gpath_save_thread);
+  for(start = 0; start < nkmers; start = batch_end)
+  {
+    batch_end = MIN2(start + nthreads * GPATH_SAVE_BATCH, nkmers);
+    for(i = 0; i < nthreads; i++) {
+      wrkrs[i].start = start + ((batch_end-start) * i) / nthreads;
+      wrkrs[i].end   = start + ((batch_end-start) * (i+1)) / nthreads;
+    }
+
+    util_run_threads(wrkrs, nthreads, sizeof(*wrkrs), nthreads, gpath_save_thread);
+
+    for(i = 0; i < nthreads; i++) {
+      if(gzwrite(gzout, wrkrs[i].sbuf.b, wrkrs[i].sbuf.end) != (int)wrkrs[i].sbuf.end)
+        die("Cannot write to output: %s", path);
+    }
+  }
+
+  for(i = 0; i < nthreads; i++) {
+    strbuf_dealloc(&wrkrs[i].sbuf);
+    gpath_subset_dealloc(&wrkrs[i].subset);
+    db_node_buf_dealloc(&wrkrs[i].nbuf);
+    size_buf_dealloc(&wrkrs[i].jposbuf);
+  }
 
-  pthread_mutex_destroy(&outlock);
   ctx_free(wrkrs);
+  ctx_free(hkeys);
 
   status("[GPathSave] Graph paths saved to %s", path);
 }
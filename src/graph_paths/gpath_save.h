@@ -32,6 +32,18 @@ cJSON* gpath_save_mkhdr(const char *path,
                         const ZeroSizeBuffer *contig_hists, size_t ncols,
                         const dBGraph *db_graph);
 
+/**
+ * As gpath_save_mkhdr() but link counts are passed rather than taken from
+ * db_graph->gpstore, for when links are written without being loaded
+ */
+cJSON* gpath_save_mkhdr2(const char *path,
+                         const char *cmdstr, cJSON *cmdhdr,
+                         cJSON **hdrs, size_t nhdrs,
+                         const ZeroSizeBuffer *contig_hists, size_t ncols,
+                         size_t num_kmers_with_paths, size_t num_paths,
+                         size_t path_bytes,
+                         const dBGraph *db_graph);
+
 /**
  * Print paths to a string buffer. Paths are sorted before being written.
  *
@@ -45,8 +57,12 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
                      dBNodeBuffer *nbuf, SizeBuffer *jposbuf,
                      const dBGraph *db_graph);
 
+// Memory gpath_save() uses to sort up to `nkmers` kmers with paths
+#define gpath_save_mem(nkmers) (MAX2(nkmers,1) * sizeof(hkey_t))
+
 /**
- * Save paths to a file.
+ * Save paths to a file. Kmers are written in sorted order, which needs
+ * gpath_save_mem(num_kmers_with_paths) bytes on top of the graph.
  * @param cmdstr  name of the command being run, to be used to add @cmdhdr
  * @param cmdhdr  JSON header to add under current command->@cmdstr
  *                If cmdstr and cmdhdr are both NULL they are ignored
@@ -0,0 +1,172 @@
+#include "global.h"
+#include "link_block.h"
+#include "util.h"
+
+static void link_kmer_alloc(LinkKmer *lk)
+{
+  strbuf_alloc(&lk->kmer, 64);
+  strbuf_alloc(&lk->lines, 1024);
+  strbuf_alloc(&lk->ctp, 1024);
+  strbuf_alloc(&lk->list, 256);
+  strbuf_alloc(&lk->dot, 256);
+}
+
+static void link_kmer_dealloc(LinkKmer *lk)
+{
+  strbuf_dealloc(&lk->kmer);
+  strbuf_dealloc(&lk->lines);
+  strbuf_dealloc(&lk->ctp);
+  strbuf_dealloc(&lk->list);
+  strbuf_dealloc(&lk->dot);
+}
+
+void link_block_alloc(LinkBlock *block, size_t max_kmers)
+{
+  size_t i;
+  block->kmers = ctx_calloc(max_kmers, sizeof(LinkKmer));
+  block->num_kmers = block->next_kmer = 0;
+  block->max_kmers = max_kmers;
+  for(i = 0; i < max_kmers; i++) link_kmer_alloc(&block->kmers[i]);
+}
+
+void link_block_dealloc(LinkBlock *block)
+{
+  size_t i;
+  for(i = 0; i < block->max_kmers; i++) link_kmer_dealloc(&block->kmers[i]);
+  ctx_free(block->kmers);
+  block->kmers = NULL;
+  block->num_kmers = block->max_kmers = 0;
+}
+
+static void link_worker_alloc(LinkWorker *wrkr, LinkBlock *block,
+                              size_t kmer_size)
+{
+  memset(wrkr, 0, sizeof(*wrkr));
+  wrkr->block = block;
+  ltree_alloc(&wrkr->ltree, kmer_size);
+  size_buf_alloc(&wrkr->countbuf, 16);
+  size_buf_alloc(&wrkr->jposbuf, 1024);
+  strbuf_alloc(&wrkr->line, 1024);
+  strbuf_alloc(&wrkr->juncsbuf, 1024);
+  strbuf_alloc(&wrkr->seqbuf, 1024);
+  if(block->hist_covg) {
+    wrkr->hists = ctx_calloc(block->hist_distsize * block->hist_covgsize,
+                             sizeof(uint64_t));
+  }
+}
+
+static void link_worker_dealloc(LinkWorker *wrkr)
+{
+  ltree_dealloc(&wrkr->ltree);
+  size_buf_dealloc(&wrkr->countbuf);
+  size_buf_dealloc(&wrkr->jposbuf);
+  strbuf_dealloc(&wrkr->line);
+  strbuf_dealloc(&wrkr->juncsbuf);
+  strbuf_dealloc(&wrkr->seqbuf);
+  ctx_free(wrkr->hists);
+}
+
+LinkWorker* link_workers_alloc(size_t n, LinkBlock *block, size_t kmer_size)
+{
+  size_t i;
+  LinkWorker *workers = ctx_calloc(n, sizeof(LinkWorker));
+  for(i = 0; i < n; i++) link_worker_alloc(&workers[i], block, kmer_size);
+  return workers;
+}
+
+void link_workers_dealloc(LinkWorker *workers, size_t n)
+{
+  size_t i;
+  for(i = 0; i < n; i++) link_worker_dealloc(&workers[i]);
+  ctx_free(workers);
+}
+
+bool link_kmer_read(GPathReader *ctpin, LinkKmer *lk, size_t kmer_size)
+{
+  if(!gpath_reader_read_kmer(ctpin, &lk->kmer, &lk->num_links_exp)) return false;
+  ctx_assert2(lk->kmer.end == kmer_size, "Kmer incorrect length %zu != %zu",
+              lk->kmer.end, kmer_size);
+
+  strbuf_reset(&lk->lines);
+  while(gpath_reader_read_link_line(ctpin, &ctpin->line)) {
+    strbuf_append_strn(&lk->lines, ctpin->line.b, ctpin->line.end);
+    strbuf_append_char(&lk->lines, '\n');
+  }
+  return true;
+}
+
+static void link_kmer_process(LinkWorker *wrkr, LinkKmer *lk)
+{
+  const LinkBlock *block = wrkr->block;
+  const GPathReader *ctpin = block->ctpin;
+  LinkTree *ltree = &wrkr->ltree;
+  const char *line, *end;
+  bool link_fw;
+  size_t njuncs, nlinks, num_links;
+
+  strbuf_reset(&lk->ctp);
+  strbuf_reset(&lk->list);
+  strbuf_reset(&lk->dot);
+  ltree_reset(ltree);
+
+  for(nlinks = 0, line = lk->lines.b; *line; nlinks++, line = end+1)
+  {
+    end = strchr(line, '\n');
+    strbuf_reset(&wrkr->line);
+    strbuf_append_strn(&wrkr->line, line, end - line);
+    link_line_parse(&wrkr->line, ctpin->version, &ctpin->fltr,
+                    &link_fw, &njuncs, &wrkr->countbuf, &wrkr->juncsbuf,
+                    &wrkr->seqbuf, &wrkr->jposbuf);
+    ltree_add(ltree, link_fw, wrkr->countbuf.b[0], wrkr->jposbuf.b,
+              wrkr->juncsbuf.b, wrkr->seqbuf.b);
+  }
+
+  if(nlinks != lk->num_links_exp)
+    warn("Links count mismatch %zu != %zu", nlinks, lk->num_links_exp);
+
+  if(block->hist_covg) {
+    ltree_update_covg_hists(ltree, wrkr->hists,
+                            block->hist_distsize, block->hist_covgsize);
+  }
+  if(block->clean) ltree_clean(ltree, block->cutoff);
+
+  // Accumulate statistics
+  num_links = wrkr->stats.num_links;
+  ltree_get_stats(ltree, &wrkr->stats);
+  num_links = wrkr->stats.num_links - num_links;
+
+  if(block->list) ltree_write_list(ltree, &lk->list);
+  if(block->save && num_links) ltree_write_ctp(ltree, lk->kmer.b, num_links, &lk->ctp);
+  if(lk->knum == block->plot_knum) ltree_write_dot(ltree, &lk->dot);
+}
+
+static void link_worker(void *ptr)
+{
+  LinkWorker *wrkr = (LinkWorker*)ptr;
+  LinkBlock *block = wrkr->block;
+  size_t i;
+
+  while((i = __sync_fetch_and_add((volatile size_t*)&block->next_kmer, 1)) < block->num_kmers)
+    link_kmer_process(wrkr, &block->kmers[i]);
+}
+
+void link_block_run(LinkBlock *block, LinkWorker *workers, size_t n)
+{
+  block->next_kmer = 0;
+  util_run_threads(workers, n, sizeof(workers[0]), n, link_worker);
+}
+
+void link_workers_merge(const LinkWorker *workers, size_t n,
+                        LinkTreeStats *stats, uint64_t *hists)
+{
+  size_t i, j, nhist = 0;
+  if(n && workers[0].block->hist_covg)
+    nhist = workers[0].block->hist_distsize * workers[0].block->hist_covgsize;
+
+  for(i = 0; i < n; i++) {
+    stats->num_trees_with_links += workers[i].stats.num_trees_with_links;
+    stats->num_links += workers[i].stats.num_links;
+    stats->num_link_bytes += workers[i].stats.num_link_bytes;
+    for(j = 0; j < nhist; j++) hists[j] += workers[i].hists[j];
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef LINK_BLOCK_H_
+#define LINK_BLOCK_H_
+
+#include "link_tree.h"
+#include "gpath_reader.h"
+
+//
+// Links are read in blocks of kmers by the main thread. Workers parse the
+// links of each kmer, build and clean its LinkTree and write the output for
+// that kmer into its own buffers, which are then written in input order.
+//
+
+// Number of kmers read into a block per thread
+#define LINKS_KMERS_PER_THREAD 1024
+
+typedef struct
+{
+  StrBuf kmer, lines; // link lines are separated by '\n'
+  size_t knum, num_links_exp;
+  StrBuf ctp, list, dot; // output
+} LinkKmer;
+
+typedef struct
+{
+  LinkKmer *kmers;
+  size_t num_kmers, max_kmers, next_kmer;
+  // Shared between workers
+  const GPathReader *ctpin; // version and filter used to parse link lines
+  bool clean, list, save, hist_covg;
+  size_t cutoff, plot_knum; // plot_knum is SIZE_MAX if not plotting
+  size_t hist_distsize, hist_covgsize;
+} LinkBlock;
+
+typedef struct
+{
+  LinkBlock *block;
+  LinkTree ltree;
+  SizeBuffer countbuf, jposbuf;
+  StrBuf line, juncsbuf, seqbuf;
+  LinkTreeStats stats;
+  uint64_t *hists; // [hist_distsize][hist_covgsize]
+} LinkWorker;
+
+// Options must be set on the block before alloc
+void link_block_alloc(LinkBlock *block, size_t max_kmers);
+void link_block_dealloc(LinkBlock *block);
+
+// Read a kmer and its unparsed link lines
+// Returns false at the end of the file
+bool link_kmer_read(GPathReader *ctpin, LinkKmer *lk, size_t kmer_size);
+
+LinkWorker* link_workers_alloc(size_t n, LinkBlock *block, size_t kmer_size);
+void link_workers_dealloc(LinkWorker *workers, size_t n);
+
+// Process the first block->num_kmers kmers using one thread per worker
+void link_block_run(LinkBlock *block, LinkWorker *workers, size_t n);
+
+// Add tree stats and coverage histograms (if block->hist_covg) from workers
+// to `stats` and `hists`
+void link_workers_merge(const LinkWorker *workers, size_t n,
+                        LinkTreeStats *stats, uint64_t *hists);
+
+#endif /* LINK_BLOCK_H_ */
@@ -0,0 +1,201 @@
+// request POSIX API (execv, PATH_MAX)
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+
+/*
+  mccortex: run the mccortex<MAXK> build for a kmer size
+
+  Each build is compiled for one range of kmer sizes (MAXK-30..MAXK), so
+  kmers are always stored in the fewest 64 bit words. This launcher picks the
+  build from the kmer size and runs it with the same arguments:
+
+    mccortex build -k 41 ...  =>  mccortex63 build -k 41 ...
+
+  The kmer size is taken from -k/-kmer/--kmer, otherwise from the header of
+  the first graph file (.ctx) argument. Values of options that take an argument
+  (e.g. -o out.ctx) are not read as graphs. Without a command or with -h the
+  default k=31 build is run to print usage, otherwise we fail if the kmer size
+  cannot be found. Build the binaries with scripts/multik-build.sh or
+  `make MAXK=31 && make MAXK=63 ...`.
+*/
+
+#define DEFAULT_KMER_SIZE 31
+
+// Long options of any command that take an argument, except --graph
+// tests/launch checks these against the options of the commands
+static const char *arg_longopts[] = {
+  "block-kmers", "block-size", "clean", "col", "color", "colour", "confid-csv",
+  "confid-cumul", "confid-step", "contig-hist", "count-mem", "covg-after",
+  "covg-before", "cut-hp", "dist", "dup-mem", "fallback", "flank", "flanks",
+  "format", "fq-cutoff", "fq-offset", "fq-zero", "frag-hist", "gap-diff-coeff",
+  "gap-diff-const", "gap-extend", "gap-hist", "gap-open", "genome", "haploid",
+  "index", "intersect", "kmer", "len-after", "len-before", "limit", "list",
+  "match", "matepair", "max-AB-dist", "max-align", "max-allele",
+  "max-context", "max-covg", "max-diff", "max-flank", "max-frag-len",
+  "max-len", "maxref", "memory", "min-count", "min-frag-len", "min-mapq",
+  "minref", "mismatch", "ncols", "ncontigs", "nkmers", "noredundant", "out",
+  "outcols", "partitions", "paths", "plot", "ref", "regions", "repeat",
+  "sample", "save-index", "sdist", "seed", "seq", "seq2", "seqi", "threads",
+  "threshold", "tips", NULL};
+
+// Short options that take an argument in every command that has them
+#define ARG_SHORTOPTS "12BCDGILNQTXZbciklmnot"
+
+// Returns 1 if the next argument is the value of option `arg`
+// Commands use getopt_long_only() so long options may start with - or --
+static int option_takes_value(const char *arg)
+{
+  size_t i;
+  if(arg[0] != '-' || arg[1] == '\0') return 0;
+  if(arg[1] != '-' && arg[2] == '\0') return strchr(ARG_SHORTOPTS, arg[1]) != NULL;
+  if(strchr(arg, '=') != NULL) return 0;
+  arg += (arg[1] == '-' ? 2 : 1);
+  for(i = 0; arg_longopts[i] != NULL; i++)
+    if(!strcmp(arg, arg_longopts[i])) return 1;
+  return 0;
+}
+
+// Smallest MAXK that can hold a given kmer size e.g. 21 => 31, 41 => 63
+#define kmer_size_maxk(k) ((((k)+31)/32)*32 - 1)
+
+// Returns 0 if not a kmer size
+static unsigned long parse_kmer_size(const char *str)
+{
+  char *end;
+  unsigned long k = strtoul(str, &end, 10);
+  return (*str && !*end && k >= 3 && k % 2 == 1) ? k : 0;
+}
+
+// Read kmer size from a graph file header, returns 0 if not a graph file
+static unsigned long graph_kmer_size(const char *path)
+{
+  FILE *fh;
+  char magic[6];
+  uint32_t version, kmer_size;
+  int ok;
+
+  if((fh = fopen(path, "r")) == NULL) return 0;
+
+  ok = (fread(magic, 1, 6, fh) == 6 && memcmp(magic, "CORTEX", 6) == 0 &&
+        fread(&version, sizeof(uint32_t), 1, fh) == 1 &&
+        fread(&kmer_size, sizeof(uint32_t), 1, fh) == 1);
+
+  fclose(fh);
+  return ok ? kmer_size : 0;
+}
+
+// Graph arguments may have a colour filter appended e.g. in.ctx:0,2
+static unsigned long arg_graph_kmer_size(const char *arg)
+{
+  char path[PATH_MAX+1];
+  const char *colon;
+  unsigned long k;
+  size_t len;
+
+  if((k = graph_kmer_size(arg)) > 0) return k;
+  if((colon = strrchr(arg, ':')) == NULL) return 0;
+
+  len = colon - arg;
+  if(len > PATH_MAX) return 0;
+  memcpy(path, arg, len);
+  path[len] = '\0';
+  return graph_kmer_size(path);
+}
+
+// Returns 0 if invalid, ULONG_MAX if not found
+static unsigned long args_kmer_size(int argc, char **argv)
+{
+  unsigned long k;
+  int i;
+
+  // -k <K>, -k<K>, -kmer <K>, -kmer=<K>, --kmer <K>, --kmer=<K>
+  // Long forms are matched first, otherwise -kmer would be read as -k mer
+  for(i = 2; i < argc; i++) {
+    const char *arg = argv[i];
+    if(!strcmp(arg, "--")) break;
+    if(arg[0] != '-') continue;
+    if(!strncmp(arg+1, "-kmer", 5) || !strncmp(arg+1, "kmer", 4)) {
+      arg += (arg[1] == '-' ? 6 : 5);
+      if(*arg == '=') return parse_kmer_size(arg+1);
+      if(*arg == '\0' && i+1 < argc) return parse_kmer_size(argv[i+1]);
+    }
+    else if(arg[1] == 'k') {
+      if(arg[2]) return parse_kmer_size(arg+2);
+      if(i+1 < argc) return parse_kmer_size(argv[i+1]);
+    }
+  }
+
+  // First graph file argument that is not the value of an option
+  for(i = 2; i < argc; i++) {
+    if(option_takes_value(argv[i])) i++;
+    else if(argv[i][0] != '-' && (k = arg_graph_kmer_size(argv[i])) > 0)
+      return k;
+  }
+
+  return ULONG_MAX;
+}
+
+// Returns 1 if only printing usage: no command, or -h/--help
+static int args_usage_only(int argc, char **argv)
+{
+  int i;
+  if(argc < 2) return 1;
+  for(i = 1; i < argc; i++)
+    if(!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) return 1;
+  return 0;
+}
+
+static int args_quiet(int argc, char **argv)
+{
+  int i;
+  for(i = 2; i < argc; i++)
+    if(!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet")) return 1;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long kmer_size = args_kmer_size(argc, argv);
+  char path[PATH_MAX+1];
+  const char *slash;
+  int dirlen = 0;
+
+  if(kmer_size == 0) {
+    fprintf(stderr, "[mccortex] Error: invalid kmer size, must be odd and >= 3\n");
+    return EXIT_FAILURE;
+  }
+
+  if(kmer_size == ULONG_MAX) {
+    if(!args_usage_only(argc, argv)) {
+      fprintf(stderr, "[mccortex] Error: cannot determine kmer size, pass -k <K> "
+                      "or a graph file, or run mccortex<MAXK> directly\n");
+      return EXIT_FAILURE;
+    }
+    kmer_size = DEFAULT_KMER_SIZE;
+  }
+
+  // Look for the build next to this executable, otherwise in $PATH
+  if((slash = strrchr(argv[0], '/')) != NULL) dirlen = slash - argv[0] + 1;
+
+  snprintf(path, sizeof(path), "%.*smccortex%lu",
+           dirlen, argv[0], kmer_size_maxk(kmer_size));
+
+  if(!args_quiet(argc, argv))
+    fprintf(stderr, "[mccortex] k=%lu using mccortex%lu\n",
+            kmer_size, kmer_size_maxk(kmer_size));
+
+  argv[0] = path;
+  if(dirlen) execv(path, argv);
+  else execvp(path, argv);
+
+  fprintf(stderr, "[mccortex] Error: cannot run %s for k=%lu, "
+                  "compile it with: make MAXK=%lu\n",
+          path, kmer_size, kmer_size_maxk(kmer_size));
+  return EXIT_FAILURE;
+}
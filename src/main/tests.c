@@ -31,13 +31,19 @@ int main(int argc, char **argv)
     test_cleaning();
     test_paths();
     // test_path_sets(); // DEV: replace with test_path_subset()
+    test_gpath_set();
+    test_link_block();
     test_graph_walker();
     test_corrected_aln();
+    test_gap_memo();
     test_repeat_walker();
     test_graph_crawler();
     test_bubble_caller();
     test_kmer_occur();
     test_infer_edges_tests();
+    test_count_filter();
+    test_genotyping();
+    test_allele_align();
   #endif
 
   cmd_destroy();
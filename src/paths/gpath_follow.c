@@ -8,9 +8,7 @@ void gpath_follow_cache_update(GPathFollow *path, size_t pos)
 {
   size_t fetch_offset, fetch_bytes, total_bytes;
 
-  // 4 bases per byte
-  #define BASES_IN_CACHE(p) (sizeof((p)->cache) * 4)
-  uint16_t new_cache_start = (pos / BASES_IN_CACHE(path)) * BASES_IN_CACHE(path);
+  uint16_t new_cache_start = gpath_follow_cache_start(pos);
 
   if(new_cache_start != path->first_cached)
   {
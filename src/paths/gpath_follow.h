@@ -31,6 +31,15 @@ struct GPathFollowStruct
 
 typedef struct GPathFollowStruct GPathFollow;
 
+// 4 bases per byte
+#define GPATH_FOLLOW_CACHE_BASES (sizeof(((GPathFollow*)0)->cache) * 4)
+
+// First base in the cache block that holds base `pos`
+static inline uint16_t gpath_follow_cache_start(size_t pos)
+{
+  return (pos / GPATH_FOLLOW_CACHE_BASES) * GPATH_FOLLOW_CACHE_BASES;
+}
+
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(gpath_follow_buf,GPathFollowBuffer,GPathFollow);
 
@@ -5,28 +5,32 @@
 #include "binary_seq.h"
 #include "misc/city.h"
 
-// Entry is [hkey:5][gpindex:5] = 10 bytes
+#include <sched.h> // sched_yield()
 
-// We compare with REHASH_LIMIT(16)*bucket_size(<255) = 4080
-// so we need 12 bits to have 2^12 = 4096 possibilities
+// Entry is [tag:8][gpindex:5] = 13 bytes
 
-// (1-(1/(2^12)))^4080 = 0.369 = 37% of entries would have zero collisions
-// (1-(1/(2^16)))^4080 = 0.939 = 94% of entries would have zero collisions
+// We compare with REHASH_LIMIT(16)*bucket_size(<255) = 4080 entries
+// The fingerprint has 23 bits, so (1-(1/(2^23)))^4080 = 0.9995 = 99.95% of
+// lookups will not compare a path with the same kmer but different sequence
+
+#define GPH_EMPTY UINT64_MAX
+#define GPH_PENDING 1UL
+#define GPH_FP_BITS 23
+#define GPH_FP_MASK ((1UL<<GPH_FP_BITS)-1)
+#define gph_tag(hkey,fp) (((uint64_t)(hkey) << (GPH_FP_BITS+1)) | ((fp) << 1))
 
 #define PATH_HASH_UNSET (0xffffffffffUL)
-#define PATH_HASH_ENTRY_ASSIGNED(x) ((x).hkey != PATH_HASH_UNSET)
 
 void gpath_hash_alloc(GPathHash *gphash, GPathStore *gpstore, size_t mem_in_bytes)
 {
   size_t cap_entries; uint64_t num_bkts = 0; uint8_t bkt_size = 0;
 
   // Decide on hash table capacity based on how much memory we can use
-  cap_entries = mem_in_bytes / sizeof(GPEntry);
+  cap_entries = mem_in_bytes / GPATH_HASH_ENTRY_MEM;
   hash_table_cap(cap_entries, &num_bkts, &bkt_size);
   cap_entries = num_bkts * bkt_size;
 
-  size_t bktlocks_mem = roundup_bits2bytes(num_bkts);
-  size_t mem = cap_entries*sizeof(GPEntry) + bktlocks_mem;
+  size_t mem = cap_entries * GPATH_HASH_ENTRY_MEM;
 
   char num_bkts_str[100], bkt_size_str[100], cap_str[100], mem_str[100];
   ulong_to_str(num_bkts, num_bkts_str);
@@ -36,41 +40,38 @@ void gpath_hash_alloc(GPathHash *gphash, GPathStore *gpstore, size_t mem_in_byte
   status("[GPathHash] Allocating table with %s entries, using %s", cap_str, mem_str);
   status("[GPathHash]  number of buckets: %s, bucket size: %s", num_bkts_str, bkt_size_str);
 
-  GPEntry *table = ctx_malloc(cap_entries * sizeof(GPEntry));
-  uint8_t *bktlocks = ctx_calloc(bktlocks_mem, sizeof(uint8_t));
-  uint8_t *bucket_nitems = ctx_calloc(num_bkts, sizeof(uint8_t));
+  uint64_t *table = ctx_malloc(cap_entries * sizeof(uint64_t));
+  GPIndex *gpindices = ctx_malloc(cap_entries * sizeof(GPIndex));
 
   ctx_assert(num_bkts * bkt_size == cap_entries);
   ctx_assert(cap_entries > 0);
-  ctx_assert(sizeof(GPEntry) == 10);
+  ctx_assert(sizeof(GPIndex) == 5);
 
   // Table all set to 1 to indicate empty
-  memset(table, 0xff, cap_entries * sizeof(GPEntry));
+  memset(table, 0xff, cap_entries * sizeof(uint64_t));
 
-  GPathHash tmp = {.gpstore = gpstore, .table = table,
+  GPathHash tmp = {.gpstore = gpstore, .table = table, .gpindices = gpindices,
                   .num_of_buckets = num_bkts,
                   .bucket_size = bkt_size,
                   .capacity = cap_entries,
                   .mask = num_bkts - 1,
-                  .num_entries = 0,
-                  .bucket_nitems = bucket_nitems,
-                  .bktlocks = bktlocks};
+                  .num_entries = 0};
 
   memcpy(gphash, &tmp, sizeof(GPathHash));
 }
 
 void gpath_hash_dealloc(GPathHash *gphash)
 {
-  ctx_free(gphash->bucket_nitems);
-  ctx_free(gphash->bktlocks);
   ctx_free(gphash->table);
+  ctx_free(gphash->gpindices);
   memset(gphash, 0, sizeof(GPathHash));
 }
 
 void gpath_hash_reset(GPathHash *gphash)
 {
   gphash->num_entries = 0;
-  memset(gphash->table, 0xff, gphash->capacity * sizeof(GPEntry));
+  memset(&gphash->stats, 0, sizeof(gphash->stats));
+  memset(gphash->table, 0xff, gphash->capacity * sizeof(uint64_t));
 }
 
 void gpath_hash_print_stats(const GPathHash *gphash)
@@ -80,94 +81,111 @@ void gpath_hash_print_stats(const GPathHash *gphash)
   ulong_to_str(gphash->capacity, cap_str);
 
   char mem_total_str[50], mem_used_str[50];
-  size_t mem_total = gphash->capacity*sizeof(GPEntry);
-  size_t mem_used = (gphash->num_entries/IDEAL_OCCUPANCY) * sizeof(GPEntry);
+  size_t mem_total = gphash->capacity * GPATH_HASH_ENTRY_MEM;
+  size_t mem_used = (gphash->num_entries/IDEAL_OCCUPANCY) * GPATH_HASH_ENTRY_MEM;
   bytes_to_str(mem_total, 1, mem_total_str);
   bytes_to_str(mem_used,  1, mem_used_str);
 
   status("[GPathHash] Paths: %s / %s occupancy [%.2f%%] %s / %s [%.2f]",
          entries_str, cap_str, (100.0 * gphash->num_entries) / gphash->capacity,
          mem_used_str, mem_total_str, (100.0 * mem_used) / mem_total);
+
+  const GPathHashStats *stats = &gphash->stats;
+  if(stats->num_lookups == 0) return;
+
+  char lookups_str[50], cmps_str[50], fp_str[50], cas_str[50], waits_str[50];
+  ulong_to_str(stats->num_lookups, lookups_str);
+  ulong_to_str(stats->num_seq_cmps, cmps_str);
+  ulong_to_str(stats->num_fp_collisions, fp_str);
+  ulong_to_str(stats->num_cas_fails, cas_str);
+  ulong_to_str(stats->num_pending_waits, waits_str);
+
+  status("[GPathHash]  lookups: %s, mean probe length: %.2f, rehashes: %.4f "
+         "per lookup", lookups_str,
+         (double)stats->num_probes / stats->num_lookups,
+         (double)stats->num_rehashes / stats->num_lookups);
+  status("[GPathHash]  path compares: %s, fingerprint collisions: %s",
+         cmps_str, fp_str);
+  status("[GPathHash]  contention: %s failed claims, %s waits on inserts",
+         cas_str, waits_str);
 }
 
-static inline bool _gphash_entries_match(const GPathSet *gpset, GPEntry entry,
-                                         hkey_t hkey, GPathNew newgpath)
+void gpath_hash_stats_merge(GPathHashStats *dst, const GPathHashStats *src)
 {
-  return (hkey == entry.hkey &&
-          gpaths_are_equal(gpset->entries.b[entry.gpindex], newgpath));
+  dst->num_lookups += src->num_lookups;
+  dst->num_probes += src->num_probes;
+  dst->num_rehashes += src->num_rehashes;
+  dst->num_seq_cmps += src->num_seq_cmps;
+  dst->num_fp_collisions += src->num_fp_collisions;
+  dst->num_cas_fails += src->num_cas_fails;
+  dst->num_pending_waits += src->num_pending_waits;
 }
 
-// Use a bucket lock to find or add an entry
-// Returns NULL if not found or inserted
+// Search bucket for a match, claiming the first empty slot if not found
+// Returns NULL if bucket is full and the path is not in it
 static inline GPath* _find_or_add_in_bucket_mt(GPathHash *gphash, uint64_t hash,
-                                               hkey_t hkey, GPathNew newgpath,
-                                               bool *found)
+                                               hkey_t hkey, uint64_t tag,
+                                               GPathNew newgpath, bool *found,
+                                               GPathHashStats *stats)
 {
   const GPathSet *gpset = &gphash->gpstore->gpset;
-
-  GPath *gpath_ret = NULL;
-  *found = false;
-
-  // Add GPath within a lock to ensure we do not add the same path more than
-  // once
-  bitlock_yield_acquire(gphash->bktlocks, hash);
-
-        GPEntry *start = gphash->table + hash * gphash->bucket_size;
-  const GPEntry *end   = start + gphash->bucket_size;
-  volatile GPEntry *entryptr;
-
-  for(entryptr = start; entryptr < end; entryptr++)
+  const size_t start = hash * gphash->bucket_size;
+  volatile uint64_t *tags = gphash->table + start;
+  GPIndex *gpindices = gphash->gpindices + start;
+  GPath *gpath;
+  uint64_t t;
+  size_t i;
+
+  for(i = 0; i < gphash->bucket_size; i++)
   {
-    GPEntry entry = *entryptr;
-    if(_gphash_entries_match(gpset, entry, hkey, newgpath))
-    {
-      *found = true;
-      gpath_ret = gpset->entries.b + entry.gpindex;
-      break;
-    }
-    else if(!PATH_HASH_ENTRY_ASSIGNED(entry))
+    stats->num_probes++;
+    t = tags[i];
+
+    if(t == GPH_EMPTY)
     {
-      gpath_ret = gpath_store_add_mt(gphash->gpstore, hkey, newgpath);
-      *entryptr = (GPEntry){.hkey = hkey,
-                            .gpindex = gpath_ret - gpset->entries.b};
-
-      __sync_synchronize(); // add entry before updating count
-      __sync_fetch_and_add((volatile uint8_t*)&gphash->bucket_nitems[hash], 1);
-      __sync_fetch_and_add((volatile size_t*)&gphash->num_entries, 1);
-      break;
+      if(__sync_bool_compare_and_swap(&tags[i], GPH_EMPTY, tag | GPH_PENDING))
+      {
+        gpath = gpath_store_add_mt(gphash->gpstore, hkey, newgpath);
+        gpindices[i].gpindex = gpset_get_pkey(gpset, gpath);
+        __sync_synchronize(); // add index before clearing pending bit
+        __sync_fetch_and_and(&tags[i], ~GPH_PENDING);
+        __sync_fetch_and_add((volatile size_t*)&gphash->num_entries, 1);
+        return gpath;
+      }
+
+      // Another thread claimed this slot first
+      stats->num_cas_fails++;
+      t = tags[i];
     }
-  }
 
-  bitlock_release(gphash->bktlocks, hash);
+    if((t | GPH_PENDING) == (tag | GPH_PENDING))
+    {
+      if(t & GPH_PENDING) {
+        stats->num_pending_waits++;
+        while(tags[i] & GPH_PENDING) sched_yield();
+        __sync_synchronize();
+      }
 
-  return gpath_ret;
-}
+      gpath = gpset_get_gpath(gpset, gpindices[i].gpindex);
+      stats->num_seq_cmps++;
 
-// Lock free search bucket for match.
-// We can traverse a full bucket without acquiring the lock first because
-// items are added but never removed from the hash. This allows us to remove
-// the use of locks and improve performance.
-// Returns NULL if not found
-static inline GPath* _find_in_bucket_mt(const GPathHash *gphash, uint64_t hash,
-                                        hkey_t hkey, GPathNew newgpath)
-{
-  const GPathSet *gpset = &gphash->gpstore->gpset;
-  const GPEntry *start = gphash->table + hash * gphash->bucket_size;
-  const GPEntry *end   = start + gphash->bucket_size;
-  volatile const GPEntry *entry;
+      if(gpaths_are_equal(*gpath, newgpath)) {
+        *found = true;
+        return gpath;
+      }
 
-  for(entry = start; entry < end; entry++)
-    if(_gphash_entries_match(gpset, *entry, hkey, newgpath))
-      return gpset->entries.b + entry->gpindex;
+      stats->num_fp_collisions++;
+    }
+  }
 
   return NULL;
 }
 
-// Returns NULL if out of memory
-// Thread Safe: uses bucket level locks
+// Dies if out of memory
+// Thread Safe: lock free
 GPath* gpath_hash_find_or_insert_mt(GPathHash *gphash,
                                     hkey_t hkey, GPathNew newgpath,
-                                    bool *found)
+                                    bool *found, GPathHashStats *stats)
 {
   ctx_assert(newgpath.seq != NULL);
   ctx_assert(gphash->table != NULL);
@@ -176,25 +194,29 @@ GPath* gpath_hash_find_or_insert_mt(GPathHash *gphash,
   *found = false;
 
   size_t i, mem = binary_seq_mem(newgpath.num_juncs);
-  uint64_t hash = hkey;
+  uint64_t hash = hkey, fp, tag = 0;
   GPath *gpath = NULL;
 
   for(i = 0; i < REHASH_LIMIT; i++)
   {
     hash = CityHash64WithSeeds((const char*)newgpath.seq, mem, hash, i);
+
+    if(i == 0) {
+      // Fingerprint from high bits, which don't pick the bucket
+      fp = ((hash >> 40) ^ ((uint64_t)newgpath.num_juncs << 1) ^ newgpath.orient);
+      tag = gph_tag(hkey, fp & GPH_FP_MASK);
+    }
+
     hash &= gphash->mask;
 
-    uint8_t bucket_fill = *(volatile uint8_t *)&gphash->bucket_nitems[hash];
-    ctx_assert(bucket_fill <= gphash->bucket_size);
+    gpath = _find_or_add_in_bucket_mt(gphash, hash, hkey, tag, newgpath,
+                                      found, stats);
 
-    if(bucket_fill < gphash->bucket_size)
-      gpath = _find_or_add_in_bucket_mt(gphash, hash, hkey, newgpath, found);
-    else {
-      gpath = _find_in_bucket_mt(gphash, hash, hkey, newgpath);
-      *found = (gpath != NULL);
+    if(gpath != NULL) {
+      stats->num_lookups++;
+      stats->num_rehashes += i;
+      return gpath;
     }
-
-    if(gpath != NULL) return gpath;
   }
 
   // Out of space
@@ -4,43 +4,45 @@
 #include "cortex_types.h"
 #include "gpath_store.h"
 
-// Packed structure is 10 bytes
-// Do not use pointes to fields in this struct - they are not aligned
-struct GPEntryStruct
-{
-  // 5 bytes each
-  hkey_t hkey:40;
-  pkey_t gpindex:40;
-} __attribute((packed));
-
-/*
-// 5+5+5+1+2 = 18 bytes
-// GPath:18 + GPEntry:10 + count:1 + colset:1 = 30
-// 18/34 = 52%
-struct GPEntryStruct
+// Each entry is a 64 bit tag and a 5 byte path index (13 bytes)
+//
+// The tag holds the kmer, a fingerprint of the path and a pending bit:
+//   [hkey:40][fingerprint:23][pending:1]
+// Slots are claimed by a compare-and-swap of an empty tag to a pending tag.
+// The path index is written before the pending bit is cleared, so readers
+// that match a pending tag wait for it. Paths are only compared when hkey and
+// fingerprint match, so most mismatches never touch the path sequence.
+
+// Do not use pointers to fields in this struct - they are not aligned
+typedef struct
 {
-  hkey_t hkey:40; // 5 bytes
-  pkey_t next:40; // 5 bytes
-  uint64_t seq_offset:40; // 5 btyes
-  uint8_t count; // 1 byte
-  uint16_t orient:1, seq_len:15; // 2 bytes
-} __attribute((packed));
-*/
+  pkey_t gpindex:40; // 5 bytes
+} __attribute((packed)) GPIndex;
+
+#define GPATH_HASH_ENTRY_MEM (sizeof(uint64_t) + sizeof(GPIndex))
 
-typedef struct GPEntryStruct GPEntry;
+// Lookup statistics. Each thread counts into its own and they are merged with
+// gpath_hash_stats_merge() once threads finish.
+typedef struct
+{
+  size_t num_lookups; // calls to find_or_insert
+  size_t num_probes; // tags examined
+  size_t num_rehashes; // buckets full so moved to next bucket
+  size_t num_seq_cmps, num_fp_collisions; // path comparisons, false matches
+  size_t num_cas_fails; // lost race to claim an empty slot
+  size_t num_pending_waits; // waited for another thread to finish an insert
+} GPathHashStats;
 
 typedef struct
 {
   GPathStore *const gpstore; // Add to this path store
-  GPEntry *const table; // Using this table to remove duplicates
+  uint64_t *const table; // tags; used to remove duplicates
+  GPIndex *const gpindices; // path for each tag
   const size_t num_of_buckets; // needs to store maximum of 1<<32
   const uint8_t bucket_size; // max value 255
   const uint64_t capacity, mask; // num_of_buckets * bucket_size
-  uint8_t *const bucket_nitems; // number of items in each bucket
-  uint8_t *const bktlocks; // always cast to volatile
-  // uint8_t *const seq;
-  // size_t seq_len, seq_capacity;
   size_t num_entries;
+  GPathHashStats stats; // merged from threads, printed by print_stats
 } GPathHash;
 
 void gpath_hash_alloc(GPathHash *phash, GPathStore *gpstore, size_t mem_in_bytes);
@@ -48,11 +50,14 @@ void gpath_hash_dealloc(GPathHash *phash);
 void gpath_hash_reset(GPathHash *phash);
 
 void gpath_hash_print_stats(const GPathHash *phash);
+void gpath_hash_stats_merge(GPathHashStats *dst, const GPathHashStats *src);
 
-// Returns NULL if out of memory
-// Thread Safe: uses bucket level locks
+// Dies if out of memory
+// Thread Safe: lock free
+// @stats lookup statistics are added to this, it must not be shared with
+//        other threads
 GPath* gpath_hash_find_or_insert_mt(GPathHash *restrict phash,
                                     hkey_t hkey, GPathNew newgpath,
-                                    bool *found);
+                                    bool *found, GPathHashStats *stats);
 
 #endif /* GPATH_HASH_H_ */
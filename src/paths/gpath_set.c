@@ -6,21 +6,75 @@
 // This is relied on by GPathFollow
 #define SEQ_STORE_PADDING 16
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
-void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
-                      size_t initpaths, size_t initmem,
-                      bool resize, bool keep_path_counts)
+#define gpset_path_mem(gpset) \
+        (sizeof(GPath) + ((gpset)->keep_nseen ? (gpset)->ncols : 0))
+
+// Add a segment of `num` paths. Must hold seglock.
+static void _add_path_seg(GPathSet *gpset, size_t num)
+{
+  if(gpset->num_segs == GPATH_SET_MAX_SEGS)
+    die("[GPathSet] Too many segments");
+
+  GPathSegment *seg = &gpset->segs[gpset->num_segs];
+  seg->gpaths = ctx_malloc(num * sizeof(GPath));
+  seg->nseen = gpset->keep_nseen ? ctx_calloc(num, gpset->ncols) : NULL;
+  seg->first = gpset->capacity;
+  seg->num = num;
+  gpset->mem_used += num * gpset_path_mem(gpset);
+
+  // Segment must be visible before other threads see the new capacity
+  __sync_synchronize();
+  gpset->num_segs++;
+  __sync_synchronize();
+  gpset->capacity += num;
+}
+
+// Add a segment of `size` bytes of sequence. Must hold seglock.
+static void _add_seq_seg(GPathSet *gpset, size_t size)
+{
+  if(gpset->num_seq_segs == GPATH_SET_MAX_SEGS)
+    die("[GPathSet] Too many segments");
+
+  ByteBuffer *seqs = &gpset->seqs[gpset->num_seq_segs];
+  byte_buf_alloc(seqs, size + SEQ_STORE_PADDING);
+  gpset->mem_used += seqs->size;
+
+  __sync_synchronize();
+  gpset->num_seq_segs++;
+}
+
+// Returns the size of the next segment, given the size of the last and the
+// minimum we need. Dies if we would go over the memory limit.
+static size_t _next_seg_size(const GPathSet *gpset, size_t last, size_t min,
+                             size_t unit_mem)
 {
-  GPathSet tmp = {.ncols = ncols, .can_resize = resize};
+  size_t mem_left = gpset->max_mem - MIN2(gpset->mem_used, gpset->max_mem);
+  size_t num = MIN2(last*2, mem_left / unit_mem);
+
+  if(num < min) {
+    char mem_str[50];
+    gpath_set_print_stats(gpset);
+    die("[GPathSet] Out of memory (limit: %s)",
+        bytes_to_str(gpset->max_mem, 1, mem_str));
+  }
+
+  return num;
+}
 
-  // 1:1 split between seq and paths (6 bytes each)
-  size_t entry_size = 0, counts_size = 0;
+void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
+                      size_t initpaths, size_t initmem, size_t max_mem,
+                      bool keep_path_counts)
+{
+  GPathSet tmp = {.ncols = ncols, .keep_nseen = keep_path_counts,
+                  .num_segs = 0, .num_paths = 0, .capacity = 0,
+                  .num_seq_segs = 0,
+                  .mem_used = 0, .max_mem = MAX2(initmem, max_mem),
+                  .seglock = 0};
 
-  entry_size = sizeof(GPath) + (ncols+7)/8;
-  counts_size = keep_path_counts ? sizeof(uint8_t)*ncols : 0;
+  memcpy(gpset, &tmp, sizeof(GPathSet));
 
-  size_t mem_used = initpaths * (entry_size + counts_size);
+  size_t counts_size = keep_path_counts ? sizeof(uint8_t)*ncols : 0;
+  size_t mem_used = initpaths * (sizeof(GPath) + (ncols+7)/8 + counts_size);
 
   if(initmem < mem_used) {
     die("[GPathSet] Not enough memory for number of paths (%zu < %zu)",
@@ -34,30 +88,23 @@ void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
   ctx_assert(total_mem <= initmem);
 
   char npathstr[50], colmemstr[50], seqmemstr[50], totalmemstr[50];
+  char maxmemstr[50];
   ulong_to_str(initpaths, npathstr);
   bytes_to_str(col_mem, 1, colmemstr);
   bytes_to_str(seq_mem, 1, seqmemstr);
   bytes_to_str(total_mem, 1, totalmemstr);
-  status("[GPathSet] Allocating for %s paths, %s colset, %s seq => %s total",
-         npathstr, colmemstr, seqmemstr, totalmemstr);
-
-  gpath_buf_alloc(&tmp.entries, initpaths);
-  byte_buf_alloc(&tmp.seqs, seq_col_mem + SEQ_STORE_PADDING);
-
-  if(keep_path_counts) {
-    // madcrowlib allocates with calloc, so these are all zero'd
-    byte_buf_alloc(&tmp.nseen_buf, initpaths * ncols);
-  } else {
-    memset(&tmp.nseen_buf, 0, sizeof(tmp.nseen_buf));
-  }
+  if(max_mem == GPATH_SET_NO_MEM_LIMIT) strcpy(maxmemstr, "no limit");
+  else bytes_to_str(gpset->max_mem, 1, maxmemstr);
+  status("[GPathSet] Allocating for %s paths, %s colset, %s seq => %s total "
+         "[max: %s]", npathstr, colmemstr, seqmemstr, totalmemstr, maxmemstr);
 
-  memcpy(gpset, &tmp, sizeof(GPathSet));
+  _add_path_seg(gpset, MAX2(initpaths, 1));
+  _add_seq_seg(gpset, MAX2(seq_col_mem, 64));
 }
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
-void gpath_set_alloc(GPathSet *gpset, size_t ncols, size_t initmem,
-                     bool resize, bool keep_path_counts)
+void gpath_set_alloc(GPathSet *gpset, size_t ncols,
+                     size_t initmem, size_t max_mem,
+                     bool keep_path_counts)
 {
   // Assume 8 bytes of sequence per path
   size_t entry_size
@@ -66,43 +113,81 @@ void gpath_set_alloc(GPathSet *gpset, size_t ncols, size_t initmem,
 
   size_t nentries = initmem / entry_size;
 
-  gpath_set_alloc2(gpset, ncols, nentries, initmem, resize, keep_path_counts);
+  gpath_set_alloc2(gpset, ncols, nentries, initmem, max_mem, keep_path_counts);
 }
 
 void gpath_set_dealloc(GPathSet *gpset)
 {
-  gpath_buf_dealloc(&gpset->entries);
-  byte_buf_dealloc(&gpset->seqs);
-  byte_buf_dealloc(&gpset->nseen_buf);
+  size_t i;
+  for(i = 0; i < gpset->num_segs; i++) {
+    ctx_free(gpset->segs[i].gpaths);
+    ctx_free(gpset->segs[i].nseen);
+  }
+  for(i = 0; i < gpset->num_seq_segs; i++)
+    byte_buf_dealloc(&gpset->seqs[i]);
   memset(gpset, 0, sizeof(GPathSet));
 }
 
+// Keep first segments only
 void gpath_set_reset(GPathSet *gpset)
 {
-  gpath_buf_reset(&gpset->entries);
-  byte_buf_reset(&gpset->seqs);
-  byte_buf_reset(&gpset->nseen_buf);
+  size_t i;
+  for(i = 1; i < gpset->num_segs; i++) {
+    gpset->mem_used -= gpset->segs[i].num * gpset_path_mem(gpset);
+    ctx_free(gpset->segs[i].gpaths);
+    ctx_free(gpset->segs[i].nseen);
+  }
+  for(i = 1; i < gpset->num_seq_segs; i++) {
+    gpset->mem_used -= gpset->seqs[i].size;
+    byte_buf_dealloc(&gpset->seqs[i]);
+  }
+
+  GPathSegment *seg = &gpset->segs[0];
+  if(seg->nseen) memset(seg->nseen, 0, seg->num * gpset->ncols);
+  byte_buf_reset(&gpset->seqs[0]);
+
+  gpset->num_segs = gpset->num_seq_segs = 1;
+  gpset->num_paths = 0;
+  gpset->capacity = seg->num;
 }
 
 void gpath_set_print_stats(const GPathSet *gpset)
 {
+  size_t i, seq_len = 0, seq_cap = 0;
+  for(i = 0; i < gpset->num_seq_segs; i++) {
+    seq_len += MIN2(gpset->seqs[i].len, gpset->seqs[i].size);
+    seq_cap += gpset->seqs[i].size;
+  }
+
+  size_t num_paths = MIN2(gpset->num_paths, gpset->capacity);
+
   char paths_str[50], paths_cap_str[50], seq_str[50], seq_cap_str[50];
-  ulong_to_str(gpset->entries.len, paths_str);
-  ulong_to_str(gpset->entries.size, paths_cap_str);
-  bytes_to_str(gpset->seqs.len, 1, seq_str);
-  bytes_to_str(gpset->seqs.size, 1, seq_cap_str);
-  status("[GPathSet] Paths: %s / %s [%.2f%%], seqs: %s / %s [%.2f%%] (%zu / %zu)",
+  char mem_str[50];
+  ulong_to_str(num_paths, paths_str);
+  ulong_to_str(gpset->capacity, paths_cap_str);
+  bytes_to_str(seq_len, 1, seq_str);
+  bytes_to_str(seq_cap, 1, seq_cap_str);
+  bytes_to_str(gpset->mem_used, 1, mem_str);
+  status("[GPathSet] Paths: %s / %s [%.2f%%], seqs: %s / %s [%.2f%%] "
+         "(%zu / %zu); %s in %zu+%zu segments",
          paths_str, paths_cap_str,
-         (100.0 * gpset->entries.len) / gpset->entries.size,
+         (100.0 * num_paths) / gpset->capacity,
          seq_str, seq_cap_str,
-         (100.0 * gpset->seqs.len) / gpset->seqs.size,
-         gpset->seqs.len, gpset->seqs.size);
+         (100.0 * seq_len) / seq_cap,
+         seq_len, seq_cap,
+         mem_str, gpset->num_segs, gpset->num_seq_segs);
 }
 
 uint8_t* gpath_set_get_nseen(const GPathSet *gpset, const GPath *gpath)
 {
-  pkey_t pkey = gpset_get_pkey(gpset, gpath);
-  return gpath_set_has_nseen(gpset) ? &gpset->nseen_buf.b[pkey*gpset->ncols] : NULL;
+  if(!gpath_set_has_nseen(gpset)) return NULL;
+
+  const GPathSegment *seg = gpset->segs, *end = seg + gpset->num_segs;
+  for(; seg < end; seg++) {
+    if(gpath >= seg->gpaths && gpath < seg->gpaths + seg->num)
+      return seg->nseen + (gpath - seg->gpaths) * gpset->ncols;
+  }
+  die("GPath is not in GPathSet");
 }
 
 // Copy nseen counts to dst from src
@@ -121,90 +206,64 @@ void gpath_set_nseen_sum_mt(const GPath *dst, GPathSet *dstset,
   }
 }
 
-// Resize buffers if needed and update internal pointers
-void _check_resize(GPathSet *gpset, size_t req_num_bytes)
+// Reserve a path, adding a segment if needed
+static GPath* _reserve_gpath(GPathSet *gpset)
 {
-  const size_t ncols = gpset->ncols;
-  size_t i;
-
-  GPath *old_entries = gpset->entries.b;
-  size_t old_num_entries = gpset->entries.size;
-  gpath_buf_capacity(&gpset->entries, gpset->entries.len+1);
-
-  if(old_entries != gpset->entries.b) {
-    // Correct all path pointers
-    for(i = 0; i < gpset->entries.len; i++) {
-      if(gpset->entries.b[i].next != NULL) {
-        gpset->entries.b[i].next = gpset->entries.b +
-                                      (gpset->entries.b[i].next - old_entries);
-      }
-    }
-  }
+  pkey_t pkey = __sync_fetch_and_add((volatile size_t*)&gpset->num_paths, 1);
 
-  if(old_num_entries != gpset->entries.size)
+  while(pkey >= *(volatile size_t*)&gpset->capacity)
   {
-    if(gpath_set_has_nseen(gpset)) {
-      // Increase size of nseen buffer to match (zero'd by default)
-      byte_buf_capacity(&gpset->nseen_buf, gpset->entries.size * ncols);
+    bitlock_yield_acquire(&gpset->seglock, 0);
+    if(pkey >= gpset->capacity) {
+      const GPathSegment *last = &gpset->segs[gpset->num_segs-1];
+      size_t num = _next_seg_size(gpset, last->num, pkey+1 - gpset->capacity,
+                                  gpset_path_mem(gpset));
+      _add_path_seg(gpset, num);
     }
+    bitlock_release(&gpset->seglock, 0);
   }
 
-  uint8_t *old_seq = gpset->seqs.b;
-  byte_buf_capacity(&gpset->seqs, gpset->seqs.len+req_num_bytes+SEQ_STORE_PADDING);
+  return gpset_get_gpath(gpset, pkey);
+}
+
+// Reserve nbytes of sequence, adding a segment if needed
+static uint8_t* _reserve_seq(GPathSet *gpset, size_t nbytes)
+{
+  ByteBuffer *seqs;
+  size_t nsegs, offset;
 
-  if(gpset->seqs.b != old_seq) {
-    // Correct all seq pointers
-    for(i = 0; i < gpset->entries.len; i++) {
-      if(gpset->entries.b[i].seq != NULL) {
-        gpset->entries.b[i].seq = gpset->seqs.b +
-                                     (gpset->entries.b[i].seq - old_seq);
-      }
+  while(1)
+  {
+    nsegs = *(volatile size_t*)&gpset->num_seq_segs;
+    seqs = &gpset->seqs[nsegs-1];
+    offset = __sync_fetch_and_add((volatile size_t*)&seqs->len, nbytes);
+
+    if(offset + nbytes + SEQ_STORE_PADDING <= seqs->size)
+      return seqs->b + offset;
+
+    // Segment full; bytes we reserved past the end are never used
+    bitlock_yield_acquire(&gpset->seglock, 0);
+    if(gpset->num_seq_segs == nsegs) {
+      size_t size = _next_seg_size(gpset, seqs->size, nbytes+SEQ_STORE_PADDING, 1);
+      _add_seq_seg(gpset, size - SEQ_STORE_PADDING);
     }
+    bitlock_release(&gpset->seglock, 0);
   }
 }
 
 // Always adds new path. If newpath could be a duplicate, use gpathhash
-// Threadsafe only if resize is false. GPath* not safe to edit until it returns
+// Threadsafe. GPath* not safe to edit until it returns
 // Copies newgpath.seq over and wipe new colset
 GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
 {
   ctx_assert(newgpath.seq != NULL);
 
-  pkey_t pkey;
-  GPath *gpath;
-  uint8_t *data;
   size_t colset_bytes = (gpset->ncols+7)/8;
   size_t junc_bytes = binary_seq_mem(newgpath.num_juncs);
   size_t nbytes = colset_bytes + junc_bytes;
 
-  if(gpset->can_resize)
-  {
-    _check_resize(gpset, nbytes);
-    pkey = gpath_buf_add(&gpset->entries, (GPath){.seq = NULL, .num_juncs = 0});
-    gpath = &gpset->entries.b[pkey];
-    data = gpset->seqs.b + gpset->seqs.len;
-    gpset->seqs.len += nbytes;
-  }
-  else
-  {
-    gpath = gpset->entries.b + __sync_fetch_and_add((volatile size_t*)&gpset->entries.len, 1);
-    data = gpset->seqs.b + __sync_fetch_and_add((volatile size_t*)&gpset->seqs.len, nbytes);
-
-    if(gpath >= gpset->entries.b + gpset->entries.size ||
-       data+nbytes+SEQ_STORE_PADDING > gpset->seqs.b + gpset->seqs.size)
-    {
-      gpath_set_print_stats(gpset);
-      status("%zu >= %zu; %zu > %zu nbytes: %zu\n",
-             gpath - gpset->entries.b,
-             gpset->entries.size,
-             data+nbytes+SEQ_STORE_PADDING - gpset->seqs.b,
-             gpset->seqs.size,
-             nbytes);
-      die("Out of memory");
-    }
-
-    pkey = gpath - gpset->entries.b;
-  }
+  GPath *gpath = _reserve_gpath(gpset);
+  uint8_t *data = _reserve_seq(gpset, nbytes);
 
   uint8_t *colset = data;
   gpath->seq = data + colset_bytes;
@@ -223,8 +282,6 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
   // link counts
   if(gpath_set_has_nseen(gpset))
   {
-    __sync_fetch_and_add((volatile size_t*)&gpset->nseen_buf.len, gpset->ncols);
-
     uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
     ctx_assert(nseen != NULL);
 
@@ -19,46 +19,86 @@ typedef struct
   Orientation orient;
 } GPathNew;
 
+//
+// Paths and their sequences are stored in segments that are added as the set
+// grows. Existing segments are never moved, so GPath pointers stay valid and
+// threads can add paths whilst the set grows. Threads reserve a path and its
+// sequence bytes with atomic increments; a lock is only taken to add a
+// segment. Each new segment is twice the size of the previous one, until the
+// memory limit is reached.
+//
+
+#define GPATH_SET_MAX_SEGS 64
+
+// No limit on memory used by a GPathSet
+#define GPATH_SET_NO_MEM_LIMIT SIZE_MAX
+
+typedef struct
+{
+  GPath *gpaths;
+  uint8_t *nseen; // ncols bytes per path, if counting sightings
+  size_t first, num; // pkey of the first path, number of paths
+} GPathSegment;
+
 typedef struct
 {
   const size_t ncols;
-  GPathBuffer entries;
-  ByteBuffer seqs; // colset+seq for each path
-  ByteBuffer nseen_buf; // counts for how many times we've seen path
-  bool can_resize;
+  const bool keep_nseen; // store counts of how many times we've seen path
+
+  // Segments of paths
+  GPathSegment segs[GPATH_SET_MAX_SEGS];
+  size_t num_segs;
+  size_t num_paths, capacity; // paths added, paths that fit in segments
+
+  // Segments of colset+seq for each path
+  ByteBuffer seqs[GPATH_SET_MAX_SEGS];
+  size_t num_seq_segs;
+
+  size_t mem_used, max_mem;
+  uint8_t seglock; // held when adding segments
 } GPathSet;
 
+// Get GPath with a given pkey
+static inline GPath* gpset_get_gpath(const GPathSet *gpset, pkey_t pkey)
+{
+  const GPathSegment *seg = gpset->segs + gpset->num_segs - 1;
+  while(seg->first > pkey) seg--;
+  ctx_assert2(pkey < gpset->num_paths, "GPath is not in GPathSet");
+  return seg->gpaths + (pkey - seg->first);
+}
 
 static inline pkey_t gpset_get_pkey(const GPathSet *gpset, const GPath *gpath)
 {
-  ctx_assert2(gpath >= gpset->entries.b &&
-              gpath <= gpset->entries.b+gpset->entries.len,
-              "GPath is not in GPathSet");
-  return gpath - gpset->entries.b;
+  const GPathSegment *seg = gpset->segs, *end = seg + gpset->num_segs;
+  for(; seg < end; seg++) {
+    if(gpath >= seg->gpaths && gpath < seg->gpaths + seg->num)
+      return seg->first + (gpath - seg->gpaths);
+  }
+  die("GPath is not in GPathSet");
 }
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
+// Initially allocate for `initpaths` paths using `initmem` bytes, then grow
+// as paths are added. Dies if more than `max_mem` bytes are needed.
 void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
-                      size_t initpaths, size_t initmem,
-                      bool resize, bool keep_path_counts);
+                      size_t initpaths, size_t initmem, size_t max_mem,
+                      bool keep_path_counts);
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
-void gpath_set_alloc(GPathSet *set, size_t ncols, size_t initmem,
-                     bool resize, bool keep_path_counts);
+// Initially allocate `initmem` bytes, then grow up to `max_mem` bytes
+void gpath_set_alloc(GPathSet *set, size_t ncols,
+                     size_t initmem, size_t max_mem,
+                     bool keep_path_counts);
 void gpath_set_dealloc(GPathSet *set);
 void gpath_set_reset(GPathSet *set);
 
 void gpath_set_print_stats(const GPathSet *gpset);
 
 // Always adds new path. If newpath could be a duplicate, use gpathhash
-// Threadsafe only if resize is false. GPath* not safe to edit until it returns
+// Threadsafe. GPath* not safe to edit until it returns
 // Copies newgpath.seq over and wipe new colset
 GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath);
 
 // Returns true if we are storing number of sightings and kmer length
-#define gpath_set_has_nseen(gpset) ((gpset)->nseen_buf.b != NULL)
+#define gpath_set_has_nseen(gpset) ((gpset)->keep_nseen)
 
 uint8_t* gpath_set_get_nseen(const GPathSet *gpset, const GPath *gpath);
 
@@ -2,6 +2,11 @@
 #include "gpath_store.h"
 #include "util.h"
 
+#ifdef CTXVERBOSE
+  #include <sys/time.h> // gettimeofday()
+#endif
+
+
 
 // If num_paths != 0, we ensure at least num_paths capacity
 // @split_linked_lists whether you intend to have traverse linked list and
@@ -18,12 +23,13 @@ void gpath_store_alloc(GPathStore *gpstore, size_t ncols, size_t graph_capacity,
 
   size_t gpset_mem = mem - store_mem;
 
-  // Don't allow resizing - this allows use to the thread safe
-  // and control memory usage (die when we fill up allowed memory)
+  // Path set grows as paths are added, up to gpset_mem (die when we fill up
+  // allowed memory). Without a number of paths, start with a quarter of it.
   if(num_paths)
-    gpath_set_alloc2(&gpstore->gpset, ncols, num_paths, gpset_mem, false, count_nseen);
+    gpath_set_alloc2(&gpstore->gpset, ncols, num_paths, gpset_mem, gpset_mem,
+                     count_nseen);
   else
-    gpath_set_alloc(&gpstore->gpset, ncols, gpset_mem, false, count_nseen);
+    gpath_set_alloc(&gpstore->gpset, ncols, gpset_mem/4, gpset_mem, count_nseen);
 
   gpstore->graph_capacity = graph_capacity;
 
@@ -36,6 +42,7 @@ void gpath_store_dealloc(GPathStore *gpstore)
 {
   gpath_set_dealloc(&gpstore->gpset);
   gpath_store_merge_read_write(gpstore);
+  ctx_free(gpstore->flat_offsets);
   ctx_free(gpstore->paths_all);
   if(gpstore->paths_traverse != gpstore->paths_all) ctx_free(gpstore->paths_traverse);
   memset(gpstore, 0, sizeof(*gpstore));
@@ -45,6 +52,16 @@ void gpath_store_reset(GPathStore *gpstore)
 {
   gpath_set_reset(&gpstore->gpset);
   gpstore->num_kmers_with_paths = gpstore->num_paths = gpstore->path_bytes = 0;
+  gpstore->max_path_juncs = 0;
+
+  if(gpath_store_is_flat(gpstore)) {
+    // Back to linked lists
+    ctx_free(gpstore->flat_offsets);
+    gpstore->flat_offsets = NULL;
+    gpstore->paths_all = ctx_calloc(gpstore->graph_capacity, sizeof(GPath*));
+    gpstore->paths_traverse = gpstore->paths_all;
+  }
+
   memset(gpstore->paths_all, 0, gpstore->graph_capacity * sizeof(GPath*));
   if(gpstore->paths_traverse != gpstore->paths_all)
     ctx_free(gpstore->paths_traverse);
@@ -65,6 +82,9 @@ void gpath_store_print_stats(const GPathStore *gpstore)
 
 void gpath_store_split_read_write(GPathStore *gpstore)
 {
+  if(gpath_store_is_flat(gpstore))
+    die("[GPathStore] Cannot add paths to flattened store");
+
   if(gpstore->paths_traverse == gpstore->paths_all)
   {
     status("[GPathStore] Creating separate read/write GraphPath linked lists");
@@ -93,13 +113,22 @@ void gpath_store_merge_read_write(GPathStore *gpstore)
   }
 }
 
+static inline GPath* _gpstore_fetch_flat(const GPathStore *gpstore, hkey_t hkey)
+{
+  uint64_t offset = gpstore->flat_offsets[hkey];
+  if(offset == gpstore->flat_offsets[hkey+1]) return NULL;
+  return gpstore->gpset.segs[0].gpaths + offset;
+}
+
 GPath* gpath_store_fetch(const GPathStore *gpstore, hkey_t hkey)
 {
+  if(gpath_store_is_flat(gpstore)) return _gpstore_fetch_flat(gpstore, hkey);
   return gpstore->paths_all[hkey];
 }
 
 GPath* gpath_store_fetch_traverse(const GPathStore *gpstore, hkey_t hkey)
 {
+  if(gpath_store_is_flat(gpstore)) return _gpstore_fetch_flat(gpstore, hkey);
   return gpstore->paths_traverse[hkey];
 }
 
@@ -129,6 +158,11 @@ static void _gpstore_add_to_llist_mt(GPathStore *gpstore, hkey_t hkey, GPath *gp
   __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_kmers_with_paths, new_kmer);
   __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_paths, 1);
   __sync_fetch_and_add((volatile uint64_t*)&gpstore->path_bytes, nbytes);
+
+  uint64_t max_juncs;
+  while((max_juncs = *(volatile uint64_t*)&gpstore->max_path_juncs) < gpath->num_juncs &&
+        !__sync_bool_compare_and_swap((volatile uint64_t*)&gpstore->max_path_juncs,
+                                      max_juncs, (uint64_t)gpath->num_juncs)) {}
 }
 
 // Linear search to find a given path
@@ -148,12 +182,184 @@ GPath* gpath_store_add_mt(GPathStore *gpstore, hkey_t hkey, GPathNew newgpath)
 {
   ctx_assert(newgpath.seq != NULL);
 
+  if(gpath_store_is_flat(gpstore))
+    die("[GPathStore] Cannot add paths to flattened store");
+
   GPath *gpath = gpath_set_add_mt(&gpstore->gpset, newgpath);
   _gpstore_add_to_llist_mt(gpstore, hkey, gpath);
 
   return gpath;
 }
 
+// Swap paths at positions i and j of a single segment, with their counts
+static inline void _gpstore_swap_paths(GPathSegment *seg, size_t ncols,
+                                       size_t i, size_t j)
+{
+  GPath tmp = seg->gpaths[i];
+  seg->gpaths[i] = seg->gpaths[j];
+  seg->gpaths[j] = tmp;
+
+  if(seg->nseen != NULL) {
+    uint8_t *a = seg->nseen + i*ncols, *b = seg->nseen + j*ncols, c;
+    size_t k;
+    for(k = 0; k < ncols; k++) { c = a[k]; a[k] = b[k]; b[k] = c; }
+  }
+}
+
+// Sort the paths of a single segment set by kmer in place. The kmer of each
+// path has been stored in its `next` field. `cursors` has `capacity` entries.
+static void _gpstore_sort_in_place(GPathSet *gpset, const uint64_t *offsets,
+                                   uint64_t *cursors, size_t capacity)
+{
+  GPathSegment *seg = &gpset->segs[0];
+  size_t b, c, i;
+
+  memcpy(cursors, offsets, capacity * sizeof(uint64_t));
+
+  // American flag sort: fill each kmer's range in turn, swapping paths that
+  // belong elsewhere directly into place
+  for(b = 0; b < capacity; b++) {
+    while((i = cursors[b]) < offsets[b+1]) {
+      c = (size_t)seg->gpaths[i].next;
+      if(c == b) cursors[b]++;
+      else _gpstore_swap_paths(seg, gpset->ncols, i, cursors[c]++);
+    }
+  }
+}
+
+// Copy paths into a single new segment in kmer order. Used when the set has
+// several segments or paths that have been dropped. Sequences are not moved.
+static void _gpstore_copy_paths(GPathStore *gpstore, size_t npaths)
+{
+  GPathSet *gpset = &gpstore->gpset;
+  const size_t ncols = gpset->ncols;
+  GPath *gpaths = ctx_malloc(npaths * sizeof(GPath)), *gpath;
+  uint8_t *nseen = gpset->keep_nseen ? ctx_malloc(npaths * ncols) : NULL;
+  size_t i, n = 0;
+  hkey_t hkey;
+
+  for(hkey = 0; hkey < gpstore->graph_capacity; hkey++) {
+    for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = gpath->next, n++) {
+      gpaths[n] = *gpath;
+      if(nseen) memcpy(nseen + n*ncols, gpath_set_get_nseen(gpset, gpath), ncols);
+    }
+  }
+
+  ctx_assert(n == npaths);
+
+  size_t path_mem = sizeof(GPath) + (gpset->keep_nseen ? ncols : 0);
+
+  for(i = 0; i < gpset->num_segs; i++) {
+    ctx_free(gpset->segs[i].gpaths);
+    ctx_free(gpset->segs[i].nseen);
+    gpset->mem_used -= gpset->segs[i].num * path_mem;
+  }
+
+  GPathSegment seg = {.gpaths = gpaths, .nseen = nseen, .first = 0, .num = npaths};
+  gpset->segs[0] = seg;
+  gpset->num_segs = 1;
+  gpset->num_paths = gpset->capacity = npaths;
+  gpset->mem_used += npaths * path_mem;
+}
+
+#ifdef CTXVERBOSE
+// Visit every path, reading its colset and sequence as a traversal would
+// Returns time taken in seconds
+static double _gpstore_traverse_time(const GPathStore *gpstore, size_t *sum)
+{
+  const size_t ncols = gpstore->gpset.ncols;
+  struct timeval start, end;
+  const GPath *gpath;
+  hkey_t hkey;
+
+  gettimeofday(&start, NULL);
+  for(hkey = 0; hkey < gpstore->graph_capacity; hkey++) {
+    gpath = gpath_store_fetch(gpstore, hkey);
+    for(; gpath != NULL; gpath = gpath->next)
+      *sum += gpath->seq[0] + *gpath_get_colset(gpath, ncols);
+  }
+  gettimeofday(&end, NULL);
+
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+#endif
+
+void gpath_store_flatten(GPathStore *gpstore)
+{
+  if(gpath_store_is_flat(gpstore) || gpstore->paths_all == NULL) return;
+  if(gpstore->paths_traverse != gpstore->paths_all)
+    die("[GPathStore] Merge read/write linked lists before flattening");
+
+  GPathSet *gpset = &gpstore->gpset;
+  const size_t capacity = gpstore->graph_capacity;
+  size_t npaths = 0;
+  hkey_t hkey;
+  GPath *gpath, *next;
+
+  size_t mem_before = gpset->mem_used + capacity * sizeof(GPath*);
+
+#ifdef CTXVERBOSE
+  size_t list_sum = 0, flat_sum = 0;
+  double list_time = _gpstore_traverse_time(gpstore, &list_sum);
+#endif
+
+  // Count paths on each kmer
+  uint64_t *offsets = ctx_calloc(capacity+1, sizeof(uint64_t));
+
+  for(hkey = 0; hkey < capacity; hkey++) {
+    offsets[hkey] = npaths;
+    for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = gpath->next)
+      npaths++;
+  }
+  offsets[capacity] = npaths;
+
+  if(gpset->num_segs == 1 && gpset->num_paths == npaths)
+  {
+    // Every path in the set is on a list: store each path's kmer in its next
+    // field, then sort in place using the linked list heads as cursors
+    for(hkey = 0; hkey < capacity; hkey++) {
+      for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = next) {
+        next = gpath->next;
+        gpath->next = (GPath*)(size_t)hkey;
+      }
+    }
+
+    ctx_assert(sizeof(GPath*) == sizeof(uint64_t));
+    _gpstore_sort_in_place(gpset, offsets, (uint64_t*)gpstore->paths_all,
+                           capacity);
+  }
+  else _gpstore_copy_paths(gpstore, npaths);
+
+  // Link paths of each kmer to the adjacent path
+  GPath *gpaths = gpset->segs[0].gpaths;
+  for(hkey = 0; hkey < capacity; hkey++) {
+    if(offsets[hkey] == offsets[hkey+1]) continue;
+    for(gpath = gpaths + offsets[hkey]; gpath+1 < gpaths + offsets[hkey+1]; gpath++)
+      gpath->next = gpath+1;
+    gpath->next = NULL;
+  }
+
+  ctx_free(gpstore->paths_all);
+  gpstore->paths_all = gpstore->paths_traverse = NULL;
+  gpstore->flat_offsets = offsets;
+
+  size_t mem_after = gpset->mem_used + (capacity+1) * sizeof(uint64_t);
+
+  char npaths_str[50], before_str[50], after_str[50];
+  ulong_to_str(npaths, npaths_str);
+  bytes_to_str(mem_before, 1, before_str);
+  bytes_to_str(mem_after, 1, after_str);
+  status("[GPathStore] Flattened %s paths; memory: %s -> %s",
+         npaths_str, before_str, after_str);
+
+#ifdef CTXVERBOSE
+  // Timing passes read every path twice, so only with make VERBOSE=1
+  double flat_time = _gpstore_traverse_time(gpstore, &flat_sum);
+  ctx_assert(list_sum == flat_sum);
+  status("[GPathStore] Traversal: %.3fs -> %.3fs", list_time, flat_time);
+#endif
+}
+
 /*
 // NOT USED ATM
 // Linear time search to find or add a given path
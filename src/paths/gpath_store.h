@@ -4,13 +4,21 @@
 #include "gpath_set.h"
 
 // GPathStore is a map from {[kmer/hkey] -> [GPath linked list]}
+//
+// Once all paths are added, the store can be flattened into a read-only
+// layout: paths of each kmer are stored contiguously in hkey order.
+// paths_all is replaced by a CSR offsets array; paths of hkey are
+// gpaths[flat_offsets[hkey]..flat_offsets[hkey+1]]. GPath.next still works,
+// pointing to the adjacent path. Colset+seq bytes are not moved.
 typedef struct
 {
   // num_paths may not match gpset->num_paths if we have dropped paths
   uint64_t num_kmers_with_paths, num_paths, path_bytes;
+  uint64_t max_path_juncs; // junctions in longest path added (not reduced on removal)
   uint64_t graph_capacity;
   GPathSet gpset;
   GPath **paths_all, **paths_traverse;
+  uint64_t *flat_offsets; // non-NULL once flattened
 } GPathStore;
 
 // If num_paths != 0, we ensure at least num_paths capacity
@@ -30,10 +38,29 @@ void gpath_store_split_read_write(GPathStore *gpstore);
 void gpath_store_merge_read_write(GPathStore *gpstore);
 
 // Traversal paths are a subset of all paths
-#define gpath_store_use_traverse(gpstore) ((gpstore)->paths_traverse != NULL)
+#define gpath_store_use_traverse(gpstore) \
+        ((gpstore)->paths_traverse != NULL || gpath_store_is_flat(gpstore))
 GPath* gpath_store_fetch(const GPathStore *gpstore, hkey_t hkey);
 GPath* gpath_store_fetch_traverse(const GPathStore *gpstore, hkey_t hkey);
 
+#define gpath_store_is_flat(gpstore) ((gpstore)->flat_offsets != NULL)
+
+// Number of paths on a kmer once flattened
+#define gpath_store_flat_num_paths(gpstore,hkey) \
+        ((gpstore)->flat_offsets[(hkey)+1] - (gpstore)->flat_offsets[hkey])
+
+// Convert to the flattened read-only layout. Paths can no longer be added.
+// Read and write linked lists must be merged first. pkeys change, so any
+// GPathHash on this store is no longer valid.
+// Paths are sorted in place if they are in a single segment, otherwise path
+// structs (not sequences) are copied. Needs gpath_store_flatten_mem() bytes
+// on top of the store for the offsets. Compiled with VERBOSE=1, traversal time
+// before and after is also reported.
+void gpath_store_flatten(GPathStore *gpstore);
+
+// Memory used by flattened offsets
+#define gpath_store_flatten_mem(capacity) (((capacity)+1) * sizeof(uint64_t))
+
 GPath* gpstore_find(const GPathStore *gpstore, hkey_t hkey, GPathNew find);
 
 // Always adds
@@ -55,8 +55,8 @@ void gpath_subset_load_set(GPathSubset *subset)
 {
   GPathSet *gpset = subset->gpset;
   size_t i;
-  for(i = 0; i < gpset->entries.len; i++)
-    gpath_ptr_buf_add(&subset->list, &gpset->entries.b[i]);
+  for(i = 0; i < gpset->num_paths; i++)
+    gpath_ptr_buf_add(&subset->list, gpset_get_gpath(gpset, i));
 }
 
 // Update the linked list of paths in set `subset->gpset`
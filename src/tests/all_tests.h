@@ -129,12 +129,21 @@ void test_paths();
 // path_set_tests.c
 // void test_path_sets();
 
+// gpath_set_tests.c
+void test_gpath_set();
+
+// link_block_tests.c
+void test_link_block();
+
 // graph_walker_tests.c
 void test_graph_walker();
 
 // corrected_aln_tests.c
 void test_corrected_aln();
 
+// gap_memo_tests.c
+void test_gap_memo();
+
 // repeat_walker_tests.c
 void test_repeat_walker();
 
@@ -150,4 +159,13 @@ void test_graph_crawler();
 // infer_edges_tests.c
 void test_infer_edges_tests();
 
+// count_filter_tests.c
+void test_count_filter();
+
+// genotyping_tests.c
+void test_genotyping();
+
+// allele_align_tests.c
+void test_allele_align();
+
 #endif  /* ALL_TESTS_H_ */
@@ -0,0 +1,155 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "allele_align.h"
+#include <ctype.h> // tolower()
+
+// Score an alignment, a gap of length n scores gap_open + n*gap_extend
+static long _aln_score(const scoring_t *sc, const char *ra, const char *rb)
+{
+  long score = 0;
+  char gap = 0; // which sequence the previous column had a gap in
+  int x, y;
+
+  for(; *ra; ra++, rb++) {
+    if(*ra == '-') {
+      score += sc->gap_extend + (gap != 'a' ? sc->gap_open : 0);
+      gap = 'a';
+    } else if(*rb == '-') {
+      score += sc->gap_extend + (gap != 'b' ? sc->gap_open : 0);
+      gap = 'b';
+    } else {
+      x = (unsigned char)*ra;
+      y = (unsigned char)*rb;
+      if(!sc->case_sensitive) { x = tolower(x); y = tolower(y); }
+      score += (x == y ? sc->match : sc->mismatch);
+      gap = 0;
+    }
+  }
+
+  return score;
+}
+
+// Check alignment `ra` against `seq` with gaps removed
+static bool _aln_matches_seq(const char *ra, const char *seq, size_t len)
+{
+  size_t i = 0;
+  for(; *ra; ra++) {
+    if(*ra == '-') continue;
+    if(i == len || *ra != seq[i]) return false;
+    i++;
+  }
+  return i == len;
+}
+
+// Align with allele_align() and needleman_wunsch_align2(), check both give
+// valid alignments with the same score
+static void _test_align(AlleleAligner *aa, nw_aligner_t *nw, alignment_t *aln,
+                        const char *a, size_t alen, const char *b, size_t blen)
+{
+  size_t len = allele_align(aa, a, alen, b, blen);
+  needleman_wunsch_align2(a, b, alen, blen, aa->scoring, nw, aln);
+
+  TASSERT(len == strlen(aa->result_a));
+  TASSERT(len == strlen(aa->result_b));
+  TASSERT2(_aln_matches_seq(aa->result_a, a, alen), "%s", aa->result_a);
+  TASSERT2(_aln_matches_seq(aa->result_b, b, blen), "%s", aa->result_b);
+
+  long score = _aln_score(aa->scoring, aa->result_a, aa->result_b);
+  TASSERT2(score == aln->score, "score: %li nw: %i\n%s\n%s\n%s\n%s",
+           score, aln->score, aa->result_a, aa->result_b,
+           aln->result_a, aln->result_b);
+}
+
+#define _test_align_str(aa,nw,aln,a,b) \
+        _test_align(aa, nw, aln, a, strlen(a), b, strlen(b))
+
+// Copy `seq` into `out` with about `nedits` random SNPs and short indels
+static size_t _mutate(const char *seq, size_t len, char *out, size_t nedits)
+{
+  size_t i, n = 0, ins;
+  for(i = 0; i < len; ) {
+    if(nedits == 0 || rand() % (len/nedits + 1) != 0) {
+      out[n++] = seq[i++];
+      continue;
+    }
+    switch(rand() % 3) {
+      case 0: rand_bases(out+n, 1); n++; i++; break; // SNP
+      case 1: ins = 1 + rand() % 4; rand_bases(out+n, ins); n += ins; break;
+      case 2: i += 1 + rand() % 4; break; // deletion
+    }
+  }
+  out[n] = '\0';
+  return n;
+}
+
+void test_allele_align()
+{
+  test_status("Testing allele alignment against Needleman-Wunsch...");
+
+  scoring_t scoring;
+  scoring_init(&scoring, 1, -2, -4, -1, false, false, 0, 0, 0, 0);
+
+  AlleleAligner aa;
+  allele_aligner_alloc(&aa, &scoring);
+  nw_aligner_t *nw = needleman_wunsch_new();
+  alignment_t *aln = alignment_create(256);
+  AlleleAlignStats prev;
+
+  // Exact, including case differences
+  prev = aa.stats;
+  _test_align_str(&aa, nw, aln, "ACAGTTGACCA", "ACAGTTGACCA");
+  _test_align_str(&aa, nw, aln, "acagTTGACCA", "ACAGttgacca");
+  _test_align_str(&aa, nw, aln, "", "");
+  TASSERT(aa.stats.num_exact == prev.num_exact + 3);
+
+  // Hamming: SNP
+  prev = aa.stats;
+  _test_align_str(&aa, nw, aln, "ACAGTTGACCA", "ACAGTAGACCA");
+  _test_align_str(&aa, nw, aln, "acagttgacca", "ACAGTAGACCG");
+  TASSERT(aa.stats.num_hamming == prev.num_hamming + 2);
+
+  // Banded: short indels and empty alleles
+  prev = aa.stats;
+  _test_align_str(&aa, nw, aln, "ACAGTTGACCA", "ACAGTTTTGACCA");
+  _test_align_str(&aa, nw, aln, "ACAGTTGACCA", "ACAGGACCA");
+  _test_align_str(&aa, nw, aln, "ACA", "");
+  _test_align_str(&aa, nw, aln, "", "ACAGT");
+  TASSERT(aa.stats.num_banded == prev.num_banded + 4);
+  TASSERT(aa.stats.num_band_retries == prev.num_band_retries);
+
+  char a[256], b[256];
+  size_t i, alen, blen;
+
+  // Band has to widen: shared sequence shifted by 40bp
+  rand_bases(a, 100);
+  memcpy(b, a+40, 60);
+  rand_bases(b+60, 40);
+  a[100] = b[100] = '\0';
+  prev = aa.stats;
+  _test_align(&aa, nw, aln, a, 100, b, 100);
+  TASSERT(aa.stats.num_banded == prev.num_banded + 1);
+  TASSERT(aa.stats.num_band_retries > prev.num_band_retries);
+
+  // Shifted further than ALLELE_ALIGN_MAX_BAND: full Needleman-Wunsch
+  rand_bases(a, 200);
+  memcpy(b, a+100, 100);
+  rand_bases(b+100, 100);
+  a[200] = b[200] = '\0';
+  prev = aa.stats;
+  _test_align(&aa, nw, aln, a, 200, b, 200);
+  TASSERT(aa.stats.num_full == prev.num_full + 1);
+
+  // Random alleles with a few edits
+  for(i = 0; i < 200; i++) {
+    alen = rand() % 120;
+    rand_bases(a, alen);
+    a[alen] = '\0';
+    blen = _mutate(a, alen, b, rand() % 6);
+    _test_align(&aa, nw, aln, a, alen, b, blen);
+  }
+
+  alignment_free(aln);
+  needleman_wunsch_free(nw);
+  allele_aligner_dealloc(&aa);
+}
@@ -149,6 +149,41 @@ static void test_bkmer_first_last_nuc()
   }
 }
 
+// Rolling kmers and keys should match building each kmer from the string,
+// including sequences with a single kmer
+static void test_bkmer_iter()
+{
+  test_status("Testing BinaryKmerIter");
+
+  char seq[200];
+  size_t k, i, len, num_bad = 0;
+  BinaryKmerIter it;
+  BinaryKmer bkmer, bkey, itkey;
+  Orientation orient;
+
+  for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE; k+=2)
+  {
+    for(len = k; len < sizeof(seq); len += sizeof(seq)-k-1)
+    {
+      dna_rand_str(seq, len);
+      binary_kmer_iter_init(&it, seq, k);
+
+      for(i = 0; i+k <= len; i++) {
+        binary_kmer_iter_add(&it, dna_char_to_nuc(seq[i+k-1]));
+        bkmer = binary_kmer_from_str(seq+i, k);
+        bkey = binary_kmer_get_key(bkmer, k);
+        itkey = binary_kmer_iter_key(&it, &orient);
+        num_bad += (!binary_kmers_are_equal(it.fw, bkmer) ||
+                    !binary_kmers_are_equal(itkey, bkey) ||
+                    (orient == FORWARD) != binary_kmers_are_equal(bkey, bkmer) ||
+                    binary_kmer_oversized(it.rv, k));
+      }
+    }
+  }
+
+  TASSERT2(num_bad == 0, "num_bad: %zu", num_bad);
+}
+
 void test_bkmer_functions()
 {
   TASSERT(sizeof(BinaryKmer) == NUM_BKMER_WORDS * 8);
@@ -156,5 +191,6 @@ void test_bkmer_functions()
   test_bkmer_revcmp();
   test_bkmer_shifts();
   test_bkmer_first_last_nuc();
+  test_bkmer_iter();
   // TODO: equal, less than, cmp
 }
@@ -83,7 +83,7 @@ static void test_bubbles(dBGraph *graph, const char **seqs, size_t nseqs,
   BubbleCallingPrefs prefs = {.max_allele_len = 100, .max_flank_len = 100,
                               .haploid_cols = NULL, .num_haploid = 0};
 
-  BubbleCaller *caller = bubble_callers_new(1, prefs, NULL, graph);
+  BubbleCaller *caller = bubble_callers_new(1, prefs, NULL, NULL, graph);
 
   _call_bubble(caller, flank5p, flank3p, alleles, nalleles, &nbuf, &sbuf);
 
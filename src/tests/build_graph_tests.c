@@ -3,8 +3,10 @@
 #include "db_graph.h"
 #include "db_node.h"
 #include "build_graph.h"
+#include "kmer_batch.h"
 
 #include <math.h>
+#include <unistd.h> // mkstemp, unlink
 
 static Covg kmer_get_covg(const char *kmer, const dBGraph *db_graph)
 {
@@ -12,6 +14,126 @@ static Covg kmer_get_covg(const char *kmer, const dBGraph *db_graph)
   return db_node_get_covg(db_graph, node.key, 0);
 }
 
+static void _graph_cmp_node(hkey_t hkey, const dBGraph *a, const dBGraph *b,
+                            size_t *num_diff)
+{
+  BinaryKmer bkey = db_node_get_bkmer(a, hkey);
+  dBNode node = db_graph_find(b, bkey);
+  if(node.key == HASH_NOT_FOUND ||
+     db_node_get_edges(a, hkey, 0) != db_node_get_edges(b, node.key, 0) ||
+     db_node_get_covg(a, hkey, 0) != db_node_get_covg(b, node.key, 0))
+    (*num_diff)++;
+}
+
+// Loading reference sequence in kmer batches should give the same kmers,
+// coverages and edges as loading each sequence with build_graph_from_str_mt()
+static void test_build_graph_from_seq()
+{
+  test_status("Testing build_graph_from_seq() in build_graph.c");
+
+  dBGraph graph_str, graph_seq;
+  const size_t kmer_size = 19, nseqs = 4, nkmers = KMER_BATCH_SIZE*3;
+  // Last sequence is longer than a batch, so is flushed part way through
+  const size_t lens[] = {kmer_size-1, kmer_size, 1000, KMER_BATCH_SIZE+1000};
+  size_t i, j, num_diff = 0;
+
+  db_graph_alloc(&graph_str, kmer_size, 1, 1, nkmers,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&graph_seq, kmer_size, 1, 1, nkmers,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  char path[] = "/tmp/ctx_build_graph_test.XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  FILE *fout = fdopen(fd, "w");
+  char *seq = ctx_malloc(lens[nseqs-1]+1);
+
+  for(i = 0; i < nseqs; i++) {
+    // Low complexity sequence repeats kmers, to test coverage
+    for(j = 0; j < lens[i]; j++) seq[j] = "ACGT"[rand() % (i % 2 ? 2 : 4)];
+    seq[lens[i]] = '\0';
+    fprintf(fout, ">seq%zu\n%s\n", i, seq);
+    if(lens[i] >= kmer_size)
+      build_graph_from_str_mt(&graph_str, 0, seq, lens[i]);
+  }
+
+  fclose(fout);
+  ctx_free(seq);
+
+  seq_file_t *sf = seq_open(path);
+  TASSERT(sf != NULL);
+  build_graph_from_seq(&graph_seq, &sf, 1, 2, 0);
+  seq_close(sf);
+  unlink(path);
+
+  TASSERT2(graph_str.ht.num_kmers == graph_seq.ht.num_kmers, "%zu vs %zu",
+           (size_t)graph_str.ht.num_kmers, (size_t)graph_seq.ht.num_kmers);
+  HASH_ITERATE(&graph_str.ht, _graph_cmp_node, &graph_str, &graph_seq, &num_diff);
+  TASSERT2(num_diff == 0, "%zu kmers differ", num_diff);
+
+  db_graph_dealloc(&graph_str);
+  db_graph_dealloc(&graph_seq);
+}
+
+static void _count_kmer_visits(hkey_t hkey, const uint8_t *visits,
+                               size_t *num_once)
+{
+  *num_once += (visits[hkey] == 1);
+}
+
+// Walking a sequence with a BinaryKmerIter should find nothing in an empty
+// graph, and each kmer exactly once in a graph built from the sequence. The
+// table has buckets of one entry, so most kmers are not in their first bucket.
+static void test_build_graph_kmer_iter()
+{
+  test_status("Testing finding kmers with BinaryKmerIter");
+
+  dBGraph graph;
+  const size_t kmer_size = 19, len = 300, nkmers = len-kmer_size+1;
+  char seq[len+1];
+  size_t i, num_found = 0, num_bad = 0, num_once = 0;
+  BinaryKmerIter it;
+  dBNode node, exp;
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+  TASSERT(graph.ht.bucket_size == 1);
+
+  rand_bases(seq, len);
+  seq[len] = '\0';
+
+  // Empty table
+  binary_kmer_iter_init(&it, seq, kmer_size);
+  for(i = kmer_size-1; i < len; i++) {
+    binary_kmer_iter_add(&it, dna_char_to_nuc(seq[i]));
+    num_found += (db_graph_find_iter(&graph, &it).key != HASH_NOT_FOUND);
+  }
+  TASSERT(num_found == 0);
+
+  build_graph_from_str_mt(&graph, 0, seq, len);
+  TASSERT2(graph.ht.num_kmers == nkmers, "%zu vs %zu",
+           (size_t)graph.ht.num_kmers, nkmers);
+
+  uint8_t *visits = ctx_calloc(graph.ht.capacity, sizeof(uint8_t));
+
+  binary_kmer_iter_init(&it, seq, kmer_size);
+  for(i = kmer_size-1; i < len; i++) {
+    binary_kmer_iter_add(&it, dna_char_to_nuc(seq[i]));
+    node = db_graph_find_iter(&graph, &it);
+    exp = db_graph_find_str(&graph, seq+i+1-kmer_size);
+    num_bad += (node.key == HASH_NOT_FOUND ||
+                node.key != exp.key || node.orient != exp.orient);
+    if(node.key != HASH_NOT_FOUND) visits[node.key]++;
+  }
+
+  TASSERT2(num_bad == 0, "num_bad: %zu", num_bad);
+  HASH_ITERATE(&graph.ht, _count_kmer_visits, visits, &num_once);
+  TASSERT2(num_once == nkmers, "%zu vs %zu", num_once, nkmers);
+
+  ctx_free(visits);
+  db_graph_dealloc(&graph);
+}
+
 void test_build_graph()
 {
   test_status("Testing remove PCR duplicates in build_graph.c");
@@ -21,8 +143,10 @@ void test_build_graph()
   size_t kmer_size = 19, ncols = 1;
 
   db_graph_alloc(&graph, kmer_size, ncols, ncols, 1024,
-                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
-                 DBG_ALLOC_BKTLOCKS | DBG_ALLOC_READSTRT);
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  DupFilter dups;
+  dup_filter_alloc(&dups, 1024);
 
   read_t r1, r2;
   seq_read_alloc(&r1);
@@ -32,13 +156,13 @@ void test_build_graph()
   size_t total_seq = 0, contigs_loaded = 0;
 
   // Test loading empty reads are ok
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_FF,
                             &stats, 0, &graph);
 
   // Load a pair of reads
   seq_read_set(&r1, "CTACGATGTATGCTTAGCTGTTCCG");
   seq_read_set(&r2, "TAGAACGTTCCCTACACGTCCTATG");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_FF,
                             &stats, 0, &graph);
   TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
@@ -48,35 +172,35 @@ void test_build_graph()
   // Check we filter out a duplicate FF
   seq_read_set(&r1, "CTACGATGTATGCTTAGCTAATGAT");
   seq_read_set(&r2, "TAGAACGTTCCCTACACGTTGTTTG");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_FF,
                             &stats, 0, &graph);
   TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
 
   // Check we filter out a duplicate FR
-  // revcmp TAGAACGTTCCCTACACGT -> AGCTAAGCATACATCGTAG
+  // revcmp TAGAACGTTCCCTACACGT -> ACGTGTAGGGAACGTTCTA
   seq_read_set(&r1, "CTACGATGTATGCTTAGCTCCGAAG");
-  seq_read_set(&r2, "AGACTAAGCTAAGCATACATCGTAG");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_FR,
+  seq_read_set(&r2, "AGACTAACGTGTAGGGAACGTTCTA");
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_FR,
                             &stats, 0, &graph);
   TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
 
   // Check we filter out a duplicate RF
-  // revcmp CTACGATGTATGCTTAGCT -> ACGTGTAGGGAACGTTCTA
-  seq_read_set(&r1, "AGGAGTTGTCTTCTAAGGAAACGTGTAGGGAACGTTCTA");
+  // revcmp CTACGATGTATGCTTAGCT -> AGCTAAGCATACATCGTAG
+  seq_read_set(&r1, "AGGAGTTGTCTTCTAAGGAAAGCTAAGCATACATCGTAG");
   seq_read_set(&r2, "TAGAACGTTCCCTACACGTTTTCCACGAGTTAATCTAAG");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_RF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_RF,
                             &stats, 0, &graph);
   TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
 
-  // Check we filter out a duplicate RF
-  // revcmp CTACGATGTATGCTTAGCT -> ACGTGTAGGGAACGTTCTA
-  // revcmp TAGAACGTTCCCTACACGT -> AGCTAAGCATACATCGTAG
-  seq_read_set(&r1, "AACCCTAAAAACGTGTAGGGAACGTTCTA");
-  seq_read_set(&r2, "AATGCGTGTTAGCTAAGCATACATCGTAG");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_RR,
+  // Check we filter out a duplicate RR
+  // revcmp CTACGATGTATGCTTAGCT -> AGCTAAGCATACATCGTAG
+  // revcmp TAGAACGTTCCCTACACGT -> ACGTGTAGGGAACGTTCTA
+  seq_read_set(&r1, "AACCCTAAAAAGCTAAGCATACATCGTAG");
+  seq_read_set(&r2, "AATGCGTGTTACGTGTAGGGAACGTTCTA");
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_RR,
                             &stats, 0, &graph);
   TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 1);
@@ -84,45 +208,54 @@ void test_build_graph()
   // Check add a duplicate when filtering is turned off
   seq_read_set(&r1, "CTACGATGTATGCTTAGCTAATGAT");
   seq_read_set(&r2, "TAGAACGTTCCCTACACGTTGTTTG");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, false, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, NULL, READPAIR_FF,
                             &stats, 0, &graph);
   TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 2);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 2);
   total_seq += r1.seq.end + r2.seq.end;
   contigs_loaded += 2;
 
+  // Single reads are not duplicates of a mate in a pair
+  seq_read_set(&r1, "CTACGATGTATGCTTAGCTAGTGTGATATCCTCCAGTCGATC");
+  build_graph_from_reads_mt(&r1, NULL, 0, 9, 9, 9, &dups, READPAIR_FF,
+                            &stats, 0, &graph);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 3);
+  total_seq += r1.seq.end;
+  contigs_loaded++;
+
   // Check SE duplicate removal with FF reads
   seq_read_set(&r1, "CTACGATGTATGCTTAGCTAGTGTGATATCCTCC");
-  build_graph_from_reads_mt(&r1, NULL, 0, 9, 9, 9, true, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, NULL, 0, 9, 9, 9, &dups, READPAIR_FF,
                             &stats, 0, &graph);
-  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 2);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 3);
 
   // Check SE duplicate removal with RR reads
+  // revcmp -> CTACGATGTATGCTTAGCTGTCAGTAGGTAACGC
   seq_read_set(&r1, "GCGTTACCTACTGACAGCTAAGCATACATCGTAG");
-  build_graph_from_reads_mt(&r1, NULL, 0, 9, 9, 9, true, READPAIR_RR,
+  build_graph_from_reads_mt(&r1, NULL, 0, 9, 9, 9, &dups, READPAIR_RR,
                             &stats, 0, &graph);
-  TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 2);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 3);
 
   // Check we don't filter out reads when kmers in opposite direction
-  // revcmp CTACGATGTATGCTTAGCT -> ACGTGTAGGGAACGTTCTA
-  // revcmp TAGAACGTTCCCTACACGT -> AGCTAAGCATACATCGTAG
+  // revcmp TAGAACGTTCCCTACACGT -> ACGTGTAGGGAACGTTCTA
+  // revcmp CTACGATGTATGCTTAGCT -> AGCTAAGCATACATCGTAG
   seq_read_set(&r1, "ACGTGTAGGGAACGTTCTA""CTTCTACCGGAGGAT");
   seq_read_set(&r2, "AGCTAAGCATACATCGTAG""TACAATGCACCCTCC");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_FF,
                             &stats, 0, &graph);
-  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 3);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 4);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 3);
   total_seq += r1.seq.end + r2.seq.end;
   contigs_loaded += 2;
 
   // shouldn't work a second time
-  // revcmp CTACGATGTATGCTTAGCT -> ACGTGTAGGGAACGTTCTA
-  // revcmp TAGAACGTTCCCTACACGT -> AGCTAAGCATACATCGTAG
+  // revcmp TAGAACGTTCCCTACACGT -> ACGTGTAGGGAACGTTCTA
+  // revcmp CTACGATGTATGCTTAGCT -> AGCTAAGCATACATCGTAG
   seq_read_set(&r1, "ACGTGTAGGGAACGTTCTA""CTTCTACCGGAGGAT");
   seq_read_set(&r2, "AGCTAAGCATACATCGTAG""TACAATGCACCCTCC");
-  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, true, READPAIR_FF,
+  build_graph_from_reads_mt(&r1, &r2, 0, 9, 9, 9, &dups, READPAIR_FF,
                             &stats, 0, &graph);
-  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 3);
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 4);
   TASSERT(kmer_get_covg("TAGAACGTTCCCTACACGT", &graph) == 3);
 
   // Update statistics
@@ -143,5 +276,9 @@ void test_build_graph()
   seq_read_dealloc(&r1);
   seq_read_dealloc(&r2);
 
+  dup_filter_dealloc(&dups);
   db_graph_dealloc(&graph);
+
+  test_build_graph_from_seq();
+  test_build_graph_kmer_iter();
 }
@@ -0,0 +1,155 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "count_filter.h"
+#include "util.h"
+
+// Counters are 4 bits and stop at COUNT_FILTER_MAX_COUNT
+static void test_count_filter_saturate()
+{
+  CountFilter cfilter;
+  count_filter_alloc(&cfilter, 1024);
+
+  const size_t kmer_size = 11;
+  BinaryKmer bkey = binary_kmer_from_str("ACAGTTGACCA", kmer_size);
+  bkey = binary_kmer_get_key(bkey, kmer_size);
+  uint8_t before, after;
+  size_t i;
+
+  TASSERT(count_filter_get(&cfilter, bkey) == 0);
+
+  for(i = 0; i < COUNT_FILTER_MAX_COUNT+5; i++) {
+    count_filter_add_mt(&cfilter, bkey, &before, &after);
+    TASSERT2(before == MIN2(i, COUNT_FILTER_MAX_COUNT), "%zu %u", i, before);
+    TASSERT2(after == MIN2(i+1, COUNT_FILTER_MAX_COUNT), "%zu %u", i, after);
+    TASSERT(count_filter_get(&cfilter, bkey) == after);
+  }
+
+  count_filter_dealloc(&cfilter);
+}
+
+// Kmers added n times pass a min count of m iff n >= m. The filter is big
+// enough that these few kmers do not collide.
+static void test_count_filter_min_count()
+{
+  CountFilter cfilter;
+  count_filter_alloc(&cfilter, 1<<16);
+
+  const size_t kmer_size = 11, nkmers = 20;
+  char seq[kmer_size+nkmers];
+  BinaryKmer bkeys[nkmers];
+  uint8_t before, after;
+  size_t i, j, min_count;
+
+  dna_rand_str(seq, sizeof(seq)-1);
+
+  // Add kmer i, i times
+  for(i = 0; i < nkmers; i++) {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_from_str(seq+i, kmer_size),
+                                   kmer_size);
+    for(j = 0; j < i; j++)
+      count_filter_add_mt(&cfilter, bkeys[i], &before, &after);
+  }
+
+  // Random kmers may repeat, only check counts are never too low
+  for(min_count = 2; min_count <= COUNT_FILTER_MAX_COUNT; min_count++)
+    for(i = min_count; i < nkmers; i++)
+      TASSERT(count_filter_get(&cfilter, bkeys[i]) >= min_count);
+
+  // Unique kmers get exact counts
+  const char *uniq[] = {"AAAAAAAAAAA", "CCACCACCACC", "GATTACAGATT"};
+  BinaryKmer ukeys[3];
+
+  count_filter_dealloc(&cfilter);
+  count_filter_alloc(&cfilter, 1<<16);
+
+  for(i = 0; i < 3; i++) {
+    ukeys[i] = binary_kmer_get_key(binary_kmer_from_str(uniq[i], kmer_size),
+                                   kmer_size);
+    for(j = 0; j <= i; j++)
+      count_filter_add_mt(&cfilter, ukeys[i], &before, &after);
+  }
+
+  for(min_count = 2; min_count <= 3; min_count++)
+    for(i = 0; i < 3; i++)
+      TASSERT((count_filter_get(&cfilter, ukeys[i]) >= min_count) ==
+              (i+1 >= min_count));
+
+  count_filter_dealloc(&cfilter);
+}
+
+#define CFILTER_TEST_NTHREADS 4
+#define CFILTER_TEST_NKMERS 100
+#define CFILTER_TEST_MIN_COUNT 6
+
+typedef struct
+{
+  size_t id;
+  CountFilter *cfilter;
+  const BinaryKmer *bkeys;
+  size_t *nreached; // number of adds that took each kmer to the min count
+} CountFilterTestWorker;
+
+// Each thread adds kmer i, (i%5)+1 times, starting at a different kmer
+static void _count_filter_test_add(void *arg)
+{
+  const CountFilterTestWorker *wrkr = (const CountFilterTestWorker*)arg;
+  uint8_t before, after;
+  size_t i, j, k;
+
+  for(j = 0; j < CFILTER_TEST_NKMERS; j++) {
+    i = (j + wrkr->id * 37) % CFILTER_TEST_NKMERS;
+    for(k = 0; k <= i % 5; k++) {
+      count_filter_add_mt(wrkr->cfilter, wrkr->bkeys[i], &before, &after);
+      if(before < CFILTER_TEST_MIN_COUNT && after >= CFILTER_TEST_MIN_COUNT)
+        __sync_fetch_and_add(&wrkr->nreached[i], 1);
+    }
+  }
+}
+
+// Threads add overlapping kmers. Counters are incremented separately, so
+// racing adds may both see a kmer reach the min count, but at least one must.
+// The filter is big enough that these kmers do not collide, so final counts
+// are exact.
+static void test_count_filter_mt()
+{
+  const size_t kmer_size = 19, nthreads = CFILTER_TEST_NTHREADS;
+  BinaryKmer bkeys[CFILTER_TEST_NKMERS];
+  size_t nreached[CFILTER_TEST_NKMERS] = {0};
+  size_t i, t, nadds, num_bad_counts = 0, num_bad_reached = 0;
+
+  for(i = 0; i < CFILTER_TEST_NKMERS; i++)
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+
+  CountFilter cfilter;
+  count_filter_alloc(&cfilter, 1<<16);
+
+  CountFilterTestWorker wrkrs[CFILTER_TEST_NTHREADS];
+  for(t = 0; t < nthreads; t++) {
+    wrkrs[t] = (CountFilterTestWorker){.id = t, .cfilter = &cfilter,
+                                       .bkeys = bkeys, .nreached = nreached};
+  }
+
+  util_run_threads(wrkrs, nthreads, sizeof(wrkrs[0]), nthreads,
+                   _count_filter_test_add);
+
+  for(i = 0; i < CFILTER_TEST_NKMERS; i++) {
+    nadds = nthreads * (i % 5 + 1);
+    num_bad_counts += (count_filter_get(&cfilter, bkeys[i]) !=
+                       MIN2(nadds, COUNT_FILTER_MAX_COUNT));
+    num_bad_reached += ((nreached[i] > 0) != (nadds >= CFILTER_TEST_MIN_COUNT));
+  }
+
+  TASSERT2(num_bad_counts == 0, "num_bad_counts: %zu", num_bad_counts);
+  TASSERT2(num_bad_reached == 0, "num_bad_reached: %zu", num_bad_reached);
+
+  count_filter_dealloc(&cfilter);
+}
+
+void test_count_filter()
+{
+  test_status("Testing counting kmer filter...");
+  test_count_filter_saturate();
+  test_count_filter_min_count();
+  test_count_filter_mt();
+}
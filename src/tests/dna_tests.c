@@ -4,6 +4,64 @@
 
 #include "dna.h"
 
+// Scalar versions of dna_scan_acgt() and dna_scan_qual() to check against
+static size_t scan_acgt_slow(const char *seq, size_t len)
+{
+  size_t i = 0;
+  while(i < len && char_is_acgt(seq[i])) i++;
+  return i;
+}
+
+static size_t scan_qual_slow(const char *qual, size_t len, size_t min_qual)
+{
+  size_t i = 0;
+  while(i < len && (uint8_t)qual[i] >= min_qual) i++;
+  return i;
+}
+
+// Put a bad base / low quality at each position either side of the 16 byte
+// boundaries where SIMD and scalar code meet
+static void test_dna_scan()
+{
+  const size_t lens[] = {0, 1, 15, 16, 17, 31, 32, 33};
+  const char badbases[] = {'N', 'n', 'X', 'U', '-', '\0', (char)0xC1, (char)0xE1};
+  const char goodquals[] = {'5', '6', (char)200};
+  const char badquals[] = {'#', '4', '\0'};
+  char seq[40], qual[40];
+  size_t i, l, len, pos, b;
+
+  for(l = 0; l < sizeof(lens)/sizeof(lens[0]); l++)
+  {
+    len = lens[l];
+
+    // All good
+    for(i = 0; i < len; i++) {
+      seq[i] = "ACGTacgt"[i%8];
+      qual[i] = goodquals[i%3];
+    }
+    TASSERT(dna_scan_acgt(seq, len) == len);
+    TASSERT(dna_scan_qual(qual, len, '5') == len);
+    TASSERT(dna_scan_qual(qual, len, 0) == len);
+    TASSERT(dna_scan_qual(qual, len, 300) == 0);
+
+    // One bad base / quality at each position
+    for(pos = 0; pos < len; pos++) {
+      for(b = 0; b < sizeof(badbases); b++) {
+        seq[pos] = badbases[b];
+        TASSERT2(dna_scan_acgt(seq, len) == pos, "len:%zu pos:%zu", len, pos);
+        TASSERT(dna_scan_acgt(seq, len) == scan_acgt_slow(seq, len));
+      }
+      for(b = 0; b < sizeof(badquals); b++) {
+        qual[pos] = badquals[b];
+        TASSERT2(dna_scan_qual(qual, len, '5') == pos, "len:%zu pos:%zu", len, pos);
+        TASSERT(dna_scan_qual(qual, len, '5') == scan_qual_slow(qual, len, '5'));
+      }
+      seq[pos] = "ACGTacgt"[pos%8];
+      qual[pos] = goodquals[pos%3];
+    }
+  }
+}
+
 void test_dna_functions()
 {
   test_status("Testing all dna.h functions...");
@@ -64,4 +122,9 @@ void test_dna_functions()
   // revcmp the whole string
   dna_reverse_complement_str(str,len);
   TASSERT(strcmp(str,rev) == 0);
+
+  //
+  // Test dna_scan_acgt, dna_scan_qual
+  //
+  test_dna_scan();
 }
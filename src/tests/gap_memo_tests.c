@@ -0,0 +1,138 @@
+#include "global.h"
+#include "all_tests.h"
+#include "gap_memo.h"
+#include "util.h"
+
+#define GMEMO_TEST_NTHREADS 4
+#define GMEMO_TEST_NKEYS 5000
+#define GMEMO_TEST_NOPS 100000
+
+// Every gap `i` has the same key, nodes and results wherever it is made
+static GapMemoKey _gmemo_test_key(size_t i)
+{
+  GapMemoKey key = {.left = {.key = i, .orient = i & 1},
+                    .right = {.key = i*7+1, .orient = (i >> 1) & 1},
+                    .hash = i * 0x9E3779B97F4A7C15UL};
+  return key;
+}
+
+// Some gaps have too many nodes to be stored
+static size_t _gmemo_test_num_nodes(size_t i)
+{
+  return i % 97 == 0 ? GAP_MEMO_BUCKET_NODES+1 : i % 40;
+}
+
+static size_t _gmemo_test_gap(size_t i, dBNodeBuffer *nbuf,
+                              TraversalResult results[GAP_MEMO_MAX_RESULTS])
+{
+  size_t j, n = _gmemo_test_num_nodes(i), nresults = 1 + i % 2;
+
+  db_node_buf_reset(nbuf);
+  for(j = 0; j < n; j++)
+    db_node_buf_add(nbuf, (dBNode){.key = i*1000+j, .orient = j & 1});
+
+  for(j = 0; j < nresults; j++) {
+    results[j] = (TraversalResult){.gap_len = i+j, .traversed = (i % 3 != 0),
+                                   .paths_disagreed = (i % 5 == 0),
+                                   .gap_too_short = (j == 1)};
+  }
+
+  return nresults;
+}
+
+typedef struct
+{
+  GapMemo *gm;
+  unsigned int seed;
+  size_t num_hits, num_bad, num_oversize_hits;
+} GapMemoTestWorker;
+
+// Threads look up random gaps, checking any hit against the gap, and add
+// gaps that were missing
+static void _gmemo_test_thread(void *arg)
+{
+  GapMemoTestWorker *wrkr = (GapMemoTestWorker*)arg;
+  TraversalResult exp_res[GAP_MEMO_MAX_RESULTS], res[GAP_MEMO_MAX_RESULTS];
+  dBNodeBuffer exp_nbuf, nbuf;
+  size_t i, n, nres, exp_nres;
+
+  db_node_buf_alloc(&exp_nbuf, 512);
+  db_node_buf_alloc(&nbuf, 512);
+
+  for(n = 0; n < GMEMO_TEST_NOPS; n++)
+  {
+    i = rand_r(&wrkr->seed) % GMEMO_TEST_NKEYS;
+    GapMemoKey key = _gmemo_test_key(i);
+    exp_nres = _gmemo_test_gap(i, &exp_nbuf, exp_res);
+
+    db_node_buf_reset(&nbuf);
+    nres = gap_memo_fetch(wrkr->gm, &key, &nbuf, res);
+
+    if(nres) {
+      wrkr->num_hits++;
+      wrkr->num_oversize_hits += (exp_nbuf.len > GAP_MEMO_BUCKET_NODES);
+      wrkr->num_bad += (nres != exp_nres || nbuf.len != exp_nbuf.len ||
+                        memcmp(nbuf.b, exp_nbuf.b, nbuf.len*sizeof(dBNode)) ||
+                        memcmp(res, exp_res, nres*sizeof(TraversalResult)));
+    }
+    else {
+      gap_memo_add(wrkr->gm, &key, exp_nbuf.b, exp_nbuf.len, exp_res, exp_nres);
+    }
+  }
+
+  db_node_buf_dealloc(&exp_nbuf);
+  db_node_buf_dealloc(&nbuf);
+}
+
+void test_gap_memo()
+{
+  test_status("Testing GapMemo shared between threads...");
+
+  TraversalResult exp_res[GAP_MEMO_MAX_RESULTS], res[GAP_MEMO_MAX_RESULTS];
+  dBNodeBuffer exp_nbuf, nbuf;
+  size_t i, nres, exp_nres;
+
+  db_node_buf_alloc(&exp_nbuf, 512);
+  db_node_buf_alloc(&nbuf, 512);
+
+  // Too small to hold every gap, so gaps are evicted
+  GapMemo gm;
+  gap_memo_alloc(&gm, gap_memo_mem(4));
+
+  // A gap is found straight after it is added, unless it has too many nodes
+  for(i = 0; i < 200; i++) {
+    GapMemoKey key = _gmemo_test_key(i);
+    exp_nres = _gmemo_test_gap(i, &exp_nbuf, exp_res);
+    gap_memo_add(&gm, &key, exp_nbuf.b, exp_nbuf.len, exp_res, exp_nres);
+    db_node_buf_reset(&nbuf);
+    nres = gap_memo_fetch(&gm, &key, &nbuf, res);
+    if(exp_nbuf.len > GAP_MEMO_BUCKET_NODES) { TASSERT(nres == 0); continue; }
+    TASSERT(nres == exp_nres);
+    TASSERT(nbuf.len == exp_nbuf.len);
+    TASSERT(memcmp(nbuf.b, exp_nbuf.b, nbuf.len*sizeof(dBNode)) == 0);
+    TASSERT(memcmp(res, exp_res, nres*sizeof(TraversalResult)) == 0);
+  }
+
+  GapMemoTestWorker wrkrs[GMEMO_TEST_NTHREADS];
+  for(i = 0; i < GMEMO_TEST_NTHREADS; i++)
+    wrkrs[i] = (GapMemoTestWorker){.gm = &gm, .seed = (unsigned int)(i+1)};
+
+  util_run_threads(wrkrs, GMEMO_TEST_NTHREADS, sizeof(wrkrs[0]),
+                   GMEMO_TEST_NTHREADS, _gmemo_test_thread);
+
+  size_t num_hits = 0, num_bad = 0, num_oversize_hits = 0;
+  for(i = 0; i < GMEMO_TEST_NTHREADS; i++) {
+    num_hits += wrkrs[i].num_hits;
+    num_bad += wrkrs[i].num_bad;
+    num_oversize_hits += wrkrs[i].num_oversize_hits;
+  }
+
+  TASSERT2(num_bad == 0, "num_bad: %zu", num_bad);
+  TASSERT(num_oversize_hits == 0);
+  TASSERT(num_hits > 0);
+  TASSERT(gm.nc.num_evicted > 0);
+
+  gap_memo_dealloc(&gm);
+  db_node_buf_dealloc(&exp_nbuf);
+  db_node_buf_dealloc(&nbuf);
+}
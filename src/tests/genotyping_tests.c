@@ -0,0 +1,185 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "genotyping.h"
+
+//
+// Check genotyping_get_covg() against assembling every compatible combination
+// of variants and adding all the kmers of each haplotype
+//
+
+static bool _vars_compatible(const GenoVar *vars, size_t nvars, uint64_t bits)
+{
+  size_t i, end = 0;
+  for(i = 0; i < nvars; i++) {
+    if(bits & (1UL << i)) {
+      if(vars[i].pos < end) return false;
+      end = vars[i].pos + vars[i].reflen;
+    }
+  }
+  return true;
+}
+
+static void _assemble_haplotype(StrBuf *seq, const char *chrom,
+                                size_t regstart, size_t regend,
+                                const GenoVar *vars, size_t nvars,
+                                uint64_t bits)
+{
+  size_t i, end = regstart;
+  strbuf_reset(seq);
+  for(i = 0; i < nvars; i++) {
+    if(bits & (1UL << i)) {
+      strbuf_append_strn(seq, chrom+end, vars[i].pos-end);
+      strbuf_append_strn(seq, vars[i].alt, vars[i].altlen);
+      end = vars[i].pos + vars[i].reflen;
+    }
+  }
+  strbuf_append_strn(seq, chrom+end, regend-end);
+}
+
+// Same region as genotyping_get_covg()
+static void _geno_kmers_exhaustive(khash_t(BkToBits) *h, GenoKmerBuffer *gkbuf,
+                                   const GenoVar *vars, size_t nvars,
+                                   size_t tgtidx, size_t ntgts,
+                                   const char *chrom, size_t chromlen,
+                                   size_t kmer_size)
+{
+  const GenoVar *tgt = &vars[tgtidx];
+  long minpos = MIN2((long)vars[0].pos, (long)tgt->pos - (long)kmer_size + 1);
+  size_t i, regstart, regend;
+
+  regstart = MAX2(minpos, 0);
+  regend = regstart;
+  for(i = 0; i < nvars; i++) regend = MAX2(regend, vars[i].pos + vars[i].reflen);
+  regend = MAX2(regend, tgt->pos + tgt->reflen + kmer_size - 1);
+  regend = MIN2(regend, chromlen);
+
+  StrBuf seq;
+  strbuf_alloc(&seq, 256);
+  kh_clear(BkToBits, h);
+
+  uint64_t bits, altref_bits;
+  BinaryKmer bkey;
+  khiter_t k;
+  int hret;
+
+  for(bits = 0; bits < (1UL << nvars); bits++)
+  {
+    if(!_vars_compatible(vars, nvars, bits)) continue;
+    _assemble_haplotype(&seq, chrom, regstart, regend, vars, nvars, bits);
+
+    for(altref_bits = 0, i = 0; i < ntgts; i++)
+      altref_bits |= 1UL << (i*2 + ((bits >> (tgtidx+i)) & 1));
+
+    for(i = 0; i + kmer_size <= seq.end; i++) {
+      bkey = binary_kmer_from_str(seq.b+i, kmer_size);
+      bkey = binary_kmer_get_key(bkey, kmer_size);
+      k = kh_put(BkToBits, h, bkey, &hret);
+      if(hret > 0) kh_value(h, k) = 0;
+      kh_value(h, k) |= altref_bits;
+    }
+  }
+
+  genokmer_buf_reset(gkbuf);
+  for(k = kh_begin(h); k != kh_end(h); ++k) {
+    if(kh_exist(h, k) && genotyping_refalt_uniq(kh_value(h, k))) {
+      genokmer_buf_add(gkbuf, (GenoKmer){.bkey = kh_key(h, k),
+                                         .arbits = kh_value(h, k)});
+    }
+  }
+
+  strbuf_dealloc(&seq);
+}
+
+static int _genokmer_cmp(const void *aa, const void *bb)
+{
+  const GenoKmer *a = (const GenoKmer*)aa, *b = (const GenoKmer*)bb;
+  int c = binary_kmers_cmp(a->bkey, b->bkey);
+  if(c) return c;
+  return a->arbits < b->arbits ? -1 : (a->arbits > b->arbits);
+}
+
+// Returns true if both give the same kmers and ref/alt bits
+static bool _geno_kmers_match(Genotyper *typer, khash_t(BkToBits) *h,
+                              GenoKmerBuffer *expbuf,
+                              const GenoVar *vars, size_t nvars,
+                              size_t tgtidx, size_t ntgts,
+                              const char *chrom, size_t chromlen,
+                              size_t kmer_size)
+{
+  GenoKmerBuffer *gkbuf = &typer->kmer_buf;
+
+  genotyping_get_covg(typer, vars, nvars, tgtidx, ntgts,
+                      chrom, chromlen, kmer_size);
+  _geno_kmers_exhaustive(h, expbuf, vars, nvars, tgtidx, ntgts,
+                         chrom, chromlen, kmer_size);
+
+  qsort(gkbuf->b, gkbuf->len, sizeof(GenoKmer), _genokmer_cmp);
+  qsort(expbuf->b, expbuf->len, sizeof(GenoKmer), _genokmer_cmp);
+
+  return (gkbuf->len == expbuf->len &&
+          (gkbuf->len == 0 ||
+           memcmp(gkbuf->b, expbuf->b, gkbuf->len * sizeof(GenoKmer)) == 0));
+}
+
+#define genovar_init(p,r,a) ((GenoVar){.pos = (p), .ref = (r), .alt = (a),     \
+                                       .reflen = strlen(r), .altlen = strlen(a)})
+
+void test_genotyping()
+{
+  test_status("Testing genotyping kmer windows against all haplotypes...");
+
+  Genotyper typer;
+  genotyper_alloc(&typer);
+  khash_t(BkToBits) *h = kh_init(BkToBits);
+  GenoKmerBuffer expbuf;
+  genokmer_buf_alloc(&expbuf, 512);
+
+  const size_t kmer_size = 11;
+  size_t i, t, n;
+
+  // A bubble: SNP at 30 (C>G), with a deletion over it and an insertion after
+  //           0         1         2         3         4         5
+  //           012345678901234567890123456789012345678901234567890123456789
+  char chrom[] = "CTGATTCGCATAGGCTTAGCATCGTACGATCGGATCCATGAGTCAGTTGCAAGTTCAGA";
+  const size_t chromlen = strlen(chrom);
+  GenoVar vars[8] = {genovar_init(28, "ATCG", "A"),
+                     genovar_init(30, "C", "G"),
+                     genovar_init(40, "A", "ATTA")};
+  n = 3;
+
+  for(t = 0; t < n; t++)
+    TASSERT2(_geno_kmers_match(&typer, h, &expbuf, vars, n, t, 1,
+                               chrom, chromlen, kmer_size), "tgt: %zu", t);
+  TASSERT(_geno_kmers_match(&typer, h, &expbuf, vars, n, 0, n,
+                            chrom, chromlen, kmer_size));
+
+  // SNP alone: every kmer over it is unique to ref or alt
+  TASSERT(_geno_kmers_match(&typer, h, &expbuf, vars+1, 1, 0, 1,
+                            chrom, chromlen, kmer_size));
+  TASSERT(typer.kmer_buf.len == 2*kmer_size);
+
+  // Random variants near the start of a random chromosome, including
+  // overlapping variants and targets within kmer_size of the start
+  char rchrom[81], alts[8][4];
+  for(i = 0; i < 200; i++)
+  {
+    dna_rand_str(rchrom, sizeof(rchrom)-1);
+    n = 1 + rand() % 6;
+    for(t = 0; t < n; t++) {
+      size_t pos = rand() % 30, reflen = rand() % 4, altlen = rand() % 4;
+      if(reflen + altlen == 0) reflen = 1;
+      dna_rand_str(alts[t], altlen);
+      vars[t] = (GenoVar){.pos = pos, .ref = rchrom+pos, .alt = alts[t],
+                          .reflen = reflen, .altlen = altlen};
+    }
+    genovars_sort(vars, n);
+    t = rand() % n;
+    TASSERT2(_geno_kmers_match(&typer, h, &expbuf, vars, n, t, 1 + rand() % (n-t),
+                               rchrom, strlen(rchrom), kmer_size), "i: %zu", i);
+  }
+
+  genokmer_buf_dealloc(&expbuf);
+  kh_destroy(BkToBits, h);
+  genotyper_dealloc(&typer);
+}
@@ -0,0 +1,227 @@
+#include "global.h"
+#include "all_tests.h"
+#include "gpath_set.h"
+#include "gpath_store.h"
+#include "util.h"
+
+#define GPSET_TEST_NCOLS 3
+#define GPSET_TEST_NTHREADS 4
+#define GPSET_TEST_NPATHS 3000
+
+typedef struct
+{
+  size_t id;
+  GPathSet *gpset;
+  GPath **gpaths; // GPSET_TEST_NPATHS paths added by this thread
+} GPathSetTestWorker;
+
+#define _gpset_test_njuncs(i) (1 + (i) % 60)
+
+// Junction bytes for the i-th path added by thread `id`
+static void _gpset_test_seq(uint8_t *seq, size_t nbytes, size_t id, size_t i)
+{
+  size_t j;
+  for(j = 0; j < nbytes; j++) seq[j] = (uint8_t)(id*31 + i*7 + j);
+}
+
+static void _gpset_test_add_paths(void *arg)
+{
+  GPathSetTestWorker *wrkr = (GPathSetTestWorker*)arg;
+  uint8_t seq[64], colset = 1 << (wrkr->id % GPSET_TEST_NCOLS);
+  uint8_t nseen[GPSET_TEST_NCOLS];
+  size_t i, njuncs;
+
+  memset(nseen, (int)wrkr->id+1, sizeof(nseen));
+
+  for(i = 0; i < GPSET_TEST_NPATHS; i++) {
+    njuncs = _gpset_test_njuncs(i);
+    _gpset_test_seq(seq, binary_seq_mem(njuncs), wrkr->id, i);
+    GPathNew newgpath = {.seq = seq, .colset = &colset, .nseen = nseen,
+                         .num_juncs = njuncs, .orient = i & 1};
+    wrkr->gpaths[i] = gpath_set_add_mt(wrkr->gpset, newgpath);
+  }
+}
+
+// Threads add paths to a GPathSet that starts small so has to add segments
+// whilst other threads are adding paths
+static void test_gpath_set_add_mt()
+{
+  const size_t nthreads = GPSET_TEST_NTHREADS, npaths = GPSET_TEST_NPATHS;
+  const size_t total = nthreads * npaths;
+  size_t i, t, njuncs, num_bad = 0, num_dup = 0;
+  uint8_t seq[64], *nseen;
+  pkey_t pkey;
+
+  GPathSet gpset;
+  gpath_set_alloc(&gpset, GPSET_TEST_NCOLS, 1024, GPATH_SET_NO_MEM_LIMIT, true);
+
+  GPathSetTestWorker wrkrs[GPSET_TEST_NTHREADS];
+  for(t = 0; t < nthreads; t++) {
+    wrkrs[t] = (GPathSetTestWorker){.id = t, .gpset = &gpset,
+                                    .gpaths = ctx_calloc(npaths, sizeof(GPath*))};
+  }
+
+  util_run_threads(wrkrs, nthreads, sizeof(wrkrs[0]), nthreads,
+                   _gpset_test_add_paths);
+
+  TASSERT2(gpset.num_paths == total, "%zu vs %zu", gpset.num_paths, total);
+  TASSERT(gpset.capacity >= total);
+  TASSERT(gpset.num_segs > 1);
+  TASSERT(gpset.num_seq_segs > 1);
+
+  // Each path has its own pkey
+  uint8_t *pkey_seen = ctx_calloc(total, sizeof(uint8_t));
+
+  for(t = 0; t < nthreads; t++) {
+    for(i = 0; i < npaths; i++) {
+      const GPath *gpath = wrkrs[t].gpaths[i];
+      njuncs = _gpset_test_njuncs(i);
+      _gpset_test_seq(seq, binary_seq_mem(njuncs), t, i);
+      nseen = gpath_set_get_nseen(&gpset, gpath);
+
+      num_bad += (gpath->num_juncs != njuncs || gpath->orient != (i & 1) ||
+                  memcmp(gpath->seq, seq, binary_seq_mem(njuncs)) != 0 ||
+                  *gpath_get_colset(gpath, GPSET_TEST_NCOLS) !=
+                    1 << (t % GPSET_TEST_NCOLS) ||
+                  nseen[0] != t+1 || nseen[GPSET_TEST_NCOLS-1] != t+1);
+
+      pkey = gpset_get_pkey(&gpset, gpath);
+      num_bad += (pkey >= total || gpset_get_gpath(&gpset, pkey) != gpath);
+      if(pkey < total) num_dup += pkey_seen[pkey]++;
+    }
+  }
+
+  TASSERT2(num_bad == 0, "num_bad: %zu", num_bad);
+  TASSERT2(num_dup == 0, "num_dup: %zu", num_dup);
+
+  ctx_free(pkey_seen);
+  for(t = 0; t < nthreads; t++) ctx_free(wrkrs[t].gpaths);
+  gpath_set_dealloc(&gpset);
+}
+
+#define GPSTORE_TEST_NKMERS 500
+#define GPSTORE_TEST_NPATHS 2000
+
+// A path added to the store and where its data lives
+typedef struct
+{
+  hkey_t hkey;
+  const uint8_t *seq;
+  uint8_t colset, nseen0;
+  uint16_t num_juncs;
+} GPathStoreTestPath;
+
+static int _gpstore_test_path_cmp(const void *aa, const void *bb)
+{
+  const GPathStoreTestPath *a = (const GPathStoreTestPath*)aa;
+  const GPathStoreTestPath *b = (const GPathStoreTestPath*)bb;
+  if(a->hkey != b->hkey) return a->hkey < b->hkey ? -1 : 1;
+  if(a->seq != b->seq) return a->seq < b->seq ? -1 : 1;
+  return 0;
+}
+
+// Record every path on each kmer, sorted by kmer then sequence pointer
+static size_t _gpstore_test_get_paths(const GPathStore *gpstore,
+                                      GPathStoreTestPath *paths)
+{
+  const size_t ncols = gpstore->gpset.ncols;
+  const GPath *gpath;
+  size_t n = 0;
+  hkey_t hkey;
+
+  for(hkey = 0; hkey < gpstore->graph_capacity; hkey++) {
+    gpath = gpath_store_fetch(gpstore, hkey);
+    for(; gpath != NULL && n < GPSTORE_TEST_NPATHS; gpath = gpath->next, n++) {
+      GPathStoreTestPath p = {.hkey = hkey, .seq = gpath->seq,
+                              .colset = *gpath_get_colset(gpath, ncols),
+                              .nseen0 = gpath_set_get_nseen(&gpstore->gpset, gpath)[0],
+                              .num_juncs = gpath->num_juncs};
+      paths[n] = p;
+    }
+  }
+
+  qsort(paths, n, sizeof(paths[0]), _gpstore_test_path_cmp);
+  return n;
+}
+
+// Add paths to random kmers, flatten and check each kmer has the same paths,
+// now stored contiguously
+static void _test_gpath_store_flatten(bool single_seg)
+{
+  const size_t ncols = GPSET_TEST_NCOLS, nkmers = GPSTORE_TEST_NKMERS;
+  const size_t npaths = GPSTORE_TEST_NPATHS;
+  size_t i, n, njuncs, num_bad = 0;
+  uint8_t seq[64], colset, nseen[GPSET_TEST_NCOLS];
+  hkey_t hkey;
+  const GPath *gpath, *gpaths;
+
+  // Preallocate all paths for a single segment, otherwise the set grows
+  GPathStore gpstore;
+  gpath_store_alloc(&gpstore, ncols, nkmers, single_seg ? npaths : 0,
+                    nkmers*sizeof(GPath*) + 256*1024, true, false);
+
+  for(i = 0; i < npaths; i++) {
+    hkey = rand() % (nkmers/2) * 2; // odd kmers have no paths
+    njuncs = _gpset_test_njuncs(i);
+    _gpset_test_seq(seq, binary_seq_mem(njuncs), hkey, i);
+    colset = 1 << (i % ncols);
+    memset(nseen, (int)(i & 0xff), sizeof(nseen));
+    GPathNew newgpath = {.seq = seq, .colset = &colset, .nseen = nseen,
+                         .num_juncs = njuncs, .orient = i & 1};
+    gpath_store_add_mt(&gpstore, hkey, newgpath);
+  }
+
+  TASSERT(gpstore.gpset.num_paths == npaths);
+  TASSERT((gpstore.gpset.num_segs == 1) == single_seg);
+
+  GPathStoreTestPath *before = ctx_calloc(2*npaths, sizeof(GPathStoreTestPath));
+  GPathStoreTestPath *after = before + npaths;
+
+  n = _gpstore_test_get_paths(&gpstore, before);
+  TASSERT(n == npaths);
+
+  gpath_store_flatten(&gpstore);
+
+  TASSERT(gpath_store_is_flat(&gpstore));
+  TASSERT(gpstore.gpset.num_segs == 1);
+  TASSERT(gpstore.flat_offsets[nkmers] == npaths);
+
+  // Same paths on each kmer, with the same colset, counts and sequence
+  n = _gpstore_test_get_paths(&gpstore, after);
+  TASSERT(n == npaths);
+  for(i = 0; i < npaths; i++)
+    num_bad += (_gpstore_test_path_cmp(&before[i], &after[i]) != 0 ||
+                before[i].colset != after[i].colset ||
+                before[i].nseen0 != after[i].nseen0 ||
+                before[i].num_juncs != after[i].num_juncs);
+
+  TASSERT2(num_bad == 0, "num_bad: %zu", num_bad);
+
+  // Paths of each kmer are contiguous and in kmer order
+  gpaths = gpstore.gpset.segs[0].gpaths;
+  num_bad = 0;
+  for(hkey = 0; hkey < nkmers; hkey++) {
+    n = gpath_store_flat_num_paths(&gpstore, hkey);
+    gpath = gpath_store_fetch(&gpstore, hkey);
+    num_bad += ((hkey & 1) && n > 0);
+    num_bad += (n == 0) != (gpath == NULL);
+    num_bad += (n > 0 && gpath != gpaths + gpstore.flat_offsets[hkey]);
+    for(i = 0; i < n; i++, gpath++)
+      num_bad += (gpath->next != (i+1 < n ? gpath+1 : NULL));
+  }
+
+  TASSERT2(num_bad == 0, "num_bad: %zu", num_bad);
+
+  ctx_free(before);
+  gpath_store_dealloc(&gpstore);
+}
+
+void test_gpath_set()
+{
+  test_status("Testing adding to GPathSet from multiple threads...");
+  test_gpath_set_add_mt();
+
+  test_status("Testing flattening GPathStore...");
+  _test_gpath_store_flatten(true);
+  _test_gpath_store_flatten(false);
+}
@@ -3,6 +3,8 @@
 #include "build_graph.h"
 #include "generate_paths.h"
 #include "graph_walker.h"
+#include "util.h"
+#include "misc/twang.h"
 
 static void _check_junction_gaps(GraphWalker *wlk, size_t *exp_gaps, size_t n)
 {
@@ -85,7 +87,124 @@ static void _test_graph_walker_test1()
   db_graph_dealloc(&graph);
 }
 
+#define GWLK_TEST_NTHREADS 4
+#define GWLK_TEST_MAX_STEPS 1000
+
+// Walk from a node, returning a hash of the nodes visited and the paths
+// being followed at each step
+static uint64_t _walk_signature(GraphWalker *wlk, dBNode node)
+{
+  uint64_t sig = 0, n;
+  graph_walker_start(wlk, node);
+  for(n = 0; n < GWLK_TEST_MAX_STEPS && graph_walker_next(wlk); n++) {
+    sig = twang_mix64(sig ^ ((wlk->node.key << 1) | wlk->node.orient));
+    sig = twang_mix64(sig ^ graph_walker_hash64(wlk));
+  }
+  graph_walker_finish(wlk);
+  return twang_mix64(sig ^ n);
+}
+
+typedef struct
+{
+  GraphWalker wlk;
+  const dBNode *nodes;
+  uint64_t *sigs;
+  size_t num_nodes;
+  volatile size_t *next_node;
+} GraphWalkerTestWorker;
+
+static void _walk_nodes_thread(void *arg)
+{
+  GraphWalkerTestWorker *wrkr = (GraphWalkerTestWorker*)arg;
+  size_t i;
+  while((i = __sync_fetch_and_add(wrkr->next_node, 1)) < wrkr->num_nodes)
+    wrkr->sigs[i] = _walk_signature(&wrkr->wlk, wrkr->nodes[i]);
+}
+
+// Walkers on several threads share the path store and each keep a link memo
+// across walks. Every walk should match a walk with an empty memo.
+static void _test_graph_walker_memo_mt()
+{
+  test_status("Testing GraphWalker link memo across threads...");
+
+  // Unique sequence separated by copies of a repeat, links resolve the repeat
+  const size_t kmer_size = 11, ncols = 1, uniqlen = 60, replen = 40, nrep = 4;
+  char rep[100], seq[1000];
+  size_t i, len = 0;
+
+  rand_bases(rep, replen);
+  for(i = 0; i <= nrep; i++) {
+    rand_bases(seq+len, uniqlen);
+    len += uniqlen;
+    if(i < nrep) { memcpy(seq+len, rep, replen); len += replen; }
+  }
+  seq[len] = '\0';
+
+  const char *seqs[1] = {seq};
+  CorrectAlnParam params = {.ctpcol = 0, .ctxcol = 0,
+                            .frag_len_min = 0, .frag_len_max = 0,
+                            .one_way_gap_traverse = true, .use_end_check = true,
+                            .max_context = 10,
+                            .gap_variance = 0.1, .gap_wiggle = 5};
+
+  dBGraph graph;
+  all_tests_construct_graph(&graph, kmer_size, ncols, seqs, 1, params);
+
+  // Start from every kmer in both orientations
+  size_t num_nodes = 0;
+  hkey_t hkey;
+  dBNode *nodes = ctx_calloc(2*graph.ht.num_kmers, sizeof(dBNode));
+  for(hkey = 0; hkey < graph.ht.capacity; hkey++) {
+    if(HASH_ENTRY_ASSIGNED(graph.ht.table[hkey])) {
+      nodes[num_nodes++] = (dBNode){.key = hkey, .orient = FORWARD};
+      nodes[num_nodes++] = (dBNode){.key = hkey, .orient = REVERSE};
+    }
+  }
+
+  // Expected: one walker with the memo emptied before every walk
+  uint64_t *exp_sigs = ctx_calloc(2*num_nodes, sizeof(uint64_t));
+  uint64_t *sigs = exp_sigs + num_nodes;
+  GraphWalker wlk;
+  graph_walker_alloc(&wlk, &graph);
+  for(i = 0; i < num_nodes; i++) {
+    memset(wlk.memo, 0, GRAPH_WALKER_MEMO_SIZE * sizeof(GraphWalkerMemo));
+    exp_sigs[i] = _walk_signature(&wlk, nodes[i]);
+  }
+  TASSERT(wlk.stats.num_forks > 0);
+  graph_walker_dealloc(&wlk);
+
+  volatile size_t next_node = 0;
+  GraphWalkerTestWorker wrkrs[GWLK_TEST_NTHREADS];
+  for(i = 0; i < GWLK_TEST_NTHREADS; i++) {
+    wrkrs[i] = (GraphWalkerTestWorker){.nodes = nodes, .sigs = sigs,
+                                       .num_nodes = num_nodes,
+                                       .next_node = &next_node};
+    graph_walker_alloc(&wrkrs[i].wlk, &graph);
+  }
+
+  util_run_threads(wrkrs, GWLK_TEST_NTHREADS, sizeof(wrkrs[0]),
+                   GWLK_TEST_NTHREADS, _walk_nodes_thread);
+
+  GraphWalkerStats stats;
+  memset(&stats, 0, sizeof(stats));
+  for(i = 0; i < GWLK_TEST_NTHREADS; i++) {
+    graph_walker_stats_merge(&stats, &wrkrs[i].wlk.stats);
+    graph_walker_dealloc(&wrkrs[i].wlk);
+  }
+
+  size_t num_diff = 0;
+  for(i = 0; i < num_nodes; i++) num_diff += (sigs[i] != exp_sigs[i]);
+
+  TASSERT2(num_diff == 0, "%zu / %zu walks differ", num_diff, num_nodes);
+  TASSERT(stats.num_memo_hits > 0);
+
+  ctx_free(exp_sigs);
+  ctx_free(nodes);
+  db_graph_dealloc(&graph);
+}
+
 void test_graph_walker()
 {
   _test_graph_walker_test1();
+  _test_graph_walker_memo_mt();
 }
@@ -3,6 +3,9 @@
 
 #include "kmer_occur.h"
 
+#include "file_util.h"
+#include <unistd.h> // mkstemp, unlink
+
 static void test_kmer_occur_filter()
 {
   // Construct 1 colour graph with kmer-size=11
@@ -94,8 +97,133 @@ static void test_kmer_occur_filter()
   db_graph_dealloc(&graph);
 }
 
+// Number of KOccur entries for a kmer
+static size_t _kolist_len(const KOccur *ko)
+{
+  size_t n = 1;
+  for(; ko->next; ko++) n++;
+  return n;
+}
+
+// Copy `src` to `dst` keeping only the first `len` bytes, after applying
+// `edit` at byte `offset` if `edit` is not 0
+static void _copy_index_file(const char *src, const char *dst, size_t len,
+                             size_t offset, char edit)
+{
+  FILE *fin = fopen(src, "r"), *fout = fopen(dst, "w");
+  int c;
+  size_t i;
+  for(i = 0; i < len && (c = fgetc(fin)) != EOF; i++)
+    fputc(edit && i == offset ? edit : c, fout);
+  fclose(fin);
+  fclose(fout);
+}
+
+static void test_kmer_occur_index()
+{
+  const size_t kmer_size = 11, nchroms = 3, nseqs[3] = {60, 5, 300};
+  size_t i, j, n, num_diff = 0;
+  dBGraph graph, graph2;
+
+  db_graph_alloc(&graph, kmer_size, 1, 1, 2000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+  db_graph_alloc(&graph2, kmer_size, 1, 1, 2000,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL | DBG_ALLOC_BKTLOCKS);
+
+  // Random chromosomes, the third repeats part of the first
+  read_t reads[3];
+  char seq[301];
+  for(i = 0; i < nchroms; i++) {
+    seq_read_alloc(&reads[i]);
+    rand_bases(seq, nseqs[i]);
+    seq[nseqs[i]] = '\0';
+    if(i == 2) memcpy(seq+100, reads[0].seq.b, 50);
+    seq_read_set(&reads[i], seq);
+    strbuf_set(&reads[i].name, i == 0 ? "chr1" : (i == 1 ? "chr2" : "chrX"));
+  }
+
+  KOGraph kograph = kograph_create(reads, nchroms, true, 1, &graph);
+
+  char path[] = "/tmp/ctx_kmer_occur_test.XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  close(fd);
+  unlink(path); // kograph_save() will not overwrite a file
+
+  kograph_save(kograph, reads, nchroms, path, &graph);
+
+  KOIndexHeader hdr;
+  TASSERT(kograph_index_read_header(path, &hdr, false));
+  TASSERT(hdr.kmer_size == kmer_size);
+  TASSERT(hdr.nchroms == nchroms);
+
+  // Load into an empty graph and compare
+  KOGraph kograph2 = kograph_load(path, true, 2, &graph2);
+
+  TASSERT(kograph2.nchroms == nchroms);
+  for(i = 0; i < nchroms && i < kograph2.nchroms; i++) {
+    TASSERT(strcmp(kograph2.chroms[i].name, kograph.chroms[i].name) == 0);
+    TASSERT(kograph2.chroms[i].length == kograph.chroms[i].length);
+  }
+
+  TASSERT2(graph2.ht.num_kmers == graph.ht.num_kmers, "%zu vs %zu",
+           (size_t)graph2.ht.num_kmers, (size_t)graph.ht.num_kmers);
+
+  for(i = 0; i < graph.ht.capacity; i++) {
+    if(!kograph_occurs(kograph, i)) continue;
+    dBNode node = db_graph_find(&graph2, graph.ht.table[i]);
+    if(node.key == HASH_NOT_FOUND || !kograph_occurs(kograph2, node.key)) {
+      num_diff++;
+      continue;
+    }
+    const KOccur *ko = kograph_get(kograph, i);
+    const KOccur *ko2 = kograph_get(kograph2, node.key);
+    n = _kolist_len(ko);
+    if(_kolist_len(ko2) != n) num_diff++;
+    else {
+      for(j = 0; j < n; j++)
+        num_diff += (memcmp(&ko[j], &ko2[j], sizeof(KOccur)) != 0);
+    }
+    // Reference edges are added to the graph
+    num_diff += (db_node_get_edges_union(&graph2, node.key) !=
+                 db_node_get_edges_union(&graph, i));
+  }
+  TASSERT2(num_diff == 0, "num_diff: %zu", num_diff);
+
+  kograph_free(kograph2);
+
+  // Bad files are rejected: magic, version, truncated
+  char bad_path[] = "/tmp/ctx_kmer_occur_test_bad.XXXXXX";
+  fd = mkstemp(bad_path);
+  TASSERT(fd >= 0);
+  close(fd);
+
+  size_t file_len = (size_t)futil_get_file_size(path);
+
+  _copy_index_file(path, bad_path, file_len, 0, 'X');
+  TASSERT(!kograph_index_read_header(bad_path, &hdr, false));
+  _copy_index_file(path, bad_path, file_len,
+                   offsetof(KOIndexHeader, version), 99);
+  TASSERT(!kograph_index_read_header(bad_path, &hdr, false));
+  _copy_index_file(path, bad_path, file_len-8, 0, 0);
+  TASSERT(!kograph_index_read_header(bad_path, &hdr, false));
+  _copy_index_file(path, bad_path, sizeof(KOIndexHeader)/2, 0, 0);
+  TASSERT(!kograph_index_read_header(bad_path, &hdr, false));
+  _copy_index_file(path, bad_path, file_len, 0, 0);
+  TASSERT(kograph_index_read_header(bad_path, &hdr, false));
+
+  unlink(bad_path);
+  unlink(path);
+
+  for(i = 0; i < nchroms; i++) seq_read_dealloc(&reads[i]);
+  kograph_free(kograph);
+  db_graph_dealloc(&graph2);
+  db_graph_dealloc(&graph);
+}
+
 void test_kmer_occur()
 {
   test_status("Testing KOGraph...");
   test_kmer_occur_filter();
+  test_kmer_occur_index();
 }
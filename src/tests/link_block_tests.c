@@ -0,0 +1,141 @@
+#include "global.h"
+#include "all_tests.h"
+#include "link_block.h"
+
+#define LBLOCK_TEST_KMER_SIZE 5
+#define LBLOCK_TEST_NKMERS 3000
+#define LBLOCK_TEST_NTHREADS 4
+#define LBLOCK_TEST_MAX_JUNCS 6
+
+// Write links for one kmer. Links in each direction share junction positions
+// so they build a tree, with a random base at one junction so it branches.
+static size_t _lblock_test_links(StrBuf *lines)
+{
+  const size_t k = LBLOCK_TEST_KMER_SIZE, nlinks = 1 + rand() % 8;
+  size_t i, j, njuncs, dir, pos[2][LBLOCK_TEST_MAX_JUNCS];
+  char base[2][100], seq[100], juncs[LBLOCK_TEST_MAX_JUNCS+1];
+
+  for(dir = 0; dir < 2; dir++) {
+    for(j = 0; j < LBLOCK_TEST_MAX_JUNCS; j++)
+      pos[dir][j] = (j ? pos[dir][j-1] + 1 : 0) + rand() % 6;
+    rand_bases(base[dir], k + pos[dir][LBLOCK_TEST_MAX_JUNCS-1] + 1);
+  }
+
+  strbuf_reset(lines);
+  for(i = 0; i < nlinks; i++) {
+    dir = rand() & 1;
+    njuncs = 1 + rand() % LBLOCK_TEST_MAX_JUNCS;
+    size_t seqlen = k + pos[dir][njuncs-1] + 1;
+    memcpy(seq, base[dir], seqlen);
+    rand_bases(seq + k + pos[dir][rand() % njuncs], 1);
+    seq[seqlen] = '\0';
+    for(j = 0; j < njuncs; j++) juncs[j] = seq[k + pos[dir][j]];
+    juncs[njuncs] = '\0';
+
+    strbuf_sprintf(lines, "%c %zu %i %s seq=%s juncpos=%zu", "FR"[dir],
+                   njuncs, 1 + rand() % 5, juncs, seq, pos[dir][0]);
+    for(j = 1; j < njuncs; j++) strbuf_sprintf(lines, ",%zu", pos[dir][j]);
+    strbuf_append_char(lines, '\n');
+  }
+
+  return nlinks;
+}
+
+// Process the block with `nthreads` workers, concatenating output in kmer
+// order
+static void _lblock_test_run(LinkBlock *block, size_t nthreads,
+                             StrBuf *ctp, StrBuf *list, StrBuf *dot,
+                             LinkTreeStats *stats, uint64_t *hists)
+{
+  LinkWorker *workers = link_workers_alloc(nthreads, block,
+                                           LBLOCK_TEST_KMER_SIZE);
+  size_t i;
+
+  link_block_run(block, workers, nthreads);
+
+  strbuf_reset(ctp);
+  strbuf_reset(list);
+  strbuf_reset(dot);
+  for(i = 0; i < block->num_kmers; i++) {
+    strbuf_append_strn(ctp, block->kmers[i].ctp.b, block->kmers[i].ctp.end);
+    strbuf_append_strn(list, block->kmers[i].list.b, block->kmers[i].list.end);
+    strbuf_append_strn(dot, block->kmers[i].dot.b, block->kmers[i].dot.end);
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  memset(hists, 0, block->hist_distsize*block->hist_covgsize*sizeof(uint64_t));
+  link_workers_merge(workers, nthreads, stats, hists);
+  link_workers_dealloc(workers, nthreads);
+}
+
+// Build and clean link trees across threads, output and stats should match a
+// single thread
+void test_link_block()
+{
+  test_status("Testing building and cleaning link trees across threads...");
+
+  const size_t nkmers = LBLOCK_TEST_NKMERS, hist_distsize = 6, hist_covgsize = 100;
+  size_t i, nlinks = 0;
+
+  // Reader is only used for its file format version and colour filter
+  GPathReader ctpin;
+  memset(&ctpin, 0, sizeof(ctpin));
+  ctpin.version = 4;
+  file_filter_open(&ctpin.fltr, "test.ctp");
+  file_filter_set_cols(&ctpin.fltr, 1, 0);
+
+  LinkBlock block = {.ctpin = &ctpin,
+                     .clean = true, .list = true, .save = true,
+                     .hist_covg = true, .cutoff = 3, .plot_knum = nkmers/2,
+                     .hist_distsize = hist_distsize,
+                     .hist_covgsize = hist_covgsize};
+
+  link_block_alloc(&block, nkmers);
+
+  for(i = 0; i < nkmers; i++) {
+    LinkKmer *lk = &block.kmers[i];
+    strbuf_ensure_capacity(&lk->kmer, LBLOCK_TEST_KMER_SIZE);
+    rand_bases(lk->kmer.b, LBLOCK_TEST_KMER_SIZE);
+    lk->kmer.b[lk->kmer.end = LBLOCK_TEST_KMER_SIZE] = '\0';
+    lk->num_links_exp = _lblock_test_links(&lk->lines);
+    lk->knum = i;
+    nlinks += lk->num_links_exp;
+  }
+  block.num_kmers = nkmers;
+
+  StrBuf ctp0, list0, dot0, ctp1, list1, dot1;
+  strbuf_alloc(&ctp0, 1024); strbuf_alloc(&list0, 1024); strbuf_alloc(&dot0, 1024);
+  strbuf_alloc(&ctp1, 1024); strbuf_alloc(&list1, 1024); strbuf_alloc(&dot1, 1024);
+
+  LinkTreeStats stats0, stats1;
+  const size_t nhist = hist_distsize * hist_covgsize;
+  uint64_t *hists0 = ctx_calloc(2 * nhist, sizeof(uint64_t));
+  uint64_t *hists1 = hists0 + nhist;
+
+  _lblock_test_run(&block, 1, &ctp0, &list0, &dot0, &stats0, hists0);
+
+  // Cleaning kept some links and removed others
+  TASSERT(stats0.num_trees_with_links > 0);
+  TASSERT(stats0.num_links > 0 && stats0.num_links < nlinks);
+  TASSERT(ctp0.end > 0 && list0.end > 0 && dot0.end > 0);
+  TASSERT(block.kmers[nkmers/2].dot.end == dot0.end);
+
+  _lblock_test_run(&block, LBLOCK_TEST_NTHREADS,
+                   &ctp1, &list1, &dot1, &stats1, hists1);
+
+  TASSERT(strcmp(ctp0.b, ctp1.b) == 0);
+  TASSERT(strcmp(list0.b, list1.b) == 0);
+  TASSERT(strcmp(dot0.b, dot1.b) == 0);
+  TASSERT2(stats0.num_trees_with_links == stats1.num_trees_with_links,
+           "%zu vs %zu", stats0.num_trees_with_links, stats1.num_trees_with_links);
+  TASSERT2(stats0.num_links == stats1.num_links,
+           "%zu vs %zu", stats0.num_links, stats1.num_links);
+  TASSERT(stats0.num_link_bytes == stats1.num_link_bytes);
+  TASSERT(memcmp(hists0, hists1, nhist * sizeof(uint64_t)) == 0);
+
+  ctx_free(hists0);
+  strbuf_dealloc(&ctp0); strbuf_dealloc(&list0); strbuf_dealloc(&dot0);
+  strbuf_dealloc(&ctp1); strbuf_dealloc(&list1); strbuf_dealloc(&dot1);
+  link_block_dealloc(&block);
+  file_filter_close(&ctpin.fltr);
+}
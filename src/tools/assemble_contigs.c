@@ -311,9 +311,9 @@ static void assemble_from_paths(void *arg)
   Assembler *assem = (Assembler*)arg;
   const dBGraph *db_graph = assem->db_graph;
 
-  const bool resize = true, keep_path_counts = false;
+  const bool keep_path_counts = false;
   gpath_set_alloc(&assem->gpset, db_graph->gpstore.gpset.ncols,
-                  ONE_MEGABYTE, resize, keep_path_counts);
+                  ONE_MEGABYTE, GPATH_SET_NO_MEM_LIMIT, keep_path_counts);
 
   gpath_subset_alloc(&assem->gpsubset);
 
@@ -450,6 +450,7 @@ void assemble_contigs(size_t nthreads,
 
   for(i = 0; i < nthreads; i++) {
     db_node_buf_dealloc(&workers[i].nbuf);
+    graph_walker_stats_merge(&workers[i].stats.wlk_stats, &workers[i].wlk.stats);
     graph_walker_dealloc(&workers[i].wlk);
     rpt_walker_dealloc(&workers[i].rptwlk);
     assemble_contigs_stats_merge(stats, &workers[i].stats);
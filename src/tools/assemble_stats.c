@@ -142,6 +142,8 @@ void assemble_contigs_stats_merge(AssembleContigStats *dst,
 
   dst->num_reseed_abort    += src->num_reseed_abort;
   dst->num_seeds_not_found += src->num_seeds_not_found;
+
+  graph_walker_stats_merge(&dst->wlk_stats, &src->wlk_stats);
 }
 
 #define PREFIX "[Assembled] "
@@ -301,4 +303,6 @@ void assemble_contigs_stats_print(const AssembleContigStats *s)
 
   status(PREFIX"Junctions:");
   _print_grphwlk_state("Paths resolved", states[GRPHWLK_USEPATH], njunc);
+
+  graph_walker_stats_print(&s->wlk_stats);
 }
@@ -53,6 +53,7 @@ typedef struct
   uint64_t num_contigs_from_seed_paths;
   uint64_t num_reseed_abort; // aborted - already visited seed
   uint64_t num_seeds_not_found; // seed contig didn't have any matching kmers
+  GraphWalkerStats wlk_stats; // forks, links followed, link memo hits
 } AssembleContigStats;
 
 // Results from a single contig
@@ -8,6 +8,8 @@
 #include "kmer_occur.h"
 #include "graph_crawler.h"
 #include "json_hdr.h"
+#include "fork_queue.h"
+#include "gz_block_writer.h"
 
 typedef struct {
   size_t first_runid, num_runs;
@@ -39,12 +41,16 @@ typedef struct
   PathRefRun *allele_refs, *flank5p_refs;
   KOccurRunBuffer allele_run_buf, flank5p_run_buf;
 
+  // Output for the current batch of fork nodes, without call ids
+  StrBuf output_buf;
+  SizeBuffer callid_pos; // where call ids go in output_buf
+  size_t batch_ncalls; // number of calls in the current batch
+
   // Passed to all instances
   const KOGraph kograph;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
-  size_t *callid;
+  ForkQueue *const fork_queue;
+  GzBlockWriter *const gzwrtr;
   const size_t min_ref_nkmers, max_ref_nkmers; // how many kmers of homology req
 } BreakpointCaller;
 
@@ -56,7 +62,8 @@ typedef struct
 #define MAX_REFRUNS_PER_CALLER(ncols) MAX_REFRUNS_PER_ORIENT(ncols)*2
 
 static BreakpointCaller* brkpt_callers_new(size_t num_callers,
-                                           gzFile gzout,
+                                           ForkQueue *fork_queue,
+                                           GzBlockWriter *gzwrtr,
                                            size_t min_ref_flank,
                                            size_t max_ref_flank,
                                            const KOGraph kograph,
@@ -67,11 +74,6 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
   const size_t ncols = db_graph->num_of_cols;
   BreakpointCaller *callers = ctx_malloc(num_callers * sizeof(BreakpointCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
-  size_t *callid = ctx_calloc(1, sizeof(size_t));
-
   // Each colour in each caller can have a GraphCache path at once
   PathRefRun *path_ref_runs = ctx_calloc(num_callers*MAX_REFRUNS_PER_CALLER(ncols),
                                          sizeof(PathRefRun));
@@ -83,9 +85,9 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
                             .nthreads = num_callers,
                             .kograph = kograph,
                             .db_graph = db_graph,
-                            .gzout = gzout,
-                            .out_lock = out_lock,
-                            .callid = callid,
+                            .fork_queue = fork_queue,
+                            .gzwrtr = gzwrtr,
+                            .batch_ncalls = 0,
                             .allele_refs = path_ref_runs,
                             .flank5p_refs = path_ref_runs+MAX_REFRUNS_PER_ORIENT(ncols),
                             .min_ref_nkmers = min_ref_flank,
@@ -105,6 +107,8 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
     kmer_run_buf_alloc(&callers[i].flank5p_run_buf, 128);
     graph_crawler_alloc(&callers[i].crawlers[0], db_graph);
     graph_crawler_alloc(&callers[i].crawlers[1], db_graph);
+    strbuf_alloc(&callers[i].output_buf, 2048);
+    size_buf_alloc(&callers[i].callid_pos, 256);
   }
 
   return callers;
@@ -124,10 +128,9 @@ static void brkpt_callers_destroy(BreakpointCaller *callers, size_t num_callers)
     kmer_run_buf_dealloc(&callers[i].flank5p_run_buf);
     graph_crawler_dealloc(&callers[i].crawlers[0]);
     graph_crawler_dealloc(&callers[i].crawlers[1]);
+    strbuf_dealloc(&callers[i].output_buf);
+    size_buf_dealloc(&callers[i].callid_pos);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
-  ctx_free(callers[0].callid);
   ctx_free(callers[0].allele_refs);
   ctx_free(callers);
 }
@@ -139,7 +142,8 @@ static void process_contig(BreakpointCaller *caller,
                            const KOccurRun *flank5p_runs, size_t num_flank5p_runs,
                            const KOccurRun *flank3p_runs, size_t num_flank3p_runs)
 {
-  gzFile gzout = caller->gzout;
+  StrBuf *sbuf = &caller->output_buf;
+  SizeBuffer *idpos = &caller->callid_pos;
   KOGraph kograph = caller->kograph;
   const size_t kmer_size = caller->db_graph->kmer_size;
 
@@ -148,8 +152,8 @@ static void process_contig(BreakpointCaller *caller,
   // we never re-met the ref
   if(num_flank3p_runs == 0) return;
 
-  // Find first place we meet the ref
-  size_t callid = __sync_fetch_and_add((volatile size_t*)caller->callid, 1);
+  // Get call number within this batch, id is filled in when batch is done
+  size_t callid = caller->batch_ncalls++;
 
   // Swallow up some of the path into the 3p flank
   size_t i, flank3pidx = flank3p_runs[0].qoffset;
@@ -157,36 +161,38 @@ static void process_contig(BreakpointCaller *caller,
   size_t num_path_kmers = flank3pidx - extra3pbases;
   size_t kmer3poffset = kmer_size-1-extra3pbases;
 
-  pthread_mutex_lock(caller->out_lock);
-
   // This can be set to anything without a '.' in it
   const char prefix[] = "call";
 
   // 5p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%s%zu.5pflank chr=", prefix, callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank5p_runs, num_flank5p_runs, 0, 0);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint(flank5p->b, flank5p->len, caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%s", prefix);
+  fork_batch_add_callid(sbuf, idpos, callid);
+  strbuf_append_str(sbuf, ".5pflank chr=");
+  koruns_sprint(sbuf, kmer_size, kograph, flank5p_runs, num_flank5p_runs, 0, 0);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_sprint(flank5p->b, flank5p->len, caller->db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
 
   // 3p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%s%zu.3pflank chr=", prefix, callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank3p_runs, num_flank3p_runs,
-                 flank3pidx, kmer3poffset);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->b+num_path_kmers,
-                        allelebuf->len-num_path_kmers,
-                        caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%s", prefix);
+  fork_batch_add_callid(sbuf, idpos, callid);
+  strbuf_append_str(sbuf, ".3pflank chr=");
+  koruns_sprint(sbuf, kmer_size, kograph, flank3p_runs, num_flank3p_runs,
+                flank3pidx, kmer3poffset);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_sprint_cont(allelebuf->b+num_path_kmers,
+                       allelebuf->len-num_path_kmers,
+                       caller->db_graph, sbuf);
+  strbuf_append_char(sbuf, '\n');
 
   // Print path with list of colours
-  gzprintf(gzout, ">brkpnt.%s%zu.path cols=%zu", prefix, callid, cols[0]);
-  for(i = 1; i < ncols; i++) gzprintf(gzout, ",%zu", cols[i]);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->b, num_path_kmers, caller->db_graph, gzout);
-  gzprintf(gzout, "\n\n");
-
-  pthread_mutex_unlock(caller->out_lock);
+  strbuf_sprintf(sbuf, ">brkpnt.%s", prefix);
+  fork_batch_add_callid(sbuf, idpos, callid);
+  strbuf_sprintf(sbuf, ".path cols=%zu", (size_t)cols[0]);
+  for(i = 1; i < ncols; i++) strbuf_sprintf(sbuf, ",%zu", (size_t)cols[i]);
+  strbuf_append_char(sbuf, '\n');
+  db_nodes_sprint_cont(allelebuf->b, num_path_kmers, caller->db_graph, sbuf);
+  strbuf_append_str(sbuf, "\n\n");
 }
 
 // If `pickup_new_runs` is true we pick up runs starting at this supernode
@@ -493,40 +499,62 @@ static void follow_break(BreakpointCaller *caller, dBNode node)
   }
 }
 
-static inline int breakpoint_caller_node(hkey_t hkey, BreakpointCaller *caller)
+static inline void breakpoint_caller_node(dBNode node, BreakpointCaller *caller)
 {
-  Edges edges;
-
   graph_crawler_reset(&caller->crawlers[0]);
   graph_crawler_reset(&caller->crawlers[1]);
 
   // check node is in the ref
-  if(kograph_occurs(caller->kograph, hkey)) {
-    edges = db_node_get_edges(caller->db_graph, hkey, 0);
-    if(edges_get_outdegree(edges, FORWARD) > 1) {
-      follow_break(caller, (dBNode){.key = hkey, .orient = FORWARD});
-    }
-    if(edges_get_outdegree(edges, REVERSE) > 1) {
-      follow_break(caller, (dBNode){.key = hkey, .orient = REVERSE});
-    }
-  }
-
-  return 0; // => keep iterating
+  if(kograph_occurs(caller->kograph, node.key))
+    follow_break(caller, node);
 }
 
+// Take batches of fork nodes from the queue, write calls to a gzip block
 static void breakpoint_caller(void *ptr)
 {
   BreakpointCaller *caller = (BreakpointCaller*)ptr;
   ctx_assert(caller->db_graph->num_edge_cols == 1);
 
-  HASH_ITERATE_PART(&caller->db_graph->ht, caller->threadid, caller->nthreads,
-                    breakpoint_caller_node, caller);
+  ForkBatch batch;
+  GzBlock *blk;
+  size_t i, first_callid;
+
+  fork_batch_alloc(&batch, FORK_QUEUE_BATCH_SIZE);
+
+  while(1)
+  {
+    // Claim an output block before taking a batch, so that in ordered mode
+    // every batch in progress already has a block and we cannot deadlock
+    blk = gz_block_writer_claim(caller->gzwrtr);
+
+    if(!fork_queue_next(caller->fork_queue, &batch)) {
+      gz_block_writer_release(caller->gzwrtr, blk);
+      break;
+    }
+
+    strbuf_reset(&caller->output_buf);
+    size_buf_reset(&caller->callid_pos);
+    caller->batch_ncalls = 0;
+
+    for(i = 0; i < batch.nodes.len; i++)
+      breakpoint_caller_node(batch.nodes.b[i], caller);
+
+    first_callid = fork_queue_number(caller->fork_queue, &batch,
+                                     caller->batch_ncalls);
+
+    blk->id = batch.id;
+    fork_batch_print_callids(&caller->output_buf, &caller->callid_pos,
+                             first_callid, &blk->txt);
+    gz_block_writer_write(caller->gzwrtr, blk);
+  }
+
+  fork_batch_dealloc(&batch);
 }
 
-// Print JSON header to gzout
-static void breakpoints_print_header(gzFile gzout, const char *out_path,
+// Print JSON header to sbuf
+static void breakpoints_print_header(StrBuf *sbuf, const char *out_path,
                                      char **seq_paths, size_t nseq_paths,
-                                     const read_t *reads, size_t nreads,
+                                     KOGraph kograph,
                                      size_t min_ref_flank, size_t max_ref_flank,
                                      cJSON **hdrs, size_t nhdrs,
                                      const dBGraph *db_graph)
@@ -562,59 +590,81 @@ static void breakpoints_print_header(gzFile gzout, const char *out_path,
 
   // List contigs
   cJSON *contigs = cJSON_CreateArray();
-  for(i = 0; i < nreads; i++) {
+  for(i = 0; i < kograph.nchroms; i++) {
     cJSON *contig = cJSON_CreateObject();
-    cJSON_AddStringToObject(contig, "id", reads[i].name.b);
-    cJSON_AddNumberToObject(contig, "length", reads[i].seq.end);
+    cJSON_AddStringToObject(contig, "id", kograph.chroms[i].name);
+    cJSON_AddNumberToObject(contig, "length", kograph.chroms[i].length);
     cJSON_AddItemToArray(contigs, contig);
   }
   json_hdr_augment_cmd(json, "breakpoints", "contigs", contigs);
 
-  // Write header to file
-  json_hdr_gzprint(json, gzout);
+  // Write header to buffer
+  json_hdr_sprint(json, sbuf);
 
   // Print comments about the format
-  gzputs(gzout, "\n");
-  gzputs(gzout, "# This file was generated with McCortex\n");
-  gzputs(gzout, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
-  gzputs(gzout, "#   url: "CORTEX_URL"\n");
-  gzputs(gzout, "# \n");
-  gzputs(gzout, "# Comment lines begin with a # and are ignored, but must come after the header\n");
-  gzputs(gzout, "# Format is:\n");
-  gzputs(gzout, "#   chr=seq:start-end:strand:offset\n");
-  gzputs(gzout, "#   all coordinates are 1-based\n");
-  gzputs(gzout, "#   <strand> is + or -. If +, start <= end otherwise start >= end.\n");
-  gzputs(gzout, "#   <offset> is the position in the sequence where ref starts agreeing\n");
-  gzputs(gzout, "\n");
+  strbuf_append_str(sbuf, "\n");
+  strbuf_append_str(sbuf, "# This file was generated with McCortex\n");
+  strbuf_append_str(sbuf, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
+  strbuf_append_str(sbuf, "#   url: "CORTEX_URL"\n");
+  strbuf_append_str(sbuf, "# \n");
+  strbuf_append_str(sbuf, "# Comment lines begin with a # and are ignored, but must come after the header\n");
+  strbuf_append_str(sbuf, "# Format is:\n");
+  strbuf_append_str(sbuf, "#   chr=seq:start-end:strand:offset\n");
+  strbuf_append_str(sbuf, "#   all coordinates are 1-based\n");
+  strbuf_append_str(sbuf, "#   <strand> is + or -. If +, start <= end otherwise start >= end.\n");
+  strbuf_append_str(sbuf, "#   <offset> is the position in the sequence where ref starts agreeing\n");
+  strbuf_append_str(sbuf, "\n");
 
   cJSON_Delete(json);
 }
 
 void breakpoints_call(size_t num_of_threads,
-                      gzFile gzout, const char *out_path,
-                      const read_t *reads, size_t num_reads,
+                      FILE *fout, const char *out_path, bool ordered,
+                      KOGraph kograph,
                       char **seq_paths, size_t num_seq_paths,
                       size_t min_ref_flank, size_t max_ref_flank,
                       cJSON **hdrs, size_t nhdrs,
                       dBGraph *db_graph)
 {
-  breakpoints_print_header(gzout, out_path,
+  // Write header before any calls
+  StrBuf hdrbuf;
+  strbuf_alloc(&hdrbuf, 4096);
+  breakpoints_print_header(&hdrbuf, out_path,
                            seq_paths, num_seq_paths,
-                           reads, num_reads,
+                           kograph,
                            min_ref_flank, max_ref_flank,
                            hdrs, nhdrs,
                            db_graph);
+  gz_block_write_str(fout, out_path, Z_DEFAULT_COMPRESSION,
+                     hdrbuf.b, hdrbuf.end);
+  strbuf_dealloc(&hdrbuf);
+
+  // Compression is done by the caller threads, one thread writes blocks out
+  GzBlockWriter gzwrtr;
+  gz_block_writer_alloc(&gzwrtr, fout, out_path, num_of_threads*2+1,
+                        Z_DEFAULT_COMPRESSION, ordered);
 
-  KOGraph kograph = kograph_create(reads, num_reads, true,
-                                   num_of_threads, db_graph);
+  ForkQueue fork_queue;
+  fork_queue_alloc(&fork_queue, FORK_QUEUE_BATCH_SIZE, ordered, db_graph);
 
-  BreakpointCaller *callers = brkpt_callers_new(num_of_threads, gzout,
+  BreakpointCaller *callers = brkpt_callers_new(num_of_threads,
+                                                &fork_queue, &gzwrtr,
                                                 min_ref_flank, max_ref_flank,
                                                 kograph, db_graph);
 
-  status("Running BreakpointCaller with %zu thread%s, output to: %s",
+  // Supernodes are shared between callers
+  SnodeCache snode_cache;
+  snode_cache_alloc(&snode_cache, SNODE_CACHE_DEFAULT_MEM);
+
+  size_t i, j;
+  for(i = 0; i < num_of_threads; i++) {
+    callers[i].crawlers[0].cache.snode_cache = &snode_cache;
+    callers[i].crawlers[1].cache.snode_cache = &snode_cache;
+  }
+
+  status("Running BreakpointCaller with %zu thread%s, output to: %s%s",
          num_of_threads, util_plural_str(num_of_threads),
-         futil_outpath_str(out_path));
+         futil_outpath_str(out_path), ordered ? " (ordered)" : "");
 
   status("  Finding breakpoints after at least %zu kmers (%zubp) of homology",
          min_ref_flank, min_ref_flank+db_graph->kmer_size-1);
@@ -622,10 +672,23 @@ void breakpoints_call(size_t num_of_threads,
   util_run_threads(callers, num_of_threads, sizeof(callers[0]),
                    num_of_threads, breakpoint_caller);
 
+  // Wait for output to be written
+  gz_block_writer_dealloc(&gzwrtr);
+
   char call_num_str[100];
-  ulong_to_str(callers[0].callid[0], call_num_str);
+  ulong_to_str(fork_queue_num_calls(&fork_queue), call_num_str);
   status("  %s calls printed to %s", call_num_str, futil_outpath_str(out_path));
 
+  for(i = 0; i < num_of_threads; i++) {
+    for(j = 0; j < 2; j++) {
+      snode_cache_add_stats(&snode_cache,
+                            callers[i].crawlers[j].cache.snode_lookups,
+                            callers[i].crawlers[j].cache.snode_hits);
+    }
+  }
+  snode_cache_print_stats(&snode_cache);
+
   brkpt_callers_destroy(callers, num_of_threads);
-  kograph_free(kograph);
+  snode_cache_dealloc(&snode_cache);
+  fork_queue_dealloc(&fork_queue);
 }
@@ -4,6 +4,7 @@
 #include "seq_file.h"
 #include "db_graph.h"
 #include "cmd.h"
+#include "kmer_occur.h"
 
 #include "cJSON/cJSON.h"
 
@@ -13,11 +14,14 @@
 #define DEFAULT_MIN_REF_NKMERS 5
 #define DEFAULT_MAX_REF_NKMERS 1000
 
-// Adds input bkmers to the graph
+// Writes gzipped output to fout
+// @param ordered if true, output is the same regardless of number of threads
+// @param kograph reference kmers, already added to the graph
+// @param seq_paths reference files (or index file) listed in the header
 // @param hdrs JSON headers of input files
 void breakpoints_call(size_t num_of_threads,
-                      gzFile gzout, const char *out_path,
-                      const read_t *reads, size_t num_reads,
+                      FILE *fout, const char *out_path, bool ordered,
+                      KOGraph kograph,
                       char **seq_paths, size_t num_seq_paths,
                       size_t min_ref_flank, size_t max_ref_flank,
                       cJSON **hdrs, size_t nhdrs,
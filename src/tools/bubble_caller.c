@@ -16,7 +16,8 @@
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  BubbleCallingPrefs prefs,
-                                 gzFile gzout,
+                                 ForkQueue *fork_queue,
+                                 GzBlockWriter *gzwrtr,
                                  const dBGraph *db_graph)
 {
   ctx_assert(num_callers > 0);
@@ -27,19 +28,15 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
 
   BubbleCaller *callers = ctx_malloc(num_callers * sizeof(BubbleCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
-  size_t *num_bubbles_ptr = ctx_calloc(1, sizeof(size_t));
-
   for(i = 0; i < num_callers; i++)
   {
     BubbleCaller tmp = {.threadid = i, .nthreads = num_callers,
                         .haploid_seen = ctx_calloc(1+prefs.num_haploid, sizeof(bool)),
-                        .num_bubbles_ptr = num_bubbles_ptr,
+                        .batch_ncalls = 0,
                         .prefs = prefs,
-                        .db_graph = db_graph, .gzout = gzout,
-                        .out_lock = out_lock};
+                        .db_graph = db_graph,
+                        .fork_queue = fork_queue,
+                        .gzwrtr = gzwrtr};
 
     memcpy(&callers[i], &tmp, sizeof(BubbleCaller));
 
@@ -54,6 +51,7 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
     cache_stepptr_buf_alloc(&callers[i].spp_forward, 1024);
     cache_stepptr_buf_alloc(&callers[i].spp_reverse, 1024);
     strbuf_alloc(&callers[i].output_buf, 2048);
+    size_buf_alloc(&callers[i].callid_pos, 256);
   }
 
   return callers;
@@ -78,15 +76,13 @@ void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers)
     cache_stepptr_buf_dealloc(&callers[i].spp_forward);
     cache_stepptr_buf_dealloc(&callers[i].spp_reverse);
     strbuf_dealloc(&callers[i].output_buf);
+    size_buf_dealloc(&callers[i].callid_pos);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
-  ctx_free(callers[0].num_bubbles_ptr);
   ctx_free(callers);
 }
 
-// Print JSON header to gzout
-static void bubble_caller_print_header(gzFile gzout, const char* out_path,
+// Print JSON header to sbuf
+static void bubble_caller_print_header(StrBuf *sbuf, const char* out_path,
                                        BubbleCallingPrefs prefs,
                                        cJSON **hdrs, size_t nhdrs,
                                        const dBGraph *db_graph)
@@ -110,17 +106,17 @@ static void bubble_caller_print_header(gzFile gzout, const char* out_path,
     cJSON_AddItemToArray(haploids, cJSON_CreateInt(prefs.haploid_cols[i]));
   json_hdr_augment_cmd(json, "bubbles", "haploid_colours", haploids);
 
-  // Write header to file
-  json_hdr_gzprint(json, gzout);
+  // Write header to buffer
+  json_hdr_sprint(json, sbuf);
 
   // Print comments about the format
-  gzputs(gzout, "\n");
-  gzputs(gzout, "# This file was generated with McCortex\n");
-  gzputs(gzout, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
-  gzputs(gzout, "#   url: "CORTEX_URL"\n");
-  gzputs(gzout, "# \n");
-  gzputs(gzout, "# Comment lines begin with a # and are ignored, but must come after the header\n");
-  gzputs(gzout, "\n");
+  strbuf_append_str(sbuf, "\n");
+  strbuf_append_str(sbuf, "# This file was generated with McCortex\n");
+  strbuf_append_str(sbuf, "#   written by Isaac Turner <turner.isaac@gmail.com>\n");
+  strbuf_append_str(sbuf, "#   url: "CORTEX_URL"\n");
+  strbuf_append_str(sbuf, "# \n");
+  strbuf_append_str(sbuf, "# Comment lines begin with a # and are ignored, but must come after the header\n");
+  strbuf_append_str(sbuf, "\n");
 
   cJSON_Delete(json);
 }
@@ -208,16 +204,16 @@ static void print_bubble(BubbleCaller *caller,
   // Print Bubble
   //
 
-  // write to string buffer then flush to gzFile
+  // write to string buffer, which is written out at the end of the batch
   StrBuf *sbuf = &caller->output_buf;
-  strbuf_reset(sbuf);
+  SizeBuffer *idpos = &caller->callid_pos;
 
   // Temporary node buffer to use
   dBNodeBuffer *pathbuf = &caller->pathbuf;
   db_node_buf_reset(pathbuf);
 
-  // Get bubble number (threadsafe num_bubbles_ptr++)
-  size_t id = __sync_fetch_and_add((volatile size_t*)caller->num_bubbles_ptr, 1);
+  // Get bubble number within this batch, id is filled in when batch is done
+  size_t id = caller->batch_ncalls++;
 
   // This can be set to anything without a '.' in it
   const char prefix[] = "call";
@@ -226,7 +222,7 @@ static void print_bubble(BubbleCaller *caller,
   // strbuf_sprintf(sbuf, ">bubble.%s%zu.5pflank kmers=%zu\n", prefix, id, flank5p->len);
   strbuf_append_str(sbuf, ">bubble.");
   strbuf_append_str(sbuf, prefix);
-  strbuf_append_ulong(sbuf, id);
+  fork_batch_add_callid(sbuf, idpos, id);
   strbuf_append_str(sbuf, ".5pflank kmers=");
   strbuf_append_ulong(sbuf, flank5p->len);
   strbuf_append_char(sbuf, '\n');
@@ -240,7 +236,7 @@ static void print_bubble(BubbleCaller *caller,
   // strbuf_sprintf(sbuf, ">bubble.%s%zu.3pflank kmers=%zu\n", prefix, id, pathbuf->len);
   strbuf_append_str(sbuf, ">bubble.");
   strbuf_append_str(sbuf, prefix);
-  strbuf_append_ulong(sbuf, id);
+  fork_batch_add_callid(sbuf, idpos, id);
   strbuf_append_str(sbuf, ".3pflank kmers=");
   strbuf_append_ulong(sbuf, pathbuf->len);
   strbuf_append_char(sbuf, '\n');
@@ -269,11 +265,6 @@ static void print_bubble(BubbleCaller *caller,
   strbuf_append_char(sbuf, '\n');
 
   ctx_assert(strlen(sbuf->b) == sbuf->end);
-
-  // lock, print, unlock
-  pthread_mutex_lock(caller->out_lock);
-  gzwrite(caller->gzout, sbuf->b, sbuf->end);
-  pthread_mutex_unlock(caller->out_lock);
 }
 
 // `fork_node` is a node with outdegree > 1
@@ -406,54 +397,111 @@ static void write_bubbles_to_file(BubbleCaller *caller)
   }
 }
 
-static inline int bubble_caller_node(hkey_t hkey, BubbleCaller *caller)
+// Take batches of fork nodes from the queue, write bubbles to a gzip block
+static void bubble_caller(void *args)
 {
-  Edges edges = db_node_get_edges(caller->db_graph, hkey, 0);
-  if(edges_get_outdegree(edges, FORWARD) > 1) {
-    find_bubbles(caller, (dBNode){.key = hkey, .orient = FORWARD});
-    write_bubbles_to_file(caller);
-  }
-  if(edges_get_outdegree(edges, REVERSE) > 1) {
-    find_bubbles(caller, (dBNode){.key = hkey, .orient = REVERSE});
-    write_bubbles_to_file(caller);
-  }
+  BubbleCaller *caller = (BubbleCaller*)args;
+  ForkBatch batch;
+  GzBlock *blk;
+  size_t i, first_callid;
 
-  return 0; // => keep iterating
-}
+  fork_batch_alloc(&batch, FORK_QUEUE_BATCH_SIZE);
 
-void bubble_caller(void *args)
-{
-  BubbleCaller *caller = (BubbleCaller*)args;
+  while(1)
+  {
+    // Claim an output block before taking a batch, so that in ordered mode
+    // every batch in progress already has a block and we cannot deadlock
+    blk = gz_block_writer_claim(caller->gzwrtr);
 
-  HASH_ITERATE_PART(&caller->db_graph->ht, caller->threadid, caller->nthreads,
-                    bubble_caller_node, caller);
+    if(!fork_queue_next(caller->fork_queue, &batch)) {
+      gz_block_writer_release(caller->gzwrtr, blk);
+      break;
+    }
+
+    strbuf_reset(&caller->output_buf);
+    size_buf_reset(&caller->callid_pos);
+    caller->batch_ncalls = 0;
+
+    for(i = 0; i < batch.nodes.len; i++) {
+      find_bubbles(caller, batch.nodes.b[i]);
+      write_bubbles_to_file(caller);
+    }
+
+    first_callid = fork_queue_number(caller->fork_queue, &batch,
+                                     caller->batch_ncalls);
+
+    blk->id = batch.id;
+    fork_batch_print_callids(&caller->output_buf, &caller->callid_pos,
+                             first_callid, &blk->txt);
+    gz_block_writer_write(caller->gzwrtr, blk);
+  }
+
+  fork_batch_dealloc(&batch);
 }
 
 void invoke_bubble_caller(size_t num_of_threads, BubbleCallingPrefs prefs,
-                          gzFile gzout, const char *out_path,
+                          FILE *fout, const char *out_path, bool ordered,
                           cJSON **hdrs, size_t nhdrs,
                           const dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_edge_cols == 1);
   ctx_assert(db_graph->node_in_cols != NULL);
 
-  status("Calling bubbles with %zu threads, output: %s", num_of_threads, out_path);
+  status("Calling bubbles with %zu threads, output: %s%s", num_of_threads,
+         futil_outpath_str(out_path), ordered ? " (ordered)" : "");
 
-  // Print header
-  bubble_caller_print_header(gzout, out_path, prefs, hdrs, nhdrs, db_graph);
+  // Write header before any calls
+  StrBuf hdrbuf;
+  strbuf_alloc(&hdrbuf, 4096);
+  bubble_caller_print_header(&hdrbuf, out_path, prefs, hdrs, nhdrs, db_graph);
+  gz_block_write_str(fout, out_path, Z_DEFAULT_COMPRESSION,
+                     hdrbuf.b, hdrbuf.end);
+  strbuf_dealloc(&hdrbuf);
+
+  // Compression is done by the caller threads, one thread writes blocks out
+  GzBlockWriter gzwrtr;
+  gz_block_writer_alloc(&gzwrtr, fout, out_path, num_of_threads*2+1,
+                        Z_DEFAULT_COMPRESSION, ordered);
+
+  ForkQueue fork_queue;
+  fork_queue_alloc(&fork_queue, FORK_QUEUE_BATCH_SIZE, ordered, db_graph);
 
   BubbleCaller *callers = bubble_callers_new(num_of_threads, prefs,
-                                             gzout, db_graph);
+                                             &fork_queue, &gzwrtr, db_graph);
+
+  // Supernodes are shared between callers
+  SnodeCache snode_cache;
+  snode_cache_alloc(&snode_cache, SNODE_CACHE_DEFAULT_MEM);
+
+  size_t i;
+  for(i = 0; i < num_of_threads; i++)
+    callers[i].cache.snode_cache = &snode_cache;
 
   // Run
   util_run_threads(callers, num_of_threads, sizeof(callers[0]),
                    num_of_threads, bubble_caller);
 
+  // Wait for output to be written
+  gz_block_writer_dealloc(&gzwrtr);
+
   // Report number of bubble called+printed
-  size_t num_of_bubbles = callers[0].num_bubbles_ptr[0];
+  size_t num_of_bubbles = fork_queue_num_calls(&fork_queue);
   char num_bubbles_str[100];
   ulong_to_str(num_of_bubbles, num_bubbles_str);
-  status("%s bubbles called with Paths-Bubble-Caller\n", num_bubbles_str);
+  status("%s bubbles called with Paths-Bubble-Caller", num_bubbles_str);
+
+  for(i = 0; i < num_of_threads; i++) {
+    snode_cache_add_stats(&snode_cache, callers[i].cache.snode_lookups,
+                          callers[i].cache.snode_hits);
+  }
+  snode_cache_print_stats(&snode_cache);
+
+  GraphWalkerStats wlk_stats;
+  memset(&wlk_stats, 0, sizeof(wlk_stats));
+  for(i = 0; i < num_of_threads; i++)
+    graph_walker_stats_merge(&wlk_stats, &callers[i].wlk.stats);
+  graph_walker_stats_print(&wlk_stats);
+  message("\n");
 
   status("Turn bubble file into VCF with:");
   status("   bwa index ref.fa");
@@ -465,4 +513,6 @@ void invoke_bubble_caller(size_t num_of_threads, BubbleCallingPrefs prefs,
 
   // Clean up
   bubble_callers_destroy(callers, num_of_threads);
+  snode_cache_dealloc(&snode_cache);
+  fork_queue_dealloc(&fork_queue);
 }
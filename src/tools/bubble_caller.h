@@ -5,6 +5,8 @@
 #include "graph_cache.h"
 #include "graph_walker.h"
 #include "repeat_walker.h"
+#include "fork_queue.h"
+#include "gz_block_writer.h"
 #include "cmd.h"
 
 #include "cJSON/cJSON.h"
@@ -37,19 +39,22 @@ typedef struct
   GraphWalker wlk;
   RepeatWalker rptwlk;
 
+  // Output for the current batch of fork nodes, without call ids
   StrBuf output_buf;
+  SizeBuffer callid_pos; // where call ids go in output_buf
+  size_t batch_ncalls; // number of bubbles in the current batch
 
   // Shared data
-  size_t *num_bubbles_ptr; // statistics - shared pointer
   const BubbleCallingPrefs prefs;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
+  ForkQueue *const fork_queue;
+  GzBlockWriter *const gzwrtr;
 } BubbleCaller;
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  BubbleCallingPrefs prefs,
-                                 gzFile gzout,
+                                 ForkQueue *fork_queue,
+                                 GzBlockWriter *gzwrtr,
                                  const dBGraph *db_graph);
 
 void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers);
@@ -61,11 +66,12 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node);
 // or caller->spp_reverse (if they traverse the snode in reverse)
 void find_bubbles_ending_with(BubbleCaller *caller, GCacheSnode *snode);
 
-// Run bubble caller, write output to gzout
+// Run bubble caller, write gzipped output to fout
+// @param ordered if true, output is the same regardless of number of threads
 // @param hdrs JSON headers of input files
 // @param nhdrs number of JSON headers of input files
 void invoke_bubble_caller(size_t num_of_threads, BubbleCallingPrefs prefs,
-                          gzFile gzout, const char *out_path,
+                          FILE *fout, const char *out_path, bool ordered,
                           cJSON **hdrs, size_t nhdrs,
                           const dBGraph *db_graph);
 
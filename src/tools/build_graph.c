@@ -5,33 +5,52 @@
 #include "seq_reader.h"
 #include "async_read_io.h"
 #include "loading_stats.h"
+#include "count_filter.h"
+#include "dup_filter.h"
+#include "kmer_batch.h"
 #include "util.h"
 #include "file_util.h"
 
 #include <pthread.h>
+#include <sys/time.h> // gettimeofday()
 #include "seq_file.h"
 
 typedef struct
 {
   dBGraph *const db_graph;
-  size_t rcounter; // counter of entries taken from the pool
+  LoadingStats *const stats; // one per input file, merged once loaded
+  volatile size_t *const rcounter; // counter of entries taken from the pool
+  // If cfilter != NULL, only load kmers with count >= min_count
+  const CountFilter *const cfilter;
+  const size_t min_count;
+  // Used by tasks with remove_pcr_dups set
+  DupFilter *const dfilter;
 } BuildGraphData;
 
 //
 // Check for PCR duplicates
 //
 
-// Read start (duplicate removal during read loading)
-#define db_node_has_read_start_mt(graph,node) \
-        bitset_get_mt((graph)->readstrt, 2*(node).key+(node).orient)
-#define db_node_set_read_start_mt(graph,node) \
-        bitset_set_mt((graph)->readstrt, 2*(node).key+(node).orient)
+// Hash the first kmer of a read and its orientation
+static inline uint64_t read_start_hash(const read_t *r, size_t start,
+                                       size_t kmer_size, uint32_t seed)
+{
+  BinaryKmer bkmer = binary_kmer_from_str(r->seq.b + start, kmer_size);
+  BinaryKmer bkey = binary_kmer_get_key(bkmer, kmer_size);
+  Orientation orient = bkmer_get_orientation(bkmer, bkey);
+  return binary_kmer_hash(bkey, seed + orient);
+}
 
-// Returns true if start1, start2 set and reads should be added
+// Returns true if reads are not a duplicate and should be added
+// Pairs are keyed on the first kmer of both mates, so are only duplicates if
+// both mates start at the same kmers as a previous pair. Reads (or pairs with
+// only one usable mate) are keyed on their first kmer. Keys include the
+// colour.
 static bool seq_reads_are_novel(read_t *r1, read_t *r2,
                                 uint8_t fq_cutoff1, uint8_t fq_cutoff2,
                                 uint8_t hp_cutoff, ReadMateDir matedir,
-                                LoadingStats *stats, dBGraph *db_graph)
+                                size_t colour, size_t kmer_size,
+                                DupFilter *dfilter)
 {
   // Remove SAM/BAM duplicates
   if(r1->from_sam && r1->bam->core.flag & BAM_FDUP &&
@@ -41,11 +60,10 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
 
   seq_reader_orient_mp_FF(r1, r2, matedir);
 
-  const size_t kmer_size = db_graph->kmer_size;
   size_t start1, start2 = 0;
   bool got_kmer1 = false, got_kmer2 = false;
-  BinaryKmer bkmer1, bkmer2;
-  dBNode node1 = DB_NODE_INIT, node2 = DB_NODE_INIT;
+  uint64_t h1 = 0, h2 = 0, key;
+  uint32_t seed = 2*colour; // orientation is added to the seed
 
   start1 = seq_contig_start(r1, 0, kmer_size, fq_cutoff1, hp_cutoff);
   got_kmer1 = (start1 < r1->seq.end);
@@ -55,36 +73,23 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
     got_kmer2 = (start2 < r2->seq.end);
   }
 
-  bool found1 = false, found2 = false;
-
-  // Look up first kmer
-  if(got_kmer1) {
-    bkmer1 = binary_kmer_from_str(r1->seq.b + start1, kmer_size);
-    node1 = db_graph_find_or_add_node_mt(db_graph, bkmer1, &found1);
-  }
-
-  // Look up second kmer
-  if(got_kmer2) {
-    bkmer2 = binary_kmer_from_str(r2->seq.b + start2, kmer_size);
-    node2 = db_graph_find_or_add_node_mt(db_graph, bkmer2, &found2);
-  }
+  // Reads without any kmers are dropped as duplicates
+  if(!got_kmer1 && !got_kmer2) return false;
 
-  size_t num_kmers_novel = !found1 + !found2;
-  __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_novel, num_kmers_novel);
+  if(got_kmer1) h1 = read_start_hash(r1, start1, kmer_size, seed);
+  if(got_kmer2) h2 = read_start_hash(r2, start2, kmer_size, seed);
 
-  // Each read gives no kmer or a duplicate kmer
-  // used find_or_insert so if we have a kmer we have a graph node
-  if((!got_kmer1 || db_node_has_read_start_mt(db_graph, node1)) &&
-     (!got_kmer2 || db_node_has_read_start_mt(db_graph, node2)))
-  {
-    return false;
+  if(got_kmer1 && got_kmer2) {
+    key = (h1 << 32) | h2;
+  } else {
+    // Single kmer, second half of the key from a different seed
+    const read_t *r = got_kmer1 ? r1 : r2;
+    size_t start = got_kmer1 ? start1 : start2;
+    key = ((got_kmer1 ? h1 : h2) << 32) |
+          read_start_hash(r, start, kmer_size, seed + 0x9e3779b9);
   }
 
-  // Read is novel
-  if(got_kmer1) (void)db_node_set_read_start_mt(db_graph, node1);
-  if(got_kmer2) (void)db_node_set_read_start_mt(db_graph, node2);
-
-  return true;
+  return !dup_filter_add_mt(dfilter, key);
 }
 
 
@@ -100,23 +105,24 @@ size_t build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
 {
   ctx_assert(len >= db_graph->kmer_size);
   const size_t kmer_size = db_graph->kmer_size;
-  BinaryKmer bkmer;
+  BinaryKmerIter kiter;
   Nucleotide nuc;
   dBNode prev, curr;
   size_t i, num_novel_kmers = 0;
   size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
   bool found;
 
-  bkmer = binary_kmer_from_str(seq, kmer_size);
-  prev = db_graph_find_or_add_node_mt(db_graph, bkmer, &found);
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+  binary_kmer_iter_add(&kiter, dna_char_to_nuc(seq[kmer_size-1]));
+  prev = db_graph_find_or_add_iter_mt(db_graph, &kiter, &found);
   db_graph_update_node_mt(db_graph, prev, colour);
   num_novel_kmers += !found;
 
   for(i = kmer_size; i < len; i++)
   {
     nuc = dna_char_to_nuc(seq[i]);
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    curr = db_graph_find_or_add_node_mt(db_graph, bkmer, &found);
+    binary_kmer_iter_add(&kiter, nuc);
+    curr = db_graph_find_or_add_iter_mt(db_graph, &kiter, &found);
     db_graph_update_node_mt(db_graph, curr, colour);
     db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
     num_novel_kmers += !found;
@@ -126,12 +132,59 @@ size_t build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
   return num_novel_kmers;
 }
 
+// Threadsafe
+// As build_graph_from_str_mt() but only load kmers with count >= min_count
+// in `cfilter`. Edges are only added between consecutive loaded kmers.
+// Sets *num_loaded to the number of kmers loaded
+// Returns number of novel kmers loaded
+static size_t build_graph_from_str_filtered_mt(dBGraph *db_graph, size_t colour,
+                                               const char *seq, size_t len,
+                                               const CountFilter *cfilter,
+                                               size_t min_count,
+                                               size_t *num_loaded)
+{
+  ctx_assert(len >= db_graph->kmer_size);
+  const size_t kmer_size = db_graph->kmer_size;
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
+  dBNode prev = DB_NODE_INIT, curr;
+  size_t i, num_novel_kmers = 0, num_kmers = 0;
+  size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
+  bool found;
+
+  binary_kmer_iter_init(&kiter, seq, kmer_size);
+
+  for(i = kmer_size-1; i < len; i++)
+  {
+    binary_kmer_iter_add(&kiter, dna_char_to_nuc(seq[i]));
+    bkey = binary_kmer_iter_key(&kiter, &orient);
+
+    if(count_filter_get(cfilter, bkey) < min_count) {
+      prev.key = HASH_NOT_FOUND;
+      continue;
+    }
+
+    curr = db_graph_find_or_add_iter_mt(db_graph, &kiter, &found);
+    db_graph_update_node_mt(db_graph, curr, colour);
+    if(prev.key != HASH_NOT_FOUND)
+      db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
+    num_novel_kmers += !found;
+    num_kmers++;
+    prev = curr;
+  }
+
+  *num_loaded = num_kmers;
+  return num_novel_kmers;
+}
+
 // Already found a start position
 static void load_read(const read_t *r, uint8_t qual_cutoff, uint8_t hp_cutoff,
+                      const CountFilter *cfilter, size_t min_count,
                       LoadingStats *stats, Colour colour, dBGraph *db_graph)
 {
   const size_t kmer_size = db_graph->kmer_size;
-  size_t contig_start, contig_end, contig_len;
+  size_t contig_start, contig_end, contig_len, contig_kmers;
   size_t num_contigs = 0, search_start = 0, num_novel_kmers;
 
   while((contig_start = seq_contig_start(r, search_start, kmer_size,
@@ -141,27 +194,39 @@ static void load_read(const read_t *r, uint8_t qual_cutoff, uint8_t hp_cutoff,
                                 qual_cutoff, hp_cutoff, &search_start);
 
     contig_len = contig_end - contig_start;
-    num_novel_kmers = build_graph_from_str_mt(db_graph, colour,
-                                              r->seq.b+contig_start, contig_len);
 
-    size_t contig_kmers = contig_len + 1 - kmer_size;
-    __sync_fetch_and_add((volatile size_t*)&stats->total_bases_loaded, contig_len);
-    __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_loaded, contig_kmers);
-    __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_novel, num_novel_kmers);
+    if(cfilter == NULL) {
+      num_novel_kmers = build_graph_from_str_mt(db_graph, colour,
+                                                r->seq.b+contig_start,
+                                                contig_len);
+      contig_kmers = contig_len + 1 - kmer_size;
+    }
+    else {
+      num_novel_kmers = build_graph_from_str_filtered_mt(db_graph, colour,
+                                                         r->seq.b+contig_start,
+                                                         contig_len,
+                                                         cfilter, min_count,
+                                                         &contig_kmers);
+    }
+
+    stats->total_bases_loaded += contig_len;
+    stats->num_kmers_loaded += contig_kmers;
+    stats->num_kmers_novel += num_novel_kmers;
     num_contigs++;
   }
 
-  __sync_fetch_and_add((volatile size_t*)&stats->contigs_parsed, num_contigs);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_good_reads, num_contigs > 0);
-  __sync_fetch_and_add((volatile size_t*)&stats->num_bad_reads, num_contigs == 0);
+  stats->contigs_parsed += num_contigs;
+  stats->num_good_reads += num_contigs > 0;
+  stats->num_bad_reads += num_contigs == 0;
 }
 
-void build_graph_from_reads_mt(read_t *r1, read_t *r2,
-                               uint8_t fq_offset1, uint8_t fq_offset2,
-                               uint8_t fq_cutoff, uint8_t hp_cutoff,
-                               bool remove_pcr_dups, ReadMateDir matedir,
-                               LoadingStats *stats, size_t colour,
-                               dBGraph *db_graph)
+static void build_graph_from_reads(read_t *r1, read_t *r2,
+                                   uint8_t fq_offset1, uint8_t fq_offset2,
+                                   uint8_t fq_cutoff, uint8_t hp_cutoff,
+                                   DupFilter *dfilter, ReadMateDir matedir,
+                                   const CountFilter *cfilter, size_t min_count,
+                                   LoadingStats *stats, size_t colour,
+                                   dBGraph *db_graph)
 {
   // status("r1: '%s' '%s'", r1->name.b, r1->seq.b);
   // if(r2) status("r2: '%s' '%s'", r2->name.b, r2->seq.b);
@@ -174,47 +239,79 @@ void build_graph_from_reads_mt(read_t *r1, read_t *r2,
   }
 
   size_t total_bases = r1->seq.end + (r2 ? r2->seq.end : 0);
-  __sync_fetch_and_add((volatile size_t*)&stats->total_bases_read, total_bases);
+  stats->total_bases_read += total_bases;
 
-  if(r2) __sync_fetch_and_add((volatile size_t*)&stats->num_pe_reads, 2);
-  else   __sync_fetch_and_add((volatile size_t*)&stats->num_se_reads, 1);
+  if(r2) stats->num_pe_reads += 2;
+  else   stats->num_se_reads++;
 
   // printf(">%s %zu\n", r1->name.b, colour);
 
-  if(remove_pcr_dups && !seq_reads_are_novel(r1, r2,
+  if(dfilter != NULL && !seq_reads_are_novel(r1, r2,
                                              fq_cutoff1, fq_cutoff2, hp_cutoff,
-                                             matedir, stats, db_graph))
+                                             matedir, colour,
+                                             db_graph->kmer_size, dfilter))
   {
-    if(r2) __sync_fetch_and_add((volatile size_t*)&stats->num_dup_pe_pairs, 1);
-    else   __sync_fetch_and_add((volatile size_t*)&stats->num_dup_se_reads, 1);
+    if(r2) stats->num_dup_pe_pairs++;
+    else   stats->num_dup_se_reads++;
   }
   else {
-    load_read(r1, fq_cutoff1, hp_cutoff, stats, colour, db_graph);
-    if(r2) load_read(r2, fq_cutoff2, hp_cutoff, stats, colour, db_graph);
+    load_read(r1, fq_cutoff1, hp_cutoff, cfilter, min_count,
+              stats, colour, db_graph);
+    if(r2) load_read(r2, fq_cutoff2, hp_cutoff, cfilter, min_count,
+                     stats, colour, db_graph);
   }
 }
 
+void build_graph_from_reads_mt(read_t *r1, read_t *r2,
+                               uint8_t fq_offset1, uint8_t fq_offset2,
+                               uint8_t fq_cutoff, uint8_t hp_cutoff,
+                               DupFilter *dfilter, ReadMateDir matedir,
+                               LoadingStats *stats, size_t colour,
+                               dBGraph *db_graph)
+{
+  build_graph_from_reads(r1, r2, fq_offset1, fq_offset2, fq_cutoff, hp_cutoff,
+                         dfilter, matedir, NULL, 0,
+                         stats, colour, db_graph);
+}
+
 static void add_reads_to_graph(AsyncIOData *data, void *ptr)
 {
   BuildGraphData *wrkr = (BuildGraphData*)ptr;
   BuildGraphTask *task = (BuildGraphTask*)data->ptr;
   read_t *r2 = data->r2.name.end == 0 && data->r2.seq.end == 0 ? NULL : &data->r2;
 
-  build_graph_from_reads_mt(&data->r1, r2,
-                            data->fq_offset1, data->fq_offset2,
-                            task->fq_cutoff, task->hp_cutoff,
-                            task->remove_pcr_dups, task->matedir,
-                            &task->stats,
-                            task->colour, wrkr->db_graph);
+  build_graph_from_reads(&data->r1, r2,
+                         data->fq_offset1, data->fq_offset2,
+                         task->fq_cutoff, task->hp_cutoff,
+                         task->remove_pcr_dups ? wrkr->dfilter : NULL,
+                         task->matedir, wrkr->cfilter, wrkr->min_count,
+                         &wrkr->stats[task->idx],
+                         task->colour, wrkr->db_graph);
 
   // Print progress
-  size_t n = __sync_add_and_fetch((volatile size_t*)&wrkr->rcounter, 1);
+  size_t n = __sync_add_and_fetch(wrkr->rcounter, 1);
   ctx_update("BuildGraph", n);
 }
 
-// One thread used per input file, num_build_threads used to add reads to graph
-void build_graph(dBGraph *db_graph, BuildGraphTask *files,
-                 size_t num_files, size_t num_build_threads)
+// Copy stats into ginfo
+static void build_graph_update_ginfo(dBGraph *db_graph,
+                                     const BuildGraphTask *files,
+                                     size_t num_files)
+{
+  size_t f, max_col = 0;
+  for(f = 0; f < num_files; f++) {
+    max_col = MAX2(max_col, files[f].colour);
+    graph_info_update_stats(&db_graph->ginfo[files[f].colour], &files[f].stats);
+  }
+
+  db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used, max_col+1);
+}
+
+// Up to MAX_IO_THREADS threads read input files, num_build_threads add reads
+void build_graph_filtered(dBGraph *db_graph, BuildGraphTask *files,
+                          size_t num_files, size_t num_build_threads,
+                          const CountFilter *cfilter, size_t min_count,
+                          DupFilter *dfilter)
 {
   ctx_assert(db_graph->bktlocks != NULL);
 
@@ -223,52 +320,307 @@ void build_graph(dBGraph *db_graph, BuildGraphTask *files,
   size_t f;
 
   for(f = 0; f < num_files; f++) {
+    ctx_assert2(dfilter != NULL || !files[f].remove_pcr_dups,
+                "Need a DupFilter to remove PCR duplicates");
     files[f].idx = f;
     files[f].files.ptr = &files[f];
     memcpy(&async_tasks[f], &files[f].files, sizeof(AsyncIOInput));
   }
 
-  BuildGraphData global_mem = {.db_graph = db_graph, .rcounter = 0};
+  // Each thread keeps its own stats for each file, to avoid sharing counters
+  BuildGraphData *wrkrs = ctx_malloc(num_build_threads * sizeof(BuildGraphData));
+  LoadingStats *stats = ctx_malloc(num_build_threads * num_files * sizeof(LoadingStats));
+  size_t i, rcounter = 0;
+
+  for(i = 0; i < num_build_threads * num_files; i++)
+    loading_stats_init(&stats[i]);
+
+  for(i = 0; i < num_build_threads; i++) {
+    BuildGraphData tmp = {.db_graph = db_graph,
+                          .stats = stats + i * num_files,
+                          .rcounter = &rcounter,
+                          .cfilter = cfilter, .min_count = min_count,
+                          .dfilter = dfilter};
+    memcpy(&wrkrs[i], &tmp, sizeof(BuildGraphData));
+  }
+
+  struct timeval start, end;
+  uint64_t bases_before = 0, bases_read = 0;
+  for(f = 0; f < num_files; f++) bases_before += files[f].stats.total_bases_read;
 
+  gettimeofday(&start, NULL);
   asyncio_run_pool(async_tasks, num_files, add_reads_to_graph,
-                   &global_mem, num_build_threads, 0);
+                   wrkrs, num_build_threads, sizeof(BuildGraphData));
+  gettimeofday(&end, NULL);
+
+  for(i = 0; i < num_build_threads; i++)
+    for(f = 0; f < num_files; f++)
+      loading_stats_merge(&files[f].stats, &wrkrs[i].stats[f]);
 
+  // Report parsing throughput
+  for(f = 0; f < num_files; f++) bases_read += files[f].stats.total_bases_read;
+  bases_read -= bases_before;
+
+  double secs = (end.tv_sec - start.tv_sec) + 1e-6 * (end.tv_usec - start.tv_usec);
+  char bases_str[50], rate_str[50];
+  ulong_to_str(bases_read, bases_str);
+  ulong_to_str(secs > 0 ? (size_t)(bases_read / secs) : bases_read, rate_str);
+  status("[build] Read %s bases in %.2f secs (%s bases/sec)",
+         bases_str, secs, rate_str);
+
+  if(dfilter != NULL && dfilter->num_keys >= dfilter->max_keys)
+    warn("[DupFilter] Full, some PCR duplicates may not have been removed");
+
+  ctx_free(stats);
+  ctx_free(wrkrs);
   ctx_free(async_tasks);
 
-  // Copy stats into ginfo
-  size_t max_col = 0;
-  for(f = 0; f < num_files; f++) {
-    max_col = MAX2(max_col, files[f].colour);
-    graph_info_update_stats(&db_graph->ginfo[files[f].colour], &files[f].stats);
+  build_graph_update_ginfo(db_graph, files, num_files);
+}
+
+// Up to MAX_IO_THREADS threads read input files, num_build_threads add reads
+void build_graph(dBGraph *db_graph, BuildGraphTask *files,
+                 size_t num_files, size_t num_build_threads)
+{
+  build_graph_filtered(db_graph, files, num_files, num_build_threads,
+                       NULL, 0, NULL);
+}
+
+//
+// Count kmers before loading (first pass of a build with a minimum count)
+//
+
+typedef struct
+{
+  CountFilter *const cfilter;
+  const size_t kmer_size, min_count;
+  size_t num_passed; // kmers that reached min_count in this thread
+  volatile size_t *const rcounter;
+} CountKmersData;
+
+static void count_read_kmers(const read_t *r, uint8_t qual_cutoff,
+                             uint8_t hp_cutoff, CountKmersData *wrkr)
+{
+  const size_t kmer_size = wrkr->kmer_size;
+  size_t i, contig_start, contig_end, search_start = 0;
+  BinaryKmerIter kiter;
+  BinaryKmer bkey;
+  Orientation orient;
+  uint8_t before, after;
+
+  while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                         qual_cutoff, hp_cutoff)) < r->seq.end)
+  {
+    contig_end = seq_contig_end(r, contig_start, kmer_size,
+                                qual_cutoff, hp_cutoff, &search_start);
+
+    binary_kmer_iter_init(&kiter, r->seq.b+contig_start, kmer_size);
+
+    for(i = contig_start+kmer_size-1; i < contig_end; i++) {
+      binary_kmer_iter_add(&kiter, dna_char_to_nuc(r->seq.b[i]));
+      bkey = binary_kmer_iter_key(&kiter, &orient);
+      count_filter_add_mt(wrkr->cfilter, bkey, &before, &after);
+      wrkr->num_passed += (before < wrkr->min_count && after >= wrkr->min_count);
+    }
   }
+}
 
-  db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used, max_col+1);
+static void count_reads_kmers(AsyncIOData *data, void *ptr)
+{
+  CountKmersData *wrkr = (CountKmersData*)ptr;
+  const BuildGraphTask *task = (const BuildGraphTask*)data->ptr;
+  read_t *r2 = data->r2.name.end == 0 && data->r2.seq.end == 0 ? NULL : &data->r2;
+
+  uint8_t fq_cutoff1 = task->fq_cutoff, fq_cutoff2 = task->fq_cutoff;
+
+  if(task->fq_cutoff) {
+    fq_cutoff1 += data->fq_offset1;
+    fq_cutoff2 += data->fq_offset2;
+  }
+
+  count_read_kmers(&data->r1, fq_cutoff1, task->hp_cutoff, wrkr);
+  if(r2) count_read_kmers(r2, fq_cutoff2, task->hp_cutoff, wrkr);
+
+  // Print progress
+  size_t n = __sync_add_and_fetch(wrkr->rcounter, 1);
+  ctx_update("CountKmers", n);
+}
+
+// Count kmers in the reads of `files` into `cfilter`, using the same quality
+// and homopolymer cutoffs as loading. Input files are read to the end.
+// Returns approx. number of kmers with count >= min_count
+size_t build_graph_count_kmers(CountFilter *cfilter, size_t min_count,
+                               size_t kmer_size, BuildGraphTask *files,
+                               size_t num_files, size_t num_threads)
+{
+  ctx_assert(min_count <= COUNT_FILTER_MAX_COUNT);
+
+  AsyncIOInput *async_tasks = ctx_malloc(num_files * sizeof(AsyncIOInput));
+  CountKmersData *wrkrs = ctx_malloc(num_threads * sizeof(CountKmersData));
+  size_t i, rcounter = 0, num_passed = 0;
+
+  for(i = 0; i < num_files; i++) {
+    files[i].idx = i;
+    files[i].files.ptr = &files[i];
+    memcpy(&async_tasks[i], &files[i].files, sizeof(AsyncIOInput));
+  }
+
+  for(i = 0; i < num_threads; i++) {
+    CountKmersData tmp = {.cfilter = cfilter, .kmer_size = kmer_size,
+                          .min_count = min_count, .num_passed = 0,
+                          .rcounter = &rcounter};
+    memcpy(&wrkrs[i], &tmp, sizeof(CountKmersData));
+  }
+
+  asyncio_run_pool(async_tasks, num_files, count_reads_kmers,
+                   wrkrs, num_threads, sizeof(CountKmersData));
+
+  for(i = 0; i < num_threads; i++) num_passed += wrkrs[i].num_passed;
+
+  ctx_free(wrkrs);
+  ctx_free(async_tasks);
+
+  return num_passed;
+}
+
+//
+// Load reference sequence in kmer-sorted batches
+//
+
+typedef struct
+{
+  dBGraph *const db_graph;
+  LoadingStats *const stats; // one per input file, merged once loaded
+  volatile size_t *const rcounter;
+  const size_t colour;
+  KmerBatch kbatch;
+  // Task of the kmers in kbatch and kbatch.num_novel when it started
+  const BuildGraphTask *task;
+  size_t num_novel_start;
+} RefLoaderData;
+
+static void ref_loader_update_node(hkey_t hkey, void *arg)
+{
+  RefLoaderData *wrkr = (RefLoaderData*)arg;
+  dBNode node = {.key = hkey, .orient = FORWARD};
+  db_graph_update_node_mt(wrkr->db_graph, node, wrkr->colour);
+}
+
+// Insert buffered kmers and count novel kmers against their task
+static void ref_loader_flush(void *arg)
+{
+  RefLoaderData *wrkr = (RefLoaderData*)arg;
+  kmer_batch_flush(&wrkr->kbatch);
+  if(wrkr->task != NULL) {
+    wrkr->stats[wrkr->task->idx].num_kmers_novel += wrkr->kbatch.num_novel -
+                                                    wrkr->num_novel_start;
+  }
+  wrkr->num_novel_start = wrkr->kbatch.num_novel;
+}
+
+static void add_ref_to_graph(AsyncIOData *data, void *ptr)
+{
+  RefLoaderData *wrkr = (RefLoaderData*)ptr;
+  const BuildGraphTask *task = (const BuildGraphTask*)data->ptr;
+  const read_t *r = &data->r1;
+  const size_t kmer_size = wrkr->db_graph->kmer_size;
+  LoadingStats *stats = &wrkr->stats[task->idx];
+  size_t contig_start, contig_end, contig_len, search_start = 0, num_contigs = 0;
+
+  if(task != wrkr->task) {
+    ref_loader_flush(wrkr);
+    wrkr->task = task;
+  }
+
+  stats->total_bases_read += r->seq.end;
+  stats->num_se_reads++;
+
+  while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                         0, 0)) < r->seq.end)
+  {
+    contig_end = seq_contig_end(r, contig_start, kmer_size, 0, 0, &search_start);
+    contig_len = contig_end - contig_start;
+
+    kmer_batch_add_str(&wrkr->kbatch, r->seq.b+contig_start, contig_len);
+
+    stats->total_bases_loaded += contig_len;
+    stats->num_kmers_loaded += contig_len + 1 - kmer_size;
+    num_contigs++;
+  }
+
+  stats->contigs_parsed += num_contigs;
+  stats->num_good_reads += num_contigs > 0;
+  stats->num_bad_reads += num_contigs == 0;
+
+  // Print progress
+  size_t n = __sync_add_and_fetch(wrkr->rcounter, 1);
+  ctx_update("BuildGraph", n);
 }
 
-// One thread used per input file, num_build_threads used to add reads to graph
+// Up to MAX_IO_THREADS threads read input files, num_build_threads add reads
 // Updates ginfo
 void build_graph_from_seq(dBGraph *db_graph,
                           seq_file_t **files, size_t num_files,
                           size_t num_build_threads,
                           size_t colour)
 {
-  size_t i;
+  ctx_assert(db_graph->bktlocks != NULL);
+
+  size_t i, f, rcounter = 0;
+  size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
   BuildGraphTask *tasks = ctx_calloc(num_files, sizeof(BuildGraphTask));
+  AsyncIOInput *async_tasks = ctx_malloc(num_files * sizeof(AsyncIOInput));
 
-  for(i = 0; i < num_files; i++) {
-    AsyncIOInput input = {.file1 = files[i], .file2 = NULL,
-                          .fq_offset = 0, .interleaved = false};
+  for(f = 0; f < num_files; f++) {
+    // Reference sequence only, names and qualities are not needed
+    AsyncIOInput input = {.file1 = files[f], .file2 = NULL,
+                          .fq_offset = 0, .interleaved = false,
+                          .fields = 0, .ptr = &tasks[f]};
 
     BuildGraphTask tmp = {.files = input, .fq_cutoff = 0, .hp_cutoff = 0,
                           .matedir = READPAIR_FR, .colour = colour,
-                          .remove_pcr_dups = false};
+                          .remove_pcr_dups = false, .idx = f};
 
     loading_stats_init(&tmp.stats);
-    memcpy(&tasks[i], &tmp, sizeof(tmp));
+    memcpy(&tasks[f], &tmp, sizeof(tmp));
+    memcpy(&async_tasks[f], &input, sizeof(AsyncIOInput));
   }
 
-  build_graph(db_graph, tasks, num_files, num_build_threads);
+  RefLoaderData *wrkrs = ctx_malloc(num_build_threads * sizeof(RefLoaderData));
+  LoadingStats *stats = ctx_malloc(num_build_threads * num_files * sizeof(LoadingStats));
+
+  for(i = 0; i < num_build_threads * num_files; i++)
+    loading_stats_init(&stats[i]);
+
+  for(i = 0; i < num_build_threads; i++) {
+    RefLoaderData tmp = {.db_graph = db_graph,
+                         .stats = stats + i * num_files,
+                         .rcounter = &rcounter,
+                         .colour = colour,
+                         .task = NULL, .num_novel_start = 0};
+    memcpy(&wrkrs[i], &tmp, sizeof(RefLoaderData));
+    kmer_batch_alloc(&wrkrs[i].kbatch, KMER_BATCH_SIZE, edge_col,
+                     ref_loader_update_node, &wrkrs[i], db_graph);
+  }
+
+  asyncio_run_pool(async_tasks, num_files, add_ref_to_graph,
+                   wrkrs, num_build_threads, sizeof(RefLoaderData));
+
+  // Insert the last batch of each thread
+  util_run_threads(wrkrs, num_build_threads, sizeof(RefLoaderData),
+                   num_build_threads, ref_loader_flush);
 
+  for(i = 0; i < num_build_threads; i++) {
+    kmer_batch_dealloc(&wrkrs[i].kbatch);
+    for(f = 0; f < num_files; f++)
+      loading_stats_merge(&tasks[f].stats, &wrkrs[i].stats[f]);
+  }
+
+  build_graph_update_ginfo(db_graph, tasks, num_files);
+
+  ctx_free(stats);
+  ctx_free(wrkrs);
+  ctx_free(async_tasks);
   ctx_free(tasks);
 }
 
@@ -14,6 +14,8 @@
 #include "seq_reader.h"
 #include "async_read_io.h"
 #include "loading_stats.h"
+#include "count_filter.h"
+#include "dup_filter.h"
 
 typedef struct
 {
@@ -48,20 +50,40 @@ void build_graph_task_print(const BuildGraphTask *task);
 void build_graph_task_print_stats(const BuildGraphTask *task);
 
 // Threadsafe graph construction
+// `stats` is updated without locking so must not be shared between threads
+// PCR duplicates are removed if `dfilter` is not NULL
 // Beware: this function does not update ginfo
 void build_graph_from_reads_mt(read_t *r1, read_t *r2,
                                uint8_t fq_offset1, uint8_t fq_offset2,
                                uint8_t fq_cutoff, uint8_t hp_cutoff,
-                               bool remove_pcr_dups, ReadMateDir matedir,
+                               DupFilter *dfilter, ReadMateDir matedir,
                                LoadingStats *stats, size_t colour,
                                dBGraph *db_graph);
 
-// One thread used per input file, num_build_threads used to add reads to graph
-// Updates ginfo
+// Up to MAX_IO_THREADS threads read input files, num_build_threads add reads
+// Updates ginfo. Tasks must not use remove_pcr_dups.
 void build_graph(dBGraph *db_graph, BuildGraphTask *files,
                  size_t num_files, size_t num_build_threads);
 
-// One thread used per input file, num_build_threads used to add reads to graph
+// As build_graph() but only loads kmers with count >= min_count in `cfilter`
+// (if not NULL). Tasks with remove_pcr_dups are checked against `dfilter`.
+void build_graph_filtered(dBGraph *db_graph, BuildGraphTask *files,
+                          size_t num_files, size_t num_build_threads,
+                          const CountFilter *cfilter, size_t min_count,
+                          DupFilter *dfilter);
+
+// First pass of a build with a minimum kmer count.
+// Count kmers in the reads of `files` into `cfilter`, using the same quality
+// and homopolymer cutoffs as loading. Input files are read to the end.
+// Returns approx. number of kmers with count >= min_count
+size_t build_graph_count_kmers(CountFilter *cfilter, size_t min_count,
+                               size_t kmer_size, BuildGraphTask *files,
+                               size_t num_files, size_t num_threads);
+
+// Load reference sequence (e.g. chromosomes): kmers are inserted in batches
+// sorted by hash bucket (see kmer_batch.h), using an extra
+// kmer_batch_mem(KMER_BATCH_SIZE) bytes per build thread.
+// Up to MAX_IO_THREADS threads read input files, num_build_threads add reads
 // Updates ginfo
 void build_graph_from_seq(dBGraph *db_graph, seq_file_t **files,
                           size_t num_files, size_t num_build_threads,
@@ -343,10 +343,15 @@ void correct_reads(CorrectAlnInput *inputs, size_t num_inputs,
 
   CorrectReadsWorker *wrkrs = ctx_calloc(num_threads, sizeof(CorrectReadsWorker));
 
+  // Gaps filled are shared between workers
+  GapMemo gap_memo;
+  gap_memo_alloc(&gap_memo, GAP_MEMO_DEFAULT_MEM);
+
   for(i = 0; i < num_threads; i++) {
     correct_reads_worker_alloc(&wrkrs[i], &read_counter,
                                fq_zero, append_orig_seq,
                                db_graph);
+    wrkrs[i].corrector.gap_memo = &gap_memo;
   }
 
   AsyncIOInput *asyncio_tasks = ctx_calloc(num_inputs, sizeof(AsyncIOInput));
@@ -371,6 +376,9 @@ void correct_reads(CorrectAlnInput *inputs, size_t num_inputs,
                          dump_fraglen_hist_path,
                          db_graph->ht.num_kmers);
 
+  gap_memo_print_stats(&gap_memo);
+  gap_memo_dealloc(&gap_memo);
+
   for(i = 0; i < num_threads; i++)
     correct_reads_worker_dealloc(&wrkrs[i]);
 
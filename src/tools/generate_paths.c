@@ -1,6 +1,7 @@
 #include "global.h"
 
 #include <pthread.h>
+#include <sys/time.h> // gettimeofday()
 #include "msg-pool/msgpool.h" // pool for getting jobs
 
 #include "generate_paths.h"
@@ -9,6 +10,7 @@
 #include "db_graph.h"
 #include "db_node.h"
 #include "db_alignment.h"
+#include "kmer_batch.h"
 #include "correct_alignment.h"
 #include "async_read_io.h"
 #include "seq_reader.h"
@@ -22,6 +24,24 @@
 
 // #define CTXVERBOSE 1
 
+// Reads are processed in batches, one stage at a time:
+//  1. align all reads to the graph: kmers of the whole batch are looked up
+//     together, sorted by hash table bucket (see kmer_batch.h)
+//  2. gap-fill each alignment into contigs
+//  3. find junctions in each contig and add links
+#define GEN_PATHS_BATCH 64
+
+enum GenPathStage { GENPATH_LOOKUP, GENPATH_GAPFILL, GENPATH_LINKS };
+#define GENPATH_NUM_STAGES 3
+
+typedef struct
+{
+  AsyncIOData store; // reads swapped in from the pool
+  AsyncIOData *data; // &store or caller's data
+  CorrectAlnInput task;
+  dBAlignment aln;
+} GenPathRead;
+
 struct GenPathWorker
 {
   pthread_t thread;
@@ -37,6 +57,21 @@ struct GenPathWorker
 
   CorrectAlnWorker corrector;
 
+  // Batch of reads
+  GenPathRead *batch;
+  size_t batch_len;
+  KmerLookup lookup; // kmers of the batch
+
+  // Gap-filled contigs from the batch, contig i is from read contig_read[i]
+  dBNodeBuffer contigs;
+  SizeBuffer contig_lens, contig_read;
+
+  // Time spent in each stage (seconds)
+  double stage_time[GENPATH_NUM_STAGES];
+
+  // Path hash lookups by this thread, merged in generate_paths()
+  GPathHashStats gphash_stats;
+
   // Nucleotides and positions of junctions
   // only one array allocated for each type, rev points to half way through
   uint8_t *pck_fw, *pck_rv;
@@ -59,6 +94,10 @@ size_t gen_paths_worker_est_mem(const dBGraph *db_graph)
   junc_mem = 2 * INIT_BUFLEN * (sizeof(Nucleotide)+sizeof(size_t));
   packed_mem = INIT_BUFLEN;
 
+  job_mem = GEN_PATHS_BATCH * (job_mem + db_alignment_est_mem() +
+                               INIT_BUFLEN * 2 * sizeof(KmerLookupEntry)) +
+            INIT_BUFLEN * (sizeof(dBNode) + 2*sizeof(size_t));
+
   return job_mem + corrector_mem + junc_mem + packed_mem + sizeof(GenPathWorker);
 }
 
@@ -81,11 +120,34 @@ static void _gen_paths_worker_alloc(GenPathWorker *wrkr, dBGraph *db_graph)
   tmp.pos_rv = tmp.pos_fw + tmp.junc_arrsize;
   tmp.num_fw = tmp.num_rv = 0;
 
+  // Batch
+  size_t i;
+  tmp.batch = ctx_calloc(GEN_PATHS_BATCH, sizeof(GenPathRead));
+  for(i = 0; i < GEN_PATHS_BATCH; i++) {
+    asynciodata_alloc(&tmp.batch[i].store);
+    db_alignment_alloc(&tmp.batch[i].aln);
+  }
+  kmer_lookup_alloc(&tmp.lookup, GEN_PATHS_BATCH * INIT_BUFLEN, db_graph);
+  db_node_buf_alloc(&tmp.contigs, INIT_BUFLEN);
+  size_buf_alloc(&tmp.contig_lens, INIT_BUFLEN);
+  size_buf_alloc(&tmp.contig_read, INIT_BUFLEN);
+
   memcpy(wrkr, &tmp, sizeof(GenPathWorker));
 }
 
 static void _gen_paths_worker_dealloc(GenPathWorker *wrkr)
 {
+  size_t i;
+  for(i = 0; i < GEN_PATHS_BATCH; i++) {
+    asynciodata_dealloc(&wrkr->batch[i].store);
+    db_alignment_dealloc(&wrkr->batch[i].aln);
+  }
+  ctx_free(wrkr->batch);
+  kmer_lookup_dealloc(&wrkr->lookup);
+  db_node_buf_dealloc(&wrkr->contigs);
+  size_buf_dealloc(&wrkr->contig_lens);
+  size_buf_dealloc(&wrkr->contig_read);
+
   correct_aln_worker_dealloc(&wrkr->corrector);
   ctx_free(wrkr->pck_fw);
   ctx_free(wrkr->pos_fw);
@@ -101,6 +163,13 @@ GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph)
   return workers;
 }
 
+void gen_paths_workers_set_gap_memo(GenPathWorker *workers, size_t n,
+                                    GapMemo *gap_memo)
+{
+  size_t i;
+  for(i = 0; i < n; i++) workers[i].corrector.gap_memo = gap_memo;
+}
+
 void gen_paths_workers_dealloc(GenPathWorker *workers, size_t n)
 {
   size_t i;
@@ -259,7 +328,8 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
     // #endif
 
     GPath *gpath = gpath_hash_find_or_insert_mt(&db_graph->gphash, node.key,
-                                                newgpath, &found);
+                                                newgpath, &found,
+                                                &wrkr->gphash_stats);
 
     // Add colour
     bitset_set(gpath_get_colset(gpath, gpset->ncols), ctpcol);
@@ -389,10 +459,18 @@ static void worker_contig_to_junctions(GenPathWorker *wrkr,
     worker_junctions_to_paths(wrkr, nodes, num_nodes);
 }
 
-// wrkr->data and wrkr->task must be set before calling this functions
-static void reads_to_paths(GenPathWorker *wrkr)
+static inline double _gen_paths_secs_since(const struct timeval *start)
 {
-  AsyncIOData *data = wrkr->data;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+// Stage 1: queue the kmers of a read (pair), the alignment in `rd` is
+// finished once the batch has been looked up
+static void read_to_alignment(GenPathWorker *wrkr, GenPathRead *rd)
+{
+  AsyncIOData *data = rd->data;
   read_t *r1 = &data->r1, *r2 = data->r2.seq.end > 0 ? &data->r2 : NULL;
 
   if(gen_paths_print_reads) {
@@ -403,54 +481,134 @@ static void reads_to_paths(GenPathWorker *wrkr)
   }
 
   uint8_t fq_cutoff1, fq_cutoff2;
-  fq_cutoff1 = fq_cutoff2 = wrkr->task.fq_cutoff;
+  fq_cutoff1 = fq_cutoff2 = rd->task.fq_cutoff;
 
   if(fq_cutoff1 > 0) {
     fq_cutoff1 += data->fq_offset1;
     fq_cutoff2 += data->fq_offset2;
   }
 
-  uint8_t hp_cutoff = wrkr->task.hp_cutoff;
+  uint8_t hp_cutoff = rd->task.hp_cutoff;
 
   // Second read is in reverse orientation - need in forward
   if(r2 != NULL)
-    seq_reader_orient_mp_FF_or_RR(r1, r2, wrkr->task.matedir);
+    seq_reader_orient_mp_FF_or_RR(r1, r2, rd->task.matedir);
 
-  correct_alignment_init(&wrkr->corrector, &wrkr->task.crt_params,
-                         r1, r2, fq_cutoff1, fq_cutoff2, hp_cutoff);
+  db_alignment_queue_reads(&rd->aln, r1, r2,
+                           fq_cutoff1, fq_cutoff2, hp_cutoff,
+                           wrkr->db_graph, rd->task.crt_params.ctxcol,
+                           &wrkr->lookup);
+}
+
+// Stage 2: gap-fill an alignment, appending contigs to wrkr->contigs
+static void alignment_to_contigs(GenPathWorker *wrkr, size_t readidx)
+{
+  GenPathRead *rd = &wrkr->batch[readidx];
 
   // ctx_check2(db_alignment_check_edges(&wrkr->corrector.aln, wrkr->db_graph),
   //            "Edges missing: was read %s%s%s used to build the graph?",
   //            r1->name.b, r2 ? ", " : "", r2 ? r2->name.b : "");
 
+  // Swap alignment into the corrector (buffers swapped back after)
+  SWAP(wrkr->corrector.aln, rd->aln);
+  correct_alignment_init_aln(&wrkr->corrector, &rd->task.crt_params);
+
   dBNodeBuffer *nbuf;
   while((nbuf = correct_alignment_nxt(&wrkr->corrector)) != NULL)
   {
-    worker_contig_to_junctions(wrkr, nbuf->b, nbuf->len);
+    db_node_buf_push(&wrkr->contigs, nbuf->b, nbuf->len);
+    size_buf_add(&wrkr->contig_lens, nbuf->len);
+    size_buf_add(&wrkr->contig_read, readidx);
+  }
+
+  SWAP(wrkr->corrector.aln, rd->aln);
+}
+
+// Run the batch of reads in wrkr->batch[0..batch_len-1] through each stage
+static void gen_paths_run_batch(GenPathWorker *wrkr)
+{
+  size_t i, offset = 0;
+  struct timeval start;
+  GenPathRead *rd;
+
+  db_node_buf_reset(&wrkr->contigs);
+  size_buf_reset(&wrkr->contig_lens);
+  size_buf_reset(&wrkr->contig_read);
+
+  gettimeofday(&start, NULL);
+  for(i = 0; i < wrkr->batch_len; i++)
+    read_to_alignment(wrkr, &wrkr->batch[i]);
+  kmer_lookup_flush(&wrkr->lookup);
+  for(i = 0; i < wrkr->batch_len; i++)
+    db_alignment_finish(&wrkr->batch[i].aln, wrkr->db_graph);
+  wrkr->stage_time[GENPATH_LOOKUP] += _gen_paths_secs_since(&start);
+
+  gettimeofday(&start, NULL);
+  for(i = 0; i < wrkr->batch_len; i++)
+    alignment_to_contigs(wrkr, i);
+  wrkr->stage_time[GENPATH_GAPFILL] += _gen_paths_secs_since(&start);
+
+  gettimeofday(&start, NULL);
+  for(i = 0; i < wrkr->contig_lens.len; i++) {
+    rd = &wrkr->batch[wrkr->contig_read.b[i]];
+    wrkr->data = rd->data;
+    memcpy(&wrkr->task, &rd->task, sizeof(CorrectAlnInput));
+    worker_contig_to_junctions(wrkr, wrkr->contigs.b+offset,
+                               wrkr->contig_lens.b[i]);
+    offset += wrkr->contig_lens.b[i];
   }
+  wrkr->stage_time[GENPATH_LINKS] += _gen_paths_secs_since(&start);
+
+  wrkr->batch_len = 0;
 }
 
 // pthread method, loop: grabs job, does processing
 static void generate_paths_worker(AsyncIOData *data, void *ptr)
 {
   GenPathWorker *wrkr = (GenPathWorker*)ptr;
-  wrkr->data = data;
-  memcpy(&wrkr->task, data->ptr, sizeof(CorrectAlnInput));
-  reads_to_paths(wrkr);
+  GenPathRead *rd = &wrkr->batch[wrkr->batch_len++];
+
+  // Take reads from the pool, leaving our empty buffers in their place
+  SWAP(rd->store.r1, data->r1);
+  SWAP(rd->store.r2, data->r2);
+  rd->store.ptr = data->ptr;
+  rd->store.fq_offset1 = data->fq_offset1;
+  rd->store.fq_offset2 = data->fq_offset2;
+  rd->data = &rd->store;
+  memcpy(&rd->task, data->ptr, sizeof(CorrectAlnInput));
+
+  if(wrkr->batch_len == GEN_PATHS_BATCH) {
+    gen_paths_run_batch(wrkr);
+
+    // Print progress, if we passed a multiple of CTX_UPDATE_REPORT_RATE
+    size_t n = __sync_add_and_fetch(wrkr->rcounter, GEN_PATHS_BATCH);
+    if(n / CTX_UPDATE_REPORT_RATE > (n-GEN_PATHS_BATCH) / CTX_UPDATE_REPORT_RATE)
+      ctx_update("GenPaths", n - n % CTX_UPDATE_REPORT_RATE);
+  }
+}
 
-  // Print progress
-  size_t n = __sync_add_and_fetch(wrkr->rcounter, 1);
-  ctx_update("GenPaths", n);
+// Run remaining reads after the pool has closed
+static void generate_paths_flush(void *ptr)
+{
+  GenPathWorker *wrkr = (GenPathWorker*)ptr;
+  size_t n = wrkr->batch_len;
+  if(n > 0) {
+    gen_paths_run_batch(wrkr);
+    __sync_add_and_fetch(wrkr->rcounter, n);
+  }
 }
 
 void gen_paths_worker_seq(GenPathWorker *wrkr, AsyncIOData *data,
                           const CorrectAlnInput *task)
 {
-  // Copy task to worker
-  wrkr->data = data;
-  memcpy(&wrkr->task, task, sizeof(CorrectAlnInput));
+  ctx_assert(wrkr->batch_len == 0);
 
-  reads_to_paths(wrkr);
+  // Batch of one read, using the caller's data
+  GenPathRead *rd = &wrkr->batch[wrkr->batch_len++];
+  rd->data = data;
+  memcpy(&rd->task, task, sizeof(CorrectAlnInput));
+
+  gen_paths_run_batch(wrkr);
 }
 
 // Function used in tests
@@ -496,9 +654,38 @@ void generate_paths(CorrectAlnInput *tasks, size_t num_inputs,
   asyncio_run_pool(asyncio_tasks, num_inputs, generate_paths_worker,
                    workers, num_workers, sizeof(GenPathWorker));
 
+  util_run_threads(workers, num_workers, sizeof(GenPathWorker),
+                   num_workers, generate_paths_flush);
+
   ctx_free(asyncio_tasks);
 
   // Merge stats into workers[0]
   for(i = 1; i < num_workers; i++)
     correct_aln_merge_stats(&workers[0].corrector, &workers[i].corrector);
+
+  // Merge path hash stats into the hash, workers may be run again
+  GPathHash *gphash = &workers[0].db_graph->gphash;
+  for(i = 0; i < num_workers; i++) {
+    gpath_hash_stats_merge(&gphash->stats, &workers[i].gphash_stats);
+    memset(&workers[i].gphash_stats, 0, sizeof(GPathHashStats));
+  }
+}
+
+void gen_paths_print_stage_times(const GenPathWorker *workers, size_t n)
+{
+  double t[GENPATH_NUM_STAGES] = {0}, total;
+  size_t i, j;
+
+  for(i = 0; i < n; i++)
+    for(j = 0; j < GENPATH_NUM_STAGES; j++)
+      t[j] += workers[i].stage_time[j];
+
+  total = t[GENPATH_LOOKUP] + t[GENPATH_GAPFILL] + t[GENPATH_LINKS];
+  if(total == 0) total = 1; // avoid divide by zero
+
+  status("[GenPaths] Thread time: kmer lookup %.2fs [%.1f%%] "
+         "gap filling %.2fs [%.1f%%] links %.2fs [%.1f%%]",
+         t[GENPATH_LOOKUP],  100.0 * t[GENPATH_LOOKUP]  / total,
+         t[GENPATH_GAPFILL], 100.0 * t[GENPATH_GAPFILL] / total,
+         t[GENPATH_LINKS],   100.0 * t[GENPATH_LINKS]   / total);
 }
@@ -7,6 +7,7 @@
 #include "db_graph.h"
 #include "loading_stats.h"
 #include "correct_aln_input.h"
+#include "gap_memo.h"
 
 typedef struct GenPathWorker GenPathWorker;
 
@@ -15,6 +16,10 @@ size_t gen_paths_worker_est_mem(const dBGraph *db_graph);
 
 GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph);
 
+// Share filled gaps between workers, pass NULL to stop using a memo
+void gen_paths_workers_set_gap_memo(GenPathWorker *workers, size_t n,
+                                    GapMemo *gap_memo);
+
 void gen_paths_workers_dealloc(GenPathWorker *mem, size_t n);
 
 // Add a single contig using a given worker
@@ -29,6 +34,9 @@ void gen_paths_from_str_mt(GenPathWorker *gen_path_wrkr, char *seq,
 void generate_paths(CorrectAlnInput *tasks, size_t num_tasks,
                     GenPathWorker *workers, size_t num_workers);
 
+// Print time spent in each stage, summed over threads
+void gen_paths_print_stage_times(const GenPathWorker *workers, size_t n);
+
 CorrectAlnStats* gen_paths_get_aln_stats(GenPathWorker *wrkr);
 LoadingStats* gen_paths_get_stats(GenPathWorker *wrkr);;
 
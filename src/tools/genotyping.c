@@ -3,14 +3,12 @@
 
 void genotyper_alloc(Genotyper *typer)
 {
-  strbuf_alloc(&typer->seq, 1024);
   typer->h = kh_init(BkToBits);
   genokmer_buf_alloc(&typer->kmer_buf, 512);
 }
 
 void genotyper_dealloc(Genotyper *typer)
 {
-  strbuf_dealloc(&typer->seq);
   kh_destroy(BkToBits, typer->h);
   genokmer_buf_dealloc(&typer->kmer_buf);
   memset(typer, 0, sizeof(*typer));
@@ -30,52 +28,108 @@ void genovars_sort(GenoVar *vars, size_t nvars)
   qsort(vars, nvars, sizeof(vars[0]), genovar_cmp);
 }
 
-static bool vars_compatible(const GenoVar *vars, size_t nvars, uint64_t bits)
+//
+// Kmers are generated by walking the haplotypes that pass through each kmer
+// window, instead of assembling every combination of variants. A walk starts
+// at a ref base or inside an alt allele, and at each ref position either
+// takes the ref base or one of the variants starting there, until it has
+// kmer_size bases. Only compatible variants can be chosen, so incompatible
+// combinations are never visited. Windows with no variants are rolled along
+// the reference.
+//
+// A walk fixes the variants it chose (cmask) and those it passed over or whose
+// ref allele it covers (umask). Other targets are free to be ref or alt, unless
+// they overlap a chosen variant.
+//
+
+typedef struct
 {
-  ctx_assert(nvars < 64);
-  size_t i, end = 0;
-  uint64_t b;
-  for(i = 0, b = 1; i < nvars; i++, b<<=1) {
-    if(bits & b) {
-      if(vars[i].pos < end) return false;
-      end = vars[i].pos + vars[i].reflen;
-    }
+  const GenoVar *vars;
+  size_t nvars, tgtidx, ntgts;
+  const char *chrom;
+  size_t regend, kmer_size;
+  uint64_t incompat[32]; // variants overlapping each target
+  khash_t(BkToBits) *h;
+} GenoWalk;
+
+#define genovar_end(v) ((v)->pos + (v)->reflen)
+
+static inline void geno_walk_add(const GenoWalk *w, const BinaryKmerIter *kiter,
+                                 uint64_t altref_bits)
+{
+  int hret;
+  Orientation orient;
+  BinaryKmer bkey = binary_kmer_iter_key(kiter, &orient);
+  khiter_t k = kh_put(BkToBits, w->h, bkey, &hret);
+  if(hret < 0) die("khash table failed: out of memory?");
+  if(hret > 0) kh_value(w->h, k) = 0; // initialise if not already in table
+  kh_value(w->h, k) |= altref_bits;
+}
+
+//                 arararararar r=ref, a=alt
+// var:  543210    554433221100
+// tgt:  aa-r-a -> 101011110110  (- = either)
+static inline uint64_t geno_walk_altref_bits(const GenoWalk *w,
+                                             uint64_t cmask, uint64_t umask)
+{
+  uint64_t i, b, r = 0;
+  for(i = 0; i < w->ntgts; i++) {
+    b = 1UL << (w->tgtidx + i);
+    if(cmask & b) r |= 2UL << (i*2);
+    else if((umask & b) || (w->incompat[i] & cmask)) r |= 1UL << (i*2);
+    else r |= 3UL << (i*2);
   }
-  return true;
+  return r;
 }
 
-static inline void assemble_haplotype(StrBuf *seq, const char *chrom,
-                                      size_t regstart, size_t regend,
-                                      const GenoVar *vars, size_t nvars,
-                                      uint64_t bits)
+static void geno_walk_allele(const GenoWalk *w, size_t vidx, size_t offset,
+                             size_t nbases, BinaryKmerIter kiter,
+                             uint64_t cmask, uint64_t umask);
+
+// At ref position `pos`, having emitted `nbases` bases
+// Variants before `vidx` can no longer be chosen
+static void geno_walk_ref(const GenoWalk *w, size_t pos, size_t vidx,
+                          size_t nbases, BinaryKmerIter kiter,
+                          uint64_t cmask, uint64_t umask)
 {
-  strbuf_reset(seq);
-  uint64_t i, end = regstart;
-
-  for(i = 0; i < nvars; i++, bits>>=1) {
-    if(bits & 1) {
-      ctx_assert(end >= vars[i].pos);
-      strbuf_append_strn(seq, chrom+end, vars[i].pos-end);
-      strbuf_append_strn(seq, vars[i].alt, vars[i].altlen);
-      end = vars[i].pos + vars[i].reflen;
-    }
+  const GenoVar *vars = w->vars;
+  uint64_t passed = 0;
+  size_t i;
+
+  if(nbases == w->kmer_size) {
+    geno_walk_add(w, &kiter, geno_walk_altref_bits(w, cmask, umask));
+    return;
+  }
+
+  // Skip variants that overlap those already chosen
+  while(vidx < w->nvars && vars[vidx].pos < pos) vidx++;
+
+  // Take one of the variants starting here, passing over those before it
+  for(i = vidx; i < w->nvars && vars[i].pos == pos; i++) {
+    geno_walk_allele(w, i, 0, nbases, kiter,
+                     cmask | (1UL << i), umask | passed);
+    passed |= 1UL << i;
+  }
+
+  // Take the ref base, passing over all variants starting here
+  if(pos < w->regend) {
+    binary_kmer_iter_add(&kiter, dna_char_to_nuc(w->chrom[pos]));
+    geno_walk_ref(w, pos+1, i, nbases+1, kiter, cmask, umask | passed);
   }
-  strbuf_append_strn(seq, chrom+end, regend-end);
 }
 
-//                 arararararar r=ref, a=alt
-// var:  543210    554433221100
-// bits: 010110 -> 011001101001
-static inline uint64_t varbits_to_altrefbits(uint64_t bits,
-                                             size_t tgtidx,
-                                             size_t ntgts)
+// Emit alt allele of vars[vidx] from `offset`, then carry on along the ref
+static void geno_walk_allele(const GenoWalk *w, size_t vidx, size_t offset,
+                             size_t nbases, BinaryKmerIter kiter,
+                             uint64_t cmask, uint64_t umask)
 {
-  ctx_assert(ntgts <= 32);
-  uint64_t i, r = 0;
-  bits >>= tgtidx;
-  for(i = 0; i < ntgts; i++, bits>>=1)
-    r |= 1UL << (i*2 + (bits&1));
-  return r;
+  const GenoVar *var = &w->vars[vidx];
+
+  for(; offset < var->altlen && nbases < w->kmer_size; offset++, nbases++) {
+    binary_kmer_iter_add(&kiter, dna_char_to_nuc(var->alt[offset]));
+  }
+
+  geno_walk_ref(w, genovar_end(var), vidx+1, nbases, kiter, cmask, umask);
 }
 
 /**
@@ -93,63 +147,101 @@ void genotyping_get_covg(Genotyper *typer,
   ctx_assert(nvars > 0);
   ctx_assert(tgtidx < nvars);
   ctx_assert(ntgts <= 32);
+  ctx_assert(tgtidx + ntgts <= nvars);
 
   GenoKmerBuffer *gkbuf = &typer->kmer_buf;
   genokmer_buf_reset(gkbuf);
 
   const GenoVar *tgt = &vars[tgtidx];
 
-  // const size_t kmer_size = db_graph->kmer_size;
-  long minpos = MIN2(vars[0].pos, tgt->pos - kmer_size + 1);
-  size_t i, regstart, regend;
+  long minpos = MIN2((long)vars[0].pos, (long)tgt->pos - (long)kmer_size + 1);
+  size_t i, j, regstart, regend;
 
   regstart = MAX2(minpos, 0);
   regend = regstart;
-  for(i = 0; i < nvars; i++) regend = MAX2(regend, vars[i].pos + vars[i].reflen);
+  for(i = 0; i < nvars; i++) regend = MAX2(regend, genovar_end(&vars[i]));
   ctx_assert(regend <= chromlen);
-  regend = MAX2(regend, tgt->pos + tgt->reflen + kmer_size - 1);
+  regend = MAX2(regend, genovar_end(tgt) + kmer_size - 1);
   regend = MIN2(regend, chromlen);
 
-  StrBuf *seq = &typer->seq;
-  khash_t(BkToBits) *h = typer->h;
-  BinaryKmer bkey;
-  int hret;
-  khiter_t k;
+  GenoWalk w = {.vars = vars, .nvars = nvars,
+                .tgtidx = tgtidx, .ntgts = ntgts,
+                .chrom = chrom, .regend = regend, .kmer_size = kmer_size,
+                .h = typer->h};
+
+  // Variants that cannot be in a haplotype with each target
+  for(i = 0; i < ntgts; i++) {
+    w.incompat[i] = 0;
+    for(j = 0; j < nvars; j++) {
+      if(j < tgtidx+i ? genovar_end(&vars[j]) > tgt[i].pos
+                      : vars[j].pos < genovar_end(&tgt[i])) {
+        w.incompat[i] |= 1UL << j;
+      }
+    }
+    w.incompat[i] &= ~(1UL << (tgtidx+i));
+  }
 
+  khash_t(BkToBits) *h = typer->h;
   kh_clear(BkToBits, h);
 
-  // Start with ref haplotype (no variants)
-  uint64_t bits = 0, limit = 1UL<<nvars, altref_bits;
-
-  for(; bits < limit; bits++) {
-    if(vars_compatible(vars, nvars, bits)) {
-      // Construct haplotype
-      assemble_haplotype(seq, chrom, regstart, regend,
-                         vars, nvars, bits);
-
-      altref_bits = varbits_to_altrefbits(bits, tgtidx, ntgts);
-
-      // Covert to kmers, find/add them to the hash table, OR bits
-      for(i = 0; i + kmer_size <= seq->end; i++) {
-        bkey = binary_kmer_from_str(seq->b+i, kmer_size);
-        bkey = binary_kmer_get_key(bkey, kmer_size);
-        k = kh_put(BkToBits, h, bkey, &hret);
-        if(hret < 0) die("khash table failed: out of memory?");
-        if(hret > 0) kh_value(h, k) = 0; // initialise if not already in table
-        kh_value(h, k) |= altref_bits;
+  // Kmers that start in an alt allele
+  // Kmers are only used once all kmer_size bases have been added
+  BinaryKmerIter kiter, first;
+  binary_kmer_iter_init_bkmer(&kiter, zero_bkmer, kmer_size);
+  for(i = 0; i < nvars; i++) {
+    for(j = 0; j < vars[i].altlen; j++)
+      geno_walk_allele(&w, i, j, 0, kiter, 1UL << i, 0);
+  }
+
+  // Kmers that start at a ref base
+  // Kmers not overlapping a variant are in all haplotypes, so are rolled along
+  // the reference
+  const uint64_t all_bits = ntgts == 32 ? UINT64_MAX : (1UL << (2*ntgts)) - 1;
+  size_t kstart, kend, rpos = regstart, next = 0, maxend = 0;
+  uint64_t umask;
+
+  for(kstart = regstart; kstart < regend; kstart++)
+  {
+    kend = kstart + kmer_size - 1;
+
+    // next is the first variant starting after kstart
+    // maxend is the furthest end of variants starting at or before kstart
+    for(; next < nvars && vars[next].pos <= kstart; next++)
+      maxend = MAX2(maxend, genovar_end(&vars[next]));
+
+    if(kend < regend && maxend <= kstart &&
+       (next == nvars || vars[next].pos > kend))
+    {
+      for(rpos = MAX2(rpos, kstart); rpos <= kend; rpos++) {
+        binary_kmer_iter_add(&kiter, dna_char_to_nuc(chrom[rpos]));
       }
+      geno_walk_add(&w, &kiter, all_bits);
+    }
+    else
+    {
+      // Variants whose ref allele covers the first base cannot be chosen
+      for(umask = 0, i = 0; i < next; i++)
+        if(genovar_end(&vars[i]) > kstart) umask |= 1UL << i;
+
+      binary_kmer_iter_init_bkmer(&first, zero_bkmer, kmer_size);
+      binary_kmer_iter_add(&first, dna_char_to_nuc(chrom[kstart]));
+      geno_walk_ref(&w, kstart+1, next, 1, first, 0, umask);
     }
   }
 
   size_t nkmers = kh_size(h);
   genokmer_buf_capacity(gkbuf, nkmers);
 
+  khiter_t k;
+  BinaryKmer bkmer;
+  uint64_t altref_bits;
+
   for(i = 0, k = kh_begin(h); k != kh_end(h); ++k) {
     if(kh_exist(h, k)) {
-      bkey = kh_key(h, k);
+      bkmer = kh_key(h, k);
       altref_bits = kh_value(h, k);
       if(genotyping_refalt_uniq(altref_bits)) {
-        gkbuf->b[i++] = (GenoKmer){.bkey = bkey, .arbits = altref_bits};
+        gkbuf->b[i++] = (GenoKmer){.bkey = bkmer, .arbits = altref_bits};
       }
     }
   }
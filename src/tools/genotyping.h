@@ -11,6 +11,7 @@ KHASH_INIT(BkToBits, BinaryKmer, uint64_t, 1, bk2bits_hash, bk2bits_eq);
 typedef struct {
   const char *ref, *alt;
   size_t pos, reflen, altlen;
+  uint32_t vcfrec, altidx; // source VCF record and ALT allele
 
   // Covg
   size_t refkmers, refsumcovg;
@@ -25,11 +26,10 @@ typedef struct {
 #include "madcrowlib/madcrow_buffer.h"
 #include "madcrowlib/madcrow_list.h"
 madcrow_buffer(genokmer_buf, GenoKmerBuffer, GenoKmer);
-// madcrow_buffer(genovar_buf,  GenoVarBuffer,  GenoVar);
+madcrow_buffer(genovar_buf,  GenoVarBuffer,  GenoVar);
 madcrow_list(  genovar_list, GenoVarList,  GenoVar);
 
 typedef struct {
-  StrBuf seq;
   khash_t(BkToBits) *h;
   GenoKmerBuffer kmer_buf;
 } Genotyper;
@@ -0,0 +1,472 @@
+#include "global.h"
+#include "graph_partition.h"
+#include "db_node.h"
+#include "graph_format.h"
+#include "seq_reader.h"
+#include "async_read_io.h"
+#include "common_buffers.h"
+#include "util.h"
+#include "file_util.h"
+
+// Super-kmer record: colour, length, base before, base after (0 if none), seq
+#define PART_REC_HDR (2*sizeof(uint32_t) + 2)
+
+// Most records that can start in one chunk
+#define part_chunk_max_records(kmer_size) \
+        (GRAPH_PART_CHUNK_SIZE / (PART_REC_HDR + (kmer_size)) + 1)
+
+size_t graph_partitions_mem(size_t num_parts, size_t kmer_size,
+                            size_t num_threads)
+{
+  size_t write_mem = num_parts * num_threads * GRAPH_PART_BUF_SIZE;
+  size_t build_mem = GRAPH_PART_CHUNK_SIZE +
+                     part_chunk_max_records(kmer_size) * sizeof(size_t);
+  return MAX2(write_mem, build_mem);
+}
+
+void graph_partitions_alloc(GraphPartitions *gp, const char *path_prefix,
+                            size_t num_parts, size_t kmer_size)
+{
+  ctx_assert(num_parts > 0);
+
+  char **paths = ctx_calloc(num_parts, sizeof(char*));
+  FILE **files = ctx_calloc(num_parts, sizeof(FILE*));
+  pthread_mutex_t *locks = ctx_calloc(num_parts, sizeof(pthread_mutex_t));
+  size_t i, pathlen = strlen(path_prefix) + 30;
+
+  for(i = 0; i < num_parts; i++) {
+    paths[i] = ctx_malloc(pathlen);
+    sprintf(paths[i], "%s.part%zu", path_prefix, i);
+    files[i] = futil_fopen_create(paths[i], "w+");
+    if(pthread_mutex_init(&locks[i], NULL) != 0) die("Mutex init failed");
+  }
+
+  status("[GraphPartitions] Writing %zu partitions to %s.part*",
+         num_parts, path_prefix);
+
+  GraphPartitions tmp = {.num_parts = num_parts, .kmer_size = kmer_size,
+                         .mmer_size = MIN2(GRAPH_PART_MMER_LEN, kmer_size),
+                         .paths = paths, .files = files, .locks = locks};
+
+  memcpy(gp, &tmp, sizeof(GraphPartitions));
+}
+
+void graph_partitions_dealloc(GraphPartitions *gp)
+{
+  size_t i;
+  for(i = 0; i < gp->num_parts; i++) {
+    fclose(gp->files[i]);
+    if(remove(gp->paths[i]) != 0) warn("Cannot remove file: %s", gp->paths[i]);
+    pthread_mutex_destroy(&gp->locks[i]);
+    ctx_free(gp->paths[i]);
+  }
+  ctx_free(gp->paths);
+  ctx_free(gp->files);
+  ctx_free(gp->locks);
+  memset(gp, 0, sizeof(GraphPartitions));
+}
+
+//
+// First pass: write super-kmers to partitions
+//
+
+typedef struct
+{
+  GraphPartitions *const gp;
+  LoadingStats *const stats; // one per input file
+  volatile size_t *const rcounter;
+  uint8_t **const bufs; // one per partition
+  size_t *const buflens;
+  Uint32Buffer mmers; // hashes of m-mers in the current contig
+} PartWriter;
+
+static inline uint32_t part_mmer_hash(uint64_t x)
+{
+  x ^= x >> 33; x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return (uint32_t)x;
+}
+
+static void part_write(GraphPartitions *gp, size_t p,
+                       const void *ptr, size_t len)
+{
+  if(fwrite(ptr, 1, len, gp->files[p]) != len)
+    die("Cannot write to file: %s", gp->paths[p]);
+}
+
+static void part_flush(PartWriter *wrkr, size_t p)
+{
+  GraphPartitions *gp = wrkr->gp;
+  if(wrkr->buflens[p] == 0) return;
+  pthread_mutex_lock(&gp->locks[p]);
+  part_write(gp, p, wrkr->bufs[p], wrkr->buflens[p]);
+  pthread_mutex_unlock(&gp->locks[p]);
+  wrkr->buflens[p] = 0;
+}
+
+static void part_add_record(PartWriter *wrkr, size_t p, Colour colour,
+                            const char *seq, size_t len, char prev, char next)
+{
+  uint8_t hdr[PART_REC_HDR];
+  uint32_t col32 = colour, len32 = len;
+  memcpy(hdr, &col32, sizeof(uint32_t));
+  memcpy(hdr+sizeof(uint32_t), &len32, sizeof(uint32_t));
+  hdr[2*sizeof(uint32_t)] = prev;
+  hdr[2*sizeof(uint32_t)+1] = next;
+
+  const size_t reclen = PART_REC_HDR + len;
+
+  if(wrkr->buflens[p] + reclen > GRAPH_PART_BUF_SIZE)
+    part_flush(wrkr, p);
+
+  if(reclen > GRAPH_PART_BUF_SIZE) {
+    // Too big to buffer, write directly
+    GraphPartitions *gp = wrkr->gp;
+    pthread_mutex_lock(&gp->locks[p]);
+    part_write(gp, p, hdr, PART_REC_HDR);
+    part_write(gp, p, seq, len);
+    pthread_mutex_unlock(&gp->locks[p]);
+  }
+  else {
+    uint8_t *buf = wrkr->bufs[p] + wrkr->buflens[p];
+    memcpy(buf, hdr, PART_REC_HDR);
+    memcpy(buf+PART_REC_HDR, seq, len);
+    wrkr->buflens[p] += reclen;
+  }
+}
+
+static inline size_t part_min_mmer(const uint32_t *h, size_t start, size_t n)
+{
+  size_t i, minpos = start;
+  for(i = start+1; i < start+n; i++)
+    if(h[i] < h[minpos]) minpos = i;
+  return minpos;
+}
+
+// Split contig into super-kmers and add to partitions
+// Sequence must be entirely ACGT and len >= kmer_size
+static void part_add_contig(PartWriter *wrkr, const char *seq, size_t len,
+                            Colour colour)
+{
+  const GraphPartitions *gp = wrkr->gp;
+  const size_t kmer_size = gp->kmer_size, mmer_size = gp->mmer_size;
+  const size_t num_mmers = len + 1 - mmer_size, num_kmers = len + 1 - kmer_size;
+  const size_t win = kmer_size + 1 - mmer_size; // m-mers per kmer
+  const size_t mbits = mmer_size * 2;
+  const uint64_t mmask = bitmask64(mbits);
+  uint64_t fw = 0, rv = 0;
+  Nucleotide nuc;
+  size_t i, start, minpos, part, curr_part, slen;
+
+  // Hash canonical m-mers
+  uint32_buf_capacity(&wrkr->mmers, num_mmers);
+  uint32_t *h = wrkr->mmers.b;
+
+  for(i = 0; i < len; i++) {
+    nuc = dna_char_to_nuc(seq[i]);
+    fw = ((fw << 2) | nuc) & mmask;
+    rv = (rv >> 2) | ((uint64_t)dna_nuc_complement(nuc) << (2*(mmer_size-1)));
+    if(i+1 >= mmer_size) h[i+1-mmer_size] = part_mmer_hash(MIN2(fw, rv));
+  }
+
+  // Minimizer of each kmer, with a sliding window
+  minpos = part_min_mmer(h, 0, win);
+  curr_part = h[minpos] % gp->num_parts;
+
+  for(start = 0, i = 1; i <= num_kmers; i++)
+  {
+    if(i < num_kmers) {
+      if(minpos < i) minpos = part_min_mmer(h, i, win);
+      else if(h[i+win-1] < h[minpos]) minpos = i+win-1;
+      part = h[minpos] % gp->num_parts;
+      if(part == curr_part) continue;
+    }
+
+    // Kmers start..i-1 are a super-kmer
+    slen = i - start + kmer_size - 1;
+    part_add_record(wrkr, curr_part, colour, seq+start, slen,
+                    start > 0 ? seq[start-1] : 0,
+                    start+slen < len ? seq[start+slen] : 0);
+
+    start = i;
+    curr_part = part;
+  }
+}
+
+static void part_add_read(PartWriter *wrkr, const read_t *r,
+                          uint8_t qual_cutoff, uint8_t hp_cutoff,
+                          LoadingStats *stats, Colour colour)
+{
+  const size_t kmer_size = wrkr->gp->kmer_size;
+  size_t contig_start, contig_end, contig_len;
+  size_t num_contigs = 0, search_start = 0;
+
+  while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                         qual_cutoff, hp_cutoff)) < r->seq.end)
+  {
+    contig_end = seq_contig_end(r, contig_start, kmer_size,
+                                qual_cutoff, hp_cutoff, &search_start);
+
+    contig_len = contig_end - contig_start;
+    part_add_contig(wrkr, r->seq.b+contig_start, contig_len, colour);
+
+    stats->total_bases_loaded += contig_len;
+    stats->num_kmers_loaded += contig_len + 1 - kmer_size;
+    num_contigs++;
+  }
+
+  stats->contigs_parsed += num_contigs;
+  stats->num_good_reads += num_contigs > 0;
+  stats->num_bad_reads += num_contigs == 0;
+}
+
+static void part_add_reads(AsyncIOData *data, void *ptr)
+{
+  PartWriter *wrkr = (PartWriter*)ptr;
+  const BuildGraphTask *task = (const BuildGraphTask*)data->ptr;
+  LoadingStats *stats = &wrkr->stats[task->idx];
+  read_t *r1 = &data->r1;
+  read_t *r2 = data->r2.name.end == 0 && data->r2.seq.end == 0 ? NULL : &data->r2;
+
+  uint8_t fq_cutoff1 = task->fq_cutoff, fq_cutoff2 = task->fq_cutoff;
+
+  if(task->fq_cutoff) {
+    fq_cutoff1 += data->fq_offset1;
+    fq_cutoff2 += data->fq_offset2;
+  }
+
+  stats->total_bases_read += r1->seq.end + (r2 ? r2->seq.end : 0);
+  if(r2) stats->num_pe_reads += 2;
+  else   stats->num_se_reads++;
+
+  part_add_read(wrkr, r1, fq_cutoff1, task->hp_cutoff, stats, task->colour);
+  if(r2) part_add_read(wrkr, r2, fq_cutoff2, task->hp_cutoff, stats, task->colour);
+
+  // Print progress
+  size_t n = __sync_add_and_fetch(wrkr->rcounter, 1);
+  ctx_update("PartitionReads", n);
+}
+
+void graph_partitions_write(GraphPartitions *gp, BuildGraphTask *files,
+                            size_t num_files, size_t num_threads)
+{
+  AsyncIOInput *async_tasks = ctx_malloc(num_files * sizeof(AsyncIOInput));
+  PartWriter *wrkrs = ctx_malloc(num_threads * sizeof(PartWriter));
+  LoadingStats *stats = ctx_malloc(num_threads * num_files * sizeof(LoadingStats));
+  size_t i, p, f, rcounter = 0;
+
+  for(f = 0; f < num_files; f++) {
+    ctx_assert(!files[f].remove_pcr_dups);
+    files[f].idx = f;
+    files[f].files.ptr = &files[f];
+    memcpy(&async_tasks[f], &files[f].files, sizeof(AsyncIOInput));
+  }
+
+  for(i = 0; i < num_threads * num_files; i++)
+    loading_stats_init(&stats[i]);
+
+  for(i = 0; i < num_threads; i++) {
+    PartWriter tmp = {.gp = gp, .stats = stats + i * num_files,
+                      .rcounter = &rcounter,
+                      .bufs = ctx_malloc(gp->num_parts * sizeof(uint8_t*)),
+                      .buflens = ctx_calloc(gp->num_parts, sizeof(size_t))};
+    for(p = 0; p < gp->num_parts; p++)
+      tmp.bufs[p] = ctx_malloc(GRAPH_PART_BUF_SIZE);
+    uint32_buf_alloc(&tmp.mmers, 256);
+    memcpy(&wrkrs[i], &tmp, sizeof(PartWriter));
+  }
+
+  asyncio_run_pool(async_tasks, num_files, part_add_reads,
+                   wrkrs, num_threads, sizeof(PartWriter));
+
+  for(i = 0; i < num_threads; i++) {
+    for(p = 0; p < gp->num_parts; p++) {
+      part_flush(&wrkrs[i], p);
+      ctx_free(wrkrs[i].bufs[p]);
+    }
+    for(f = 0; f < num_files; f++)
+      loading_stats_merge(&files[f].stats, &wrkrs[i].stats[f]);
+    ctx_free(wrkrs[i].bufs);
+    ctx_free(wrkrs[i].buflens);
+    uint32_buf_dealloc(&wrkrs[i].mmers);
+  }
+
+  ctx_free(stats);
+  ctx_free(wrkrs);
+  ctx_free(async_tasks);
+}
+
+//
+// Second pass: build each partition
+//
+
+typedef struct
+{
+  dBGraph *const db_graph;
+  const uint8_t *const data;
+  const size_t *const offsets;
+  const size_t num_records, idx, num_threads;
+} PartLoader;
+
+// Load one super-kmer and the edges to the kmers either side of it
+static void part_load_record(const uint8_t *rec, dBGraph *db_graph)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  uint32_t colour, len;
+  char prev, next;
+
+  memcpy(&colour, rec, sizeof(uint32_t));
+  memcpy(&len, rec+sizeof(uint32_t), sizeof(uint32_t));
+  prev = rec[2*sizeof(uint32_t)];
+  next = rec[2*sizeof(uint32_t)+1];
+
+  const char *seq = (const char*)rec + PART_REC_HDR;
+  size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
+  dBNode node;
+
+  build_graph_from_str_mt(db_graph, colour, seq, len);
+
+  // Only add edges to this partition's kmers, the kmers either side add the
+  // edges in the other direction when their partition is loaded
+  if(prev) {
+    node = db_graph_find_str(db_graph, seq);
+    db_node_set_col_edge_mt(db_graph, node.key, edge_col,
+                            dna_nuc_complement(dna_char_to_nuc(prev)),
+                            !node.orient);
+  }
+
+  if(next) {
+    node = db_graph_find_str(db_graph, seq+len-kmer_size);
+    db_node_set_col_edge_mt(db_graph, node.key, edge_col,
+                            dna_char_to_nuc(next), node.orient);
+  }
+}
+
+static void part_load_records(void *arg)
+{
+  const PartLoader *ldr = (const PartLoader*)arg;
+  size_t i;
+  for(i = ldr->idx; i < ldr->num_records; i += ldr->num_threads)
+    part_load_record(ldr->data + ldr->offsets[i], ldr->db_graph);
+}
+
+// Remove all kmers, keep graph info
+static void part_graph_empty(dBGraph *db_graph)
+{
+  size_t capacity = db_graph->ht.capacity;
+  hash_table_empty(&db_graph->ht);
+
+  if(db_graph->col_edges != NULL)
+    memset(db_graph->col_edges, 0,
+           db_graph->num_edge_cols * sizeof(Edges) * capacity);
+  if(db_graph->col_covgs != NULL)
+    memset(db_graph->col_covgs, 0,
+           db_graph->num_of_cols * sizeof(Covg) * capacity);
+}
+
+// Load records data[offsets[0..n-1]] into the graph with all threads
+static void part_load_chunk(const uint8_t *data, const size_t *offsets,
+                            size_t num_records, PartLoader *ldrs,
+                            size_t num_threads, dBGraph *db_graph)
+{
+  size_t i;
+
+  for(i = 0; i < num_threads; i++) {
+    PartLoader tmp = {.db_graph = db_graph, .data = data,
+                      .offsets = offsets, .num_records = num_records,
+                      .idx = i, .num_threads = num_threads};
+    memcpy(&ldrs[i], &tmp, sizeof(PartLoader));
+  }
+
+  util_run_threads(ldrs, num_threads, sizeof(PartLoader),
+                   num_threads, part_load_records);
+}
+
+// Load partition file `p` into the graph one chunk at a time
+// A record that straddles the end of a chunk is moved to the start of the next
+// Returns number of records loaded
+static size_t part_load_file(GraphPartitions *gp, size_t p,
+                             uint8_t **data, size_t *datacap,
+                             SizeBuffer *offsets, PartLoader *ldrs,
+                             size_t num_threads, dBGraph *db_graph)
+{
+  FILE *fh = gp->files[p];
+  size_t nread, have = 0, offset, num_records = 0;
+  uint32_t len;
+
+  if(fflush(fh) != 0 || fseeko(fh, 0, SEEK_SET) != 0)
+    die("Cannot read file: %s [%s]", gp->paths[p], strerror(errno));
+
+  while(1)
+  {
+    nread = fread(*data+have, 1, *datacap-have, fh);
+    if(ferror(fh)) die("Cannot read file: %s", gp->paths[p]);
+    have += nread;
+    if(have == 0) break;
+
+    // Find complete records
+    size_buf_reset(offsets);
+    for(offset = 0; offset + PART_REC_HDR <= have; offset += PART_REC_HDR + len) {
+      memcpy(&len, *data+offset+sizeof(uint32_t), sizeof(uint32_t));
+      if(offset + PART_REC_HDR + len > have) break;
+      size_buf_add(offsets, offset);
+    }
+
+    if(offsets->len == 0) {
+      if(nread == 0) die("Truncated partition file: %s", gp->paths[p]);
+      // Record bigger than the chunk
+      *datacap *= 2;
+      *data = ctx_realloc(*data, *datacap);
+      continue;
+    }
+
+    part_load_chunk(*data, offsets->b, offsets->len, ldrs, num_threads,
+                    db_graph);
+    num_records += offsets->len;
+
+    // Keep the incomplete record at the end
+    memmove(*data, *data+offset, have-offset);
+    have -= offset;
+  }
+
+  return num_records;
+}
+
+size_t graph_partitions_build(GraphPartitions *gp, dBGraph *db_graph,
+                              FILE *fout, size_t num_threads)
+{
+  ctx_assert(db_graph->bktlocks != NULL);
+  ctx_assert(db_graph->ht.num_kmers == 0);
+
+  size_t p, nrecs, nkmers, total_kmers = 0;
+  size_t datacap = GRAPH_PART_CHUNK_SIZE;
+  uint8_t *data = ctx_malloc(datacap);
+  SizeBuffer offsets;
+  size_buf_alloc(&offsets, part_chunk_max_records(gp->kmer_size));
+
+  PartLoader *ldrs = ctx_malloc(num_threads * sizeof(PartLoader));
+  char nkmers_str[50], nrecs_str[50];
+
+  for(p = 0; p < gp->num_parts; p++)
+  {
+    nrecs = part_load_file(gp, p, &data, &datacap, &offsets,
+                           ldrs, num_threads, db_graph);
+
+    nkmers = graph_write_all_kmers(fout, db_graph);
+    total_kmers += nkmers;
+
+    ulong_to_str(nkmers, nkmers_str);
+    ulong_to_str(nrecs, nrecs_str);
+    status("[GraphPartitions] partition %zu/%zu: %s super-kmers, %s kmers",
+           p+1, gp->num_parts, nrecs_str, nkmers_str);
+
+    part_graph_empty(db_graph);
+  }
+
+  ctx_free(ldrs);
+  ctx_free(data);
+  size_buf_dealloc(&offsets);
+
+  return total_kmers;
+}
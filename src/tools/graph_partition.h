@@ -0,0 +1,67 @@
+#ifndef GRAPH_PARTITION_H_
+#define GRAPH_PARTITION_H_
+
+#include <pthread.h>
+
+#include "db_graph.h"
+#include "build_graph.h"
+
+//
+// Disk-backed graph construction for graphs larger than memory
+//
+// First pass: reads are split into super-kmers (runs of consecutive kmers in
+// the same partition) and appended to temporary partition files. The
+// partition of a kmer is given by its minimizer: the canonical m-mer in the
+// kmer with the lowest hash value, so a kmer and its reverse complement are
+// always in the same partition.
+//
+// Second pass: each partition is loaded into the graph on its own, its kmers
+// written out and the graph emptied. Each super-kmer record keeps the bases
+// either side of it in the read, so edges to kmers in other partitions are
+// kept.
+//
+
+// Length of minimizers (or kmer_size if smaller)
+#define GRAPH_PART_MMER_LEN 13
+
+// Bytes buffered per thread, per partition before writing
+#define GRAPH_PART_BUF_SIZE (1UL<<14)
+
+// Bytes of a partition file read into memory at a time when loading it
+#define GRAPH_PART_CHUNK_SIZE (1UL<<26)
+
+typedef struct
+{
+  const size_t num_parts, kmer_size, mmer_size;
+  char **const paths;
+  FILE **const files;
+  pthread_mutex_t *const locks; // one per partition file
+} GraphPartitions;
+
+// Memory used on top of the graph by graph_partitions_write() (write buffers)
+// or graph_partitions_build() (read chunk and record offsets), whichever is
+// larger
+size_t graph_partitions_mem(size_t num_parts, size_t kmer_size,
+                            size_t num_threads);
+
+// Temporary partition files are `<path_prefix>.part<i>`
+void graph_partitions_alloc(GraphPartitions *gp, const char *path_prefix,
+                            size_t num_parts, size_t kmer_size);
+
+// Closes and removes temporary files
+void graph_partitions_dealloc(GraphPartitions *gp);
+
+// First pass: split the reads of `files` into super-kmers and write them to
+// partition files, using the same cutoffs as build_graph(). Loading stats are
+// added to each task. PCR duplicate removal is not supported.
+void graph_partitions_write(GraphPartitions *gp, BuildGraphTask *files,
+                            size_t num_files, size_t num_threads);
+
+// Second pass: load each partition into `db_graph` in turn, write its kmers
+// to `fout` (after the header) then empty the graph. Partition files are read
+// GRAPH_PART_CHUNK_SIZE bytes at a time.
+// Returns number of kmers written
+size_t graph_partitions_build(GraphPartitions *gp, dBGraph *db_graph,
+                              FILE *fout, size_t num_threads);
+
+#endif /* GRAPH_PARTITION_H_ */
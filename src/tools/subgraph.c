@@ -209,7 +209,7 @@ void subgraph_from_reads(dBGraph *db_graph, size_t nthreads, size_t dist,
     die("Out of memory");
 
   for(i = 0; i < num_files; i++)
-    seq_parse_se_sf(files[i], 0, &r1, store_read_nodes, &builder);
+    seq_parse_se_sf(files[i], 0, 0, &r1, store_read_nodes, &builder);
 
   print_stats(&builder);
 